@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "capture.h"
+
+namespace packet_filter {
+    namespace {
+        const __u32 PCAP_MAGIC_NSEC = 0xa1b23c4d;
+        const __u32 LINKTYPE_ETHERNET = 1;
+        const size_t FILE_BUFFER_SIZE = 1 << 20;
+
+        // Must match struct capture_record
+        struct CaptureRecord {
+            __u64 ts_ns;
+            __u32 len;
+            __u32 caplen;
+            __u8 data[CAPTURE_SNAPLEN_MAX];
+        };
+
+        struct PcapGlobalHeader {
+            __u32 magic;
+            __u16 version_major;
+            __u16 version_minor;
+            __s32 thiszone;
+            __u32 sigfigs;
+            __u32 snaplen;
+            __u32 linktype;
+        };
+
+        struct PcapRecordHeader {
+            __u32 ts_sec;
+            __u32 ts_nsec;
+            __u32 caplen;
+            __u32 len;
+        };
+
+        __s64 clock_ns(clockid_t clock) {
+            struct timespec ts;
+            clock_gettime(clock, &ts);
+            return static_cast<__s64>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        }
+    }
+
+    CaptureWriter::CaptureWriter(int capture_ringbuf_fd, int capture_stats_map_fd)
+        : map_fd_stats(capture_stats_map_fd), ring(nullptr), file(nullptr), file_buffer(FILE_BUFFER_SIZE),
+          file_bytes(0), file_seq(0), realtime_offset_ns(0), written(0), running(false) {
+        ring = ring_buffer__new(capture_ringbuf_fd, &CaptureWriter::on_record, this, nullptr);
+        if (!ring) {
+            std::cerr << "Failed to open capture_ringbuf: " << strerror(errno) << std::endl;
+        }
+    }
+
+    CaptureWriter::~CaptureWriter() {
+        stop();
+        ring_buffer__free(ring);
+    }
+
+    void CaptureWriter::set_config(const CaptureConfig& config) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        pending_config = config;
+    }
+
+    int CaptureWriter::start() {
+        if (running) {
+            return 0;
+        }
+        if (!ring) {
+            return -1;
+        }
+        running = true;
+        worker = std::thread(&CaptureWriter::run, this);
+        return 0;
+    }
+
+    void CaptureWriter::stop() {
+        if (!running) {
+            return;
+        }
+        running = false;
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void CaptureWriter::run() {
+        while (running) {
+            // Wakes up for new records, or every 100 ms to notice stop()
+            int err = ring_buffer__poll(ring, 100);
+            if (err < 0 && err != -EINTR) {
+                std::cerr << "Failed to poll capture_ringbuf: " << strerror(-err) << std::endl;
+                break;
+            }
+        }
+        ring_buffer__consume(ring);
+        close_file();
+    }
+
+    int CaptureWriter::on_record(void* ctx, void* data, size_t size) {
+        static_cast<CaptureWriter*>(ctx)->write_record(data, size);
+        return 0;
+    }
+
+    void CaptureWriter::write_record(const void* data, size_t size) {
+        if (size < sizeof(CaptureRecord)) {
+            return;
+        }
+        const CaptureRecord* record = static_cast<const CaptureRecord*>(data);
+        __u32 caplen = std::min(record->caplen, CAPTURE_SNAPLEN_MAX);
+
+        __u64 max_bytes = static_cast<__u64>(active_config.file_mb) << 20;
+        if (file && file_bytes + sizeof(PcapRecordHeader) + caplen > max_bytes) {
+            close_file();
+        }
+        if (!file && open_next_file() != 0) {
+            return;
+        }
+
+        __s64 ts_ns = static_cast<__s64>(record->ts_ns) + realtime_offset_ns;
+        PcapRecordHeader header = {static_cast<__u32>(ts_ns / 1000000000LL), static_cast<__u32>(ts_ns % 1000000000LL),
+                                   caplen, record->len};
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(record->data, 1, caplen, file);
+        file_bytes += sizeof(header) + caplen;
+        written++;
+    }
+
+    // capture-<start time>-<sequence>.pcap in the configured directory; the oldest
+    // file beyond capture_files is removed
+    int CaptureWriter::open_next_file() {
+        {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            active_config = pending_config;
+        }
+        if (mkdir(active_config.dir.c_str(), 0750) != 0 && errno != EEXIST) {
+            std::cerr << "Failed to create capture directory " << active_config.dir << ": " << strerror(errno)
+                      << std::endl;
+            return -1;
+        }
+
+        static const time_t started = time(nullptr);
+        std::string path = active_config.dir + "/capture-" + std::to_string(started) + "-" +
+                           std::to_string(file_seq++) + ".pcap";
+        file = fopen(path.c_str(), "wb");
+        if (!file) {
+            std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        setvbuf(file, file_buffer.data(), _IOFBF, file_buffer.size());
+
+        PcapGlobalHeader header = {PCAP_MAGIC_NSEC, 2, 4, 0, 0, CAPTURE_SNAPLEN_MAX, LINKTYPE_ETHERNET};
+        fwrite(&header, sizeof(header), 1, file);
+        file_bytes = sizeof(header);
+        realtime_offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+        kept_files.push_back(path);
+        while (active_config.files > 0 && kept_files.size() > active_config.files) {
+            unlink(kept_files.front().c_str());
+            kept_files.pop_front();
+        }
+        return 0;
+    }
+
+    void CaptureWriter::close_file() {
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    void CaptureWriter::print_summary(std::ostream& out) const {
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus <= 0) {
+            return;
+        }
+        __u64 totals[CAPTURE_COUNTERS] = {0, 0};
+        std::vector<__u64> percpu(ncpus);
+        for (__u32 key = 0; key < CAPTURE_COUNTERS; key++) {
+            if (bpf_map_lookup_elem(map_fd_stats, &key, percpu.data()) != 0) {
+                return;
+            }
+            for (__u64 v : percpu) {
+                totals[key] += v;
+            }
+        }
+        if (totals[CAPTURE_SAMPLED] + totals[CAPTURE_LOST] == 0) {
+            return;
+        }
+        out << "Capture: " << written << " packets written to " << kept_files.size() << " file(s) in "
+            << active_config.dir << ", " << totals[CAPTURE_LOST] << " lost (ring buffer full)\n";
+    }
+} // namespace packet_filter
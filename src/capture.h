@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet_filter.h"
+
+struct ring_buffer;
+
+namespace packet_filter {
+    // Counters of capture_stats_map (must match CAPTURE_* in the BPF code)
+    enum CaptureCounter : __u32 {
+        CAPTURE_SAMPLED = 0, // Records submitted to capture_ringbuf
+        CAPTURE_LOST,        // Samples lost to a full ring buffer
+        CAPTURE_COUNTERS
+    };
+
+    // Background thread that drains capture_ringbuf into size-capped, rotating
+    // pcap files (nanosecond timestamps, Ethernet). Records are written straight
+    // from the ring buffer through one preallocated stdio buffer.
+    class CaptureWriter {
+    public:
+        CaptureWriter(int capture_ringbuf_fd, int capture_stats_map_fd);
+        ~CaptureWriter();
+
+        // Apply a new configuration (safe to call while the thread is running);
+        // file settings take effect when the next file is opened
+        void set_config(const CaptureConfig& config);
+
+        int start();
+        void stop();
+
+        // Written / lost packet counts and the files kept
+        void print_summary(std::ostream& out) const;
+
+    private:
+        static int on_record(void* ctx, void* data, size_t size);
+        void write_record(const void* data, size_t size);
+        int open_next_file();
+        void close_file();
+        void run();
+
+        int map_fd_stats;
+        ring_buffer* ring;
+
+        std::mutex config_mutex;
+        CaptureConfig pending_config;
+        CaptureConfig active_config; // Writer thread only
+
+        FILE* file;
+        std::vector<char> file_buffer; // stdio buffer of the open file
+        __u64 file_bytes;
+        __u64 file_seq;
+        __s64 realtime_offset_ns;      // CLOCK_REALTIME - CLOCK_MONOTONIC when the file was opened
+        std::deque<std::string> kept_files;
+        __u64 written;
+
+        std::thread worker;
+        std::atomic<bool> running;
+    };
+} // namespace packet_filter
+
+#endif /* CAPTURE_H */
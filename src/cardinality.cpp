@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "cardinality.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        const char* const SET_NAMES[HLL_SETS] = {"all", "dropped", "passed"};
+
+        __u64 monotonic_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        prometheus::Family<prometheus::Gauge>& estimate_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_distinct_sources")
+                .Help("HyperLogLog estimate of distinct source IPs in the current window")
+                .Register(metrics::registry());
+            return family;
+        }
+    }
+
+    double hll_estimate(const HllRegisters& registers) {
+        const double m = HLL_REGISTERS;
+        const double alpha = 0.7213 / (1.0 + 1.079 / m);
+        const double two_pow_32 = 4294967296.0;
+
+        double sum = 0.0;
+        __u32 zeros = 0;
+        for (__u32 i = 0; i < HLL_REGISTERS; i++) {
+            sum += std::ldexp(1.0, -registers.reg[i]);
+            if (registers.reg[i] == 0) {
+                zeros++;
+            }
+        }
+
+        double estimate = alpha * m * m / sum;
+        if (estimate <= 2.5 * m && zeros > 0) {
+            estimate = m * std::log(m / zeros); // Linear counting for small cardinalities
+        } else if (estimate > two_pow_32 / 30.0) {
+            estimate = -two_pow_32 * std::log(1.0 - estimate / two_pow_32); // 32-bit hash collisions
+        }
+        return estimate;
+    }
+
+    CardinalityMonitor::CardinalityMonitor(int hll_map_fd)
+        : map_fd_hll(hll_map_fd), ncpus(libbpf_num_possible_cpus()), enabled(false), running(false) {}
+
+    CardinalityMonitor::~CardinalityMonitor() {
+        stop();
+    }
+
+    void CardinalityMonitor::set_config(const CardinalityConfig& config, bool hll_enabled) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        current_config = config;
+        enabled = hll_enabled;
+    }
+
+    void CardinalityMonitor::start() {
+        if (running) {
+            return;
+        }
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return;
+        }
+        running = true;
+        worker = std::thread(&CardinalityMonitor::run, this);
+    }
+
+    void CardinalityMonitor::stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void CardinalityMonitor::run() {
+        __u64 window_start_ns = monotonic_ns();
+
+        while (running) {
+            CardinalityConfig config;
+            bool hll_enabled;
+            {
+                std::lock_guard<std::mutex> lock(config_mutex);
+                config = current_config;
+                hll_enabled = enabled;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms),
+                              [this] { return !running; });
+            }
+            if (!running || !hll_enabled) {
+                continue;
+            }
+
+            double estimates[HLL_SETS];
+            if (read_estimates(estimates) != 0) {
+                continue;
+            }
+            for (__u32 set = 0; set < HLL_SETS; set++) {
+                estimate_family().Add({{"set", SET_NAMES[set]}}).Set(estimates[set]);
+            }
+
+            __u64 now_ns = monotonic_ns();
+            if (config.window_sec > 0 && now_ns - window_start_ns >= config.window_sec * 1000000000ULL) {
+                std::cout << "Distinct sources in the last " << config.window_sec << "s: "
+                          << static_cast<__u64>(estimates[0]) << " (dropped "
+                          << static_cast<__u64>(estimates[1]) << ", passed "
+                          << static_cast<__u64>(estimates[2]) << ")" << std::endl;
+                clear_registers();
+                window_start_ns = now_ns;
+            }
+        }
+    }
+
+    // Merge the per-CPU registers of every estimator (register-wise max)
+    int CardinalityMonitor::read_estimates(double estimates[HLL_SETS]) {
+        std::vector<HllRegisters> percpu(ncpus);
+
+        for (__u32 set = 0; set < HLL_SETS; set++) {
+            if (bpf_map_lookup_elem(map_fd_hll, &set, percpu.data()) != 0) {
+                std::cerr << "Failed to read hll_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            HllRegisters merged = percpu[0];
+            for (int cpu = 1; cpu < ncpus; cpu++) {
+                for (__u32 i = 0; i < HLL_REGISTERS; i++) {
+                    merged.reg[i] = std::max(merged.reg[i], percpu[cpu].reg[i]);
+                }
+            }
+            estimates[set] = hll_estimate(merged);
+        }
+        return 0;
+    }
+
+    // Start a new window; racing updates only lose a few register raises
+    void CardinalityMonitor::clear_registers() {
+        std::vector<HllRegisters> zeros(ncpus);
+        memset(zeros.data(), 0, zeros.size() * sizeof(HllRegisters));
+
+        for (__u32 set = 0; set < HLL_SETS; set++) {
+            if (bpf_map_update_elem(map_fd_hll, &set, zeros.data(), BPF_ANY) != 0) {
+                std::cerr << "Failed to clear hll_map: " << strerror(errno) << std::endl;
+            }
+        }
+    }
+} // namespace packet_filter
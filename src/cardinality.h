@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef CARDINALITY_H
+#define CARDINALITY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "packet_filter.h"
+
+namespace packet_filter {
+    // HyperLogLog layout (must match the BPF definitions)
+    constexpr __u32 HLL_PRECISION = 10;
+    constexpr __u32 HLL_REGISTERS = 1U << HLL_PRECISION;
+    constexpr __u32 HLL_SETS = 3; // HLL_ALL, HLL_DROPPED, HLL_PASSED
+
+    // Registers of one estimator (must match struct hll_registers)
+    struct HllRegisters {
+        __u8 reg[HLL_REGISTERS];
+    };
+
+    // Cardinality estimate of merged registers, with the small and large range corrections
+    double hll_estimate(const HllRegisters& registers);
+
+    // Background thread that merges the per-CPU HyperLogLog registers, exports
+    // the distinct-source estimates and clears the registers every window.
+    class CardinalityMonitor {
+    public:
+        explicit CardinalityMonitor(int hll_map_fd);
+        ~CardinalityMonitor();
+
+        // Apply a new configuration (safe to call while the thread is running)
+        void set_config(const CardinalityConfig& config, bool hll_enabled);
+
+        void start();
+        void stop();
+
+    private:
+        void run();
+        int read_estimates(double estimates[HLL_SETS]);
+        void clear_registers();
+
+        int map_fd_hll;
+        int ncpus;
+
+        std::mutex config_mutex;
+        CardinalityConfig current_config;
+        bool enabled;
+
+        std::thread worker;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+    };
+} // namespace packet_filter
+
+#endif /* CARDINALITY_H */
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <bpf/bpf.h>
+
+#include "counters.h"
+
+namespace packet_filter {
+    namespace {
+        // A CPU that keeps its slot busy is read as-is after this many attempts:
+        // the values are still whole 64-bit words, only not from the same instant
+        const int SEQ_RETRIES = 16;
+    }
+
+    const char* drop_reason_name(__u32 reason) {
+        static const char* const names[DROP_REASONS] = {
+            "blacklist", "rate_limit", "syn_rate", "conn_limit", "bad_syn_cookie", "syn_cookie_reply",
+            "l4_rule", "l4_rate_limit"};
+        return reason < DROP_REASONS ? names[reason] : "unknown";
+    }
+
+    CounterReader::CounterReader() : slots(nullptr), nslots(0), mapped_size(0) {}
+
+    CounterReader::~CounterReader() {
+        close();
+    }
+
+    int CounterReader::open(int counters_map_fd) {
+        close();
+        struct bpf_map_info info;
+        __u32 info_len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (bpf_map_get_info_by_fd(counters_map_fd, &info, &info_len) != 0) {
+            std::cerr << "Failed to get counters_map info: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        if (info.value_size != sizeof(CpuCounters) || !(info.map_flags & BPF_F_MMAPABLE)) {
+            std::cerr << "counters_map layout does not match this binary" << std::endl;
+            return -1;
+        }
+
+        long page = sysconf(_SC_PAGESIZE);
+        size_t size = static_cast<size_t>(info.max_entries) * sizeof(CpuCounters);
+        size = (size + page - 1) / page * page;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, counters_map_fd, 0);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "Failed to map counters_map: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        slots = static_cast<const CpuCounters*>(mapped);
+        nslots = info.max_entries;
+        mapped_size = size;
+        return 0;
+    }
+
+    void CounterReader::close() {
+        if (slots) {
+            munmap(const_cast<CpuCounters*>(slots), mapped_size);
+            slots = nullptr;
+        }
+        nslots = 0;
+        mapped_size = 0;
+    }
+
+    bool CounterReader::read(CounterTotals& totals) const {
+        if (!slots) {
+            return false;
+        }
+        memset(&totals, 0, sizeof(totals));
+        __u64 values[COUNTERS];
+        for (__u32 cpu = 0; cpu < nslots; cpu++) {
+            const CpuCounters& slot = slots[cpu];
+            for (int attempt = 0; attempt < SEQ_RETRIES; attempt++) {
+                __u32 seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+                for (__u32 i = 0; i < COUNTERS; i++) {
+                    values[i] = __atomic_load_n(&slot.values[i], __ATOMIC_RELAXED);
+                }
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (!(seq & 1) && __atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == seq) {
+                    break;
+                }
+            }
+            for (__u32 i = 0; i < COUNTERS; i++) {
+                totals.values[i] += values[i];
+            }
+        }
+        return true;
+    }
+} // namespace packet_filter
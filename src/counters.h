@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include "packet_filter.h"
+
+namespace packet_filter {
+    // Label of a drop reason ("blacklist", "rate_limit", ...)
+    const char* drop_reason_name(__u32 reason);
+
+    // Totals of counters_map, summed over the CPUs
+    struct CounterTotals {
+        __u64 values[COUNTERS];
+
+        __u64 drops(__u32 reason) const { return values[COUNTER_DROP_REASONS + reason]; }
+    };
+
+    // Read-only mapping of counters_map (BPF_F_MMAPABLE array, one slot per CPU).
+    // read() costs no syscall: each slot is copied under its seq counter and
+    // retried while its CPU is in the middle of an update, so it is cheap enough
+    // to poll at 100 Hz. Works on the map of this process or on a pinned one.
+    class CounterReader {
+    public:
+        CounterReader();
+        ~CounterReader();
+
+        int open(int counters_map_fd);
+        void close();
+
+        // false before open()
+        bool read(CounterTotals& totals) const;
+
+    private:
+        const CpuCounters* slots;
+        __u32 nslots;
+        size_t mapped_size;
+    };
+} // namespace packet_filter
+
+#endif /* COUNTERS_H */
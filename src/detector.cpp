@@ -0,0 +1,299 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <vector>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+
+#include "detector.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        const __u32 SUBNET_MASK_24 = htonl(0xFFFFFF00);
+        const double SUBNET_FORGET_PPS = 0.01; // A quiet /24 whose EWMA decayed below this is dropped
+
+        __u64 monotonic_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        std::string ip_to_string(__u32 ip) {
+            struct in_addr addr;
+            addr.s_addr = ip;
+            char ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
+            return ip_str;
+        }
+
+        std::string ewma_reason(double rate) {
+            return "EWMA " + std::to_string(static_cast<__u64>(rate)) + " pps";
+        }
+
+        prometheus::Family<prometheus::Counter>& decisions_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_autoban_decisions_total")
+                .Help("Automatic ban and rate-limit decisions taken by the detector")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Gauge>& active_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_autoban_active")
+                .Help("Automatic decisions currently installed in the BPF maps")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Gauge& tracked_sources_gauge() {
+            static auto& gauge = prometheus::BuildGauge()
+                .Name("packetfilter_autoban_tracked_sources")
+                .Help("Sources with an EWMA rate tracked by the detector")
+                .Register(metrics::registry())
+                .Add({});
+            return gauge;
+        }
+    }
+
+    AutoBanDetector::AutoBanDetector(int ip_stats_map_fd, int blacklist_map_fd, int rate_limits_map_fd)
+        : map_fd_ip_stats(ip_stats_map_fd), map_fd_blacklist(blacklist_map_fd),
+          map_fd_rate_limits(rate_limits_map_fd), running(false), samples(0) {}
+
+    AutoBanDetector::~AutoBanDetector() {
+        stop();
+    }
+
+    void AutoBanDetector::set_config(const AutoBanConfig& config) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        current_config = config;
+    }
+
+    void AutoBanDetector::start() {
+        if (running) {
+            return;
+        }
+        running = true;
+        worker = std::thread(&AutoBanDetector::run, this);
+        std::cout << "Auto-ban detector started." << std::endl;
+    }
+
+    void AutoBanDetector::stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        std::cout << "Auto-ban detector stopped." << std::endl;
+    }
+
+    void AutoBanDetector::request_ban(__u32 ip, const std::string& reason) {
+        std::lock_guard<std::mutex> lock(requests_mutex);
+        requested_bans.emplace(ip, reason);
+    }
+
+    void AutoBanDetector::run() {
+        __u64 last_sample_ns = monotonic_ns();
+
+        while (running) {
+            AutoBanConfig config;
+            {
+                std::lock_guard<std::mutex> lock(config_mutex);
+                config = current_config;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms),
+                              [this] { return !running; });
+            }
+            if (!running) {
+                break;
+            }
+
+            __u64 now_ns = monotonic_ns();
+            double elapsed_s = (now_ns - last_sample_ns) / 1e9;
+            last_sample_ns = now_ns;
+
+            expire_decisions(now_ns);
+            apply_requested_bans(config);
+            if (config.enabled && elapsed_s > 0) {
+                sample(elapsed_s, config);
+            }
+        }
+    }
+
+    void AutoBanDetector::sample(double elapsed_s, const AutoBanConfig& config) {
+        std::vector<IpStatsEntry> entries;
+        if (read_ip_stats(map_fd_ip_stats, entries) != 0) {
+            return;
+        }
+
+        // Per-source EWMA; the /24 rate is the sum of the instantaneous source rates
+        samples++;
+        std::unordered_map<__u32, double> subnet_rates;
+        for (const auto& entry : entries) {
+            __u64 total = entry.stats.dropped + entry.stats.passed;
+            auto it = sources.find(entry.ip);
+            if (it == sources.end()) {
+                // First sample only establishes the baseline
+                sources[entry.ip] = {total, 0.0, samples};
+                continue;
+            }
+
+            double rate = total >= it->second.last_total
+                ? (total - it->second.last_total) / elapsed_s : 0.0;
+            it->second.last_total = total;
+            it->second.last_seen = samples;
+            it->second.ewma_pps = config.alpha * rate + (1.0 - config.alpha) * it->second.ewma_pps;
+            subnet_rates[entry.ip & SUBNET_MASK_24] += rate;
+
+            double ewma = it->second.ewma_pps;
+            if (config.ban_pps > 0 && ewma >= config.ban_pps) {
+                apply(Action::Ban, entry.ip, ewma_reason(ewma), config);
+            } else if (config.rate_limit_pps > 0 && ewma >= config.rate_limit_pps) {
+                apply(Action::RateLimit, entry.ip, ewma_reason(ewma), config);
+            }
+        }
+
+        // Sources evicted from (or deleted in) ip_stats_map have no counters left to diff
+        for (auto it = sources.begin(); it != sources.end();) {
+            if (it->second.last_seen != samples) {
+                it = sources.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        tracked_sources_gauge().Set(static_cast<double>(sources.size()));
+
+        // Decay subnets that went quiet and forget them once the EWMA is negligible
+        for (auto it = subnets.begin(); it != subnets.end();) {
+            it->second *= (1.0 - config.alpha);
+            if (it->second < SUBNET_FORGET_PPS && subnet_rates.find(it->first) == subnet_rates.end()) {
+                it = subnets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const auto& rate : subnet_rates) {
+            double& ewma = subnets[rate.first];
+            ewma += config.alpha * rate.second;
+            if (config.subnet_ban_pps > 0 && ewma >= config.subnet_ban_pps) {
+                apply(Action::SubnetBan, rate.first, ewma_reason(ewma), config);
+            }
+        }
+    }
+
+    // Bans requested by other components (e.g. the payload signature matcher)
+    void AutoBanDetector::apply_requested_bans(const AutoBanConfig& config) {
+        std::unordered_map<__u32, std::string> requests;
+        {
+            std::lock_guard<std::mutex> lock(requests_mutex);
+            requests.swap(requested_bans);
+        }
+        for (const auto& request : requests) {
+            apply(Action::Ban, request.first, request.second, config);
+        }
+    }
+
+    const char* AutoBanDetector::action_name(Action action) {
+        switch (action) {
+            case Action::Ban: return "ban";
+            case Action::RateLimit: return "rate_limit";
+            case Action::SubnetBan: return "subnet_ban";
+        }
+        return "unknown";
+    }
+
+    void AutoBanDetector::apply(Action action, __u32 ip, const std::string& reason, const AutoBanConfig& config) {
+        __u64 decision_key = (static_cast<__u64>(action) << 32) | ip;
+        if (decisions.count(decision_key)) {
+            return;
+        }
+
+        std::string target = ip_to_string(ip) + (action == Action::SubnetBan ? "/24" : "/32");
+        if (action == Action::RateLimit) {
+            // Never override a rate limit the operator configured
+            BpfRateLimit existing;
+            if (bpf_map_lookup_elem(map_fd_rate_limits, &ip, &existing) == 0 || rate_limit_configured(ip)) {
+                return;
+            }
+            if (add_to_rate_limits(map_fd_rate_limits, RateLimit(ip, config.rate_limit_value)) != 0) {
+                return;
+            }
+        } else {
+            // Never take over a prefix that is already blacklisted (by the operator or
+            // otherwise): the detector only removes entries it created itself
+            BpfTrieKey key = {action == Action::SubnetBan ? 24u : 32u, ip};
+            __u64 value;
+            if (blacklist_configured(key)) {
+                return;
+            }
+            // LPM lookup: matches the key itself or any shorter prefix already covering it
+            if (bpf_map_lookup_elem(map_fd_blacklist, &key, &value) == 0) {
+                return;
+            }
+            if (add_to_blacklist(map_fd_blacklist, target) != 0) {
+                return;
+            }
+        }
+
+        __u64 expires_ns = config.ban_seconds ? monotonic_ns() + config.ban_seconds * 1000000000ULL : 0;
+        decisions[decision_key] = {action, ip, expires_ns};
+        signal_update();
+
+        const char* name = action_name(action);
+        std::cout << "Auto-ban: " << name << " " << target << " (" << reason << ")"
+                  << (config.ban_seconds ? " for " + std::to_string(config.ban_seconds) + "s" : "")
+                  << std::endl;
+        decisions_family().Add({{"action", name}}).Increment();
+        active_family().Add({{"action", name}}).Increment();
+    }
+
+    void AutoBanDetector::expire_decisions(__u64 now_ns) {
+        for (auto it = decisions.begin(); it != decisions.end(); ) {
+            if (it->second.expires_ns != 0 && it->second.expires_ns <= now_ns) {
+                remove_decision(it->second);
+                it = decisions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void AutoBanDetector::remove_decision(const Decision& decision) {
+        const char* name = action_name(decision.action);
+        // The operator may have configured the same entry meanwhile: it then stays in place
+        bool configured;
+        if (decision.action == Action::RateLimit) {
+            configured = rate_limit_configured(decision.ip);
+            if (!configured) {
+                remove_from_rate_limits(map_fd_rate_limits, decision.ip);
+            }
+        } else {
+            BpfTrieKey key = {decision.action == Action::SubnetBan ? 24u : 32u, decision.ip};
+            configured = blacklist_configured(key);
+            if (!configured) {
+                remove_from_blacklist(map_fd_blacklist, &key);
+            }
+        }
+        if (!configured) {
+            signal_update();
+        }
+
+        std::cout << "Auto-ban: expired " << name << " for " << ip_to_string(decision.ip)
+                  << (configured ? " (kept, now in the config file)" : "") << std::endl;
+        decisions_family().Add({{"action", "expire"}}).Increment();
+        active_family().Add({{"action", name}}).Decrement();
+    }
+} // namespace packet_filter
@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef DETECTOR_H
+#define DETECTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "packet_filter.h"
+
+namespace packet_filter {
+    // Background thread that samples ip_stats_map, keeps EWMA rates per source
+    // and per /24, and inserts bans or rate limits when thresholds are crossed.
+    class AutoBanDetector {
+    public:
+        AutoBanDetector(int ip_stats_map_fd, int blacklist_map_fd, int rate_limits_map_fd);
+        ~AutoBanDetector();
+
+        // Apply new thresholds (safe to call while the thread is running)
+        void set_config(const AutoBanConfig& config);
+
+        void start();
+        void stop();
+
+        // Queue a ban of one source (applied on the next sampling tick with the
+        // configured lifetime); safe to call from any thread
+        void request_ban(__u32 ip, const std::string& reason);
+
+    private:
+        // Kind of automatic decision, also used as the metrics label
+        enum class Action { Ban, RateLimit, SubnetBan };
+
+        struct SourceRate {
+            __u64 last_total; // passed + dropped at the previous sample
+            double ewma_pps;
+            __u64 last_seen;  // Sample in which ip_stats_map still had the source
+        };
+
+        static const char* action_name(Action action);
+
+        struct Decision {
+            Action action;
+            __u32 ip;          // Source address or /24 network (network byte order)
+            __u64 expires_ns;  // 0 = never
+        };
+
+        void run();
+        void sample(double elapsed_s, const AutoBanConfig& config);
+        void apply(Action action, __u32 ip, const std::string& reason, const AutoBanConfig& config);
+        void apply_requested_bans(const AutoBanConfig& config);
+        void expire_decisions(__u64 now_ns);
+        void remove_decision(const Decision& decision);
+
+        int map_fd_ip_stats;
+        int map_fd_blacklist;
+        int map_fd_rate_limits;
+
+        std::mutex config_mutex;
+        AutoBanConfig current_config;
+
+        std::thread worker;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        std::mutex requests_mutex;
+        std::unordered_map<__u32, std::string> requested_bans; // Reason keyed by source IP
+
+        std::unordered_map<__u32, SourceRate> sources;   // Keyed by source IP
+        std::unordered_map<__u32, double> subnets;       // EWMA pps keyed by /24 network
+        std::unordered_map<__u64, Decision> decisions;   // Keyed by (action << 32 | ip)
+        __u64 samples;                                   // Number of sample() calls
+    };
+} // namespace packet_filter
+
+#endif /* DETECTOR_H */
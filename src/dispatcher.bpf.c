@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+// XDP dispatcher: lets xdp_filter share an interface with other XDP programs.
+// Each program replaces one of the prog0..prog9 stubs with freplace (BPF_PROG_TYPE_EXT),
+// slots run in priority order and the chain goes on while a program returns an
+// action of its chain_call_actions mask. Stubs follow the libxdp dispatcher
+// conventions, so programs written for libxdp can be chained here unchanged.
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+#define MAX_DISPATCHER_ACTIONS 10
+#define XDP_DISPATCHER_RETVAL 31 // Returned by a stub no program replaced: always chained
+
+// Set by user-space before load
+const volatile __u32 num_progs_enabled = 0;
+const volatile __u32 chain_call_actions[MAX_DISPATCHER_ACTIONS] = {}; // Bit n = continue after action n
+
+#define DISPATCHER_STUB(n)                                   \
+    __attribute__((noinline)) int prog##n(struct xdp_md *ctx) { \
+        volatile int ret = XDP_DISPATCHER_RETVAL;            \
+        if (!ctx) {                                          \
+            return XDP_ABORTED;                              \
+        }                                                    \
+        return ret;                                          \
+    }
+
+DISPATCHER_STUB(0)
+DISPATCHER_STUB(1)
+DISPATCHER_STUB(2)
+DISPATCHER_STUB(3)
+DISPATCHER_STUB(4)
+DISPATCHER_STUB(5)
+DISPATCHER_STUB(6)
+DISPATCHER_STUB(7)
+DISPATCHER_STUB(8)
+DISPATCHER_STUB(9)
+
+// Unrolled: the verifier sees a straight line of calls, each replaced by a direct jump
+#define DISPATCHER_SLOT(n)                                   \
+    if (num_progs_enabled < n + 1) {                         \
+        goto out;                                            \
+    }                                                        \
+    ret = prog##n(ctx);                                      \
+    if (!((1U << ret) & chain_call_actions[n])) {            \
+        return ret;                                          \
+    }
+
+SEC("xdp")
+int xdp_dispatcher(struct xdp_md *ctx) {
+    __u32 ret;
+
+    DISPATCHER_SLOT(0)
+    DISPATCHER_SLOT(1)
+    DISPATCHER_SLOT(2)
+    DISPATCHER_SLOT(3)
+    DISPATCHER_SLOT(4)
+    DISPATCHER_SLOT(5)
+    DISPATCHER_SLOT(6)
+    DISPATCHER_SLOT(7)
+    DISPATCHER_SLOT(8)
+    DISPATCHER_SLOT(9)
+out:
+    return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
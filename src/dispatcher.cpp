@@ -0,0 +1,237 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <linux/bpf.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "dispatcher.h"
+#include "dispatcher.skel.h" // File skeleton được tạo tự động
+
+namespace packet_filter {
+    namespace {
+        const __u32 DISPATCHER_RETVAL = 31; // XDP_DISPATCHER_RETVAL, returned by a stub nobody replaced
+        const __u32 DEFAULT_PRIORITY = 10;  // xdp_filter runs before programs with the libxdp default (50)
+
+        const char* const ACTION_NAMES[] = {"aborted", "drop", "pass", "tx", "redirect"};
+
+        std::string stub_name(size_t slot) {
+            return "prog" + std::to_string(slot);
+        }
+
+        std::string chain_actions_name(__u32 actions) {
+            std::string names;
+            for (__u32 action = 0; action < sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]); action++) {
+                if (actions & (1U << action)) {
+                    names += (names.empty() ? "" : ",") + std::string(ACTION_NAMES[action]);
+                }
+            }
+            return names.empty() ? "none" : names;
+        }
+
+        // PATH:PROGRAM:PRIORITY[:ACTIONS]
+        bool parse_chain_program(const std::string& value, ChainProgram& program) {
+            std::vector<std::string> fields;
+            std::stringstream ss(value);
+            std::string field;
+            while (fields.size() < 3 && std::getline(ss, field, ':')) {
+                fields.push_back(field);
+            }
+            if (fields.size() < 3 || fields[0].empty() || fields[1].empty()) {
+                return false;
+            }
+            program.path = fields[0];
+            program.prog_name = fields[1];
+            program.chain_actions = 1U << XDP_PASS;
+            try {
+                program.priority = static_cast<__u32>(std::stoul(fields[2]));
+            } catch (const std::exception& e) {
+                return false;
+            }
+            std::string actions;
+            if (std::getline(ss, actions) && !parse_chain_actions(actions, program.chain_actions)) {
+                return false;
+            }
+            return true;
+        }
+    }
+
+    DispatcherConfig::DispatcherConfig()
+        : enabled(false), priority(DEFAULT_PRIORITY), chain_actions(1U << XDP_PASS) {}
+
+    bool parse_chain_actions(const std::string& value, __u32& actions) {
+        std::stringstream ss(value);
+        std::string item;
+        __u32 parsed = 0;
+        while (std::getline(ss, item, ',')) {
+            bool known = false;
+            for (__u32 action = 0; action < sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]); action++) {
+                if (item == ACTION_NAMES[action]) {
+                    parsed |= 1U << action;
+                    known = true;
+                }
+            }
+            if (!known && item != "none") {
+                return false;
+            }
+        }
+        actions = parsed;
+        return true;
+    }
+
+    int read_dispatcher_config(const std::string& config_path, DispatcherConfig& config) {
+        std::ifstream file(config_path);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open config file: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        config = DispatcherConfig();
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            if (line.find("xdp_dispatcher=") == 0) {
+                config.enabled = line.substr(strlen("xdp_dispatcher=")) == "1";
+            } else if (line.find("xdp_priority=") == 0) {
+                try {
+                    config.priority = static_cast<__u32>(std::stoul(line.substr(strlen("xdp_priority="))));
+                } catch (const std::exception& e) {
+                    std::cerr << "Warning: Invalid xdp_priority, using " << DEFAULT_PRIORITY << "." << std::endl;
+                    config.priority = DEFAULT_PRIORITY;
+                }
+            } else if (line.find("xdp_chain_call_actions=") == 0) {
+                if (!parse_chain_actions(line.substr(strlen("xdp_chain_call_actions=")), config.chain_actions)) {
+                    std::cerr << "Warning: Invalid xdp_chain_call_actions (aborted, drop, pass, tx, redirect), "
+                              << "using pass." << std::endl;
+                    config.chain_actions = 1U << XDP_PASS;
+                }
+            } else if (line.find("xdp_chain_program=") == 0) {
+                ChainProgram program;
+                if (parse_chain_program(line.substr(strlen("xdp_chain_program=")), program)) {
+                    config.programs.push_back(program);
+                } else {
+                    std::cerr << "Warning: Invalid xdp_chain_program '" << line.substr(strlen("xdp_chain_program="))
+                              << "' (PATH:PROGRAM:PRIORITY[:ACTIONS]), ignored." << std::endl;
+                }
+            }
+        }
+
+        if (!config.enabled && !config.programs.empty()) {
+            std::cerr << "Warning: xdp_chain_program lines need xdp_dispatcher=1, ignored." << std::endl;
+        }
+        return 0;
+    }
+
+    XdpDispatcher::XdpDispatcher(const DispatcherConfig& config) : config(config), skel(nullptr) {}
+
+    XdpDispatcher::~XdpDispatcher() {
+        for (const auto& slot : slots) {
+            bpf_link__destroy(slot.link);
+            if (slot.obj) {
+                bpf_object__close(slot.obj);
+            }
+        }
+        if (skel) {
+            dispatcher_bpf__destroy(skel);
+        }
+    }
+
+    int XdpDispatcher::prepare(bpf_program* filter) {
+        slots.push_back({"xdp_filter", config.priority, config.chain_actions, nullptr, nullptr, filter, nullptr});
+        for (const auto& program : config.programs) {
+            slots.push_back({program.prog_name, program.priority, program.chain_actions, &program, nullptr, nullptr,
+                             nullptr});
+        }
+        if (slots.size() > DISPATCHER_SLOTS) {
+            std::cerr << "Too many XDP programs for the dispatcher: " << slots.size() << " (max "
+                      << DISPATCHER_SLOTS << ")" << std::endl;
+            return -1;
+        }
+        // Equal priorities keep the config order, xdp_filter first
+        std::stable_sort(slots.begin(), slots.end(),
+                         [](const Slot& a, const Slot& b) { return a.priority < b.priority; });
+
+        skel = dispatcher_bpf__open();
+        if (!skel) {
+            std::cerr << "Failed to open XDP dispatcher skeleton: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        skel->rodata->num_progs_enabled = static_cast<__u32>(slots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            skel->rodata->chain_call_actions[i] = slots[i].chain_actions | (1U << DISPATCHER_RETVAL);
+        }
+        if (dispatcher_bpf__load(skel) != 0) {
+            std::cerr << "Failed to load XDP dispatcher: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            Slot& slot = slots[i];
+            std::string stub = stub_name(i);
+            if (!slot.program) {
+                bpf_program__set_type(filter, BPF_PROG_TYPE_EXT);
+                if (bpf_program__set_attach_target(filter, prog_fd(), stub.c_str()) != 0) {
+                    std::cerr << "Failed to target dispatcher slot " << stub << ": " << strerror(errno) << std::endl;
+                    return -1;
+                }
+                continue;
+            }
+
+            // Other programs: only the configured program of the object is loaded
+            const ChainProgram* program = slot.program;
+            slot.obj = bpf_object__open_file(program->path.c_str(), nullptr);
+            if (!slot.obj) {
+                std::cerr << "Failed to open " << program->path << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+            bpf_program* prog;
+            bpf_object__for_each_program(prog, slot.obj) {
+                bpf_program__set_autoload(prog, strcmp(bpf_program__name(prog), slot.name.c_str()) == 0);
+            }
+            slot.prog = bpf_object__find_program_by_name(slot.obj, slot.name.c_str());
+            if (!slot.prog) {
+                std::cerr << "Program " << slot.name << " not found in " << program->path << std::endl;
+                return -1;
+            }
+            bpf_program__set_type(slot.prog, BPF_PROG_TYPE_EXT);
+            if (bpf_program__set_attach_target(slot.prog, prog_fd(), stub.c_str()) != 0 ||
+                bpf_object__load(slot.obj) != 0) {
+                std::cerr << "Failed to load " << slot.name << " from " << program->path << " as dispatcher slot "
+                          << stub << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    int XdpDispatcher::attach() {
+        for (size_t i = 0; i < slots.size(); i++) {
+            // No target: the slot given to bpf_program__set_attach_target at load time
+            slots[i].link = bpf_program__attach_freplace(slots[i].prog, 0, nullptr);
+            if (!slots[i].link) {
+                std::cerr << "Failed to attach " << slots[i].name << " to dispatcher slot " << stub_name(i) << ": "
+                          << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    int XdpDispatcher::prog_fd() const {
+        return bpf_program__fd(skel->progs.xdp_dispatcher);
+    }
+
+    void XdpDispatcher::print_chain(std::ostream& out) const {
+        out << "XDP dispatcher chain:\n";
+        for (size_t i = 0; i < slots.size(); i++) {
+            out << "  " << i << ": " << slots[i].name << " (priority " << slots[i].priority << ", chain on "
+                << chain_actions_name(slots[i].chain_actions) << ")\n";
+        }
+    }
+} // namespace packet_filter
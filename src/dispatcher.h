@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <linux/types.h>
+
+struct bpf_link;
+struct bpf_object;
+struct bpf_program;
+struct dispatcher_bpf;
+
+namespace packet_filter {
+    // Programs the dispatcher can run (must match MAX_DISPATCHER_ACTIONS)
+    constexpr size_t DISPATCHER_SLOTS = 10;
+
+    // Another XDP program chained next to xdp_filter, one "xdp_chain_program=" line:
+    // PATH:PROGRAM:PRIORITY[:ACTIONS], e.g. /opt/lb/lb.bpf.o:xdp_lb:20:pass
+    struct ChainProgram {
+        std::string path;      // BPF object file
+        std::string prog_name; // XDP program in the object
+        __u32 priority;        // Lower runs first
+        __u32 chain_actions;   // Bit n = run the next program after XDP action n
+    };
+
+    // xdp_dispatcher options, read once at startup: with the dispatcher xdp_filter
+    // is loaded as a freplace program, which cannot change without a restart
+    struct DispatcherConfig {
+        bool enabled;
+        __u32 priority;      // Slot priority of xdp_filter (xdp_priority=)
+        __u32 chain_actions; // Actions of xdp_filter that continue the chain (xdp_chain_call_actions=)
+        std::vector<ChainProgram> programs;
+
+        DispatcherConfig();
+    };
+
+    // Read the xdp_dispatcher / xdp_priority / xdp_chain_* lines of the config file
+    int read_dispatcher_config(const std::string& config_path, DispatcherConfig& config);
+
+    // "pass,drop" -> action bitmask; false on an unknown action
+    bool parse_chain_actions(const std::string& value, __u32& actions);
+
+    // In-tree XDP dispatcher (dispatcher.bpf.c): xdp_filter and the other configured
+    // programs replace its prog0..prog9 stubs in priority order, and the dispatcher
+    // is what InterfaceSet attaches. Everything runs as one program per packet,
+    // with direct jumps between the slots instead of separate attachments.
+    class XdpDispatcher {
+    public:
+        explicit XdpDispatcher(const DispatcherConfig& config);
+        ~XdpDispatcher();
+
+        // Load the dispatcher and the other programs, and turn `filter` (opened,
+        // not loaded yet) into the freplace program of its slot
+        int prepare(bpf_program* filter);
+
+        // Once xdp_filter is loaded: replace every slot stub
+        int attach();
+
+        // Program to attach to the interfaces
+        int prog_fd() const;
+
+        // Slot order, e.g. "0: xdp_filter (priority 10, chain on pass)"
+        void print_chain(std::ostream& out) const;
+
+    private:
+        struct Slot {
+            std::string name;
+            __u32 priority;
+            __u32 chain_actions;
+            const ChainProgram* program; // nullptr for xdp_filter
+            bpf_object* obj;   // Object of another program
+            bpf_program* prog;
+            bpf_link* link;    // freplace link, nullptr until attached
+        };
+
+        DispatcherConfig config;
+        dispatcher_bpf* skel;
+        std::vector<Slot> slots;
+    };
+} // namespace packet_filter
+
+#endif /* DISPATCHER_H */
@@ -0,0 +1,367 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "flow_export.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        const __u16 IPFIX_VERSION = 10;
+        const __u16 TEMPLATE_SET_ID = 2;
+        const __u16 TEMPLATE_ID = 256;
+        const size_t HEADER_LEN = 16;
+        const size_t SET_HEADER_LEN = 4;
+        const size_t MESSAGE_MAX = 1400;                 // Fits one Ethernet frame
+        const __u64 TEMPLATE_REFRESH_NS = 60000000000ULL; // UDP collectors need the template resent
+        const __u32 BATCH_SIZE = 256;
+
+        // forwardingStatus (RFC 7270): status in the two high bits, reason 0 = unknown
+        const __u8 STATUS_FORWARDED = 0x40;
+        const __u8 STATUS_DROPPED = 0x80;
+        const __u8 STATUS_CONSUMED = 0xC0;
+
+        // IANA information elements of the data record, in order
+        struct TemplateField {
+            __u16 id;
+            __u16 length;
+        };
+        const TemplateField TEMPLATE_FIELDS[] = {
+            {8, 4},   // sourceIPv4Address
+            {12, 4},  // destinationIPv4Address
+            {7, 2},   // sourceTransportPort
+            {11, 2},  // destinationTransportPort
+            {4, 1},   // protocolIdentifier
+            {6, 2},   // tcpControlBits
+            {10, 4},  // ingressInterface
+            {89, 1},  // forwardingStatus
+            {2, 8},   // packetDeltaCount
+            {1, 8},   // octetDeltaCount
+            {133, 8}, // droppedPacketDeltaCount
+            {152, 8}, // flowStartMilliseconds
+            {153, 8}, // flowEndMilliseconds
+        };
+        const size_t TEMPLATE_FIELD_COUNT = sizeof(TEMPLATE_FIELDS) / sizeof(TEMPLATE_FIELDS[0]);
+        const size_t RECORD_LEN = 60;
+
+        __s64 clock_ns(clockid_t clock) {
+            struct timespec ts;
+            clock_gettime(clock, &ts);
+            return static_cast<__s64>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        }
+
+        // Big-endian writers, return the next offset
+        size_t put8(std::vector<__u8>& buf, size_t off, __u8 v) {
+            buf[off] = v;
+            return off + 1;
+        }
+
+        size_t put16(std::vector<__u8>& buf, size_t off, __u16 v) {
+            buf[off] = v >> 8;
+            buf[off + 1] = v;
+            return off + 2;
+        }
+
+        size_t put32(std::vector<__u8>& buf, size_t off, __u32 v) {
+            off = put16(buf, off, v >> 16);
+            return put16(buf, off, v);
+        }
+
+        size_t put64(std::vector<__u8>& buf, size_t off, __u64 v) {
+            off = put32(buf, off, v >> 32);
+            return put32(buf, off, v);
+        }
+
+        // Already in network byte order
+        size_t put_raw(std::vector<__u8>& buf, size_t off, const void* v, size_t len) {
+            memcpy(&buf[off], v, len);
+            return off + len;
+        }
+
+        prometheus::Family<prometheus::Counter>& exported_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_flow_export_records_total")
+                .Help("Flow records sent to the IPFIX collector")
+                .Register(metrics::registry());
+            return family;
+        }
+    }
+
+    FlowExporter::FlowExporter(int flow_export_map_fd)
+        : map_fd_flows(flow_export_map_fd), sock(-1), enabled(false), message(MESSAGE_MAX), message_len(0),
+          data_set_start(0), message_records(0), sequence(0), template_sent_ns(0), realtime_offset_ns(0),
+          flows_exported(0), messages_sent(0), send_errors(0), running(false) {}
+
+    FlowExporter::~FlowExporter() {
+        stop();
+        if (sock >= 0) {
+            close(sock);
+        }
+    }
+
+    void FlowExporter::set_config(const FlowExportConfig& config, bool export_enabled) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        current_config = config;
+        enabled = export_enabled;
+    }
+
+    void FlowExporter::start() {
+        if (running) {
+            return;
+        }
+        running = true;
+        worker = std::thread(&FlowExporter::run, this);
+    }
+
+    void FlowExporter::stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void FlowExporter::run() {
+        FlowExportConfig config;
+        bool export_enabled = false;
+
+        while (running) {
+            {
+                std::lock_guard<std::mutex> lock(config_mutex);
+                config = current_config;
+                export_enabled = enabled;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms),
+                              [this] { return !running; });
+            }
+            if (!running || !export_enabled) {
+                continue;
+            }
+            if (config.collector != connected_collector) {
+                open_collector(config.collector);
+            }
+            if (sock >= 0) {
+                export_flows(config, false);
+            }
+        }
+
+        // Shutting down: whatever is still in the map is exported as ended
+        if (export_enabled && sock >= 0) {
+            export_flows(config, true);
+        }
+    }
+
+    // "host:port" or "[v6]:port"; an unreachable collector only shows up as send errors
+    int FlowExporter::open_collector(const std::string& collector) {
+        if (sock >= 0) {
+            close(sock);
+            sock = -1;
+        }
+        connected_collector = collector; // Not retried until the setting changes
+        template_sent_ns = 0;
+
+        size_t colon = collector.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == collector.size()) {
+            std::cerr << "Invalid flow_export_collector '" << collector << "' (host:port)" << std::endl;
+            return -1;
+        }
+        std::string host = collector.substr(0, colon);
+        std::string port = collector.substr(colon + 1);
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        struct addrinfo* result = nullptr;
+        int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+        if (err != 0) {
+            std::cerr << "Failed to resolve flow_export_collector " << collector << ": " << gai_strerror(err)
+                      << std::endl;
+            return -1;
+        }
+        for (struct addrinfo* ai = result; ai && sock < 0; ai = ai->ai_next) {
+            sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (sock >= 0 && connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+                close(sock);
+                sock = -1;
+            }
+        }
+        freeaddrinfo(result);
+        if (sock < 0) {
+            std::cerr << "Failed to open flow export socket to " << collector << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        std::cout << "Exporting flows (IPFIX) to " << collector << std::endl;
+        return 0;
+    }
+
+    // Export and remove the expired records (every record with `flush`), one batch at a
+    // time. Packets landing on a record between the read and the delete are lost.
+    int FlowExporter::export_flows(const FlowExportConfig& config, bool flush) {
+        std::vector<FlowKey> keys(BATCH_SIZE);
+        std::vector<FlowRecord> values(BATCH_SIZE);
+        std::vector<FlowKey> expired;
+        expired.reserve(BATCH_SIZE);
+        __u32 in_batch = 0, out_batch = 0;
+        bool first = true;
+
+        __u64 now = static_cast<__u64>(clock_ns(CLOCK_MONOTONIC));
+        __u64 idle_ns = static_cast<__u64>(config.idle_sec) * 1000000000ULL;
+        __u64 active_ns = static_cast<__u64>(config.active_sec) * 1000000000ULL;
+        realtime_offset_ns = clock_ns(CLOCK_REALTIME) - static_cast<__s64>(now);
+
+        // Batch ops are always there: the program needs a 5.18+ kernel (bpf_xdp_load_bytes)
+        while (true) {
+            __u32 count = BATCH_SIZE;
+            int ret = bpf_map_lookup_batch(map_fd_flows, first ? nullptr : &in_batch, &out_batch, keys.data(),
+                                           values.data(), &count, nullptr);
+            if (ret != 0 && errno != ENOENT) {
+                std::cerr << "Failed to batch read flow_export_map: " << strerror(errno) << std::endl;
+                break;
+            }
+
+            expired.clear();
+            for (__u32 i = 0; i < count; i++) {
+                const FlowRecord& record = values[i];
+                if (flush || record.last_seen_ns + idle_ns <= now || record.first_seen_ns + active_ns <= now) {
+                    add_record(keys[i], record, config);
+                    expired.push_back(keys[i]);
+                }
+            }
+            if (!expired.empty()) {
+                __u32 deleted = static_cast<__u32>(expired.size());
+                if (bpf_map_delete_batch(map_fd_flows, expired.data(), &deleted, nullptr) != 0) {
+                    // A key evicted meanwhile stops the batch, remove the rest one by one
+                    for (size_t i = deleted + 1; i < expired.size(); i++) {
+                        bpf_map_delete_elem(map_fd_flows, &expired[i]);
+                    }
+                }
+            }
+
+            if (ret != 0) {
+                break; // ENOENT: the whole map has been read
+            }
+            in_batch = out_batch;
+            first = false;
+        }
+
+        send_message(config);
+        return 0;
+    }
+
+    void FlowExporter::begin_message() {
+        message_len = HEADER_LEN;
+        data_set_start = 0;
+        message_records = 0;
+
+        __u64 now = static_cast<__u64>(clock_ns(CLOCK_MONOTONIC));
+        if (template_sent_ns != 0 && now - template_sent_ns < TEMPLATE_REFRESH_NS) {
+            return;
+        }
+        size_t off = put16(message, message_len, TEMPLATE_SET_ID);
+        off = put16(message, off, SET_HEADER_LEN + 4 + TEMPLATE_FIELD_COUNT * 4);
+        off = put16(message, off, TEMPLATE_ID);
+        off = put16(message, off, TEMPLATE_FIELD_COUNT);
+        for (const auto& field : TEMPLATE_FIELDS) {
+            off = put16(message, off, field.id);
+            off = put16(message, off, field.length);
+        }
+        message_len = off;
+        template_sent_ns = now;
+    }
+
+    void FlowExporter::add_record(const FlowKey& key, const FlowRecord& record, const FlowExportConfig& config) {
+        if (message_len == 0) {
+            begin_message();
+        }
+        if (message_len + (data_set_start ? 0 : SET_HEADER_LEN) + RECORD_LEN > MESSAGE_MAX) {
+            send_message(config);
+            begin_message();
+        }
+        if (!data_set_start) {
+            data_set_start = message_len;
+            put16(message, message_len, TEMPLATE_ID); // Length is filled in by send_message
+            message_len += SET_HEADER_LEN;
+        }
+
+        __u8 status = record.verdict == FLOW_DROPPED    ? STATUS_DROPPED
+                      : record.verdict == FLOW_REDIRECTED ? STATUS_CONSUMED
+                                                          : STATUS_FORWARDED;
+        __u64 start_ms = static_cast<__u64>(static_cast<__s64>(record.first_seen_ns) + realtime_offset_ns) / 1000000;
+        __u64 end_ms = static_cast<__u64>(static_cast<__s64>(record.last_seen_ns) + realtime_offset_ns) / 1000000;
+
+        size_t off = put_raw(message, message_len, &key.saddr, 4);
+        off = put_raw(message, off, &key.daddr, 4);
+        off = put_raw(message, off, &key.sport, 2);
+        off = put_raw(message, off, &key.dport, 2);
+        off = put8(message, off, key.protocol);
+        off = put16(message, off, record.tcp_flags);
+        off = put32(message, off, record.ifindex);
+        off = put8(message, off, status);
+        off = put64(message, off, record.packets);
+        off = put64(message, off, record.bytes);
+        off = put64(message, off, record.dropped_packets);
+        off = put64(message, off, start_ms);
+        off = put64(message, off, end_ms);
+        message_len = off;
+        message_records++;
+    }
+
+    void FlowExporter::send_message(const FlowExportConfig& config) {
+        if (message_len == 0 || (message_records == 0 && message_len == HEADER_LEN)) {
+            message_len = 0;
+            return;
+        }
+        if (data_set_start) {
+            put16(message, data_set_start + 2, message_len - data_set_start);
+        }
+        size_t off = put16(message, 0, IPFIX_VERSION);
+        off = put16(message, off, message_len);
+        off = put32(message, off, static_cast<__u32>(time(nullptr)));
+        off = put32(message, off, sequence);
+        put32(message, off, config.domain_id);
+
+        if (send(sock, message.data(), message_len, 0) < 0) {
+            send_errors++;
+            template_sent_ns = 0; // The template may have been lost with this message
+        } else {
+            messages_sent++;
+            flows_exported += message_records;
+            exported_family().Add({}).Increment(message_records);
+        }
+        sequence += message_records; // Counts every record exported, delivered or not
+        message_len = 0;
+    }
+
+    void FlowExporter::print_summary(std::ostream& out) const {
+        if (messages_sent == 0 && send_errors == 0) {
+            return;
+        }
+        out << "Flow export: " << flows_exported << " flows in " << messages_sent << " IPFIX messages to "
+            << connected_collector;
+        if (send_errors > 0) {
+            out << ", " << send_errors << " messages not sent";
+        }
+        out << "\n";
+    }
+} // namespace packet_filter
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef FLOW_EXPORT_H
+#define FLOW_EXPORT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet_filter.h"
+
+namespace packet_filter {
+    // Verdicts of a flow record (must match FLOW_* in the BPF code)
+    enum FlowVerdict : __u8 {
+        FLOW_PASSED = 0,
+        FLOW_DROPPED,
+        FLOW_REDIRECTED
+    };
+
+    // Exported flow (must match struct flow_record)
+    struct FlowRecord {
+        __u64 first_seen_ns;
+        __u64 last_seen_ns;
+        __u64 packets;
+        __u64 bytes;
+        __u64 dropped_packets;
+        __u32 ifindex;
+        __u8 tcp_flags;
+        __u8 verdict;
+        __u8 drop_reason;
+        __u8 pad;
+    };
+
+    // Background thread that scans flow_export_map in batches, sends the idle and
+    // long-running flows to an IPFIX collector over UDP (one template, resent
+    // periodically) and removes them from the map. Memory is bounded by the LRU map
+    // and one batch; a record is exported at most one interval after it expired.
+    class FlowExporter {
+    public:
+        explicit FlowExporter(int flow_export_map_fd);
+        ~FlowExporter();
+
+        // Apply a new configuration (safe to call while the thread is running)
+        void set_config(const FlowExportConfig& config, bool export_enabled);
+
+        void start();
+        // Export every remaining flow, then stop the thread
+        void stop();
+
+        // Flows / messages sent
+        void print_summary(std::ostream& out) const;
+
+    private:
+        void run();
+        int open_collector(const std::string& collector);
+        int export_flows(const FlowExportConfig& config, bool flush);
+        void add_record(const FlowKey& key, const FlowRecord& record, const FlowExportConfig& config);
+        void begin_message();
+        void send_message(const FlowExportConfig& config);
+
+        int map_fd_flows;
+        int sock;
+        std::string connected_collector;
+
+        std::mutex config_mutex;
+        FlowExportConfig current_config;
+        bool enabled;
+
+        // Writer thread only: the message being built and the export state
+        std::vector<__u8> message;
+        size_t message_len;
+        size_t data_set_start;  // Offset of the open data set, 0 = none
+        __u32 message_records;
+        __u32 sequence;         // Data records sent so far (IPFIX sequence number)
+        __u64 template_sent_ns; // 0 = the template must go with the next message
+        __s64 realtime_offset_ns;
+
+        std::atomic<__u64> flows_exported;
+        std::atomic<__u64> messages_sent;
+        std::atomic<__u64> send_errors;
+
+        std::thread worker;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+    };
+} // namespace packet_filter
+
+#endif /* FLOW_EXPORT_H */
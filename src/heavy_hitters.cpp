@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "heavy_hitters.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        __u64 monotonic_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        prometheus::Family<prometheus::Gauge>& pps_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_heavy_hitter_pps")
+                .Help("Packet rate of the top sources estimated from the count-min sketch")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Gauge>& bps_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_heavy_hitter_bytes_per_second")
+                .Help("Byte rate of the top sources estimated from the count-min sketch")
+                .Register(metrics::registry());
+            return family;
+        }
+    }
+
+    HeavyHitterMonitor::HeavyHitterMonitor(int cms_map_fd, int candidates_map_fd)
+        : map_fd_cms(cms_map_fd), map_fd_candidates(candidates_map_fd),
+          ncpus(libbpf_num_possible_cpus()), enabled(false), running(false), have_prev(false) {}
+
+    HeavyHitterMonitor::~HeavyHitterMonitor() {
+        stop();
+    }
+
+    void HeavyHitterMonitor::set_config(const HeavyHitterConfig& config, bool sketch_enabled) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        current_config = config;
+        enabled = sketch_enabled;
+    }
+
+    void HeavyHitterMonitor::start() {
+        if (running) {
+            return;
+        }
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return;
+        }
+        running = true;
+        worker = std::thread(&HeavyHitterMonitor::run, this);
+    }
+
+    void HeavyHitterMonitor::stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void HeavyHitterMonitor::run() {
+        __u64 last_report_ns = monotonic_ns();
+
+        while (running) {
+            HeavyHitterConfig config;
+            bool sketch_enabled;
+            {
+                std::lock_guard<std::mutex> lock(config_mutex);
+                config = current_config;
+                sketch_enabled = enabled;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms),
+                              [this] { return !running; });
+            }
+            if (!running) {
+                break;
+            }
+
+            __u64 now_ns = monotonic_ns();
+            double elapsed_s = (now_ns - last_report_ns) / 1e9;
+            last_report_ns = now_ns;
+
+            if (!sketch_enabled) {
+                have_prev = false;
+                continue;
+            }
+            report(elapsed_s, config);
+        }
+    }
+
+    // Sum the per-CPU copies of every row into packets/bytes (row-major)
+    int HeavyHitterMonitor::read_sketch(std::vector<__u64>& packets, std::vector<__u64>& bytes) {
+        std::vector<CmsRow> percpu(ncpus);
+        packets.assign(CMS_DEPTH * CMS_WIDTH, 0);
+        bytes.assign(CMS_DEPTH * CMS_WIDTH, 0);
+
+        for (__u32 row = 0; row < CMS_DEPTH; row++) {
+            if (bpf_map_lookup_elem(map_fd_cms, &row, percpu.data()) != 0) {
+                std::cerr << "Failed to read cms_map row " << row << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+            __u64* row_packets = &packets[row * CMS_WIDTH];
+            __u64* row_bytes = &bytes[row * CMS_WIDTH];
+            for (int cpu = 0; cpu < ncpus; cpu++) {
+                for (__u32 i = 0; i < CMS_WIDTH; i++) {
+                    row_packets[i] += percpu[cpu].packets[i];
+                    row_bytes[i] += percpu[cpu].bytes[i];
+                }
+            }
+        }
+        return 0;
+    }
+
+    // Union of the candidate IPs of all CPUs
+    int HeavyHitterMonitor::read_candidates(std::vector<__u32>& ips) {
+        std::vector<HhCandidate> percpu(ncpus);
+        std::unordered_set<__u32> seen;
+
+        for (__u32 slot = 0; slot < HH_CANDIDATES; slot++) {
+            if (bpf_map_lookup_elem(map_fd_candidates, &slot, percpu.data()) != 0) {
+                std::cerr << "Failed to read hh_candidates_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            for (int cpu = 0; cpu < ncpus; cpu++) {
+                if (percpu[cpu].votes > 0 && seen.insert(percpu[cpu].ip).second) {
+                    ips.push_back(percpu[cpu].ip);
+                }
+            }
+        }
+        return 0;
+    }
+
+    void HeavyHitterMonitor::report(double elapsed_s, const HeavyHitterConfig& config) {
+        std::vector<__u64> packets, bytes;
+        std::vector<__u32> ips;
+        if (read_sketch(packets, bytes) != 0 || read_candidates(ips) != 0) {
+            return;
+        }
+        if (!have_prev || elapsed_s <= 0) {
+            prev_packets.swap(packets);
+            prev_bytes.swap(bytes);
+            have_prev = true;
+            return;
+        }
+
+        // Estimate = minimum over the rows of the interval delta
+        std::vector<HeavyHitter> hitters;
+        for (__u32 ip : ips) {
+            __u64 est_packets = UINT64_MAX, est_bytes = UINT64_MAX;
+            for (__u32 row = 0; row < CMS_DEPTH; row++) {
+                size_t cell = row * CMS_WIDTH + (cms_hash(ip, row) & (CMS_WIDTH - 1));
+                est_packets = std::min(est_packets, packets[cell] - prev_packets[cell]);
+                est_bytes = std::min(est_bytes, bytes[cell] - prev_bytes[cell]);
+            }
+            if (est_packets > 0) {
+                hitters.push_back({ip, est_packets / elapsed_s, est_bytes / elapsed_s});
+            }
+        }
+        prev_packets.swap(packets);
+        prev_bytes.swap(bytes);
+
+        std::sort(hitters.begin(), hitters.end(),
+            [](const HeavyHitter& a, const HeavyHitter& b) { return a.pps > b.pps; });
+        if (hitters.size() > config.top) {
+            hitters.resize(config.top);
+        }
+
+        // Replace the previous interval's series
+        for (size_t i = 0; i < exported.size(); i++) {
+            (i % 2 ? bps_family() : pps_family()).Remove(exported[i]);
+        }
+        exported.clear();
+
+        for (size_t rank = 0; rank < hitters.size(); rank++) {
+            struct in_addr addr;
+            addr.s_addr = hitters[rank].ip;
+            char ip_str[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
+
+            prometheus::Labels labels = {{"rank", std::to_string(rank + 1)}, {"ip", ip_str}};
+            auto& pps = pps_family().Add(labels);
+            auto& bps = bps_family().Add(labels);
+            pps.Set(hitters[rank].pps);
+            bps.Set(hitters[rank].bps);
+            exported.push_back(&pps);
+            exported.push_back(&bps);
+
+            if (config.log_pps > 0 && hitters[rank].pps >= config.log_pps) {
+                std::cout << "Heavy hitter #" << rank + 1 << ": " << ip_str << " "
+                          << static_cast<__u64>(hitters[rank].pps) << " pps, "
+                          << static_cast<__u64>(hitters[rank].bps) << " B/s" << std::endl;
+            }
+        }
+    }
+} // namespace packet_filter
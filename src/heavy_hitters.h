@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef HEAVY_HITTERS_H
+#define HEAVY_HITTERS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "packet_filter.h"
+
+namespace prometheus {
+    class Gauge;
+}
+
+namespace packet_filter {
+    // Count-min sketch dimensions (must match the BPF definitions)
+    constexpr __u32 CMS_DEPTH = 4;
+    constexpr __u32 CMS_WIDTH = 1024;
+    constexpr __u32 HH_CANDIDATES = 64;
+
+    // One row of the sketch (must match struct cms_row)
+    struct CmsRow {
+        __u64 packets[CMS_WIDTH];
+        __u64 bytes[CMS_WIDTH];
+    };
+
+    // Candidate slot (must match struct hh_candidate)
+    struct HhCandidate {
+        __u32 ip;
+        __u32 window;
+        __u64 votes;
+    };
+
+    // Hash of a source IP for sketch row `row` (must match cms_hash() in the BPF code)
+    inline __u32 cms_hash(__u32 ip, __u32 row) {
+        __u32 h = ip * 0x9E3779B1U + row * 0x85EBCA6BU;
+        h ^= h >> 16;
+        h *= 0x7FEB352DU;
+        h ^= h >> 15;
+        h *= 0x846CA68BU;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // Heavy hitter estimated from one sketch interval
+    struct HeavyHitter {
+        __u32 ip;
+        double pps;
+        double bps; // Bytes per second
+    };
+
+    // Background thread that merges the per-CPU sketches every interval and
+    // reports the candidates with the largest packet and byte rates.
+    class HeavyHitterMonitor {
+    public:
+        HeavyHitterMonitor(int cms_map_fd, int candidates_map_fd);
+        ~HeavyHitterMonitor();
+
+        // Apply a new configuration (safe to call while the thread is running)
+        void set_config(const HeavyHitterConfig& config, bool sketch_enabled);
+
+        void start();
+        void stop();
+
+    private:
+        void run();
+        int read_sketch(std::vector<__u64>& packets, std::vector<__u64>& bytes);
+        int read_candidates(std::vector<__u32>& ips);
+        void report(double elapsed_s, const HeavyHitterConfig& config);
+
+        int map_fd_cms;
+        int map_fd_candidates;
+        int ncpus;
+
+        std::mutex config_mutex;
+        HeavyHitterConfig current_config;
+        bool enabled;
+
+        std::thread worker;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        // Merged counters of the previous interval, CMS_DEPTH * CMS_WIDTH cells each
+        std::vector<__u64> prev_packets;
+        std::vector<__u64> prev_bytes;
+        bool have_prev;
+
+        // Series exported for the previous interval (pps, bytes/s pairs)
+        std::vector<prometheus::Gauge*> exported;
+    };
+} // namespace packet_filter
+
+#endif /* HEAVY_HITTERS_H */
@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_tun.h>
+#include <bpf/bpf.h>
+
+#include "inspection.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        const __u32 ETH_HLEN_BYTES = 14;
+        const __u8 TCP_FIN = 0x01, TCP_SYN = 0x02, TCP_RST = 0x04, TCP_PSH = 0x08, TCP_ACK = 0x10, TCP_URG = 0x20;
+
+        prometheus::Family<prometheus::Counter>& signature_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_signature_matches_total")
+                .Help("Inspected frames dropped because their payload matched a signature")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Counter>& frames_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_inspection_frames_total")
+                .Help("Frames handled by the AF_XDP deep-inspection workers")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        InspectVerdict check_headers(const __u8* data, __u32 len) {
+            if (len < ETH_HLEN_BYTES || data[12] != 0x08 || data[13] != 0x00) {
+                return InspectVerdict::Accept; // Not IPv4, nothing to check
+            }
+            const __u8* ip = data + ETH_HLEN_BYTES;
+            __u32 ip_len = len - ETH_HLEN_BYTES;
+            if (ip_len < 20 || (ip[0] >> 4) != 4) {
+                return InspectVerdict::Drop;
+            }
+            __u32 ihl = (ip[0] & 0x0F) * 4;
+            __u32 tot_len = (static_cast<__u32>(ip[2]) << 8) | ip[3];
+            if (ihl < 20 || tot_len < ihl || tot_len > ip_len) {
+                return InspectVerdict::Drop;
+            }
+            bool first_fragment = ((ip[6] & 0x1F) | ip[7]) == 0;
+            if (ip[9] != IPPROTO_TCP || !first_fragment) {
+                return InspectVerdict::Accept;
+            }
+
+            const __u8* tcp = ip + ihl;
+            if (tot_len - ihl < 20 || (tcp[12] >> 4) < 5) {
+                return InspectVerdict::Drop;
+            }
+            __u8 flags = tcp[13];
+            if (flags == 0 ||                                                   // NULL scan
+                (flags & (TCP_SYN | TCP_FIN)) == (TCP_SYN | TCP_FIN) ||
+                (flags & (TCP_SYN | TCP_RST)) == (TCP_SYN | TCP_RST) ||
+                (flags & (TCP_FIN | TCP_PSH | TCP_URG)) == (TCP_FIN | TCP_PSH | TCP_URG) || // Xmas scan
+                ((flags & TCP_FIN) && !(flags & TCP_ACK))) {
+                return InspectVerdict::Drop;
+            }
+            return InspectVerdict::Accept;
+        }
+    }
+
+    void HeaderSanityInspector::inspect(const InspectFrame* frames, __u32 count, InspectVerdict* verdicts) {
+        for (__u32 i = 0; i < count; i++) {
+            verdicts[i] = check_headers(frames[i].data, frames[i].len);
+        }
+    }
+
+    SignatureInspector::SignatureInspector(BanHandler on_ban) : on_ban(std::move(on_ban)) {}
+
+    void SignatureInspector::set_config(const DeepInspectionConfig& config) {
+        auto next = std::make_shared<Compiled>(config.signatures, config.ban_on_match);
+        for (size_t id = 0; id < next->matcher.size(); id++) {
+            next->matches.push_back(&signature_family().Add({{"signature", next->matcher.name(id)}}));
+        }
+        std::shared_ptr<const Compiled> published = next;
+        std::atomic_store(&compiled, published);
+        std::cout << "Deep inspection: " << next->matcher.size() << " payload signature(s), "
+                  << next->matcher.state_count() << " DFA states" << std::endl;
+    }
+
+    void SignatureInspector::inspect(const InspectFrame* frames, __u32 count, InspectVerdict* verdicts) {
+        HeaderSanityInspector::inspect(frames, count, verdicts);
+
+        std::shared_ptr<const Compiled> current = std::atomic_load(&compiled);
+        if (!current || current->matcher.size() == 0) {
+            return;
+        }
+        for (__u32 i = 0; i < count; i++) {
+            if (i + 1 < count) {
+                __builtin_prefetch(frames[i + 1].data + 64); // First payload line of the next frame
+            }
+            if (verdicts[i] == InspectVerdict::Drop) {
+                continue;
+            }
+            const __u8* data = frames[i].data;
+            __u32 offset = payload_offset(data, frames[i].len);
+            int id = current->matcher.find(data + offset, frames[i].len - offset);
+            if (id < 0) {
+                continue;
+            }
+
+            verdicts[i] = InspectVerdict::Drop;
+            current->matches[id]->Increment();
+            if (current->ban && on_ban) {
+                __u32 src_ip; // payload_offset() only returns < len for IPv4 frames
+                memcpy(&src_ip, data + ETH_HLEN_BYTES + 12, sizeof(src_ip));
+                on_ban(src_ip, current->matcher.name(id));
+            }
+        }
+    }
+
+    InspectionPool::InspectionPool(int xsks_map_fd, __u32 ifindex, const DeepInspectionConfig& config,
+                                   std::shared_ptr<Inspector> inspector)
+        : map_fd_xsks(xsks_map_fd), ifindex(ifindex), config(config), inspector(std::move(inspector)),
+          tap_fd(-1), running(false) {
+        memset(tap_mac, 0, sizeof(tap_mac));
+    }
+
+    InspectionPool::~InspectionPool() {
+        stop();
+    }
+
+    // Create (or attach to) the TAP device used to hand accepted frames to the host stack
+    int InspectionPool::open_tap() {
+        tap_fd = open("/dev/net/tun", O_RDWR | O_CLOEXEC);
+        if (tap_fd < 0) {
+            std::cerr << "Failed to open /dev/net/tun: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+        strncpy(ifr.ifr_name, config.tap_name.c_str(), IFNAMSIZ - 1);
+        if (ioctl(tap_fd, TUNSETIFF, &ifr) != 0) {
+            std::cerr << "Failed to create TAP device " << config.tap_name << ": " << strerror(errno) << std::endl;
+            close(tap_fd);
+            tap_fd = -1;
+            return -1;
+        }
+
+        int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (sock < 0) {
+            std::cerr << "Failed to create control socket: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0) {
+            ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+            if (ioctl(sock, SIOCSIFFLAGS, &ifr) != 0) {
+                std::cerr << "Failed to bring up " << config.tap_name << ": " << strerror(errno) << std::endl;
+            }
+        }
+        // Frames are rewritten to the TAP MAC so the stack treats them as addressed to the host
+        if (ioctl(sock, SIOCGIFHWADDR, &ifr) == 0) {
+            memcpy(tap_mac, ifr.ifr_hwaddr.sa_data, sizeof(tap_mac));
+        }
+        close(sock);
+        return 0;
+    }
+
+    int InspectionPool::start() {
+        if (running) {
+            return 0;
+        }
+        if (config.reinject == "tap" && open_tap() != 0) {
+            return -1;
+        }
+
+        XskSocketConfig xsk_config;
+        xsk_config.frame_count = config.frame_count;
+        xsk_config.frame_size = 4096;
+        xsk_config.ring_size = config.ring_size;
+        xsk_config.busy_poll_budget = config.busy_poll ? config.batch_size : 0;
+        xsk_config.zerocopy = config.zerocopy;
+
+        for (__u32 queue_id : config.queues) {
+            std::unique_ptr<Worker> worker(new Worker());
+            worker->queue_id = queue_id;
+            if (worker->socket.open(ifindex, queue_id, xsk_config) != 0) {
+                stop();
+                return -1;
+            }
+            int sock_fd = worker->socket.fd();
+            if (bpf_map_update_elem(map_fd_xsks, &queue_id, &sock_fd, BPF_ANY) != 0) {
+                std::cerr << "Failed to add queue " << queue_id << " to xsks_map: " << strerror(errno) << std::endl;
+                stop();
+                return -1;
+            }
+            workers.push_back(std::move(worker));
+        }
+
+        running = true;
+        for (auto& worker : workers) {
+            worker->thread = std::thread(&InspectionPool::run, this, worker.get());
+        }
+        std::cout << "Deep inspection: " << workers.size() << " AF_XDP worker(s), reinject="
+                  << config.reinject << (config.busy_poll ? ", busy polling" : "") << std::endl;
+        return 0;
+    }
+
+    void InspectionPool::stop() {
+        running = false;
+        for (auto& worker : workers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+            // Without a socket in the slot xdp_filter falls back to XDP_PASS
+            bpf_map_delete_elem(map_fd_xsks, &worker->queue_id);
+            worker->socket.close();
+        }
+        workers.clear();
+        if (tap_fd >= 0) {
+            close(tap_fd);
+            tap_fd = -1;
+        }
+    }
+
+    void InspectionPool::run(Worker* worker) {
+        const __u32 batch = config.batch_size;
+        XskSocket& xsk = worker->socket;
+        std::vector<struct xdp_desc> rx_descs(batch);
+        std::vector<struct xdp_desc> tx_descs(batch);
+        std::vector<InspectFrame> frames(batch);
+        std::vector<InspectVerdict> verdicts(batch);
+        std::vector<__u64> recycle(batch);
+        bool reinject_tx = config.reinject == "tx";
+        bool reinject_tap = config.reinject == "tap" && tap_fd >= 0;
+
+        std::string queue = std::to_string(worker->queue_id);
+        auto& accepted = frames_family().Add({{"queue", queue}, {"verdict", "accept"}});
+        auto& dropped = frames_family().Add({{"queue", queue}, {"verdict", "drop"}});
+
+        struct pollfd pfd;
+        pfd.fd = xsk.fd();
+        pfd.events = POLLIN;
+
+        while (running) {
+            // Frames the kernel finished transmitting go back to the fill ring
+            __u32 done = xsk.complete(recycle.data(), batch);
+            if (done > 0) {
+                xsk.refill(recycle.data(), done);
+            }
+
+            __u32 count = xsk.receive(rx_descs.data(), batch);
+            if (count == 0) {
+                if (config.busy_poll) {
+                    recvfrom(xsk.fd(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr); // Drives NAPI busy polling
+                } else {
+                    xsk.kick_rx();
+                    poll(&pfd, 1, 100);
+                }
+                continue;
+            }
+
+            for (__u32 i = 0; i < count; i++) {
+                frames[i].data = xsk.frame(rx_descs[i].addr);
+                frames[i].len = rx_descs[i].len;
+                frames[i].queue_id = worker->queue_id;
+            }
+            inspector->inspect(frames.data(), count, verdicts.data());
+
+            __u32 tx_count = 0, recycle_count = 0, accept_count = 0;
+            for (__u32 i = 0; i < count; i++) {
+                if (verdicts[i] == InspectVerdict::Accept) {
+                    accept_count++;
+                    if (reinject_tx) {
+                        tx_descs[tx_count++] = rx_descs[i]; // Zero copy: the RX frame is transmitted as is
+                        continue;
+                    }
+                    if (reinject_tap && rx_descs[i].len >= ETH_HLEN_BYTES) {
+                        __u8* data = xsk.frame(rx_descs[i].addr);
+                        memcpy(data, tap_mac, sizeof(tap_mac));
+                        if (write(tap_fd, data, rx_descs[i].len) < 0 && errno != EAGAIN) {
+                            std::cerr << "Failed to reinject frame: " << strerror(errno) << std::endl;
+                        }
+                    }
+                }
+                recycle[recycle_count++] = rx_descs[i].addr;
+            }
+
+            if (tx_count > 0) {
+                __u32 sent = xsk.transmit(tx_descs.data(), tx_count);
+                for (__u32 i = sent; i < tx_count; i++) {
+                    recycle[recycle_count++] = tx_descs[i].addr; // TX ring full, drop the rest
+                }
+                xsk.kick_tx();
+            }
+            if (recycle_count > 0) {
+                xsk.refill(recycle.data(), recycle_count);
+            }
+
+            accepted.Increment(accept_count);
+            dropped.Increment(count - accept_count);
+        }
+    }
+} // namespace packet_filter
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef INSPECTION_H
+#define INSPECTION_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet_filter.h"
+#include "xsk.h"
+#include "signatures.h"
+
+namespace prometheus {
+    class Counter;
+}
+
+namespace packet_filter {
+    enum class InspectVerdict : __u8 {
+        Accept, // Hand the frame back to the network (reinject)
+        Drop,   // Recycle the frame without forwarding it
+    };
+
+    // A received frame, valid only during the inspect() call
+    struct InspectFrame {
+        const __u8* data; // Starts at the Ethernet header
+        __u32 len;
+        __u32 queue_id;
+    };
+
+    // Deep-inspection engine run by the AF_XDP workers.
+    // inspect() is called concurrently from every worker and must be thread-safe.
+    class Inspector {
+    public:
+        virtual ~Inspector() = default;
+        virtual void inspect(const InspectFrame* frames, __u32 count, InspectVerdict* verdicts) = 0;
+    };
+
+    // Default engine: drops malformed IPv4 headers and impossible TCP flag combinations
+    class HeaderSanityInspector : public Inspector {
+    public:
+        void inspect(const InspectFrame* frames, __u32 count, InspectVerdict* verdicts) override;
+    };
+
+    // Header checks plus payload signatures: frames whose TCP/UDP payload matches a
+    // signature are dropped, and with payload_ban their source is handed to on_ban
+    class SignatureInspector : public HeaderSanityInspector {
+    public:
+        using BanHandler = std::function<void(__u32 src_ip, const std::string& signature)>;
+
+        explicit SignatureInspector(BanHandler on_ban);
+
+        // Recompile the signatures (safe to call while the workers are running)
+        void set_config(const DeepInspectionConfig& config);
+
+        void inspect(const InspectFrame* frames, __u32 count, InspectVerdict* verdicts) override;
+
+    private:
+        struct Compiled {
+            SignatureMatcher matcher;
+            std::vector<prometheus::Counter*> matches; // Per-signature match counters
+            bool ban;
+
+            Compiled(const std::vector<PayloadSignature>& signatures, bool ban)
+                : matcher(signatures), ban(ban) {}
+        };
+
+        BanHandler on_ban;
+        std::shared_ptr<const Compiled> compiled; // Swapped with std::atomic_store on reload
+    };
+
+    // AF_XDP worker pool: one thread, socket and UMEM per RX queue.
+    // Frames redirected by xdp_filter are inspected in batches; accepted frames are
+    // written to a TAP device (host stack) or sent back out through the TX ring.
+    class InspectionPool {
+    public:
+        InspectionPool(int xsks_map_fd, __u32 ifindex, const DeepInspectionConfig& config,
+                       std::shared_ptr<Inspector> inspector);
+        ~InspectionPool();
+
+        int start();
+        void stop();
+
+    private:
+        struct Worker {
+            __u32 queue_id;
+            XskSocket socket;
+            std::thread thread;
+        };
+
+        int open_tap();
+        void run(Worker* worker);
+
+        int map_fd_xsks;
+        __u32 ifindex;
+        DeepInspectionConfig config;
+        std::shared_ptr<Inspector> inspector;
+        int tap_fd;
+        __u8 tap_mac[6];
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> running;
+    };
+} // namespace packet_filter
+
+#endif /* INSPECTION_H */
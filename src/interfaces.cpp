@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <prometheus/gauge.h>
+
+#include "interfaces.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        prometheus::Family<prometheus::Gauge>& mode_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_xdp_attach_mode")
+                .Help("XDP attach mode in use per interface (1 for the active mode)")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        __u32 mode_flags(XdpMode mode) {
+            return mode == XdpMode::Generic ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+        }
+    }
+
+    InterfaceSet::InterfaceSet(int prog_fd, int iface_stats_map_fd, int iface_policy_map_fd)
+        : prog_fd(prog_fd), prog_id(0), map_fd_stats(iface_stats_map_fd), map_fd_policy(iface_policy_map_fd),
+          ncpus(libbpf_num_possible_cpus()) {
+        struct bpf_prog_info info;
+        __u32 info_len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (bpf_prog_get_info_by_fd(prog_fd, &info, &info_len) == 0) {
+            prog_id = info.id;
+        }
+    }
+
+    InterfaceSet::~InterfaceSet() {
+        for (const auto& attachment : attached) {
+            close(attachment.link_fd);
+        }
+    }
+
+    int InterfaceSet::sync(const std::vector<InterfaceConfig>& interfaces, const std::vector<VipPolicy>& policies,
+                           XdpMode mode) {
+        // Resolve names now: an interface that was re-created has a new ifindex
+        std::vector<__u32> ifindexes;
+        for (const auto& iface : interfaces) {
+            __u32 ifindex = if_nametoindex(iface.name.c_str());
+            if (!ifindex) {
+                std::cerr << "Warning: Interface " << iface.name << " not found (" << strerror(errno)
+                          << "), retrying on the next reload." << std::endl;
+            }
+            ifindexes.push_back(ifindex);
+        }
+
+        // Detach first, the attachment maps have IFACES_MAX entries
+        std::vector<Attachment> kept;
+        for (const auto& attachment : attached) {
+            bool found = false;
+            for (size_t i = 0; i < interfaces.size() && !found; i++) {
+                found = interfaces[i].name == attachment.name && ifindexes[i] == attachment.ifindex;
+            }
+            if (found && attachment.requested == mode) {
+                kept.push_back(attachment);
+            } else {
+                detach(attachment);
+            }
+        }
+
+        std::vector<Attachment> next;
+        for (size_t i = 0; i < interfaces.size(); i++) {
+            if (!ifindexes[i]) {
+                continue;
+            }
+            Attachment attachment = {interfaces[i].name, ifindexes[i], 0, -1, mode, nullptr, nullptr};
+            for (const auto& existing : kept) {
+                if (existing.ifindex == ifindexes[i]) {
+                    attachment = existing;
+                }
+            }
+            if (attachment.link_fd < 0 && attach(interfaces[i].name, ifindexes[i], mode, attachment) != 0) {
+                continue;
+            }
+
+            attachment.policy = 0;
+            for (__u32 id = 0; id < policies.size() && !interfaces[i].policy.empty(); id++) {
+                if (policies[id].name == interfaces[i].policy) {
+                    attachment.policy = id + 1;
+                }
+            }
+            if (!interfaces[i].policy.empty() && !attachment.policy) {
+                std::cerr << "Warning: Unknown vip policy '" << interfaces[i].policy << "' for interface "
+                          << interfaces[i].name << ", using the interface-wide lists." << std::endl;
+            }
+            if (attachment.policy) {
+                bpf_map_update_elem(map_fd_policy, &attachment.ifindex, &attachment.policy, BPF_ANY);
+            } else {
+                bpf_map_delete_elem(map_fd_policy, &attachment.ifindex);
+            }
+            next.push_back(attachment);
+        }
+        attached = next;
+        return static_cast<int>(attached.size());
+    }
+
+    int InterfaceSet::attach(const std::string& name, __u32 ifindex, XdpMode requested, Attachment& attachment) {
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return -1;
+        }
+        // Counters start from zero for every new attachment
+        std::vector<IfaceStats> zeros(ncpus);
+        memset(zeros.data(), 0, zeros.size() * sizeof(IfaceStats));
+        if (bpf_map_update_elem(map_fd_stats, &ifindex, zeros.data(), BPF_ANY) != 0) {
+            std::cerr << "Failed to add " << name << " to iface_stats_map: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        // auto: native first, then an explicit (and logged) fallback to generic mode
+        XdpMode mode = requested == XdpMode::Generic ? XdpMode::Generic : XdpMode::Native;
+        struct bpf_link_create_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.sz = sizeof(opts);
+        opts.flags = mode_flags(mode);
+        int link_fd = bpf_link_create(prog_fd, ifindex, BPF_XDP, &opts);
+        if (link_fd < 0 && requested == XdpMode::Auto) {
+            std::cerr << "Warning: Native XDP not available on " << name << " (" << strerror(errno)
+                      << "), falling back to generic mode." << std::endl;
+            mode = XdpMode::Generic;
+            opts.flags = mode_flags(mode);
+            link_fd = bpf_link_create(prog_fd, ifindex, BPF_XDP, &opts);
+        }
+        if (link_fd < 0) {
+            std::cerr << "Failed to attach XDP program to " << name << " (index " << ifindex << ") in "
+                      << xdp_mode_name(mode) << " mode: " << strerror(errno) << std::endl;
+            bpf_map_delete_elem(map_fd_stats, &ifindex);
+            return -1;
+        }
+
+        attachment.link_fd = link_fd;
+        attachment.requested = requested;
+        attachment.mode = query_mode(ifindex);
+        if (!attachment.mode) {
+            attachment.mode = xdp_mode_name(mode); // Query failed, trust the flags we asked for
+        }
+        attachment.mode_gauge = &mode_family().Add({{"interface", name}, {"mode", attachment.mode}});
+        attachment.mode_gauge->Set(1);
+        std::cout << "Attached BPF program to interface " << name << " (index " << ifindex << "), XDP mode: "
+                  << attachment.mode << std::endl;
+        if (strcmp(attachment.mode, "generic") == 0) {
+            std::cerr << "Warning: " << name << " runs XDP in generic (skb) mode, expect much lower packet rates."
+                      << std::endl;
+        }
+        return 0;
+    }
+
+    // Mode the kernel reports for our program on ifindex, nullptr when unknown
+    const char* InterfaceSet::query_mode(__u32 ifindex) {
+        struct bpf_xdp_query_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.sz = sizeof(opts);
+        if (bpf_xdp_query(static_cast<int>(ifindex), 0, &opts) != 0) {
+            return nullptr;
+        }
+        switch (opts.attach_mode) {
+            case XDP_ATTACHED_DRV: return "native";
+            case XDP_ATTACHED_SKB: return "generic";
+            case XDP_ATTACHED_HW: return "offload";
+            case XDP_ATTACHED_MULTI:
+                if (opts.drv_prog_id == prog_id) {
+                    return "native";
+                }
+                return opts.skb_prog_id == prog_id ? "generic" : nullptr;
+            default: return nullptr;
+        }
+    }
+
+    void InterfaceSet::detach(const Attachment& attachment) {
+        IfaceStats total;
+        if (read_stats(attachment.ifindex, total) == 0) {
+            std::cout << "Detaching interface " << attachment.name << " (dropped " << total.dropped << ", passed "
+                      << total.passed << ", redirected " << total.redirected << ")." << std::endl;
+        }
+        close(attachment.link_fd);
+        if (attachment.mode_gauge) {
+            mode_family().Remove(attachment.mode_gauge);
+        }
+        bpf_map_delete_elem(map_fd_stats, &attachment.ifindex);
+        bpf_map_delete_elem(map_fd_policy, &attachment.ifindex);
+    }
+
+    int InterfaceSet::read_stats(__u32 ifindex, IfaceStats& total) const {
+        if (ncpus <= 0) {
+            return -1;
+        }
+        std::vector<IfaceStats> percpu(ncpus);
+        if (bpf_map_lookup_elem(map_fd_stats, &ifindex, percpu.data()) != 0) {
+            return -1;
+        }
+        memset(&total, 0, sizeof(total));
+        for (const auto& cpu : percpu) {
+            total.dropped += cpu.dropped;
+            total.passed += cpu.passed;
+            total.redirected += cpu.redirected;
+        }
+        return 0;
+    }
+
+    void InterfaceSet::print_stats(std::ostream& out) const {
+        if (attached.size() < 2) {
+            return; // Same as the totals
+        }
+        out << "Interfaces:\n";
+        for (const auto& attachment : attached) {
+            IfaceStats total;
+            if (read_stats(attachment.ifindex, total) != 0) {
+                continue;
+            }
+            out << "  " << attachment.name << " (index " << attachment.ifindex << ", " << attachment.mode
+                << "): dropped " << total.dropped << ", passed " << total.passed << ", redirected "
+                << total.redirected << "\n";
+        }
+    }
+} // namespace packet_filter
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef INTERFACES_H
+#define INTERFACES_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "packet_filter.h"
+
+namespace prometheus {
+    class Gauge;
+}
+
+namespace packet_filter {
+    // XDP attachments of xdp_filter (or of the dispatcher running it), kept in sync with the interface= list on every
+    // reload: new interfaces are attached, removed ones detached, the others keep
+    // their link (and their counters in iface_stats_map). Links are created with
+    // explicit mode flags so the mode in use is known and exported.
+    class InterfaceSet {
+    public:
+        InterfaceSet(int prog_fd, int iface_stats_map_fd, int iface_policy_map_fd);
+        ~InterfaceSet(); // Detaches every interface
+
+        // Attach / detach / re-policy; returns the number of attached interfaces.
+        // Interfaces attached with another requested xdp_mode are re-attached.
+        int sync(const std::vector<InterfaceConfig>& interfaces, const std::vector<VipPolicy>& policies,
+                 XdpMode mode);
+
+        // Per-interface dropped / passed / redirected counters
+        void print_stats(std::ostream& out) const;
+
+    private:
+        struct Attachment {
+            std::string name;
+            __u32 ifindex;
+            __u32 policy; // vip policy id, 0 = interface-wide lists
+            int link_fd;  // BPF_XDP link, -1 when not attached
+            XdpMode requested;
+            const char* mode; // Mode reported by the kernel ("native", "generic", "offload")
+            prometheus::Gauge* mode_gauge;
+        };
+
+        int attach(const std::string& name, __u32 ifindex, XdpMode requested, Attachment& attachment);
+        const char* query_mode(__u32 ifindex);
+        void detach(const Attachment& attachment);
+        int read_stats(__u32 ifindex, IfaceStats& total) const;
+
+        int prog_fd;
+        __u32 prog_id;
+        int map_fd_stats;
+        int map_fd_policy;
+        int ncpus;
+        std::vector<Attachment> attached;
+    };
+} // namespace packet_filter
+
+#endif /* INTERFACES_H */
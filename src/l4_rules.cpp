@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "l4_rules.h"
+#include "packet_filter.h"
+
+namespace packet_filter {
+    namespace {
+        // Must match struct l4_rule
+        struct L4RuleValue {
+            __u32 action;
+            __u32 pps;
+            __u64 interval_ns;
+        };
+
+        // Must match struct l4_rule_stats
+        struct L4RuleStats {
+            __u64 packets;
+            __u64 bytes;
+        };
+
+        const __u32 PORT_ENTRIES = 65536;
+        const __u32 PROTO_ENTRIES = 256;
+
+        __u32 prefix_mask(__u32 prefixlen) {
+            return prefixlen == 0 ? 0 : htonl(0xFFFFFFFFU << (32 - prefixlen));
+        }
+
+        bool parse_protocol(const std::string& value, int& protocol) {
+            if (value == "any") {
+                protocol = -1;
+            } else if (value == "tcp") {
+                protocol = IPPROTO_TCP;
+            } else if (value == "udp") {
+                protocol = IPPROTO_UDP;
+            } else if (value == "icmp") {
+                protocol = IPPROTO_ICMP;
+            } else {
+                try {
+                    unsigned long number = std::stoul(value);
+                    if (number > 255) {
+                        return false;
+                    }
+                    protocol = static_cast<int>(number);
+                } catch (const std::exception& e) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // "80,443,1000-2000"
+        bool parse_ports(const std::string& value, std::vector<std::pair<__u16, __u16>>& ports) {
+            std::stringstream ss(value);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                size_t dash = item.find('-');
+                try {
+                    unsigned long low = std::stoul(item.substr(0, dash));
+                    unsigned long high = dash == std::string::npos ? low : std::stoul(item.substr(dash + 1));
+                    if (low == 0 || high > 65535 || low > high) {
+                        return false;
+                    }
+                    ports.emplace_back(static_cast<__u16>(low), static_cast<__u16>(high));
+                } catch (const std::exception& e) {
+                    return false;
+                }
+            }
+            return !ports.empty();
+        }
+
+        bool same_rule(const L4Rule& a, const L4Rule& b) {
+            return a.name == b.name && a.action == b.action && a.protocol == b.protocol && a.src_ip == b.src_ip &&
+                   a.src_prefixlen == b.src_prefixlen && a.ports == b.ports && a.pps == b.pps;
+        }
+    }
+
+    bool parse_l4_rule(const std::string& value, size_t index, L4Rule& rule) {
+        std::stringstream ss(value);
+        std::string token;
+
+        rule = L4Rule();
+        rule.name = "rule" + std::to_string(index);
+        if (!(ss >> token)) {
+            return false;
+        }
+        if (token == "drop") {
+            rule.action = L4_ACTION_DROP;
+        } else if (token == "pass") {
+            rule.action = L4_ACTION_PASS;
+        } else if (token == "rate_limit") {
+            rule.action = L4_ACTION_RATE_LIMIT;
+        } else if (token == "redirect") {
+            rule.action = L4_ACTION_REDIRECT;
+        } else {
+            std::cerr << "Warning: Unknown l4_rule action '" << token << "' (drop, pass, rate_limit or redirect)."
+                      << std::endl;
+            return false;
+        }
+
+        while (ss >> token) {
+            size_t eq = token.find('=');
+            std::string field = token.substr(0, eq);
+            std::string field_value = eq == std::string::npos ? "" : token.substr(eq + 1);
+            bool ok = true;
+            if (field == "proto") {
+                ok = parse_protocol(field_value, rule.protocol);
+            } else if (field == "dport") {
+                ok = parse_ports(field_value, rule.ports);
+            } else if (field == "src") {
+                BpfTrieKey source = {0, 0};
+                ok = parse_cidr(field_value, source);
+                rule.src_ip = source.ip;
+                rule.src_prefixlen = source.prefixlen;
+            } else if (field == "pps") {
+                try {
+                    rule.pps = static_cast<__u32>(std::stoul(field_value));
+                } catch (const std::exception& e) {
+                    ok = false;
+                }
+            } else if (field == "name" && !field_value.empty()) {
+                rule.name = field_value;
+            } else {
+                ok = false;
+            }
+            if (!ok) {
+                std::cerr << "Warning: Invalid l4_rule field '" << token << "'." << std::endl;
+                return false;
+            }
+        }
+
+        if (!rule.ports.empty() && rule.protocol != IPPROTO_TCP && rule.protocol != IPPROTO_UDP) {
+            std::cerr << "Warning: l4_rule " << rule.name << ": dport needs proto=tcp or proto=udp." << std::endl;
+            return false;
+        }
+        if (rule.action == L4_ACTION_RATE_LIMIT && rule.pps == 0) {
+            std::cerr << "Warning: l4_rule " << rule.name << ": rate_limit needs pps greater than 0." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    L4RuleSet::L4RuleSet(const L4RuleMaps& maps)
+        : maps(maps), current_proto_masks(PROTO_ENTRIES, 0), current_port_masks(PORT_ENTRIES, 0) {}
+
+    int L4RuleSet::apply(const std::vector<L4Rule>& requested) {
+        std::vector<L4Rule> rules(requested);
+        if (rules.size() > L4_RULES_MAX) {
+            std::cerr << "Warning: Only the first " << L4_RULES_MAX << " l4_rule lines are used." << std::endl;
+            rules.resize(L4_RULES_MAX);
+        }
+
+        bool changed = rules.size() != current_rules.size();
+        for (size_t i = 0; i < rules.size() && !changed; i++) {
+            changed = !same_rule(rules[i], current_rules[i]);
+        }
+        if (!changed) {
+            return 0;
+        }
+
+        // Actions first: while the bitmaps are rewritten a packet can briefly match a
+        // mix of the old and new rule sets, never an index without an action
+        for (__u32 i = 0; i < L4_RULES_MAX; i++) {
+            L4RuleValue value = {L4_ACTION_PASS, 0, 0};
+            if (i < rules.size()) {
+                value.action = rules[i].action;
+                value.pps = rules[i].pps;
+                value.interval_ns = rules[i].pps > 0 ? 1000000000ULL / rules[i].pps : 0;
+            }
+            if (bpf_map_update_elem(maps.rules_fd, &i, &value, BPF_ANY) != 0) {
+                std::cerr << "Failed to update l4_rules_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+
+        // Protocol bitmaps
+        std::vector<__u64> proto_masks(PROTO_ENTRIES, 0);
+        for (size_t i = 0; i < rules.size(); i++) {
+            for (__u32 proto = 0; proto < PROTO_ENTRIES; proto++) {
+                if (rules[i].protocol < 0 || rules[i].protocol == static_cast<int>(proto)) {
+                    proto_masks[proto] |= 1ULL << i;
+                }
+            }
+        }
+        for (__u32 proto = 0; proto < PROTO_ENTRIES; proto++) {
+            if (proto_masks[proto] != current_proto_masks[proto] &&
+                bpf_map_update_elem(maps.proto_fd, &proto, &proto_masks[proto], BPF_ANY) != 0) {
+                std::cerr << "Failed to update l4_proto_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        current_proto_masks = proto_masks;
+
+        // Destination port bitmaps (entry 0: packets without ports, only any-port rules)
+        std::vector<__u64> port_masks(PORT_ENTRIES, 0);
+        for (size_t i = 0; i < rules.size(); i++) {
+            if (rules[i].ports.empty()) {
+                for (__u32 port = 0; port < PORT_ENTRIES; port++) {
+                    port_masks[port] |= 1ULL << i;
+                }
+                continue;
+            }
+            for (const auto& range : rules[i].ports) {
+                for (__u32 port = range.first; port <= range.second; port++) {
+                    port_masks[port] |= 1ULL << i;
+                }
+            }
+        }
+        if (sync_ports(port_masks) != 0 || sync_sources(rules) != 0) {
+            return -1;
+        }
+
+        // New rule set, new counters
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus > 0) {
+            std::vector<L4RuleStats> zeros(ncpus);
+            memset(zeros.data(), 0, zeros.size() * sizeof(L4RuleStats));
+            __u64 last = 0;
+            for (__u32 i = 0; i < L4_RULES_MAX; i++) {
+                bpf_map_update_elem(maps.stats_fd, &i, zeros.data(), BPF_ANY);
+                bpf_map_update_elem(maps.last_fd, &i, &last, BPF_ANY);
+            }
+        }
+
+        current_rules = rules;
+        std::cout << "L4 rules compiled: " << rules.size() << " rule(s), " << current_sources.size()
+                  << " source prefix(es)" << std::endl;
+        return 0;
+    }
+
+    // Rewrite only the port entries whose bitmap changed
+    int L4RuleSet::sync_ports(const std::vector<__u64>& port_masks) {
+        for (__u32 port = 0; port < PORT_ENTRIES; port++) {
+            if (port_masks[port] == current_port_masks[port]) {
+                continue;
+            }
+            if (bpf_map_update_elem(maps.port_fd, &port, &port_masks[port], BPF_ANY) != 0) {
+                std::cerr << "Failed to update l4_port_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            current_port_masks[port] = port_masks[port];
+        }
+        return 0;
+    }
+
+    // Every rule prefix (plus 0/0) maps to the rules whose source covers it, so the
+    // single longest-prefix match of the kernel returns all applicable rules at once
+    int L4RuleSet::sync_sources(const std::vector<L4Rule>& rules) {
+        std::vector<std::pair<__u32, __u32>> sources = {{0, 0}};
+        for (const auto& rule : rules) {
+            std::pair<__u32, __u32> source(rule.src_prefixlen, rule.src_ip);
+            bool known = false;
+            for (const auto& existing : sources) {
+                known = known || existing == source;
+            }
+            if (!known) {
+                sources.push_back(source);
+            }
+        }
+
+        for (const auto& source : sources) {
+            __u64 mask = 0;
+            for (size_t i = 0; i < rules.size(); i++) {
+                if (rules[i].src_prefixlen <= source.first &&
+                    (source.second & prefix_mask(rules[i].src_prefixlen)) == rules[i].src_ip) {
+                    mask |= 1ULL << i;
+                }
+            }
+            BpfTrieKey key = {source.first, source.second};
+            if (bpf_map_update_elem(maps.src_fd, &key, &mask, BPF_ANY) != 0) {
+                std::cerr << "Failed to update l4_src_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        for (const auto& old_source : current_sources) {
+            bool kept = false;
+            for (const auto& source : sources) {
+                kept = kept || source == old_source;
+            }
+            if (!kept) {
+                BpfTrieKey key = {old_source.first, old_source.second};
+                bpf_map_delete_elem(maps.src_fd, &key);
+            }
+        }
+        current_sources = sources;
+        return 0;
+    }
+
+    void L4RuleSet::print_stats(std::ostream& out) const {
+        int ncpus = libbpf_num_possible_cpus();
+        if (current_rules.empty() || ncpus <= 0) {
+            return;
+        }
+        std::vector<L4RuleStats> percpu(ncpus);
+        out << "L4 rules:\n";
+        for (__u32 i = 0; i < current_rules.size(); i++) {
+            if (bpf_map_lookup_elem(maps.stats_fd, &i, percpu.data()) != 0) {
+                continue;
+            }
+            L4RuleStats total = {0, 0};
+            for (const auto& stats : percpu) {
+                total.packets += stats.packets;
+                total.bytes += stats.bytes;
+            }
+            out << "  " << current_rules[i].name << ": " << total.packets << " packets, " << total.bytes << " bytes\n";
+        }
+    }
+} // namespace packet_filter
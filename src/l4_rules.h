@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef L4_RULES_H
+#define L4_RULES_H
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <linux/types.h>
+
+namespace packet_filter {
+    // Layout of the compiled rule set (must match the BPF definitions)
+    constexpr __u32 L4_RULES_MAX = 64;
+
+    enum L4Action : __u32 {
+        L4_ACTION_PASS = 0,       // Stop rule evaluation, continue with the rest of the filter
+        L4_ACTION_DROP = 1,
+        L4_ACTION_RATE_LIMIT = 2, // Shared packet rate of every packet matching the rule
+        L4_ACTION_REDIRECT = 3,   // Divert to the honeypot interface (dropped over its rate cap)
+    };
+
+    // One "l4_rule=" line, e.g. "drop proto=udp dport=11211" or
+    // "pass proto=tcp dport=80,443 src=10.1.0.0/16 name=web" or "redirect proto=udp dport=53"
+    struct L4Rule {
+        std::string name;
+        __u32 action;
+        int protocol;      // IP protocol number, -1 = any
+        __u32 src_ip;      // Network byte order
+        __u32 src_prefixlen; // 0 = any source
+        std::vector<std::pair<__u16, __u16>> ports; // Inclusive destination port ranges, empty = any
+        __u32 pps;         // L4_ACTION_RATE_LIMIT only
+
+        L4Rule() : action(L4_ACTION_DROP), protocol(-1), src_ip(0), src_prefixlen(0), pps(0) {}
+    };
+
+    // Parse the value of an "l4_rule=" line; `index` names rules without name=
+    bool parse_l4_rule(const std::string& value, size_t index, L4Rule& rule);
+
+    // File descriptors of the rule engine maps
+    struct L4RuleMaps {
+        int proto_fd;  // l4_proto_map
+        int port_fd;   // l4_port_map
+        int src_fd;    // l4_src_map
+        int rules_fd;  // l4_rules_map
+        int last_fd;   // l4_rule_last_map
+        int stats_fd;  // l4_rule_stats_map
+    };
+
+    // Compiles an ordered rule list into the per-protocol, per-port and per-source
+    // bitmaps evaluated by xdp_filter (bit i = rule i, the lowest matching bit wins).
+    class L4RuleSet {
+    public:
+        explicit L4RuleSet(const L4RuleMaps& maps);
+
+        // Replace the rule set; only map entries whose bitmap changed are rewritten
+        int apply(const std::vector<L4Rule>& rules);
+
+        // Per-rule packet / byte counters
+        void print_stats(std::ostream& out) const;
+
+    private:
+        int sync_ports(const std::vector<__u64>& port_masks);
+        int sync_sources(const std::vector<L4Rule>& rules);
+
+        L4RuleMaps maps;
+        std::vector<L4Rule> current_rules;
+        std::vector<__u64> current_proto_masks;  // 256 entries
+        std::vector<__u64> current_port_masks;   // 65536 entries
+        std::vector<std::pair<__u32, __u32>> current_sources; // (prefixlen, ip) keys in l4_src_map
+    };
+} // namespace packet_filter
+
+#endif /* L4_RULES_H */
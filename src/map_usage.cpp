@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "map_usage.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        const __u32 BATCH_SIZE = 1024; // Keys read per batched lookup
+
+        // Failed control-plane inserts by map name; inserts happen in the config
+        // loader and the detector, possibly before the monitor exists
+        std::mutex control_failures_mutex;
+
+        std::unordered_map<std::string, __u64>& control_failures() {
+            static std::unordered_map<std::string, __u64> failures;
+            return failures;
+        }
+
+        __u64 control_failure_count(const char* map_name) {
+            std::lock_guard<std::mutex> lock(control_failures_mutex);
+            auto it = control_failures().find(map_name);
+            return it != control_failures().end() ? it->second : 0;
+        }
+
+        bool is_percpu(__u32 map_type) {
+            return map_type == BPF_MAP_TYPE_PERCPU_HASH || map_type == BPF_MAP_TYPE_LRU_PERCPU_HASH ||
+                   map_type == BPF_MAP_TYPE_PERCPU_ARRAY;
+        }
+
+        prometheus::Family<prometheus::Gauge>& entries_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_map_entries")
+                .Help("Entries currently in a bounded BPF map")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Gauge>& capacity_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_map_capacity")
+                .Help("max_entries of a bounded BPF map")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Gauge>& high_water_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_map_high_water")
+                .Help("Highest entry count of a bounded BPF map since startup")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Counter>& failures_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_map_insert_failures_total")
+                .Help("Inserts refused by a bounded BPF map, by source (kernel or control plane)")
+                .Register(metrics::registry());
+            return family;
+        }
+    }
+
+    void note_map_insert_failure(const char* map_name) {
+        std::lock_guard<std::mutex> lock(control_failures_mutex);
+        control_failures()[map_name]++;
+    }
+
+    MapUsageMonitor::MapUsageMonitor(const std::vector<TrackedMap>& maps, int map_fail_map_fd, int map_usage_map_fd)
+        : map_fd_fail(map_fail_map_fd), map_fd_usage(map_usage_map_fd), ncpus(libbpf_num_possible_cpus()), running(false) {
+        for (const auto& map : maps) {
+            states.emplace_back(map);
+        }
+    }
+
+    MapUsageMonitor::~MapUsageMonitor() {
+        stop();
+    }
+
+    void MapUsageMonitor::set_config(const MapUsageConfig& config) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        current_config = config;
+        std::sort(current_config.warn_percent.begin(), current_config.warn_percent.end());
+    }
+
+    void MapUsageMonitor::start() {
+        if (running) {
+            return;
+        }
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return;
+        }
+        for (auto& state : states) {
+            state.readable = open_map(state) == 0;
+        }
+        running = true;
+        worker = std::thread(&MapUsageMonitor::run, this);
+    }
+
+    void MapUsageMonitor::stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+
+        MapUsageConfig config;
+        {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            config = current_config;
+        }
+        sample(config);
+    }
+
+    void MapUsageMonitor::run() {
+        while (running) {
+            MapUsageConfig config;
+            {
+                std::lock_guard<std::mutex> lock(config_mutex);
+                config = current_config;
+            }
+
+            sample(config);
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms), [this] { return !running; });
+        }
+    }
+
+    int MapUsageMonitor::open_map(MapState& state) {
+        struct bpf_map_info info;
+        __u32 info_len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (bpf_map_get_info_by_fd(state.map.fd, &info, &info_len) != 0) {
+            std::cerr << "Failed to get " << state.map.name << " info: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        state.map_type = info.type;
+        state.key_size = info.key_size;
+        state.capacity = info.max_entries;
+        // Per-CPU values: the kernel rounds each CPU's value up to 8 bytes
+        state.value_stride = is_percpu(info.type) ? ((info.value_size + 7) & ~7U) * static_cast<size_t>(ncpus)
+                                                  : info.value_size;
+        capacity_family().Add({{"map", state.map.name}}).Set(state.capacity);
+        return 0;
+    }
+
+    // Walk the keys of one map: batched lookups for hash maps, get_next_key for LPM tries
+    int MapUsageMonitor::count_entries(MapState& state, __u64& entries) {
+        entries = 0;
+        if (state.map_type == BPF_MAP_TYPE_LPM_TRIE) {
+            keys.resize(2 * static_cast<size_t>(state.key_size));
+            __u8* key = keys.data();
+            __u8* next = key + state.key_size;
+            bool have_key = false;
+            while (bpf_map_get_next_key(state.map.fd, have_key ? key : nullptr, next) == 0) {
+                memcpy(key, next, state.key_size);
+                have_key = true;
+                entries++;
+            }
+            return 0;
+        }
+
+        keys.resize(static_cast<size_t>(BATCH_SIZE) * state.key_size);
+        values.resize(BATCH_SIZE * state.value_stride);
+        __u32 in_batch = 0, out_batch = 0;
+        bool first = true;
+        while (true) {
+            __u32 count = BATCH_SIZE;
+            int ret = bpf_map_lookup_batch(state.map.fd, first ? nullptr : &in_batch, &out_batch, keys.data(),
+                                           values.data(), &count, nullptr);
+            if (ret != 0 && errno != ENOENT) {
+                std::cerr << "Failed to batch read " << state.map.name << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+            entries += count;
+            if (ret != 0) {
+                return 0; // ENOENT: the whole map has been read
+            }
+            in_batch = out_batch;
+            first = false;
+        }
+    }
+
+    __u64 MapUsageMonitor::read_kernel_failures(__u32 counter) {
+        std::vector<__u64> percpu(ncpus);
+        if (bpf_map_lookup_elem(map_fd_fail, &counter, percpu.data()) != 0) {
+            return 0;
+        }
+        __u64 sum = 0;
+        for (__u64 value : percpu) {
+            sum += value;
+        }
+        return sum;
+    }
+
+    void MapUsageMonitor::sample(const MapUsageConfig& config) {
+        for (auto& state : states) {
+            if (!state.readable) {
+                continue;
+            }
+            const char* name = state.map.name;
+
+            __u64 entries;
+            if (count_entries(state, entries) == 0) {
+                state.entries = entries;
+                state.high_water = std::max(state.high_water, entries);
+                entries_family().Add({{"map", name}}).Set(entries);
+                high_water_family().Add({{"map", name}}).Set(state.high_water);
+
+                MapUsage usage = {entries, state.capacity, state.high_water};
+                if (bpf_map_update_elem(map_fd_usage, &state.map.usage_slot, &usage, BPF_ANY) != 0) {
+                    std::cerr << "Failed to update map_usage_map for " << name << ": " << strerror(errno)
+                              << std::endl;
+                }
+
+                // One warning per threshold crossed; a map that drains below a threshold re-arms it
+                double percent = state.capacity ? 100.0 * entries / state.capacity : 0.0;
+                size_t level = 0;
+                while (level < config.warn_percent.size() && percent >= config.warn_percent[level]) {
+                    level++;
+                }
+                if (level > state.warn_level) {
+                    std::cerr << "Warning: " << name << " is " << static_cast<unsigned>(percent)
+                              << "% full (" << entries << "/" << state.capacity << " entries)" << std::endl;
+                } else if (level == 0 && state.warn_level > 0) {
+                    std::cout << name << " back below " << config.warn_percent[0] << "% full (" << entries << "/"
+                              << state.capacity << " entries)" << std::endl;
+                }
+                state.warn_level = level;
+            }
+
+            // Failed inserts: kernel counters are per-CPU sums, both only ever grow
+            __u64 kernel = state.map.kernel_counter >= 0 ? read_kernel_failures(state.map.kernel_counter) : 0;
+            if (kernel > state.kernel_failures) {
+                failures_family().Add({{"map", name}, {"source", "kernel"}}).Increment(kernel - state.kernel_failures);
+                std::cerr << "Warning: " << (kernel - state.kernel_failures) << " inserts into " << name
+                          << " failed in xdp_filter (" << state.entries << "/" << state.capacity << " entries)"
+                          << std::endl;
+                state.kernel_failures = kernel;
+            }
+            __u64 control = control_failure_count(name);
+            if (control > state.control_failures) {
+                failures_family().Add({{"map", name}, {"source", "control"}})
+                    .Increment(control - state.control_failures);
+                std::cerr << "Warning: " << (control - state.control_failures) << " control-plane inserts into "
+                          << name << " failed (" << state.entries << "/" << state.capacity << " entries)"
+                          << std::endl;
+                state.control_failures = control;
+            }
+        }
+    }
+
+    void MapUsageMonitor::print_summary(std::ostream& out) const {
+        bool header = false;
+        for (const auto& state : states) {
+            if (!state.readable) {
+                continue;
+            }
+            if (!header) {
+                out << "Map usage:\n";
+                header = true;
+            }
+            out << "  " << std::left << std::setw(22) << state.map.name << std::right << state.entries << "/"
+                << state.capacity << " entries, peak " << state.high_water;
+            if (state.kernel_failures > 0) {
+                out << ", " << state.kernel_failures << " failed inserts in xdp_filter";
+            }
+            if (state.control_failures > 0) {
+                out << ", " << state.control_failures << " failed control-plane inserts";
+            }
+            out << "\n";
+        }
+    }
+} // namespace packet_filter
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef MAP_USAGE_H
+#define MAP_USAGE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "packet_filter.h"
+
+namespace packet_filter {
+    // Count a control-plane insert into `map_name` that the kernel refused (map full,
+    // out of memory); reported by the MapUsageMonitor tracking that map, if any
+    void note_map_insert_failure(const char* map_name);
+
+    // A bounded map watched by MapUsageMonitor
+    struct TrackedMap {
+        const char* name;
+        int fd;
+        __u32 usage_slot;   // MAP_USAGE_* slot of map_usage_map
+        int kernel_counter; // MAP_FAIL_* slot of map_fail_map, -1 = only the control plane inserts
+
+        TrackedMap(const char* name, int fd, __u32 usage_slot, int kernel_counter = -1)
+            : name(name), fd(fd), usage_slot(usage_slot), kernel_counter(kernel_counter) {}
+    };
+
+    // Background thread that counts the entries of the tracked maps, keeps their
+    // high-water marks, reads the failed inserts (map_fail_map for the kernel, the
+    // note_map_insert_failure() counts for the control plane) and exports all of it,
+    // to Prometheus and to map_usage_map for pf_top. A warning is logged when a map crosses a fill threshold or an insert fails,
+    // so a full map shows up before it silently stops tracking sources.
+    class MapUsageMonitor {
+    public:
+        MapUsageMonitor(const std::vector<TrackedMap>& maps, int map_fail_map_fd, int map_usage_map_fd);
+        ~MapUsageMonitor();
+
+        // Apply a new configuration (safe to call while the thread is running)
+        void set_config(const MapUsageConfig& config);
+
+        void start();
+        // Stop the thread and take a last sample for print_summary()
+        void stop();
+
+        // Occupancy, high-water marks and failed inserts of every tracked map
+        void print_summary(std::ostream& out) const;
+
+    private:
+        struct MapState {
+            TrackedMap map;
+            __u32 map_type;
+            __u32 key_size;
+            size_t value_stride;  // Bytes per value in a batch (all CPUs for per-CPU maps)
+            __u32 capacity;
+            __u64 entries;
+            __u64 high_water;
+            __u64 kernel_failures;
+            __u64 control_failures;
+            size_t warn_level;    // warn_percent thresholds currently exceeded
+            bool readable;
+
+            explicit MapState(const TrackedMap& map)
+                : map(map), map_type(0), key_size(0), value_stride(0), capacity(0), entries(0), high_water(0),
+                  kernel_failures(0), control_failures(0), warn_level(0), readable(false) {}
+        };
+
+        void run();
+        void sample(const MapUsageConfig& config);
+        int open_map(MapState& state);
+        int count_entries(MapState& state, __u64& entries);
+        __u64 read_kernel_failures(__u32 counter);
+
+        int map_fd_fail;
+        int map_fd_usage;
+        int ncpus;
+        std::vector<MapState> states; // Monitor thread only, read by print_summary after stop()
+        std::vector<__u8> keys;
+        std::vector<__u8> values;
+
+        std::mutex config_mutex;
+        MapUsageConfig current_config;
+
+        std::thread worker;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+    };
+} // namespace packet_filter
+
+#endif /* MAP_USAGE_H */
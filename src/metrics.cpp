@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <memory>
+#include <prometheus/exposer.h>
+
+#include "metrics.h"
+
+namespace packet_filter {
+namespace metrics {
+    namespace {
+        std::shared_ptr<prometheus::Registry> shared_registry = std::make_shared<prometheus::Registry>();
+        std::unique_ptr<prometheus::Exposer> exposer; // HTTP endpoint, null when disabled
+    }
+
+    prometheus::Registry& registry() {
+        return *shared_registry;
+    }
+
+    int start(const std::string& bind_address) {
+        if (exposer) {
+            return 0;
+        }
+        try {
+            exposer.reset(new prometheus::Exposer(bind_address));
+            exposer->RegisterCollectable(shared_registry);
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to start metrics endpoint on " << bind_address << ": " << e.what() << std::endl;
+            return -1;
+        }
+        std::cout << "Serving metrics on http://" << bind_address << "/metrics" << std::endl;
+        return 0;
+    }
+
+    void stop() {
+        exposer.reset();
+    }
+} // namespace metrics
+} // namespace packet_filter
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <prometheus/registry.h>
+#include <prometheus/counter.h>
+#include <prometheus/gauge.h>
+
+namespace packet_filter {
+namespace metrics {
+    // Registry shared by every component that exports metrics
+    prometheus::Registry& registry();
+
+    // Start serving the registry on http://<bind_address>/metrics (e.g. "0.0.0.0:9435")
+    int start(const std::string& bind_address);
+
+    // Stop the HTTP endpoint (the registry itself stays valid)
+    void stop();
+} // namespace metrics
+} // namespace packet_filter
+
+#endif /* METRICS_H */
@@ -6,14 +6,23 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <bpf/bpf.h>
+#include <bpf/libbpf.h>
 #include <cerrno>
 #include <ctime>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "packet_filter.h"
+#include "map_usage.h"
+
+#ifndef ENOTSUPP
+#define ENOTSUPP 524 // Kernel-internal errno returned for unsupported BPF commands
+#endif
 
 namespace packet_filter {
     // Static variables to maintain state across function calls
@@ -21,16 +30,629 @@ namespace packet_filter {
         int map_fd_blacklist_subnets; // File descriptor của blacklist map
         int map_fd_update_signal;     // File descriptor của update signal map
         int map_fd_rate_limits;       // File descriptor của rate limits map
+        int map_fd_settings;          // File descriptor của settings map
         std::string* config_file_path_abs_ptr; // Pointer to đường dẫn tuyệt đối tới file config
         std::string* filter_interface_name_ptr; // Pointer to tên interface
         uint32_t* current_ifindex_ptr; // Pointer to ifindex của interface
         SubnetNode** current_blacklist_subnets_ptr; // Pointer to linked list of current subnets
         RateLimitNode** current_rate_limits_ptr;   // Pointer to linked list of current rate limits
+        Options* options_ptr;                      // Pointer to daemon options
+        int map_fd_inspect_subnets = -1;           // File descriptor của inspect subnets map (optional)
+        SubnetNode** current_inspect_subnets_ptr;  // Pointer to linked list of inspected subnets
+        bool offline_mode = false;                 // Replay: the interface does not need to exist
+        int map_fd_inspect_ports = -1;             // File descriptor của inspect ports map (optional)
+        const char* const TCP_SYNCOOKIES_PATH = "/proc/sys/net/ipv4/tcp_syncookies";
+        std::string saved_tcp_syncookies;          // Host value before syn_cookies=1 changed it, empty = untouched
+        std::mutex configured_mutex;               // Guards the two copies below (read by the detector)
+        std::vector<BpfTrieKey> configured_blacklist; // ip_blacklist prefixes of the last config load
+        std::vector<__u32> configured_rate_limits;    // ip_rate_limits sources of the last config load
+        std::vector<__u32> current_inspect_ports;  // Ports currently in inspect_ports_map
+        int map_fd_syncookie_ports = -1;           // File descriptor của SYN cookie ports map (optional)
+        std::vector<__u32> current_syncookie_ports; // Ports currently in syncookie_ports_map
+        int map_fd_conn_limits = -1;               // File descriptor của connection limits map (optional)
+        std::vector<__u32> current_conn_limit_ips; // Keys currently in conn_limits_map
+        L4RuleSet* l4_rule_set = nullptr;          // Compiler of the l4_rule lines (optional)
+        VipPolicyMaps vip_maps = {-1, -1, -1, -1}; // Destination policy maps (optional)
+        int map_fd_cpu_map = -1;                   // File descriptor của cpumap (optional)
+        int map_fd_cpumap_cpus = -1;               // File descriptor của cpumap slot map
+        int cpumap_prog_fd = -1;                   // xdp_filter_cpumap, run by every cpu_map entry
+        std::vector<__u32> current_cpumap_cpus;    // CPUs currently in cpu_map
+        int map_fd_honeypot = -1;                  // File descriptor của honeypot devmap (optional)
+        int map_fd_honeypot_config = -1;           // File descriptor của honeypot rate cap map
+        __u32 current_honeypot_ifindex = 0;        // Interface in honeypot_map, 0 = none
+        __u32 current_cpumap_qsize = 0;
+        std::vector<BpfTrieKey> current_vip_destinations; // Keys currently in vip_dst_map
+        std::vector<PolicyTrieKey> current_vip_blacklist; // Keys currently in vip_blacklist_map
+        std::vector<PolicyTrieKey> current_vip_allowlist; // Keys currently in vip_allowlist_map
+        std::vector<PolicyIpKey> current_vip_rate_limits; // Keys currently in vip_rate_limits_map
+
+        // Honeypot rate cap (must match struct honeypot_config)
+        struct HoneypotRateCap {
+            __u64 interval_ns;
+            __u64 burst_ns;
+        };
+
+        // Parse "IP:syn_per_sec:max_conns,..." ("*" as IP sets the default for every source)
+        int parse_conn_limits(const std::string& list, std::vector<ConnLimitEntry>& entries) {
+            std::stringstream ss(list);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                item.erase(0, item.find_first_not_of(" \t"));
+                item.erase(item.find_last_not_of(" \t") + 1);
+                if (item.empty()) {
+                    continue;
+                }
+                size_t first = item.find(':');
+                size_t second = first == std::string::npos ? first : item.find(':', first + 1);
+                if (second == std::string::npos) {
+                    std::cerr << "Warning: Invalid ip_conn_limits entry '" << item
+                              << "', expected IP:syn_per_sec:max_conns." << std::endl;
+                    continue;
+                }
+                std::string ip_str = item.substr(0, first);
+                ConnLimitEntry entry;
+                struct in_addr addr;
+                if (ip_str == "*") {
+                    entry.ip = 0;
+                } else if (inet_pton(AF_INET, ip_str.c_str(), &addr) == 1 && addr.s_addr != 0) {
+                    entry.ip = addr.s_addr;
+                } else {
+                    std::cerr << "Warning: Invalid IP address '" << ip_str << "' in ip_conn_limits." << std::endl;
+                    continue;
+                }
+                try {
+                    entry.limit.syn_per_sec = static_cast<__u32>(std::stoul(item.substr(first + 1, second - first - 1)));
+                    entry.limit.max_conns = static_cast<__u32>(std::stoul(item.substr(second + 1)));
+                } catch (const std::exception& e) {
+                    std::cerr << "Warning: Invalid limits in ip_conn_limits entry '" << item << "'." << std::endl;
+                    continue;
+                }
+                entries.push_back(entry);
+            }
+            return static_cast<int>(entries.size());
+        }
+
+        // Parse a comma separated list of IPs/subnets into a new linked list
+        __u64 monotonic_ns() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts); // Same clock as bpf_ktime_get_ns()
+            return static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        int parse_subnet_list(const std::string& list, SubnetNode** head) {
+            int ip_count = 0;
+            SubnetNode* new_subnets_list = nullptr;
+            SubnetNode* new_subnets_tail = nullptr;
+
+            std::stringstream ss(list);
+            std::string subnet;
+        
+            while (std::getline(ss, subnet, ',')) {
+                // Trim whitespace
+                subnet.erase(0, subnet.find_first_not_of(" \t"));
+                subnet.erase(subnet.find_last_not_of(" \t") + 1);
+            
+                if (!subnet.empty()) {
+                    struct in_addr addr;
+                    std::string ip_only;
+                    int prefixlen;
+                
+                    size_t slash_pos = subnet.find('/');
+                    if (slash_pos != std::string::npos) {
+                        ip_only = subnet.substr(0, slash_pos);
+                        prefixlen = std::stoi(subnet.substr(slash_pos + 1));
+                    } else {
+                        ip_only = subnet;
+                        prefixlen = 32;
+                    }
+
+                    if (inet_pton(AF_INET, ip_only.c_str(), &addr) == 1) {
+                        if (prefixlen >= 0 && prefixlen <= 32) {
+                            auto new_node = new SubnetNode();
+                            if (!new_node) {
+                                std::cerr << "Failed to allocate subnet_node" << std::endl;
+                                free_subnet_list(new_subnets_list);
+                                *head = nullptr;
+                                return -1;
+                            }
+                            new_node->key.ip = addr.s_addr;
+                            new_node->key.prefixlen = static_cast<__u32>(prefixlen);
+                            new_node->next = nullptr;
+                        
+                            if (new_subnets_list == nullptr) {
+                                new_subnets_list = new_node;
+                                new_subnets_tail = new_node;
+                            } else {
+                                new_subnets_tail->next = new_node;
+                                new_subnets_tail = new_node;
+                            }
+                            ip_count++;
+                        } else {
+                            std::cerr << "Warning: Invalid prefix length for '" << subnet << "' in config file." << std::endl;
+                        }
+                    } else {
+                        std::cerr << "Warning: Invalid IP address '" << ip_only << "' in config file." << std::endl;
+                    }
+                }
+            }
+
+            *head = new_subnets_list;
+            return ip_count;
+        }
+
+        // Parse "eth0,eth1:POLICY,..." and append the interfaces not listed yet
+        void parse_interface_list(const std::string& list, std::vector<InterfaceConfig>& interfaces) {
+            std::stringstream ss(list);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                item.erase(0, item.find_first_not_of(" \t"));
+                item.erase(item.find_last_not_of(" \t") + 1);
+                if (item.empty()) {
+                    continue;
+                }
+                InterfaceConfig iface;
+                size_t colon = item.find(':');
+                iface.name = item.substr(0, colon);
+                if (colon != std::string::npos) {
+                    iface.policy = item.substr(colon + 1);
+                }
+                bool known = false;
+                for (const auto& existing : interfaces) {
+                    known = known || existing.name == iface.name;
+                }
+                if (known) {
+                    std::cerr << "Warning: Interface " << iface.name << " is listed twice, keeping the first entry."
+                              << std::endl;
+                    continue;
+                }
+                interfaces.push_back(iface);
+            }
+        }
+
+        // Parse a comma separated list of IPs/subnets into LPM keys
+        bool parse_cidr_list(const std::string& list, std::vector<BpfTrieKey>& keys) {
+            std::stringstream ss(list);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                BpfTrieKey key;
+                if (!parse_cidr(item, key)) {
+                    std::cerr << "Warning: Invalid IP/subnet '" << item << "' in vip line." << std::endl;
+                    return false;
+                }
+                keys.push_back(key);
+            }
+            return true;
+        }
+
+        // Parse "NAME dst=CIDR,... [blacklist=CIDR,...] [allowlist=CIDR,...] [rate_limits=IP:PPS,...]"
+        bool parse_vip_policy(const std::string& value, VipPolicy& policy) {
+            std::stringstream ss(value);
+            std::string token;
+            if (!(ss >> policy.name) || policy.name.find('=') != std::string::npos) {
+                std::cerr << "Warning: vip line must start with the policy name." << std::endl;
+                return false;
+            }
+            while (ss >> token) {
+                size_t eq = token.find('=');
+                std::string field = token.substr(0, eq);
+                std::string list = eq == std::string::npos ? "" : token.substr(eq + 1);
+                bool ok = true;
+                if (field == "dst") {
+                    ok = parse_cidr_list(list, policy.destinations);
+                } else if (field == "blacklist") {
+                    ok = parse_cidr_list(list, policy.blacklist);
+                } else if (field == "allowlist") {
+                    ok = parse_cidr_list(list, policy.allowlist);
+                } else if (field == "rate_limits") {
+                    std::stringstream items(list);
+                    std::string item;
+                    while (ok && std::getline(items, item, ',')) {
+                        size_t colon = item.find(':');
+                        struct in_addr addr;
+                        ok = colon != std::string::npos &&
+                             inet_pton(AF_INET, item.substr(0, colon).c_str(), &addr) == 1;
+                        if (ok) {
+                            try {
+                                __u32 pps = static_cast<__u32>(std::stoul(item.substr(colon + 1)));
+                                ok = pps > 0;
+                                if (ok) {
+                                    policy.rate_limits.emplace_back(addr.s_addr, pps);
+                                }
+                            } catch (const std::exception& e) {
+                                ok = false;
+                            }
+                        }
+                    }
+                } else {
+                    ok = false;
+                }
+                if (!ok) {
+                    std::cerr << "Warning: Invalid field '" << token << "' in vip " << policy.name << "." << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Make a map hold exactly `keys` with `values`. Stale keys are deleted; with
+        // BPF_NOEXIST entries that already exist keep their value (e.g. hit counters).
+        template <typename Key, typename Value>
+        void sync_keyed_map(int map_fd, const char* map_name, std::vector<Key>& current,
+                            const std::vector<Key>& keys, const std::vector<Value>& values, __u64 update_flags) {
+            auto contains = [](const std::vector<Key>& list, const Key& key) {
+                for (const auto& k : list) {
+                    if (memcmp(&k, &key, sizeof(Key)) == 0) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            for (const auto& key : current) {
+                if (!contains(keys, key) && bpf_map_delete_elem(map_fd, &key) != 0 && errno != ENOENT) {
+                    std::cerr << "Failed to delete from " << map_name << ": " << strerror(errno) << std::endl;
+                }
+            }
+            current.clear();
+            for (size_t i = 0; i < keys.size(); i++) {
+                if (bpf_map_update_elem(map_fd, &keys[i], &values[i], update_flags) != 0 && errno != EEXIST) {
+                    std::cerr << "Failed to update " << map_name << ": " << strerror(errno) << std::endl;
+                    note_map_insert_failure(map_name);
+                    continue;
+                }
+                current.push_back(keys[i]);
+            }
+        }
+
+        // Add the cpumap_cpus entries to cpu_map (remote program + queue size) and point the
+        // flow hash slots at them; returns the CPUs in use, in slot order
+        std::vector<__u32> add_cpumap_cpus(const CpumapConfig& config) {
+            std::vector<__u32> cpus;
+            int ncpus = libbpf_num_possible_cpus();
+            for (__u32 cpu : config.cpus) {
+                if (ncpus <= 0 || cpu >= static_cast<__u32>(ncpus) || cpus.size() >= CPUMAP_MAX) {
+                    std::cerr << "Warning: cpumap_cpus: CPU " << cpu << " not usable, skipped." << std::endl;
+                    continue;
+                }
+                if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+                    continue;
+                }
+                // Rewriting an entry restarts its kthread: only new CPUs or a new queue size
+                bool known = config.qsize == current_cpumap_qsize &&
+                             std::find(current_cpumap_cpus.begin(), current_cpumap_cpus.end(), cpu) !=
+                                 current_cpumap_cpus.end();
+                if (!known) {
+                    struct bpf_cpumap_val value;
+                    memset(&value, 0, sizeof(value));
+                    value.qsize = config.qsize;
+                    value.bpf_prog.fd = cpumap_prog_fd;
+                    if (bpf_map_update_elem(map_fd_cpu_map, &cpu, &value, BPF_ANY) != 0) {
+                        std::cerr << "Failed to add CPU " << cpu << " to cpu_map: " << strerror(errno) << std::endl;
+                        continue;
+                    }
+                }
+                cpus.push_back(cpu);
+            }
+            for (__u32 slot = 0; slot < cpus.size(); slot++) {
+                bpf_map_update_elem(map_fd_cpumap_cpus, &slot, &cpus[slot], BPF_ANY);
+            }
+            return cpus;
+        }
+
+        // honeypot_map entry first, rate cap last (and the other way round on removal):
+        // a diverted packet only sees a non-zero interval once the interface is in place
+        void sync_honeypot(const HoneypotConfig& config) {
+            __u32 key = 0;
+            __u32 ifindex = config.interface.empty() ? 0 : if_nametoindex(config.interface.c_str());
+            if (!config.interface.empty() && !ifindex) {
+                std::cerr << "Warning: Honeypot interface " << config.interface << " not found ("
+                          << strerror(errno) << "), redirect actions drop instead." << std::endl;
+            }
+            if (ifindex && config.pps == 0) {
+                std::cerr << "Warning: honeypot_pps is 0, redirect actions drop instead." << std::endl;
+                ifindex = 0;
+            }
+
+            HoneypotRateCap cap = {0, 0};
+            if (ifindex) {
+                if (bpf_map_update_elem(map_fd_honeypot, &key, &ifindex, BPF_ANY) != 0) {
+                    std::cerr << "Failed to set honeypot interface " << config.interface << ": " << strerror(errno)
+                              << std::endl;
+                    ifindex = 0;
+                } else {
+                    cap.interval_ns = 1000000000ULL / config.pps;
+                    cap.burst_ns = cap.interval_ns * (config.burst > 0 ? config.burst : 1);
+                }
+            }
+            if (bpf_map_update_elem(map_fd_honeypot_config, &key, &cap, BPF_ANY) != 0) {
+                std::cerr << "Failed to update honeypot_config_map: " << strerror(errno) << std::endl;
+            }
+            if (!ifindex && current_honeypot_ifindex) {
+                bpf_map_delete_elem(map_fd_honeypot, &key);
+            }
+            if (ifindex != current_honeypot_ifindex && ifindex) {
+                std::cout << "Honeypot interface set to " << config.interface << " (index " << ifindex << "), "
+                          << config.pps << " packets/s" << std::endl;
+            }
+            current_honeypot_ifindex = ifindex;
+        }
+
+        // Remove the cpu_map entries the new settings no longer use (after the settings are written)
+        void remove_stale_cpumap_cpus(const std::vector<__u32>& cpus, __u32 qsize) {
+            for (__u32 cpu : current_cpumap_cpus) {
+                if (std::find(cpus.begin(), cpus.end(), cpu) == cpus.end()) {
+                    bpf_map_delete_elem(map_fd_cpu_map, &cpu);
+                }
+            }
+            if (cpus != current_cpumap_cpus || qsize != current_cpumap_qsize) {
+                std::cout << "cpumap CPUs configured: " << cpus.size() << " (queue size " << qsize << ")" << std::endl;
+            }
+            current_cpumap_cpus = cpus;
+            current_cpumap_qsize = qsize;
+        }
+
+        // Write every policy into the vip_* maps, policy id = position + 1
+        void sync_vip_policies(const std::vector<VipPolicy>& policies) {
+            std::vector<BpfTrieKey> destinations;
+            std::vector<__u32> destination_ids;
+            std::vector<PolicyTrieKey> blacklist, allowlist;
+            std::vector<PolicyIpKey> rate_limit_keys;
+            std::vector<BpfRateLimit> rate_limits;
+
+            for (__u32 i = 0; i < policies.size(); i++) {
+                __u32 id = i + 1;
+                const VipPolicy& policy = policies[i];
+                for (const auto& dst : policy.destinations) {
+                    destinations.push_back(dst);
+                    destination_ids.push_back(id);
+                }
+                for (const auto& src : policy.blacklist) {
+                    blacklist.push_back({32 + src.prefixlen, id, src.ip});
+                }
+                for (const auto& src : policy.allowlist) {
+                    allowlist.push_back({32 + src.prefixlen, id, src.ip});
+                }
+                for (const auto& limit : policy.rate_limits) {
+                    rate_limit_keys.push_back({id, limit.ip});
+                    rate_limits.push_back({limit.pps, limit.interval_ns});
+                }
+            }
+
+            // Policy lists first, destinations last: a VIP only switches once its lists are in place
+            sync_keyed_map(vip_maps.blacklist_fd, "vip_blacklist_map", current_vip_blacklist, blacklist,
+                           std::vector<__u64>(blacklist.size(), 0), BPF_NOEXIST);
+            sync_keyed_map(vip_maps.allowlist_fd, "vip_allowlist_map", current_vip_allowlist, allowlist,
+                           std::vector<__u8>(allowlist.size(), 1), BPF_ANY);
+            sync_keyed_map(vip_maps.rate_limits_fd, "vip_rate_limits_map", current_vip_rate_limits,
+                           rate_limit_keys, rate_limits, BPF_ANY);
+            sync_keyed_map(vip_maps.dst_fd, "vip_dst_map", current_vip_destinations, destinations,
+                           destination_ids, BPF_ANY);
+            std::cout << "VIP policies configured: " << policies.size() << " (" << destinations.size()
+                      << " destinations)" << std::endl;
+        }
+
+        // Parse "name=<0|1>" and set or clear `flag` in flags
+        bool parse_flag_option(const std::string& line, const char* name, __u32 flag, __u32& flags) {
+            size_t name_len = strlen(name);
+            if (line.compare(0, name_len, name) != 0 || line.size() <= name_len || line[name_len] != '=') {
+                return false;
+            }
+            std::string value = line.substr(name_len + 1);
+            if (value == "1") {
+                flags |= flag;
+            } else if (value == "0") {
+                flags &= ~flag;
+            } else {
+                std::cerr << "Warning: '" << name << "' expects 0 or 1 in config file." << std::endl;
+            }
+            return true;
+        }
+
+        // Parse "name=<unsigned>" into value
+        bool parse_uint_option(const std::string& line, const char* name, __u32& value) {
+            size_t name_len = strlen(name);
+            if (line.compare(0, name_len, name) != 0 || line.size() <= name_len || line[name_len] != '=') {
+                return false;
+            }
+            try {
+                value = static_cast<__u32>(std::stoul(line.substr(name_len + 1)));
+            } catch (const std::exception& e) {
+                std::cerr << "Warning: Invalid value for '" << name << "' in config file: " << e.what() << std::endl;
+            }
+            return true;
+        }
+
+        // Parse one "bpf_stats" / "latency_sample" / "runtime_stats_*" line
+        bool parse_runtime_stats_option(const std::string& line, RuntimeStatsConfig& cfg) {
+            if (parse_uint_option(line, "latency_sample", cfg.latency_sample) ||
+                parse_uint_option(line, "runtime_stats_interval_ms", cfg.interval_ms)) {
+                return true;
+            }
+            __u32 flag = cfg.bpf_stats ? 1 : 0;
+            if (parse_flag_option(line, "bpf_stats", 1, flag)) {
+                cfg.bpf_stats = flag != 0;
+                return true;
+            }
+            return false;
+        }
+
+        // Parse one "autoban_*" line into the auto-ban configuration
+        bool parse_autoban_option(const std::string& line, AutoBanConfig& cfg) {
+            size_t eq_pos = line.find('=');
+            std::string name = line.substr(0, eq_pos);
+            std::string value = line.substr(eq_pos + 1);
+            try {
+                if (name == "autoban_enabled") {
+                    cfg.enabled = std::stoul(value) != 0;
+                } else if (name == "autoban_interval_ms") {
+                    cfg.interval_ms = static_cast<__u32>(std::stoul(value));
+                } else if (name == "autoban_alpha") {
+                    cfg.alpha = std::stod(value);
+                } else if (name == "autoban_ban_pps") {
+                    cfg.ban_pps = std::stod(value);
+                } else if (name == "autoban_rate_limit_pps") {
+                    cfg.rate_limit_pps = std::stod(value);
+                } else if (name == "autoban_rate_limit_value") {
+                    cfg.rate_limit_value = static_cast<__u32>(std::stoul(value));
+                } else if (name == "autoban_subnet_ban_pps") {
+                    cfg.subnet_ban_pps = std::stod(value);
+                } else if (name == "autoban_ban_seconds") {
+                    cfg.ban_seconds = static_cast<__u32>(std::stoul(value));
+                } else {
+                    std::cerr << "Warning: Unknown option '" << name << "' in config file." << std::endl;
+                    return false;
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Warning: Invalid value for '" << name << "' in config file: " << e.what() << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        bool same_key(const BpfTrieKey& a, const BpfTrieKey& b) {
+            return a.ip == b.ip && a.prefixlen == b.prefixlen;
+        }
+
+        // Make an LPM map hold exactly new_list, then replace *current with it
+        void sync_subnet_map(int map_fd, const char* map_name, SubnetNode** current, SubnetNode* new_list) {
+            __u64 value = 0; // Hit counter of the rule
+            for (SubnetNode* cur = *current; cur != nullptr; cur = cur->next) {
+                bool found = false;
+                for (SubnetNode* n = new_list; n != nullptr && !found; n = n->next) {
+                    found = same_key(cur->key, n->key);
+                }
+                if (!found && bpf_map_delete_elem(map_fd, &cur->key) != 0 && errno != ENOENT) {
+                    std::cerr << "Failed to delete from " << map_name << ": " << strerror(errno) << std::endl;
+                }
+            }
+            for (SubnetNode* n = new_list; n != nullptr; n = n->next) {
+                bool found = false;
+                for (SubnetNode* cur = *current; cur != nullptr && !found; cur = cur->next) {
+                    found = same_key(cur->key, n->key);
+                }
+                if (!found && bpf_map_update_elem(map_fd, &n->key, &value, BPF_ANY) != 0) {
+                    std::cerr << "Failed to update " << map_name << ": " << strerror(errno) << std::endl;
+                    note_map_insert_failure(map_name);
+                }
+            }
+            free_subnet_list(*current);
+            *current = new_list;
+        }
+
+        // Make a port map (__u16 host byte order -> __u8) hold exactly `ports`
+        void sync_port_map(int map_fd, const char* map_name, std::vector<__u32>& current,
+                           const std::vector<__u32>& ports) {
+            for (__u32 port : current) {
+                if (std::find(ports.begin(), ports.end(), port) == ports.end()) {
+                    __u16 key = static_cast<__u16>(port);
+                    bpf_map_delete_elem(map_fd, &key);
+                }
+            }
+            current.clear();
+            for (__u32 port : ports) {
+                if (port == 0 || port > 65535) {
+                    std::cerr << "Warning: Invalid port " << port << " for " << map_name << ", skipping." << std::endl;
+                    continue;
+                }
+                __u16 key = static_cast<__u16>(port);
+                __u8 value = 1;
+                if (bpf_map_update_elem(map_fd, &key, &value, BPF_ANY) != 0) {
+                    std::cerr << "Failed to add port " << port << " to " << map_name << ": " << strerror(errno) << std::endl;
+                    continue;
+                }
+                current.push_back(port);
+            }
+        }
+
+        // Cookie ACKs passed by XDP are only accepted by the stack when it validates
+        // cookies unconditionally (its listen queue never overflows behind XDP).
+        // The previous value is kept for restore_tcp_syncookies().
+        void ensure_tcp_syncookies() {
+            std::ifstream in(TCP_SYNCOOKIES_PATH);
+            std::string value;
+            if (in >> value && value == "2") {
+                return;
+            }
+            std::ofstream out(TCP_SYNCOOKIES_PATH);
+            if (!(out << "2\n") || !out.flush()) {
+                std::cerr << "Warning: Failed to set net.ipv4.tcp_syncookies=2, SYN cookie handshakes will be reset "
+                          << "by the host stack" << std::endl;
+                return;
+            }
+            if (saved_tcp_syncookies.empty()) {
+                saved_tcp_syncookies = value;
+            }
+            std::cout << "Set net.ipv4.tcp_syncookies=2 (was " << (value.empty() ? "?" : value)
+                      << ", restored when syn_cookies is turned off or on exit)" << std::endl;
+        }
+
+        // Parse "a,b,c" into a list of unsigned values
+        bool parse_uint_list_option(const std::string& line, const char* name, std::vector<__u32>& values) {
+            size_t name_len = strlen(name);
+            if (line.compare(0, name_len, name) != 0 || line.size() <= name_len || line[name_len] != '=') {
+                return false;
+            }
+            std::stringstream ss(line.substr(name_len + 1));
+            std::string item;
+            values.clear();
+            while (std::getline(ss, item, ',')) {
+                try {
+                    values.push_back(static_cast<__u32>(std::stoul(item)));
+                } catch (const std::exception& e) {
+                    std::cerr << "Warning: Invalid value '" << item << "' for '" << name << "' in config file." << std::endl;
+                }
+            }
+            return true;
+        }
+
+        // Parse one "xsk_*" line into the deep-inspection configuration
+        bool parse_inspection_option(const std::string& line, DeepInspectionConfig& cfg) {
+            __u32 flag = 0;
+            if (parse_uint_list_option(line, "xsk_queues", cfg.queues) ||
+                parse_uint_option(line, "xsk_frames", cfg.frame_count) ||
+                parse_uint_option(line, "xsk_ring_size", cfg.ring_size) ||
+                parse_uint_option(line, "xsk_batch", cfg.batch_size)) {
+                return true;
+            }
+            if (parse_flag_option(line, "xsk_zerocopy", 1, flag)) {
+                cfg.zerocopy = flag != 0;
+                return true;
+            }
+            if (parse_flag_option(line, "xsk_busy_poll", 1, flag)) {
+                cfg.busy_poll = flag != 0;
+                return true;
+            }
+            if (line.find("xsk_reinject=") == 0) {
+                cfg.reinject = line.substr(strlen("xsk_reinject="));
+                return true;
+            }
+            if (line.find("xsk_tap=") == 0) {
+                cfg.tap_name = line.substr(strlen("xsk_tap="));
+                return true;
+            }
+            if (parse_uint_list_option(line, "inspect_ports", cfg.ports)) {
+                return true;
+            }
+            if (parse_flag_option(line, "payload_ban", 1, flag)) {
+                cfg.ban_on_match = flag != 0;
+                return true;
+            }
+            if (line.find("payload_signature=") == 0) {
+                PayloadSignature signature;
+                if (parse_signature(line.substr(strlen("payload_signature=")), signature)) {
+                    cfg.signatures.push_back(signature);
+                } else {
+                    std::cerr << "Warning: Invalid payload_signature '" << line << "', expected name:pattern." << std::endl;
+                }
+                return true;
+            }
+            return false;
+        }
     }
 
     void init(int blacklist_map_fd, int signal_map_fd, int rate_limits_map_fd,
             const std::string& config_file_path, std::string& interface_name,
-            uint32_t& ifindex, SubnetNode** subnets, RateLimitNode** rate_limits) {
+            uint32_t& ifindex, SubnetNode** subnets, RateLimitNode** rate_limits,
+            int settings_map_fd, Options* options) {
         map_fd_blacklist_subnets = blacklist_map_fd;
         map_fd_update_signal = signal_map_fd;
         map_fd_rate_limits = rate_limits_map_fd;
@@ -39,6 +661,53 @@ namespace packet_filter {
         current_ifindex_ptr = &ifindex;
         current_blacklist_subnets_ptr = subnets;
         current_rate_limits_ptr = rate_limits;
+        map_fd_settings = settings_map_fd;
+        options_ptr = options;
+    }
+
+    void set_offline(bool offline) {
+        offline_mode = offline;
+    }
+
+    void set_inspect_map(int inspect_map_fd, int inspect_ports_map_fd, SubnetNode** subnets) {
+        map_fd_inspect_subnets = inspect_map_fd;
+        map_fd_inspect_ports = inspect_ports_map_fd;
+        current_inspect_subnets_ptr = subnets;
+    }
+
+    void set_syncookie_map(int syncookie_ports_map_fd) {
+        map_fd_syncookie_ports = syncookie_ports_map_fd;
+    }
+
+    void set_conn_limits_map(int conn_limits_map_fd) {
+        map_fd_conn_limits = conn_limits_map_fd;
+    }
+
+    void set_vip_policy_maps(const VipPolicyMaps& maps) {
+        vip_maps = maps;
+    }
+
+    void set_cpumap_maps(int cpu_map_fd, int cpumap_cpus_map_fd, int prog_fd) {
+        map_fd_cpu_map = cpu_map_fd;
+        map_fd_cpumap_cpus = cpumap_cpus_map_fd;
+        cpumap_prog_fd = prog_fd;
+    }
+
+    void set_honeypot_maps(int honeypot_map_fd, int honeypot_config_map_fd) {
+        map_fd_honeypot = honeypot_map_fd;
+        map_fd_honeypot_config = honeypot_config_map_fd;
+    }
+
+    void set_l4_rules(L4RuleSet* rule_set) {
+        l4_rule_set = rule_set;
+    }
+
+    const char* xdp_mode_name(XdpMode mode) {
+        switch (mode) {
+            case XdpMode::Native: return "native";
+            case XdpMode::Generic: return "generic";
+            default: return "auto";
+        }
     }
 
     void free_subnet_list(SubnetNode *head) {
@@ -96,10 +765,11 @@ namespace packet_filter {
             .prefixlen = static_cast<__u32>(prefixlen),
             .ip = addr.s_addr // IP mạng (network byte order)
         };
-        __u8 value = 1; // Giá trị placeholder
+        __u64 value = 0; // Bộ đếm số gói tin khớp rule
 
         if (bpf_map_update_elem(map_fd, &key, &value, BPF_ANY) != 0) {
             std::cerr << "Failed to update blacklist subnet map: " << strerror(errno) << std::endl;
+            note_map_insert_failure("blacklist_subnets_map");
             return -1;
         }
         return 0;
@@ -113,10 +783,7 @@ namespace packet_filter {
         inet_ntop(AF_INET, &addr, ip_str, sizeof(ip_str));
         
         // Create BPF rate limit structure
-        struct {
-            __u32 packets_per_second;
-            __u64 packet_interval_ns;
-        } bpf_rate_limit = {
+        BpfRateLimit bpf_rate_limit = {
             .packets_per_second = limit.pps,
             .packet_interval_ns = limit.interval_ns
         };
@@ -124,6 +791,7 @@ namespace packet_filter {
         if (bpf_map_update_elem(map_fd, &limit.ip, &bpf_rate_limit, BPF_ANY) != 0) {
             std::cerr << "Failed to update rate limits map for IP " << ip_str 
                       << " (" << limit.pps << " pps): " << strerror(errno) << std::endl;
+            note_map_insert_failure("ip_rate_limits_map");
             return -1;
         }
         
@@ -132,6 +800,27 @@ namespace packet_filter {
         return 0;
     }
 
+    bool parse_cidr(const std::string& value, BpfTrieKey& key) {
+        size_t slash = value.find('/');
+        struct in_addr addr;
+        if (inet_pton(AF_INET, value.substr(0, slash).c_str(), &addr) != 1) {
+            return false;
+        }
+        key.prefixlen = 32;
+        if (slash != std::string::npos) {
+            try {
+                key.prefixlen = static_cast<__u32>(std::stoul(value.substr(slash + 1)));
+            } catch (const std::exception& e) {
+                return false;
+            }
+            if (key.prefixlen > 32) {
+                return false;
+            }
+        }
+        key.ip = key.prefixlen == 0 ? 0 : addr.s_addr & htonl(0xFFFFFFFFU << (32 - key.prefixlen));
+        return true;
+    }
+
     // Hàm xóa một subnet khỏi blacklist map
     int remove_from_blacklist(int map_fd, BpfTrieKey *key) {
         if (bpf_map_delete_elem(map_fd, key) != 0) {
@@ -148,6 +837,38 @@ namespace packet_filter {
         return 0;
     }
 
+    // Function to put back the net.ipv4.tcp_syncookies value saved by ensure_tcp_syncookies
+    void restore_tcp_syncookies() {
+        if (saved_tcp_syncookies.empty()) {
+            return;
+        }
+        std::ofstream out(TCP_SYNCOOKIES_PATH);
+        if (!(out << saved_tcp_syncookies << "\n") || !out.flush()) {
+            std::cerr << "Warning: Failed to restore net.ipv4.tcp_syncookies=" << saved_tcp_syncookies << std::endl;
+        } else {
+            std::cout << "Restored net.ipv4.tcp_syncookies=" << saved_tcp_syncookies << std::endl;
+        }
+        saved_tcp_syncookies.clear();
+    }
+
+    // Function to check whether a prefix is in the blacklist of the loaded config
+    bool blacklist_configured(const BpfTrieKey& key) {
+        std::lock_guard<std::mutex> lock(configured_mutex);
+        for (const auto& configured : configured_blacklist) {
+            if (configured.ip == key.ip && configured.prefixlen == key.prefixlen) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Function to check whether an IP has a rate limit in the loaded config
+    bool rate_limit_configured(__u32 ip) {
+        std::lock_guard<std::mutex> lock(configured_mutex);
+        return std::find(configured_rate_limits.begin(), configured_rate_limits.end(), ip) !=
+               configured_rate_limits.end();
+    }
+
     // Function to remove a rate limit from the rate limit map
     int remove_from_rate_limits(int map_fd, __u32 ip) {
         if (bpf_map_delete_elem(map_fd, &ip) != 0) {
@@ -164,6 +885,207 @@ namespace packet_filter {
         return 0;
     }
 
+    // Function to read every ip_stats_map entry (batched, per-CPU values summed)
+    int read_ip_stats(int map_fd, std::vector<IpStatsEntry>& entries) {
+        const __u32 batch_size = 256;
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return -1;
+        }
+
+        std::vector<__u32> keys(batch_size);
+        std::vector<PacketStats> values(batch_size * ncpus);
+        __u32 in_batch = 0, out_batch = 0;
+        bool first = true;
+
+        entries.clear();
+        while (true) {
+            __u32 count = batch_size;
+            int ret = bpf_map_lookup_batch(map_fd, first ? nullptr : &in_batch, &out_batch,
+                                           keys.data(), values.data(), &count, nullptr);
+            if (ret != 0 && errno != ENOENT) {
+                if (first && (errno == EINVAL || errno == ENOTSUP || errno == ENOTSUPP)) {
+                    break; // Kernel without batch ops, fall back to key iteration below
+                }
+                std::cerr << "Failed to batch read ip_stats_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            for (__u32 i = 0; i < count; i++) {
+                IpStatsEntry entry = {keys[i], {0, 0}};
+                for (int cpu = 0; cpu < ncpus; cpu++) {
+                    entry.stats.dropped += values[i * ncpus + cpu].dropped;
+                    entry.stats.passed += values[i * ncpus + cpu].passed;
+                }
+                entries.push_back(entry);
+            }
+            if (ret != 0) {
+                return 0; // ENOENT: the whole map has been read
+            }
+            in_batch = out_batch;
+            first = false;
+        }
+
+        __u32 ip_key = 0;
+        bool have_key = false;
+        while (bpf_map_get_next_key(map_fd, have_key ? &ip_key : nullptr, &ip_key) == 0) {
+            have_key = true;
+            if (bpf_map_lookup_elem(map_fd, &ip_key, values.data()) != 0) {
+                continue;
+            }
+            IpStatsEntry entry = {ip_key, {0, 0}};
+            for (int cpu = 0; cpu < ncpus; cpu++) {
+                entry.stats.dropped += values[cpu].dropped;
+                entry.stats.passed += values[cpu].passed;
+            }
+            entries.push_back(entry);
+        }
+        return 0;
+    }
+
+    // Function to read every conntrack_map entry (batched, each flow at most once)
+    int read_conntrack(int map_fd, std::vector<FlowEntry>& entries) {
+        const __u32 batch_size = 256;
+        std::vector<FlowKey> keys(batch_size);
+        std::vector<FlowState> values(batch_size);
+        __u32 in_batch = 0, out_batch = 0;
+        bool first = true;
+
+        entries.clear();
+        while (true) {
+            __u32 count = batch_size;
+            int ret = bpf_map_lookup_batch(map_fd, first ? nullptr : &in_batch, &out_batch,
+                                           keys.data(), values.data(), &count, nullptr);
+            if (ret != 0 && errno != ENOENT) {
+                if (first && (errno == EINVAL || errno == ENOTSUP || errno == ENOTSUPP)) {
+                    break; // Kernel without batch ops, fall back to key iteration below
+                }
+                std::cerr << "Failed to batch read conntrack_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            for (__u32 i = 0; i < count; i++) {
+                entries.push_back({keys[i], values[i]});
+            }
+            if (ret != 0) {
+                return 0; // ENOENT: the whole map has been read
+            }
+            in_batch = out_batch;
+            first = false;
+        }
+
+        // get_next_key restarts from the first key when the current one is evicted
+        // mid-walk: keep the keys already seen so no flow is counted twice
+        auto key_bytes = [](const FlowKey& key) {
+            return std::string(reinterpret_cast<const char*>(&key), sizeof(key));
+        };
+        std::unordered_set<std::string> seen;
+        FlowEntry entry;
+        bool have_key = false;
+        while (bpf_map_get_next_key(map_fd, have_key ? &entry.key : nullptr, &entry.key) == 0) {
+            have_key = true;
+            if (seen.insert(key_bytes(entry.key)).second &&
+                bpf_map_lookup_elem(map_fd, &entry.key, &entry.state) == 0) {
+                entries.push_back(entry);
+            }
+        }
+        if (errno != ENOENT) {
+            std::cerr << "Failed to read conntrack_map: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+    int expire_conntrack(int map_fd, __u32 idle_sec) {
+        std::vector<FlowEntry> flows;
+        if (read_conntrack(map_fd, flows) != 0) {
+            return -1;
+        }
+        __u64 now = monotonic_ns();
+        __u64 idle_ns = static_cast<__u64>(idle_sec) * 1000000000ULL;
+        int expired = 0;
+        for (const auto& flow : flows) {
+            if (flow.state.last_seen_ns + idle_ns > now) {
+                continue;
+            }
+            // Looked up again: a packet may have refreshed the flow since the read
+            FlowState state;
+            if (bpf_map_lookup_elem(map_fd, &flow.key, &state) == 0 && state.last_seen_ns + idle_ns <= now &&
+                bpf_map_delete_elem(map_fd, &flow.key) == 0) {
+                expired++;
+            }
+        }
+        return expired;
+    }
+
+    int read_vip_stats(int map_fd, std::vector<VipStats>& stats) {
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return -1;
+        }
+        std::vector<VipStats> percpu(ncpus);
+        stats.assign(VIP_POLICIES_MAX + 1, VipStats{0, 0});
+        for (__u32 id = 0; id <= VIP_POLICIES_MAX; id++) {
+            if (bpf_map_lookup_elem(map_fd, &id, percpu.data()) != 0) {
+                std::cerr << "Failed to read vip_stats_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            for (const auto& cpu : percpu) {
+                stats[id].dropped += cpu.dropped;
+                stats[id].passed += cpu.passed;
+            }
+        }
+        return 0;
+    }
+
+    int reconcile_conn_counts(int conntrack_map_fd, int conn_state_map_fd, __u32 idle_sec) {
+        std::vector<FlowEntry> flows;
+        if (read_conntrack(conntrack_map_fd, flows) != 0) {
+            return -1;
+        }
+        __u64 now = monotonic_ns();
+        __u64 idle_ns = static_cast<__u64>(idle_sec) * 1000000000ULL;
+        std::unordered_map<__u32, __u32> active;
+        for (const auto& flow : flows) {
+            // Idle flows are no longer connections, the fast path would check them again
+            if (flow.key.protocol == IPPROTO_TCP && flow.state.last_seen_ns + idle_ns > now) {
+                active[flow.key.saddr]++;
+            }
+        }
+
+        // Racing SYNs / closes between the read and the write are off by a few at most
+        __u32 ip = 0;
+        bool have_key = false;
+        while (bpf_map_get_next_key(conn_state_map_fd, have_key ? &ip : nullptr, &ip) == 0) {
+            have_key = true;
+            ConnCounter counter;
+            if (bpf_map_lookup_elem(conn_state_map_fd, &ip, &counter) != 0) {
+                continue;
+            }
+            auto it = active.find(ip);
+            __u32 count = it == active.end() ? 0 : it->second;
+            if (counter.active != count) {
+                counter.active = count;
+                bpf_map_update_elem(conn_state_map_fd, &ip, &counter, BPF_EXIST);
+            }
+        }
+        return 0;
+    }
+
+    // Gửi tín hiệu cập nhật đến kernel (cho kernel biết các map đã thay đổi)
+    int signal_update() {
+        __u32 key = 0;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        __u64 timestamp = static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+
+        if (bpf_map_update_elem(map_fd_update_signal, &key, &timestamp, BPF_ANY) != 0) {
+            std::cerr << "Failed to signal update to kernel via update_signal_map: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
     // Hàm đọc và cập nhật blacklist từ file config
     int update_from_config() {
         // Get references to the actual variables via pointers
@@ -172,6 +1094,7 @@ namespace packet_filter {
         uint32_t* current_ifindex = current_ifindex_ptr;
         SubnetNode** current_blacklist_subnets = current_blacklist_subnets_ptr;
         RateLimitNode** current_rate_limits = current_rate_limits_ptr;
+        Options new_options;
         
         std::ifstream file(config_file_path_abs);
         if (!file.is_open()) {
@@ -183,6 +1106,7 @@ namespace packet_filter {
         std::string iface_name_buf;
         std::string subnet_list_buf;
         std::string rate_limits_buf;
+        std::string inspect_list_buf;
 
         bool iface_found = false;
         bool subnet_list_found = false;
@@ -197,7 +1121,8 @@ namespace packet_filter {
             if (line.find("interface=") == 0) {
                 iface_found = true;
                 iface_name_buf = line.substr(strlen("interface="));
-                std::cout << "Config: Interface name: " << iface_name_buf << std::endl;
+                std::cout << "Config: Interfaces: " << iface_name_buf << std::endl;
+                parse_interface_list(iface_name_buf, new_options.interfaces);
             } else if (line.find("ip_blacklist=") == 0) {
                 subnet_list_found = true;
                 subnet_list_buf = line.substr(strlen("ip_blacklist="));
@@ -206,86 +1131,114 @@ namespace packet_filter {
                 rate_limits_found = true;
                 rate_limits_buf = line.substr(strlen("ip_rate_limits="));
                 std::cout << "Config: IP rate limits string: " << rate_limits_buf << std::endl;
+            } else if (line.find("ip_conn_limits=") == 0) {
+                parse_conn_limits(line.substr(strlen("ip_conn_limits=")), new_options.conn_limits);
+            } else if (line.find("vip=") == 0) {
+                VipPolicy policy;
+                if (parse_vip_policy(line.substr(strlen("vip=")), policy)) {
+                    new_options.vip_policies.push_back(policy);
+                }
+            } else if (line.find("l4_rule=") == 0) {
+                L4Rule rule;
+                if (parse_l4_rule(line.substr(strlen("l4_rule=")), new_options.l4_rules.size(), rule)) {
+                    new_options.l4_rules.push_back(rule);
+                }
+            } else if (line.find("inspect_subnets=") == 0) {
+                inspect_list_buf = line.substr(strlen("inspect_subnets="));
+            } else if (line.find("xdp_mode=") == 0) {
+                std::string mode = line.substr(strlen("xdp_mode="));
+                if (mode == "native") {
+                    new_options.xdp_mode = XdpMode::Native;
+                } else if (mode == "generic") {
+                    new_options.xdp_mode = XdpMode::Generic;
+                } else if (mode == "auto") {
+                    new_options.xdp_mode = XdpMode::Auto;
+                } else {
+                    std::cerr << "Warning: Unknown xdp_mode '" << mode << "' (native, generic or auto), using auto."
+                              << std::endl;
+                }
+            } else if (line.find("honeypot_interface=") == 0) {
+                new_options.honeypot.interface = line.substr(strlen("honeypot_interface="));
+            } else if (line.find("capture_dir=") == 0) {
+                new_options.capture.dir = line.substr(strlen("capture_dir="));
+            } else if (line.find("flow_export_collector=") == 0) {
+                new_options.flow_export.collector = line.substr(strlen("flow_export_collector="));
+            } else if (line.find("metrics_listen=") == 0) {
+                new_options.metrics_listen = line.substr(strlen("metrics_listen="));
+            } else if (line.find("bpf_pin_dir=") == 0) {
+                new_options.pin_dir = line.substr(strlen("bpf_pin_dir="));
+            } else if (line.find("autoban_") == 0 && line.find('=') != std::string::npos) {
+                parse_autoban_option(line, new_options.autoban);
+            } else if (parse_flag_option(line, "ip_stats", SETTING_IP_STATS, new_options.settings.flags) ||
+                       parse_flag_option(line, "heavy_hitters", SETTING_SKETCH, new_options.settings.flags) ||
+                       parse_uint_option(line, "heavy_hitters_interval_ms", new_options.heavy_hitters.interval_ms) ||
+                       parse_uint_option(line, "heavy_hitters_top", new_options.heavy_hitters.top) ||
+                       parse_uint_option(line, "heavy_hitters_log_pps", new_options.heavy_hitters.log_pps) ||
+                       parse_flag_option(line, "distinct_sources", SETTING_HLL, new_options.settings.flags) ||
+                       parse_uint_option(line, "distinct_sources_interval_ms", new_options.cardinality.interval_ms) ||
+                       parse_uint_option(line, "distinct_sources_window_sec", new_options.cardinality.window_sec) ||
+                       parse_flag_option(line, "latency_histogram", SETTING_LATENCY, new_options.settings.flags) ||
+                       parse_runtime_stats_option(line, new_options.runtime_stats) ||
+                       parse_flag_option(line, "conntrack", SETTING_CONNTRACK, new_options.settings.flags) ||
+                       parse_uint_option(line, "conntrack_idle_sec", new_options.settings.conntrack_idle_sec) ||
+                       parse_flag_option(line, "syn_cookies", SETTING_SYNCOOKIE, new_options.settings.flags) ||
+                       parse_uint_list_option(line, "syn_cookie_ports", new_options.syn_cookie_ports) ||
+                       parse_flag_option(line, "deep_inspection", SETTING_XSK, new_options.settings.flags) ||
+                       parse_uint_list_option(line, "cpumap_cpus", new_options.cpumap.cpus) ||
+                       parse_uint_option(line, "cpumap_qsize", new_options.cpumap.qsize) ||
+                       parse_flag_option(line, "blacklist_redirect", SETTING_BLACKLIST_REDIRECT,
+                                         new_options.settings.flags) ||
+                       parse_uint_option(line, "honeypot_pps", new_options.honeypot.pps) ||
+                       parse_uint_option(line, "honeypot_burst", new_options.honeypot.burst) ||
+                       parse_flag_option(line, "capture", SETTING_CAPTURE, new_options.settings.flags) ||
+                       parse_uint_option(line, "capture_sample", new_options.capture.sample) ||
+                       parse_uint_option(line, "capture_snaplen", new_options.capture.snaplen) ||
+                       parse_uint_option(line, "capture_file_mb", new_options.capture.file_mb) ||
+                       parse_uint_option(line, "capture_files", new_options.capture.files) ||
+                       parse_flag_option(line, "flow_export", SETTING_FLOW_EXPORT, new_options.settings.flags) ||
+                       parse_uint_option(line, "flow_export_interval_ms", new_options.flow_export.interval_ms) ||
+                       parse_uint_option(line, "flow_export_idle_sec", new_options.flow_export.idle_sec) ||
+                       parse_uint_option(line, "flow_export_active_sec", new_options.flow_export.active_sec) ||
+                       parse_uint_option(line, "flow_export_domain_id", new_options.flow_export.domain_id) ||
+                       parse_uint_option(line, "map_usage_interval_ms", new_options.map_usage.interval_ms) ||
+                       parse_uint_list_option(line, "map_usage_warn_percent", new_options.map_usage.warn_percent) ||
+                       parse_inspection_option(line, new_options.inspection)) {
+                // Handled by the helpers
             }
         }
         file.close();
 
-        if (!iface_found) {
+        if (!iface_found || new_options.interfaces.empty()) {
             std::cerr << "Error: Config file must contain 'interface='." << std::endl;
             return -1;
         }
 
-        // So sánh interface name (chỉ được đặt 1 lần lúc khởi động)
+        // Interface chính (interface đầu tiên, dùng cho deep inspection) chỉ được đặt 1 lần lúc khởi động;
+        // các interface còn lại được attach / detach khi reload
+        const std::string& primary_name = new_options.interfaces.front().name;
         if (filter_interface_name->empty()) { // Lần đầu đọc config
-            *filter_interface_name = iface_name_buf;
-            *current_ifindex = if_nametoindex(filter_interface_name->c_str());
-            if (!*current_ifindex) {
+            *filter_interface_name = primary_name;
+            *current_ifindex = offline_mode ? 0 : if_nametoindex(filter_interface_name->c_str());
+            if (!*current_ifindex && !offline_mode) {
                 std::cerr << "if_nametoindex error: " << strerror(errno) << std::endl;
                 return -1;
             }
             std::cout << "Initial interface set to " << *filter_interface_name << " (index " << *current_ifindex << ")." << std::endl;
-        } else if (*filter_interface_name != iface_name_buf) {
-            std::cerr << "Error: Changing interface name (" << *filter_interface_name << " to " 
-                    << iface_name_buf << ") dynamically is not supported. Please restart." << std::endl;
-            return -1;
+        } else if (*filter_interface_name != primary_name) {
+            std::cerr << "Warning: Primary interface changed (" << *filter_interface_name << " to "
+                      << primary_name << "), deep inspection stays on " << *filter_interface_name
+                      << " until restart." << std::endl;
         }
 
         // Process subnet blacklist (if present)
         int ip_count = 0;
         SubnetNode* new_subnets_list = nullptr;
-        SubnetNode* new_subnets_tail = nullptr;
 
         if (subnet_list_found) {
             // Parse the subnet list
-            std::stringstream ss(subnet_list_buf);
-            std::string subnet;
-            
-            while (std::getline(ss, subnet, ',')) {
-                // Trim whitespace
-                subnet.erase(0, subnet.find_first_not_of(" \t"));
-                subnet.erase(subnet.find_last_not_of(" \t") + 1);
-                
-                if (!subnet.empty()) {
-                    struct in_addr addr;
-                    std::string ip_only;
-                    int prefixlen;
-                    
-                    size_t slash_pos = subnet.find('/');
-                    if (slash_pos != std::string::npos) {
-                        ip_only = subnet.substr(0, slash_pos);
-                        prefixlen = std::stoi(subnet.substr(slash_pos + 1));
-                    } else {
-                        ip_only = subnet;
-                        prefixlen = 32;
-                    }
-
-                    if (inet_pton(AF_INET, ip_only.c_str(), &addr) == 1) {
-                        if (prefixlen >= 0 && prefixlen <= 32) {
-                            auto new_node = new SubnetNode();
-                            if (!new_node) {
-                                std::cerr << "Failed to allocate subnet_node" << std::endl;
-                                free_subnet_list(new_subnets_list);
-                                return -1;
-                            }
-                            new_node->key.ip = addr.s_addr;
-                            new_node->key.prefixlen = static_cast<__u32>(prefixlen);
-                            new_node->next = nullptr;
-                            
-                            if (new_subnets_list == nullptr) {
-                                new_subnets_list = new_node;
-                                new_subnets_tail = new_node;
-                            } else {
-                                new_subnets_tail->next = new_node;
-                                new_subnets_tail = new_node;
-                            }
-                            ip_count++;
-                        } else {
-                            std::cerr << "Warning: Invalid prefix length for '" << subnet << "' in config file." << std::endl;
-                        }
-                    } else {
-                        std::cerr << "Warning: Invalid IP address '" << ip_only << "' in config file." << std::endl;
-                    }
-                }
+            ip_count = parse_subnet_list(subnet_list_buf, &new_subnets_list);
+            if (ip_count < 0) {
+                return -1;
             }
 
             std::cout << "Total blacklist IP entries parsed: " << ip_count << std::endl;
@@ -408,6 +1361,13 @@ namespace packet_filter {
             // 3. Cập nhật danh sách Subnet hiện tại
             free_subnet_list(*current_blacklist_subnets); // Giải phóng danh sách cũ
             *current_blacklist_subnets = new_subnets_list; // Gán danh sách mới
+
+            // Bản sao cho detector (chạy trên thread khác, không đọc được linked list)
+            std::lock_guard<std::mutex> lock(configured_mutex);
+            configured_blacklist.clear();
+            for (SubnetNode* n = new_subnets_list; n != nullptr; n = n->next) {
+                configured_blacklist.push_back(n->key);
+            }
         }
 
         // --- Begin rate limits synchronization ---
@@ -459,17 +1419,210 @@ namespace packet_filter {
             // 3. Update the current rate limits list
             free_rate_limit_list(*current_rate_limits); // Free the old list
             *current_rate_limits = new_rate_limits_list; // Assign the new list
+
+            // Copy for the detector thread, which cannot walk the list
+            std::lock_guard<std::mutex> lock(configured_mutex);
+            configured_rate_limits.clear();
+            for (RateLimitNode* n = new_rate_limits_list; n != nullptr; n = n->next) {
+                configured_rate_limits.push_back(n->config.ip);
+            }
         }
 
-        // 4. Gửi tín hiệu cập nhật đến kernel (cho kernel biết blacklist đã thay đổi)
-        __u32 key = 0;
-        struct timespec ts;
-        clock_gettime(CLOCK_MONOTONIC, &ts);
-        __u64 timestamp = static_cast<__u64>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        // Validate and publish the daemon options
+        if (new_options.autoban.alpha <= 0.0 || new_options.autoban.alpha > 1.0) {
+            std::cerr << "Warning: autoban_alpha must be in (0, 1], using 0.5." << std::endl;
+            new_options.autoban.alpha = 0.5;
+        }
+        if (new_options.autoban.interval_ms == 0) {
+            std::cerr << "Warning: autoban_interval_ms must be greater than 0, using 1000." << std::endl;
+            new_options.autoban.interval_ms = 1000;
+        }
+        if (new_options.heavy_hitters.interval_ms == 0) {
+            std::cerr << "Warning: heavy_hitters_interval_ms must be greater than 0, using 1000." << std::endl;
+            new_options.heavy_hitters.interval_ms = 1000;
+        }
+        if (new_options.cardinality.interval_ms == 0) {
+            std::cerr << "Warning: distinct_sources_interval_ms must be greater than 0, using 1000." << std::endl;
+            new_options.cardinality.interval_ms = 1000;
+        }
+        if (new_options.runtime_stats.interval_ms == 0) {
+            std::cerr << "Warning: runtime_stats_interval_ms must be greater than 0, using 1000." << std::endl;
+            new_options.runtime_stats.interval_ms = 1000;
+        }
+        if (new_options.flow_export.interval_ms == 0) {
+            std::cerr << "Warning: flow_export_interval_ms must be greater than 0, using 1000." << std::endl;
+            new_options.flow_export.interval_ms = 1000;
+        }
+        if (new_options.flow_export.idle_sec == 0 || new_options.flow_export.active_sec == 0) {
+            std::cerr << "Warning: flow_export_idle_sec and flow_export_active_sec must be greater than 0, "
+                      << "using 15 and 60." << std::endl;
+            new_options.flow_export.idle_sec = 15;
+            new_options.flow_export.active_sec = 60;
+        }
+        if (new_options.map_usage.interval_ms == 0) {
+            std::cerr << "Warning: map_usage_interval_ms must be greater than 0, using 5000." << std::endl;
+            new_options.map_usage.interval_ms = 5000;
+        }
+        {
+            auto& percents = new_options.map_usage.warn_percent;
+            auto invalid = [](__u32 percent) { return percent == 0 || percent > 100; };
+            if (std::any_of(percents.begin(), percents.end(), invalid)) {
+                std::cerr << "Warning: map_usage_warn_percent values must be between 1 and 100, "
+                          << "ignoring the others." << std::endl;
+                percents.erase(std::remove_if(percents.begin(), percents.end(), invalid), percents.end());
+            }
+        }
+        {
+            // Sample one packet in 2^k >= latency_sample
+            __u32 sample = std::max(1U, std::min(new_options.runtime_stats.latency_sample, 1U << 20));
+            __u32 mask = 0;
+            while (mask + 1 < sample) {
+                mask = (mask << 1) | 1;
+            }
+            new_options.runtime_stats.latency_sample = mask + 1;
+            new_options.settings.latency_sample_mask = mask;
+        }
+        {
+            // Same rounding for the capture sample
+            __u32 sample = std::max(1U, std::min(new_options.capture.sample, 1U << 20));
+            __u32 mask = 0;
+            while (mask + 1 < sample) {
+                mask = (mask << 1) | 1;
+            }
+            new_options.capture.sample = mask + 1;
+            new_options.settings.capture_sample_mask = mask;
+        }
+        if (new_options.capture.snaplen == 0 || new_options.capture.snaplen > CAPTURE_SNAPLEN_MAX) {
+            std::cerr << "Warning: capture_snaplen must be in [1, " << CAPTURE_SNAPLEN_MAX << "], using "
+                      << CAPTURE_SNAPLEN_MAX << "." << std::endl;
+            new_options.capture.snaplen = CAPTURE_SNAPLEN_MAX;
+        }
+        new_options.settings.capture_snaplen = new_options.capture.snaplen;
+        if (new_options.capture.file_mb == 0) {
+            std::cerr << "Warning: capture_file_mb must be greater than 0, using 64." << std::endl;
+            new_options.capture.file_mb = 64;
+        }
+        if (new_options.conn_limits.empty()) {
+            new_options.settings.flags &= ~SETTING_CONN_LIMITS;
+        } else {
+            new_options.settings.flags |= SETTING_CONN_LIMITS;
+            bool needs_conntrack = false;
+            for (const auto& entry : new_options.conn_limits) {
+                needs_conntrack = needs_conntrack || entry.limit.max_conns > 0;
+            }
+            if (needs_conntrack && !(new_options.settings.flags & SETTING_CONNTRACK)) {
+                std::cerr << "Warning: ip_conn_limits max_conns needs conntrack=1, concurrent limits are not enforced."
+                          << std::endl;
+            }
+        }
+        if (new_options.vip_policies.size() > VIP_POLICIES_MAX) {
+            std::cerr << "Warning: At most " << VIP_POLICIES_MAX << " vip lines are supported." << std::endl;
+            new_options.vip_policies.resize(VIP_POLICIES_MAX);
+        }
+        if (new_options.vip_policies.empty()) {
+            new_options.settings.flags &= ~SETTING_VIP_POLICIES;
+        } else {
+            new_options.settings.flags |= SETTING_VIP_POLICIES;
+        }
+        if (new_options.l4_rules.size() > L4_RULES_MAX) {
+            std::cerr << "Warning: At most " << L4_RULES_MAX << " l4_rule lines are supported." << std::endl;
+            new_options.l4_rules.resize(L4_RULES_MAX);
+        }
+        if (new_options.l4_rules.empty()) {
+            new_options.settings.flags &= ~SETTING_L4_RULES;
+        } else {
+            new_options.settings.flags |= SETTING_L4_RULES;
+        }
 
-        if (bpf_map_update_elem(map_fd_update_signal, &key, &timestamp, BPF_ANY) != 0) {
-            std::cerr << "Failed to signal update to kernel via update_signal_map: " << strerror(errno) << std::endl;
+        // cpumap: CPUs are added and the slots written before the settings enable them,
+        // CPUs no longer used are removed once the new settings are in place
+        std::vector<__u32> cpumap_cpus;
+        if (map_fd_cpu_map >= 0 && !offline_mode) {
+            cpumap_cpus = add_cpumap_cpus(new_options.cpumap);
+        }
+        new_options.settings.cpumap_cpus = static_cast<__u32>(cpumap_cpus.size());
+        new_options.settings.xsk_ifindex = *current_ifindex; // Deep inspection stays on the primary interface
+        if (cpumap_cpus.empty()) {
+            new_options.settings.flags &= ~SETTING_CPUMAP;
         } else {
+            new_options.settings.flags |= SETTING_CPUMAP;
+        }
+        *options_ptr = new_options;
+
+        // Compile the L4 rules before the flag reaches the kernel
+        if (l4_rule_set != nullptr) {
+            l4_rule_set->apply(new_options.l4_rules);
+        }
+
+        // Per-destination policies, same ordering
+        if (vip_maps.dst_fd >= 0) {
+            sync_vip_policies(new_options.vip_policies);
+        }
+
+        // Target of the redirect actions
+        if (map_fd_honeypot >= 0 && !offline_mode) {
+            sync_honeypot(new_options.honeypot);
+        }
+
+        __u32 settings_key = 0;
+        if (bpf_map_update_elem(map_fd_settings, &settings_key, &new_options.settings, BPF_ANY) != 0) {
+            std::cerr << "Failed to update settings map: " << strerror(errno) << std::endl;
+        }
+        if (map_fd_cpu_map >= 0 && !offline_mode) {
+            remove_stale_cpumap_cpus(cpumap_cpus, new_options.cpumap.qsize);
+        }
+
+        // Sources diverted to the AF_XDP inspection path
+        if (map_fd_inspect_subnets >= 0) {
+            SubnetNode* new_inspect_list = nullptr;
+            if (parse_subnet_list(inspect_list_buf, &new_inspect_list) < 0) {
+                return -1;
+            }
+            sync_subnet_map(map_fd_inspect_subnets, "inspect_subnets_map",
+                            current_inspect_subnets_ptr, new_inspect_list);
+        }
+
+        // Destination ports diverted to the AF_XDP inspection path
+        if (map_fd_inspect_ports >= 0) {
+            sync_port_map(map_fd_inspect_ports, "inspect_ports_map", current_inspect_ports,
+                          new_options.inspection.ports);
+        }
+
+        // Per-source connection limits
+        if (map_fd_conn_limits >= 0) {
+            for (__u32 ip : current_conn_limit_ips) {
+                bool found = false;
+                for (const auto& entry : new_options.conn_limits) {
+                    found = found || entry.ip == ip;
+                }
+                if (!found) {
+                    bpf_map_delete_elem(map_fd_conn_limits, &ip);
+                }
+            }
+            current_conn_limit_ips.clear();
+            for (const auto& entry : new_options.conn_limits) {
+                if (bpf_map_update_elem(map_fd_conn_limits, &entry.ip, &entry.limit, BPF_ANY) != 0) {
+                    std::cerr << "Failed to update conn_limits_map: " << strerror(errno) << std::endl;
+                    continue;
+                }
+                current_conn_limit_ips.push_back(entry.ip);
+            }
+            std::cout << "Connection limits configured: " << current_conn_limit_ips.size() << std::endl;
+        }
+
+        // Listening ports whose handshakes are answered with SYN cookies
+        if (map_fd_syncookie_ports >= 0) {
+            sync_port_map(map_fd_syncookie_ports, "syncookie_ports_map", current_syncookie_ports,
+                          new_options.syn_cookie_ports);
+            if ((new_options.settings.flags & SETTING_SYNCOOKIE) && !offline_mode) {
+                ensure_tcp_syncookies();
+            } else {
+                restore_tcp_syncookies(); // xdp_filter no longer answers with cookies
+            }
+        }
+
+        // 4. Gửi tín hiệu cập nhật đến kernel (cho kernel biết blacklist đã thay đổi)
+        if (signal_update() == 0) {
             std::cout << "Sent update signal to kernel." << std::endl;
             std::cout << "\n--- Packet filter configuration has been updated! ---\n";
         }
@@ -4,6 +4,11 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <linux/types.h>
+
+#include "signatures.h"
+#include "l4_rules.h"
 
 namespace packet_filter {
     // Define the key structure for the LPM Trie map
@@ -35,6 +40,381 @@ namespace packet_filter {
         }
     };
 
+    // Value of ip_rate_limits_map / vip_rate_limits_map (must match struct ip_rate_limit)
+    struct BpfRateLimit {
+        __u32 packets_per_second;
+        __u64 packet_interval_ns;
+    };
+
+    // Structure for packet statistics by IP (must match the BPF struct)
+    struct PacketStats {
+        __u64 dropped;  // Number of dropped packets
+        __u64 passed;   // Number of passed packets
+    };
+
+    // One ip_stats_map entry with its per-CPU values already summed
+    struct IpStatsEntry {
+        __u32 ip;
+        PacketStats stats;
+    };
+
+    // Bits of FilterSettings::flags (must match SETTING_* in the BPF code)
+    enum SettingFlags : __u32 {
+        SETTING_IP_STATS = 1U << 0, // Track every source in ip_stats_map
+        SETTING_SKETCH   = 1U << 1, // Update the count-min sketch and candidate table
+        SETTING_HLL      = 1U << 2, // Update the HyperLogLog distinct-source estimators
+        SETTING_XSK      = 1U << 3, // Redirect inspect_subnets_map sources to AF_XDP
+        SETTING_LATENCY  = 1U << 4, // Record sampled per-stage latencies in latency_hist_map
+        SETTING_SYNCOOKIE = 1U << 5, // Answer SYNs to syncookie_ports_map with SYN cookies
+        SETTING_CONNTRACK = 1U << 6, // Let verified flows in conntrack_map skip the policy stages
+        SETTING_CONN_LIMITS = 1U << 7, // Enforce conn_limits_map (set when ip_conn_limits is not empty)
+        SETTING_L4_RULES = 1U << 8,    // Evaluate the l4_rule bitmaps (set when l4_rule lines exist)
+        SETTING_VIP_POLICIES = 1U << 9, // Select per-destination policies (set when vip lines exist)
+        SETTING_CPUMAP = 1U << 10,      // Spread packets over cpumap_cpus (set when CPUs were added)
+        SETTING_BLACKLIST_REDIRECT = 1U << 11, // Divert blacklisted sources to the honeypot interface
+        SETTING_CAPTURE = 1U << 12,     // Copy sampled dropped / diverted packets to capture_ringbuf
+        SETTING_FLOW_EXPORT = 1U << 13, // Account every TCP/UDP flow in flow_export_map
+    };
+
+    // Runtime switches of the XDP program (must match struct filter_settings)
+    struct FilterSettings {
+        __u32 flags;
+        __u32 latency_sample_mask; // A packet is timed when (random & mask) == 0
+        __u32 conntrack_idle_sec;  // Flows idle for longer go through the policy stages again
+        __u32 cpumap_cpus;         // Slots used in cpumap_cpus_map
+        __u32 capture_sample_mask; // A dropped / diverted packet is captured when (random & mask) == 0
+        __u32 capture_snaplen;     // Bytes copied per captured packet
+        __u32 xsk_ifindex;         // Interface whose queues have the AF_XDP sockets, 0 = any (replay)
+
+        FilterSettings()
+            : flags(SETTING_IP_STATS), latency_sample_mask(63), conntrack_idle_sec(120), cpumap_cpus(0),
+              capture_sample_mask(1023), capture_snaplen(128), xsk_ifindex(0) {}
+    };
+
+    // Per-source TCP connection limits (must match struct conn_limit)
+    struct ConnLimit {
+        __u32 syn_per_sec; // New connections (SYNs) per second, 0 = unlimited
+        __u32 max_conns;   // Concurrent tracked connections, 0 = unlimited (needs conntrack=1)
+    };
+
+    // One ip_conn_limits entry; ip 0 is the "*" default for every other source
+    struct ConnLimitEntry {
+        __u32 ip; // Network byte order
+        ConnLimit limit;
+    };
+
+    // Per-source connection state (must match struct conn_counter)
+    struct ConnCounter {
+        __u32 window;
+        __u32 syns;
+        __u32 active;
+        __u32 pad;
+    };
+
+    // Drop reasons (must match DROP_* in the BPF code)
+    enum DropReason : __u32 {
+        DROP_BLACKLIST = 0,
+        DROP_RATE_LIMIT,
+        DROP_SYN_RATE,
+        DROP_CONN_LIMIT,
+        DROP_BAD_COOKIE,
+        DROP_COOKIE_REPLY,
+        DROP_L4_RULE,
+        DROP_L4_RATE,
+        DROP_REASONS
+    };
+
+    // Indexes of the counters_map values (must match COUNTER_* in the BPF code)
+    enum GlobalCounter : __u32 {
+        COUNTER_DROPPED = 0,
+        COUNTER_PASSED,
+        COUNTER_REDIRECTED,   // Handed to user-space inspection or diverted to the honeypot
+        COUNTER_DROPPED_BYTES,
+        COUNTER_PASSED_BYTES,
+        COUNTER_REDIRECTED_BYTES,
+        COUNTER_DROP_REASONS, // + DropReason
+        COUNTERS = COUNTER_DROP_REASONS + DROP_REASONS
+    };
+
+    // Counters of one CPU (must match struct cpu_counters); seq is odd during an update
+    struct CpuCounters {
+        __u32 seq;
+        __u32 pad;
+        __u64 values[COUNTERS];
+        __u64 pad_to_line[1];
+    };
+
+    // Destination policies (ids 1..VIP_POLICIES_MAX, 0 = the interface-wide lists)
+    constexpr __u32 VIP_POLICIES_MAX = 64;
+
+    // Source prefix scoped to a policy (must match struct policy_trie_key)
+    struct PolicyTrieKey {
+        __u32 prefixlen; // 32 + source prefix length
+        __u32 policy;
+        __u32 ip;        // Network byte order
+    };
+
+    // Source IP scoped to a policy (must match struct policy_ip_key)
+    struct PolicyIpKey {
+        __u32 policy;
+        __u32 ip; // Network byte order
+    };
+
+    // Verdicts of the traffic to one policy (must match struct vip_stats)
+    struct VipStats {
+        __u64 dropped;
+        __u64 passed;
+    };
+
+    // One "vip=" line: the destinations it covers and the lists applied to their traffic
+    // instead of ip_blacklist / ip_rate_limits (a policy without destinations is only
+    // selected through interface=NAME:POLICY)
+    struct VipPolicy {
+        std::string name;
+        std::vector<BpfTrieKey> destinations;
+        std::vector<BpfTrieKey> blacklist;
+        std::vector<BpfTrieKey> allowlist; // Sources that skip the blacklist and rate limits
+        std::vector<RateLimit> rate_limits;
+    };
+
+    // Slots of cpumap_cpus_map (must match CPUMAP_MAX)
+    constexpr __u32 CPUMAP_MAX = 256;
+
+    // cpumap mode: xdp_filter only hashes the flow and queues the frame to one of
+    // `cpus`, where xdp_filter_cpumap runs the filter (for single-queue devices)
+    struct CpumapConfig {
+        std::vector<__u32> cpus; // cpumap_cpus=, empty = filter on the receiving CPU
+        __u32 qsize;             // cpumap_qsize=, frames queued per remote CPU
+
+        CpumapConfig() : qsize(2048) {}
+    };
+
+    // Counters of honeypot_stats_map (must match HONEYPOT_* in the BPF code)
+    enum HoneypotCounter : __u32 {
+        HONEYPOT_REDIRECTED = 0, // Diverted packets sent to the honeypot interface
+        HONEYPOT_OVER_CAP,       // Diverted packets dropped by the rate cap
+        HONEYPOT_COUNTERS
+    };
+
+    // Counters of map_fail_map (must match MAP_FAIL_* in the BPF code)
+    enum MapFailCounter : __u32 {
+        MAP_FAIL_IP_STATS = 0,  // Sources seen without a slot in ip_stats_map
+        MAP_FAIL_IP_TIMESTAMPS, // Rate-limited sources without a slot in ip_timestamps_map
+        MAP_FAIL_COUNTERS
+    };
+
+    // Slots of map_usage_map, one per map tracked by the map usage monitor
+    // (must match MAP_USAGE_SLOTS in the BPF code)
+    enum MapUsageSlot : __u32 {
+        MAP_USAGE_IP_STATS = 0,
+        MAP_USAGE_IP_TIMESTAMPS,
+        MAP_USAGE_IP_RATE_LIMITS,
+        MAP_USAGE_BLACKLIST_SUBNETS,
+        MAP_USAGE_CONNTRACK,
+        MAP_USAGE_FLOW_EXPORT,
+        MAP_USAGE_SLOTS
+    };
+
+    // Value of map_usage_map (must match struct map_usage)
+    struct MapUsage {
+        __u64 entries;
+        __u64 capacity;
+        __u64 high_water;
+    };
+
+    // Target of the redirect actions (l4_rule "redirect", blacklist_redirect=1): matched
+    // packets go out of `interface` through a devmap, at most pps per second (burst
+    // packets at once); above the cap, or without an interface, they are dropped
+    struct HoneypotConfig {
+        std::string interface; // honeypot_interface=, empty = no honeypot
+        __u32 pps;             // honeypot_pps=
+        __u32 burst;           // honeypot_burst=
+
+        HoneypotConfig() : pps(1000), burst(100) {}
+    };
+
+    // One entry of the interface= list: "NAME" or "NAME:POLICY"
+    struct InterfaceConfig {
+        std::string name;
+        std::string policy; // vip policy applied to traffic matching no vip dst, empty = interface-wide lists
+    };
+
+    // xdp_mode= option: requested attach mode of every interface
+    enum class XdpMode {
+        Auto,    // Native (driver) mode, generic mode when the driver has no XDP support
+        Native,  // XDP_FLAGS_DRV_MODE only
+        Generic, // XDP_FLAGS_SKB_MODE (skb path, much slower, for testing / unsupported drivers)
+    };
+
+    // "auto", "native" or "generic"
+    const char* xdp_mode_name(XdpMode mode);
+
+    // Verdicts of the traffic received on one interface (must match struct iface_stats)
+    struct IfaceStats {
+        __u64 dropped;
+        __u64 passed;
+        __u64 redirected;
+    };
+
+    // File descriptors of the destination policy maps
+    struct VipPolicyMaps {
+        int dst_fd;         // vip_dst_map
+        int blacklist_fd;   // vip_blacklist_map
+        int allowlist_fd;   // vip_allowlist_map
+        int rate_limits_fd; // vip_rate_limits_map
+    };
+
+    // 5-tuple of a tracked flow (must match struct flow_key, network byte order)
+    struct FlowKey {
+        __u32 saddr;
+        __u32 daddr;
+        __u16 sport;
+        __u16 dport;
+        __u8 protocol;
+        __u8 pad[3];
+    };
+
+    // Verified flow state (must match struct flow_state)
+    struct FlowState {
+        __u64 first_seen_ns;
+        __u64 last_seen_ns;
+        __u64 packets;
+        __u64 bytes;
+        __u64 generation;
+        __u32 policed;
+        __u32 pad;
+    };
+
+    struct FlowEntry {
+        FlowKey key;
+        FlowState state;
+    };
+
+    // Heavy-hitter reporting from the count-min sketch
+    struct HeavyHitterConfig {
+        __u32 interval_ms; // How often the sketches are merged and reported
+        __u32 top;         // Number of heavy hitters reported per interval
+        __u32 log_pps;     // Log heavy hitters at or above this rate (0 = never log)
+
+        HeavyHitterConfig() : interval_ms(1000), top(10), log_pps(1000) {}
+    };
+
+    // Distinct-source estimation with HyperLogLog
+    struct CardinalityConfig {
+        __u32 interval_ms; // How often the estimates are exported
+        __u32 window_sec;  // Registers are cleared after each window
+
+        CardinalityConfig() : interval_ms(1000), window_sec(60) {}
+    };
+
+    // Cost of xdp_filter itself: kernel run-time stats and sampled in-program latencies
+    struct RuntimeStatsConfig {
+        bool bpf_stats;          // Keep BPF_STATS_RUN_TIME enabled while the daemon runs
+        __u32 interval_ms;       // How often run_cnt / run_time_ns and the histograms are exported
+        __u32 latency_sample;    // Time one packet in this many (rounded up to a power of two)
+
+        RuntimeStatsConfig() : bpf_stats(false), interval_ms(1000), latency_sample(64) {}
+    };
+
+    // Bytes of a packet the capture can keep (must match CAPTURE_SNAPLEN_MAX)
+    constexpr __u32 CAPTURE_SNAPLEN_MAX = 256;
+
+    // Sampled capture of dropped / diverted packets (capture=1); sample and snaplen
+    // reach the kernel on every reload, the writer picks up the file settings at the
+    // next rotation
+    struct CaptureConfig {
+        __u32 sample;      // Capture one packet in this many (rounded up to a power of two)
+        __u32 snaplen;     // Bytes kept per packet (at most CAPTURE_SNAPLEN_MAX)
+        std::string dir;   // Directory of the capture-N.pcap files
+        __u32 file_mb;     // A file is rotated once it reaches this size
+        __u32 files;       // Files kept, the oldest one is removed
+
+        CaptureConfig() : sample(1000), snaplen(128), dir("captures"), file_mb(64), files(8) {}
+    };
+
+    // IPFIX export of the flow_export_map records (flow_export=1), applied on every reload
+    struct FlowExportConfig {
+        std::string collector; // host:port of the UDP collector
+        __u32 interval_ms;     // How often the map is scanned for expired flows
+        __u32 idle_sec;        // A flow without packets for this long is exported and removed
+        __u32 active_sec;      // A longer-running flow is exported and starts a new record
+        __u32 domain_id;       // IPFIX observation domain
+
+        FlowExportConfig() : collector("127.0.0.1:4739"), interval_ms(1000), idle_sec(15), active_sec(60),
+                             domain_id(0) {}
+    };
+
+    // Occupancy of the bounded maps: entry counts, high-water marks and failed inserts
+    // are exported every interval, a warning is logged when a map fills past each of
+    // warn_percent (again after it has dropped back below)
+    struct MapUsageConfig {
+        __u32 interval_ms;              // map_usage_interval_ms=, how often the maps are counted
+        std::vector<__u32> warn_percent; // map_usage_warn_percent=, fill levels that log a warning
+
+        MapUsageConfig() : interval_ms(5000), warn_percent{80, 95} {}
+    };
+
+    // AF_XDP deep-inspection path (sockets are set up once at startup;
+    // ports, signatures and payload_ban are applied on every reload)
+    struct DeepInspectionConfig {
+        std::vector<__u32> queues; // RX queues served by one worker each
+        __u32 frame_count;         // UMEM frames per queue (power of two)
+        __u32 ring_size;           // Descriptors per RX/TX ring (power of two)
+        __u32 batch_size;          // Frames handled per RX/TX batch
+        bool zerocopy;             // Require zero-copy mode instead of copy mode
+        bool busy_poll;            // Busy-poll the queues instead of sleeping in poll()
+        std::string reinject;      // Accepted frames: "tap" (host stack), "tx" (back out) or "none"
+        std::string tap_name;      // TAP device used by reinject=tap
+        std::vector<__u32> ports;  // TCP/UDP destination ports diverted to inspection
+        std::vector<PayloadSignature> signatures; // Payloads dropped by the signature matcher
+        bool ban_on_match;         // Blacklist sources that send a matching payload
+
+        DeepInspectionConfig() : queues{0}, frame_count(4096), ring_size(2048), batch_size(64),
+                                 zerocopy(false), busy_poll(false), reinject("tap"),
+                                 tap_name("pfinject0"), ban_on_match(false) {}
+    };
+
+    // Thresholds for the auto-ban detector (rates are EWMA packets per second)
+    struct AutoBanConfig {
+        bool enabled;
+        __u32 interval_ms;        // Sampling period of ip_stats_map
+        double alpha;             // EWMA smoothing factor, 0 < alpha <= 1
+        double ban_pps;           // Blacklist a single source above this rate (0 = off)
+        double rate_limit_pps;    // Rate-limit a single source above this rate (0 = off)
+        __u32 rate_limit_value;   // PPS installed for automatically rate-limited sources
+        double subnet_ban_pps;    // Blacklist the whole /24 above this aggregate rate (0 = off)
+        __u32 ban_seconds;        // Lifetime of an automatic decision (0 = until restart)
+
+        AutoBanConfig() : enabled(false), interval_ms(1000), alpha(0.5), ban_pps(0),
+                          rate_limit_pps(0), rate_limit_value(100), subnet_ban_pps(0),
+                          ban_seconds(300) {}
+    };
+
+    // Daemon options that are read from the config file besides the filter lists
+    struct Options {
+        std::string metrics_listen; // host:port of the Prometheus endpoint, empty = disabled
+        std::string pin_dir;        // bpffs directory of the maps read by pf_top, empty = not pinned
+        std::vector<InterfaceConfig> interfaces; // XDP attachments, the first one hosts deep inspection
+        XdpMode xdp_mode;
+        CpumapConfig cpumap;
+        FilterSettings settings;    // Pushed into settings_map on every load
+        AutoBanConfig autoban;
+        HeavyHitterConfig heavy_hitters;
+        CardinalityConfig cardinality;
+        RuntimeStatsConfig runtime_stats;
+        std::vector<__u32> syn_cookie_ports; // Listening TCP ports protected by SYN cookies
+        std::vector<ConnLimitEntry> conn_limits; // ip_conn_limits entries
+        std::vector<VipPolicy> vip_policies;     // vip lines, policy id = index + 1
+        std::vector<L4Rule> l4_rules;            // l4_rule lines, in evaluation order
+        DeepInspectionConfig inspection;
+        HoneypotConfig honeypot;
+        CaptureConfig capture;
+        FlowExportConfig flow_export;
+        MapUsageConfig map_usage;
+
+        Options() : pin_dir("/sys/fs/bpf/packetfilter"), xdp_mode(XdpMode::Auto) {}
+    };
+
     // Structure to track rate limits in a linked list
     class RateLimitNode {
     public:
@@ -52,6 +432,9 @@ namespace packet_filter {
     // Function to free a linked list of rate limits
     void free_rate_limit_list(RateLimitNode *head);
 
+    // Function to parse "A.B.C.D[/len]" into an LPM key (host bits cleared)
+    bool parse_cidr(const std::string& value, BpfTrieKey& key);
+
     // Function to add a subnet to the blacklist map
     int add_to_blacklist(int map_fd, const std::string& subnet_str);
 
@@ -64,13 +447,68 @@ namespace packet_filter {
     // Function to remove a rate limit from the rate limit map
     int remove_from_rate_limits(int map_fd, __u32 ip);
 
+    // Whether the last config load lists this exact prefix in ip_blacklist (safe from any thread)
+    bool blacklist_configured(const BpfTrieKey& key);
+
+    // Whether the last config load lists a rate limit for this IP (safe from any thread)
+    bool rate_limit_configured(__u32 ip);
+
+    // Function to read every ip_stats_map entry (batched, per-CPU values summed)
+    int read_ip_stats(int map_fd, std::vector<IpStatsEntry>& entries);
+
+    // Function to read every conntrack_map entry
+    int read_conntrack(int map_fd, std::vector<FlowEntry>& entries);
+
+    // Function to read the per-policy verdict counters (per-CPU values summed), index = policy id
+    int read_vip_stats(int map_fd, std::vector<VipStats>& stats);
+
+    // Function to delete the conntrack_map flows idle for idle_sec or longer (the fast path
+    // only expires a flow when its next packet arrives); returns the number deleted
+    int expire_conntrack(int map_fd, __u32 idle_sec);
+
+    // Function to re-count the tracked TCP flows of every source in conn_state_map, flows idle
+    // for idle_sec or longer excluded (flows evicted from the LRU conntrack_map never decrement
+    // the in-kernel count)
+    int reconcile_conn_counts(int conntrack_map_fd, int conn_state_map_fd, __u32 idle_sec);
+
+    // Function to put back net.ipv4.tcp_syncookies if syn_cookies=1 changed it (on exit)
+    void restore_tcp_syncookies();
+
+    // Function to tell the kernel that the filter maps have changed
+    int signal_update();
+
     // Function to read and update blacklist from config file
     int update_from_config();
 
+    // Offline use (--replay): keep the configured interface name without resolving it
+    void set_offline(bool offline);
+
+    // Set the maps of sources and ports diverted to the AF_XDP inspection path (optional)
+    void set_inspect_map(int inspect_map_fd, int inspect_ports_map_fd, SubnetNode** subnets);
+
+    // Set the map of TCP ports protected by SYN cookies (optional)
+    void set_syncookie_map(int syncookie_ports_map_fd);
+
+    // Set the map of per-source connection limits (optional)
+    void set_conn_limits_map(int conn_limits_map_fd);
+
+    // Set the maps of the per-destination policies (optional)
+    void set_vip_policy_maps(const VipPolicyMaps& maps);
+
+    // Set cpu_map, cpumap_cpus_map and the program run by every cpu_map entry (optional)
+    void set_cpumap_maps(int cpu_map_fd, int cpumap_cpus_map_fd, int cpumap_prog_fd);
+
+    // Set the honeypot devmap and its rate cap map (optional)
+    void set_honeypot_maps(int honeypot_map_fd, int honeypot_config_map_fd);
+
+    // Set the compiler of the l4_rule lines (optional)
+    void set_l4_rules(L4RuleSet* rule_set);
+
     // Initialize the packet filter module
     void init(int blacklist_map_fd, int signal_map_fd, int rate_limits_map_fd,
             const std::string& config_file_path, std::string& interface_name,
-            uint32_t& ifindex, SubnetNode** subnets, RateLimitNode** rate_limits);
+            uint32_t& ifindex, SubnetNode** subnets, RateLimitNode** rate_limits,
+            int settings_map_fd, Options* options);
 } // namespace packet_filter
 
 #endif /* PACKET_FILTER_H */
\ No newline at end of file
@@ -2,10 +2,126 @@
 #include "vmlinux.h"
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_endian.h>
+#include <bpf/bpf_core_read.h>
 
 #define ETH_P_IP 0x0800
+#define ETH_ALEN 6
+#define BPF_F_CURRENT_NETNS (-1) // Socket lookups in the netns of the device (uapi define, not in vmlinux.h)
 #define MAX_ENTRIES 1024  // Maximum number of tracked IPs
 
+// Count-min sketch dimensions (width must be a power of two)
+#define CMS_DEPTH 4
+#define CMS_WIDTH 1024
+#define HH_CANDIDATES 64   // Slots in the heavy-hitter candidate table (power of two)
+
+// Bits of filter_settings.flags
+#define SETTING_IP_STATS (1U << 0) // Track every source in ip_stats_map
+#define SETTING_SKETCH   (1U << 1) // Update the count-min sketch and candidate table
+#define SETTING_HLL      (1U << 2) // Update the HyperLogLog distinct-source estimators
+#define SETTING_XSK      (1U << 3) // Redirect inspected sources / ports to AF_XDP sockets
+#define SETTING_LATENCY  (1U << 4) // Record sampled per-stage latencies in latency_hist_map
+#define SETTING_SYNCOOKIE (1U << 5) // Answer SYNs to syncookie_ports_map with SYN cookies
+#define SETTING_CONNTRACK (1U << 6) // Let verified flows in conntrack_map skip the policy stages
+#define SETTING_CONN_LIMITS (1U << 7) // Enforce conn_limits_map (SYN rate / concurrent connections)
+#define SETTING_L4_RULES (1U << 8) // Evaluate the compiled l4_rule set
+#define SETTING_VIP_POLICIES (1U << 9) // Select per-destination policies from vip_dst_map
+#define SETTING_CPUMAP (1U << 10) // Spread packets over cpumap_cpus_map with a flow hash
+#define SETTING_BLACKLIST_REDIRECT (1U << 11) // Divert blacklisted sources to honeypot_map instead of dropping
+#define SETTING_CAPTURE (1U << 12) // Copy sampled dropped / diverted packets to capture_ringbuf
+#define SETTING_FLOW_EXPORT (1U << 13) // Account every TCP/UDP flow in flow_export_map
+
+#define XSK_MAX_QUEUES 64  // RX queues that can have an AF_XDP socket
+#define INSPECT_PORTS_MAX 64 // Protected ports whose payloads are inspected
+#define SYNCOOKIE_PORTS_MAX 64 // Listening ports protected by SYN cookies
+
+// Counters of syncookie_stats_map
+#define SYNCOOKIE_SENT 0     // SYN answered with a SYN-ACK from XDP
+#define SYNCOOKIE_VALID 1    // ACK to a listener with a valid cookie, passed to the stack
+#define SYNCOOKIE_INVALID 2  // ACK to a listener with a bad cookie, dropped
+#define SYNCOOKIE_ERROR 3    // SYN left to the stack (cookie generation or resize failed)
+#define SYNCOOKIE_COUNTERS 4
+
+#define CONNTRACK_MAX 65536 // Verified flows remembered (LRU)
+#define CONN_SOURCES_MAX 65536 // Sources with connection-limit state (LRU)
+#define FLOW_EXPORT_MAX 65536 // Flows waiting for export (LRU)
+
+// Verdicts of a flow_record
+#define FLOW_PASSED 0
+#define FLOW_DROPPED 1
+#define FLOW_REDIRECTED 2 // AF_XDP inspection or honeypot interface
+
+// Drop reasons, counted from COUNTER_DROP_REASONS in counters_map
+#define DROP_BLACKLIST 0      // Source in blacklist_subnets_map
+#define DROP_RATE_LIMIT 1     // Over the ip_rate_limits_map packet rate
+#define DROP_SYN_RATE 2       // Over the per-source new-connection rate
+#define DROP_CONN_LIMIT 3     // Over the per-source concurrent connection cap
+#define DROP_BAD_COOKIE 4     // ACK to a SYN-cookie port with an invalid cookie
+#define DROP_COOKIE_REPLY 5   // SYN answered with a SYN cookie (not delivered to the stack)
+#define DROP_L4_RULE 6        // Matched an l4_rule with action drop
+#define DROP_L4_RATE 7        // Over the rate of a matching l4_rule with action rate_limit
+#define DROP_REASONS 8
+
+// Indexes of cpu_counters.values
+#define COUNTER_DROPPED 0
+#define COUNTER_PASSED 1
+#define COUNTER_REDIRECTED 2     // Handed to user-space inspection or diverted to the honeypot
+#define COUNTER_DROPPED_BYTES 3
+#define COUNTER_PASSED_BYTES 4
+#define COUNTER_REDIRECTED_BYTES 5
+#define COUNTER_DROP_REASONS 6   // + DROP_* reason
+#define COUNTERS (COUNTER_DROP_REASONS + DROP_REASONS)
+
+// L4 rule engine: rule i is bit i, lower bits win (config order)
+#define L4_RULES_MAX 64
+#define L4_ACTION_PASS 0       // Stop rule evaluation, continue with the rest of the filter
+#define L4_ACTION_DROP 1
+#define L4_ACTION_RATE_LIMIT 2 // Shared packet rate of every packet matching the rule
+#define L4_ACTION_REDIRECT 3   // Divert to the honeypot interface (dropped over its rate cap)
+
+// Sampled capture of dropped / diverted packets
+#define CAPTURE_SNAPLEN_MAX 256       // Bytes copied per packet at most
+#define CAPTURE_RINGBUF_SIZE (1 << 22) // Ring buffer shared with the pcap writer (4 MiB)
+#define CAPTURE_SAMPLED 0             // capture_stats_map: records submitted
+#define CAPTURE_LOST 1                // capture_stats_map: samples lost to a full ring buffer
+#define CAPTURE_COUNTERS 2
+
+// Counters of honeypot_stats_map
+#define HONEYPOT_REDIRECTED 0 // Diverted packets sent to the honeypot interface
+#define HONEYPOT_OVER_CAP 1   // Diverted packets dropped by the rate cap
+#define HONEYPOT_COUNTERS 2
+
+// Inserts refused by a full map (map_fail_map)
+#define MAP_FAIL_IP_STATS 0      // ip_stats_map: the source is filtered without per-source stats
+#define MAP_FAIL_IP_TIMESTAMPS 1 // ip_timestamps_map: packets of the source are not timed
+#define MAP_FAIL_COUNTERS 2
+
+#define VIP_POLICIES_MAX 64 // Destination policies, ids 1..VIP_POLICIES_MAX (0 = interface-wide lists)
+#define IFACES_MAX 64       // Interfaces the program can be attached to at the same time
+#define CPUMAP_MAX 256      // cpu_map entries (resized to the possible CPUs) and cpumap_cpus_map slots
+
+// TCP flag bits (byte 13 of the TCP header)
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+#define TCP_FLAG_ACK 0x10
+
+// HyperLogLog estimators (2^HLL_PRECISION one-byte registers each)
+#define HLL_PRECISION 10
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+#define HLL_HASH_ROW 7     // cms_hash() row reserved for the HyperLogLog hash
+#define HLL_ALL 0          // Every source
+#define HLL_DROPPED 1      // Sources with at least one dropped packet
+#define HLL_PASSED 2       // Sources with at least one passed packet
+#define HLL_SETS 3
+
+// Sampled latency histograms (log2 buckets of nanoseconds)
+#define LAT_BUCKETS 32
+#define LAT_STAGE_ACCOUNTING 0 // Settings lookup, sketch and HyperLogLog updates
+#define LAT_STAGE_STATE 1      // Per-source statistics and rate limiting
+#define LAT_STAGE_RULES 2      // Blacklist / inspection lookups and the verdict counters
+#define LAT_STAGE_TOTAL 3      // Whole program from the settings lookup on
+#define LAT_STAGES 4
+
 // Cấu trúc key cho LPM Trie map
 // ip: Địa chỉ IP của subnet (network byte order)
 // prefixlen: Độ dài tiền tố (ví dụ: 24 cho /24)
@@ -31,14 +147,183 @@ struct packet_timestamp {
     __u64 last_timestamp; // Last packet timestamp in nanoseconds
 };
 
+// Runtime switches written by user-space on every config load
+struct filter_settings {
+    __u32 flags;               // SETTING_* bits
+    __u32 latency_sample_mask; // A packet is timed when (random & mask) == 0
+    __u32 conntrack_idle_sec;  // Flows idle for longer go through the policy stages again
+    __u32 cpumap_cpus;         // Slots used in cpumap_cpus_map
+    __u32 capture_sample_mask; // A dropped / diverted packet is captured when (random & mask) == 0
+    __u32 capture_snaplen;     // Bytes copied per captured packet (at most CAPTURE_SNAPLEN_MAX)
+    __u32 xsk_ifindex;         // Interface whose queues have the AF_XDP sockets, 0 = any (replay)
+};
+
+// Per-source TCP connection limits (key 0 holds the "*" default)
+struct conn_limit {
+    __u32 syn_per_sec; // New connections per second, 0 = unlimited
+    __u32 max_conns;   // Concurrent tracked connections, 0 = unlimited
+};
+
+// Per-source connection state
+struct conn_counter {
+    __u32 window; // bpf_ktime_get_ns() >> 30 of the SYN count
+    __u32 syns;   // SYNs seen in window
+    __u32 active; // TCP flows of the source in conntrack_map (re-counted by user-space)
+    __u32 pad;
+};
+
+// Compiled l4_rule (match fields live in the l4_*_map bitmaps)
+struct l4_rule {
+    __u32 action;      // L4_ACTION_*
+    __u32 pps;         // L4_ACTION_RATE_LIMIT only
+    __u64 interval_ns; // Minimum interval between two packets of the rule
+};
+
+// Per-rule counters
+struct l4_rule_stats {
+    __u64 packets;
+    __u64 bytes;
+};
+
+// Source prefix scoped to a destination policy; prefixlen counts the 32 policy bits
+// too, so a lookup only matches entries of its own policy
+struct policy_trie_key {
+    __u32 prefixlen; // 32 + source prefix length
+    __u32 policy;
+    __u32 ip;        // IPv4 address (network byte order)
+};
+
+// Source IP scoped to a destination policy
+struct policy_ip_key {
+    __u32 policy;
+    __u32 ip; // IPv4 address (network byte order)
+};
+
+// Verdicts of the traffic to one destination policy
+struct vip_stats {
+    __u64 dropped;
+    __u64 passed;
+};
+
+// Verdicts of the traffic received on one interface
+struct iface_stats {
+    __u64 dropped;
+    __u64 passed;
+    __u64 redirected;
+};
+
+// Rate cap of the honeypot redirects (token bucket kept as a theoretical arrival time)
+struct honeypot_config {
+    __u64 interval_ns; // 1s / honeypot_pps, 0 = no honeypot interface (diverted packets are dropped)
+    __u64 burst_ns;    // honeypot_burst * interval_ns
+};
+
+// One sampled packet in capture_ringbuf
+struct capture_record {
+    __u64 ts_ns;  // bpf_ktime_get_ns() (CLOCK_MONOTONIC)
+    __u32 len;    // Packet length
+    __u32 caplen; // Bytes of data used
+    __u8 data[CAPTURE_SNAPLEN_MAX];
+};
+
+// 5-tuple of a TCP/UDP flow (addresses and ports in network byte order)
+struct flow_key {
+    __u32 saddr;
+    __u32 daddr;
+    __u16 sport;
+    __u16 dport;
+    __u8 protocol;
+    __u8 pad[3];
+};
+
+// Verified flow: counters and the update_signal_map generation it was verified under
+struct flow_state {
+    __u64 first_seen_ns;
+    __u64 last_seen_ns;
+    __u64 packets;
+    __u64 bytes;
+    __u64 generation;
+    __u32 policed;     // Source had a rate limit: counted here but never fast-pathed
+    __u32 pad;
+};
+
+// One row of the count-min sketch: packet and byte counters per bucket
+struct cms_row {
+    __u64 packets[CMS_WIDTH];
+    __u64 bytes[CMS_WIDTH];
+};
+
+// Heavy-hitter candidate slot, owned by the source that dominates the slot
+// within the current ~1s window (majority vote, constant cost per packet)
+struct hh_candidate {
+    __u32 ip;     // Source IP (network byte order)
+    __u32 window; // bpf_ktime_get_ns() >> 30 of the last update
+    __u64 votes;  // Packets of ip minus packets of other sources in this window
+};
+
+// HyperLogLog registers of one estimator
+struct hll_registers {
+    __u8 reg[HLL_REGISTERS];
+};
+
+// Latency histogram of one stage
+struct latency_hist {
+    __u64 buckets[LAT_BUCKETS]; // buckets[i]: durations in [2^i, 2^(i+1)) ns
+    __u64 sum_ns;
+};
+
+// Counters of one CPU in counters_map. Only that CPU writes its slot, so the updates
+// are plain increments; seq is odd while a verdict is being counted, which lets a
+// reader retry instead of seeing the total and the reason of one drop half-applied.
+// Two cache lines per CPU, no false sharing between neighbours.
+struct cpu_counters {
+    __u32 seq;
+    __u32 pad;
+    __u64 values[COUNTERS];
+    __u64 pad_to_line[1];
+};
+
+// Exported flow: counters and verdict of the packets seen since the record was created
+struct flow_record {
+    __u64 first_seen_ns;
+    __u64 last_seen_ns;
+    __u64 packets;
+    __u64 bytes;
+    __u64 dropped_packets;
+    __u32 ifindex;     // Ingress interface of the first packet
+    __u8 tcp_flags;    // TCP flags seen, ORed
+    __u8 verdict;      // FLOW_* of the last packet
+    __u8 drop_reason;  // DROP_* of the last dropped packet
+    __u8 pad;
+};
+
+// Per-packet state carried to the verdict helpers
+struct pkt_ctx {
+    struct packet_stats *ip_stats; // NULL when per-source tracking is off
+    __u32 hll_idx;                 // HyperLogLog register of the source
+    __u8 hll_rank;                 // 0 when HyperLogLog is off
+    __u8 lat_stage;                // Stage being timed
+    __u8 policed;                  // Source has a rate limit, its flows are never fast-pathed
+    __u8 allowed;                  // Source is on the allowlist of its destination policy
+    __u8 capture;                  // SETTING_CAPTURE: drops and diverts may be sampled
+    __u32 policy;                  // Destination policy, 0 = interface-wide lists
+    __u32 ifindex;                 // Ingress interface
+    __u64 lat_start;               // 0 when this packet is not sampled
+    __u64 lat_stage_start;
+    struct xdp_md *ctx;            // The packet itself, for the sampled capture
+    struct flow_key *flow;         // SETTING_FLOW_EXPORT: 5-tuple of the packet, NULL otherwise
+    __u32 bytes;                   // Packet length
+    __u8 tcp_flags;
+};
+
 // Định blacklist subnet
 // Key: bpf_trie_key (chứa subnet và prefixlen)
-// Value: Một giá trị placeholder (u8), sự tồn tại của key đã đủ
+// Value: số gói tin đã khớp với rule này (per-rule hit counter)
 struct {
     __uint(type, BPF_MAP_TYPE_LPM_TRIE);
     __uint(max_entries, 1024); // Số lượng subnet tối đa
     __type(key, struct bpf_trie_key);
-    __type(value, __u8);
+    __type(value, __u64);
     __uint(map_flags, BPF_F_NO_PREALLOC); // Không cấp phát trước, tiết kiệm bộ nhớ
 } blacklist_subnets_map SEC(".maps"); // Đổi tên map để rõ ràng hơn
 
@@ -51,20 +336,24 @@ struct {
 } update_signal_map SEC(".maps");
 
 // Map for tracking packet statistics per IP address
+// Per-CPU so the hot path needs no atomics; user-space sums the CPUs when reading
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
     __uint(max_entries, MAX_ENTRIES); // Maximum number of tracked IPs
     __type(key, __u32);               // IP address as key
     __type(value, struct packet_stats); // Statistics as value
 } ip_stats_map SEC(".maps");
 
-// Map for global counters (for quick access to totals)
+// Global verdict and drop-reason counters, one cpu_counters slot per CPU (key = CPU id).
+// Memory-mapped by user-space: totals are read without a syscall per counter.
+// User-space sets max_entries to the number of possible CPUs.
 struct {
     __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, 2);  // 0: dropped, 1: passed
+    __uint(map_flags, BPF_F_MMAPABLE);
+    __uint(max_entries, 1);
     __type(key, __u32);
-    __type(value, __u64);
-} global_stats_map SEC(".maps");
+    __type(value, struct cpu_counters);
+} counters_map SEC(".maps");
 
 // New map for rate limiting configuration
 struct {
@@ -82,8 +371,1074 @@ struct {
     __type(value, struct packet_timestamp); // Timestamp tracking as value
 } ip_timestamps_map SEC(".maps");
 
-SEC("xdp")
-int xdp_filter(struct xdp_md *ctx) {
+// Runtime settings (single entry)
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct filter_settings);
+} settings_map SEC(".maps");
+
+// Count-min sketch over source IPs, one array entry per row
+// Fixed memory regardless of how many sources are seen; user-space merges the CPUs
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, CMS_DEPTH);
+    __type(key, __u32);
+    __type(value, struct cms_row);
+} cms_map SEC(".maps");
+
+// Heavy-hitter candidates whose sketch estimates user-space reports
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, HH_CANDIDATES);
+    __type(key, __u32);
+    __type(value, struct hh_candidate);
+} hh_candidates_map SEC(".maps");
+
+// Distinct-source estimators, keyed by HLL_ALL / HLL_DROPPED / HLL_PASSED
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, HLL_SETS);
+    __type(key, __u32);
+    __type(value, struct hll_registers);
+} hll_map SEC(".maps");
+
+// Sources whose packets are handed to the AF_XDP inspection workers (value: hit counter)
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 1024);
+    __type(key, struct bpf_trie_key);
+    __type(value, __u64);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} inspect_subnets_map SEC(".maps");
+
+// TCP/UDP destination ports (host byte order) whose packets go to the inspection workers
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, INSPECT_PORTS_MAX);
+    __type(key, __u16);
+    __type(value, __u8);
+} inspect_ports_map SEC(".maps");
+
+// AF_XDP sockets by RX queue, filled by user-space
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, XSK_MAX_QUEUES);
+    __type(key, __u32);
+    __type(value, __u32);
+} xsks_map SEC(".maps");
+
+// TCP destination ports (host byte order) whose handshakes are answered from XDP
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, SYNCOOKIE_PORTS_MAX);
+    __type(key, __u16);
+    __type(value, __u8);
+} syncookie_ports_map SEC(".maps");
+
+// SYNCOOKIE_* counters
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, SYNCOOKIE_COUNTERS);
+    __type(key, __u32);
+    __type(value, __u64);
+} syncookie_stats_map SEC(".maps");
+
+// Connection tracking: flows that passed every policy stage
+// LRU so floods of new flows only evict the oldest entries
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, CONNTRACK_MAX);
+    __type(key, struct flow_key);
+    __type(value, struct flow_state);
+} conntrack_map SEC(".maps");
+
+// Flow records drained by the user-space IPFIX exporter; LRU so the memory stays bounded,
+// a flood of new flows evicts the least recently seen records before they are exported
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, FLOW_EXPORT_MAX);
+    __type(key, struct flow_key);
+    __type(value, struct flow_record);
+} flow_export_map SEC(".maps");
+
+// ip_conn_limits from the config, by source IP (network byte order) or 0 for "*"
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, __u32);
+    __type(value, struct conn_limit);
+} conn_limits_map SEC(".maps");
+
+// SYN rate and concurrent connections per source
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, CONN_SOURCES_MAX);
+    __type(key, __u32);
+    __type(value, struct conn_counter);
+} conn_state_map SEC(".maps");
+
+
+// L4 rule bitmaps: a packet matches rule i when bit i is set in all three lookups
+// IP protocol -> rules that accept the protocol
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 256);
+    __type(key, __u32);
+    __type(value, __u64);
+} l4_proto_map SEC(".maps");
+
+// Destination port (host byte order, 0 for packets without ports) -> rules that accept the port
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 65536);
+    __type(key, __u32);
+    __type(value, __u64);
+} l4_port_map SEC(".maps");
+
+// Source prefix -> rules whose source covers the prefix (0/0 holds the any-source rules)
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 1024);
+    __type(key, struct bpf_trie_key);
+    __type(value, __u64);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} l4_src_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, L4_RULES_MAX);
+    __type(key, __u32);
+    __type(value, struct l4_rule);
+} l4_rules_map SEC(".maps");
+
+// Last packet time of each rate_limit rule
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, L4_RULES_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} l4_rule_last_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, L4_RULES_MAX);
+    __type(key, __u32);
+    __type(value, struct l4_rule_stats);
+} l4_rule_stats_map SEC(".maps");
+
+// Destination prefix -> policy id (1..VIP_POLICIES_MAX); unmatched destinations use policy 0,
+// the interface-wide blacklist_subnets_map / ip_rate_limits_map
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 256);
+    __type(key, struct bpf_trie_key);
+    __type(value, __u32);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} vip_dst_map SEC(".maps");
+
+// Per-policy blacklist (value: per-rule hit counter)
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 4096);
+    __type(key, struct policy_trie_key);
+    __type(value, __u64);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} vip_blacklist_map SEC(".maps");
+
+// Per-policy allowlist: sources that skip the blacklist and rate limits of the policy
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 1024);
+    __type(key, struct policy_trie_key);
+    __type(value, __u8);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} vip_allowlist_map SEC(".maps");
+
+// Per-policy rate limits
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 4096);
+    __type(key, struct policy_ip_key);
+    __type(value, struct ip_rate_limit);
+} vip_rate_limits_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct policy_ip_key);
+    __type(value, struct packet_timestamp);
+} vip_timestamps_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, VIP_POLICIES_MAX + 1);
+    __type(key, __u32);
+    __type(value, struct vip_stats);
+} vip_stats_map SEC(".maps");
+
+// ingress ifindex -> policy id of the traffic whose destination matches no vip_dst_map entry
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, IFACES_MAX);
+    __type(key, __u32);
+    __type(value, __u32);
+} iface_policy_map SEC(".maps");
+
+// Per-interface counters, keyed by ingress ifindex; user-space creates the entry on attach
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, IFACES_MAX);
+    __type(key, __u32);
+    __type(value, struct iface_stats);
+} iface_stats_map SEC(".maps");
+
+// Remote CPUs of cpumap mode, keyed by CPU id; every entry runs xdp_filter_cpumap
+struct {
+    __uint(type, BPF_MAP_TYPE_CPUMAP);
+    __uint(max_entries, CPUMAP_MAX);
+    __type(key, __u32);
+    __type(value, struct bpf_cpumap_val);
+} cpu_map SEC(".maps");
+
+// Flow hash slot -> CPU id in cpu_map (slots 0 .. filter_settings.cpumap_cpus - 1)
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, CPUMAP_MAX);
+    __type(key, __u32);
+    __type(value, __u32);
+} cpumap_cpus_map SEC(".maps");
+
+// Honeypot / scrubbing interface (key 0 -> ifindex), the target of diverted packets
+struct {
+    __uint(type, BPF_MAP_TYPE_DEVMAP);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} honeypot_map SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct honeypot_config);
+} honeypot_config_map SEC(".maps");
+
+// Shared by every CPU: earliest time the bucket is full again
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} honeypot_bucket_map SEC(".maps");
+
+// Per-CPU counters, keyed by HONEYPOT_*
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, HONEYPOT_COUNTERS);
+    __type(key, __u32);
+    __type(value, __u64);
+} honeypot_stats_map SEC(".maps");
+
+// Sampled packets for the pcap writer thread
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, CAPTURE_RINGBUF_SIZE);
+} capture_ringbuf SEC(".maps");
+
+// Per-CPU counters, keyed by CAPTURE_*
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, CAPTURE_COUNTERS);
+    __type(key, __u32);
+    __type(value, __u64);
+} capture_stats_map SEC(".maps");
+
+// Per-CPU counts of failed inserts into the per-source maps, keyed by MAP_FAIL_*.
+// A full hash map refuses new keys: user-space reports these next to the occupancy.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, MAP_FAIL_COUNTERS);
+    __type(key, __u32);
+    __type(value, __u64);
+} map_fail_map SEC(".maps");
+
+// Occupancy of the bounded maps (must match struct MapUsage), keyed by MAP_USAGE_* of
+// packet_filter.h. Only user-space writes it, after each count of the map usage monitor;
+// it is pinned so pf_top can show the counts without walking the maps again.
+#define MAP_USAGE_SLOTS 6
+struct map_usage {
+    __u64 entries;
+    __u64 capacity;
+    __u64 high_water;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, MAP_USAGE_SLOTS);
+    __type(key, __u32);
+    __type(value, struct map_usage);
+} map_usage_map SEC(".maps");
+
+// Sampled latency histograms, keyed by LAT_STAGE_*
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, LAT_STAGES);
+    __type(key, __u32);
+    __type(value, struct latency_hist);
+} latency_hist_map SEC(".maps");
+
+// Hash of a source IP for sketch row `row` (row == CMS_DEPTH selects the candidate slot)
+// Must match cms_hash() in user-space
+static __always_inline __u32 cms_hash(__u32 ip, __u32 row) {
+    __u32 h = ip * 0x9E3779B1U + row * 0x85EBCA6BU;
+    h ^= h >> 16;
+    h *= 0x7FEB352DU;
+    h ^= h >> 15;
+    h *= 0x846CA68BU;
+    h ^= h >> 16;
+    return h;
+}
+
+// Add one packet of `bytes` bytes from src_ip to the sketch and candidate table
+static __always_inline void sketch_update(__u32 src_ip, __u64 bytes) {
+    for (__u32 row = 0; row < CMS_DEPTH; row++) {
+        struct cms_row *counters = bpf_map_lookup_elem(&cms_map, &row);
+        if (!counters) {
+            return;
+        }
+        __u32 idx = cms_hash(src_ip, row) & (CMS_WIDTH - 1);
+        counters->packets[idx]++;
+        counters->bytes[idx] += bytes;
+    }
+
+    __u32 slot = cms_hash(src_ip, CMS_DEPTH) & (HH_CANDIDATES - 1);
+    struct hh_candidate *candidate = bpf_map_lookup_elem(&hh_candidates_map, &slot);
+    if (!candidate) {
+        return;
+    }
+    __u32 window = bpf_ktime_get_ns() >> 30;
+    if (candidate->ip == src_ip) {
+        candidate->votes = candidate->window == window ? candidate->votes + 1 : 1;
+        candidate->window = window;
+    } else if (candidate->window != window || candidate->votes <= 1) {
+        candidate->ip = src_ip;
+        candidate->window = window;
+        candidate->votes = 1;
+    } else {
+        candidate->votes--;
+    }
+}
+
+// Position of the first set bit of w counted from the MSB (1-based), 33 for w == 0
+static __always_inline __u8 hll_rank(__u32 w) {
+    __u8 rank = 1;
+    if (!w) {
+        return 33;
+    }
+    if (!(w & 0xFFFF0000)) { rank += 16; w <<= 16; }
+    if (!(w & 0xFF000000)) { rank += 8; w <<= 8; }
+    if (!(w & 0xF0000000)) { rank += 4; w <<= 4; }
+    if (!(w & 0xC0000000)) { rank += 2; w <<= 2; }
+    if (!(w & 0x80000000)) { rank += 1; }
+    return rank;
+}
+
+// floor(log2(v)) for v > 0, 0 for v == 0
+static __always_inline __u32 log2_u64(__u64 v) {
+    __u32 r = 0;
+    if (v >> 32) { r += 32; v >>= 32; }
+    if (v >> 16) { r += 16; v >>= 16; }
+    if (v >> 8) { r += 8; v >>= 8; }
+    if (v >> 4) { r += 4; v >>= 4; }
+    if (v >> 2) { r += 2; v >>= 2; }
+    if (v >> 1) { r += 1; }
+    return r;
+}
+
+static __always_inline void latency_add(__u32 stage, __u64 delta_ns) {
+    struct latency_hist *hist = bpf_map_lookup_elem(&latency_hist_map, &stage);
+    if (hist) {
+        __u32 bucket = log2_u64(delta_ns);
+        if (bucket >= LAT_BUCKETS) {
+            bucket = LAT_BUCKETS - 1;
+        }
+        hist->buckets[bucket]++;
+        hist->sum_ns += delta_ns;
+    }
+}
+
+// Close the stage being timed and start the next one (no-op for unsampled packets)
+static __always_inline void latency_next_stage(struct pkt_ctx *pkt) {
+    if (!pkt->lat_start) {
+        return;
+    }
+    __u64 now = bpf_ktime_get_ns();
+    latency_add(pkt->lat_stage, now - pkt->lat_stage_start);
+    pkt->lat_stage++;
+    pkt->lat_stage_start = now;
+}
+
+// Close the last stage and record the whole program run
+static __always_inline void latency_done(struct pkt_ctx *pkt) {
+    if (!pkt->lat_start) {
+        return;
+    }
+    __u64 now = bpf_ktime_get_ns();
+    latency_add(pkt->lat_stage, now - pkt->lat_stage_start);
+    latency_add(LAT_STAGE_TOTAL, now - pkt->lat_start);
+}
+
+// Raise register pkt->hll_idx of estimator `set` to pkt->hll_rank
+static __always_inline void hll_add(__u32 set, struct pkt_ctx *pkt) {
+    if (!pkt->hll_rank) {
+        return;
+    }
+    struct hll_registers *regs = bpf_map_lookup_elem(&hll_map, &set);
+    if (regs) {
+        __u32 idx = pkt->hll_idx & (HLL_REGISTERS - 1);
+        if (regs->reg[idx] < pkt->hll_rank) {
+            regs->reg[idx] = pkt->hll_rank;
+        }
+    }
+}
+
+static __always_inline void map_insert_failed(__u32 counter) {
+    __u64 *value = bpf_map_lookup_elem(&map_fail_map, &counter);
+    if (value) {
+        (*value)++;
+    }
+}
+
+static __always_inline void capture_count(__u32 counter) {
+    __u64 *value = bpf_map_lookup_elem(&capture_stats_map, &counter);
+    if (value) {
+        (*value)++;
+    }
+}
+
+// Copy the first capture_snaplen bytes of one dropped / diverted packet in
+// (capture_sample_mask + 1) to capture_ringbuf; with the ring full the sample is lost
+static __always_inline void capture_sample(struct pkt_ctx *pkt) {
+    if (!pkt->capture) {
+        return;
+    }
+    __u32 settings_key = 0;
+    struct filter_settings *settings = bpf_map_lookup_elem(&settings_map, &settings_key);
+    if (!settings || (bpf_get_prandom_u32() & settings->capture_sample_mask)) {
+        return;
+    }
+    struct capture_record *record = bpf_ringbuf_reserve(&capture_ringbuf, sizeof(*record), 0);
+    if (!record) {
+        capture_count(CAPTURE_LOST);
+        return;
+    }
+    __u32 len = bpf_xdp_get_buff_len(pkt->ctx);
+    __u32 caplen = len < settings->capture_snaplen ? len : settings->capture_snaplen;
+    if (caplen > CAPTURE_SNAPLEN_MAX) {
+        caplen = CAPTURE_SNAPLEN_MAX;
+    }
+    if (caplen == 0 || bpf_xdp_load_bytes(pkt->ctx, 0, record->data, caplen) != 0) {
+        bpf_ringbuf_discard(record, 0);
+        return;
+    }
+    record->ts_ns = bpf_ktime_get_ns();
+    record->len = len;
+    record->caplen = caplen;
+    bpf_ringbuf_submit(record, 0);
+    capture_count(CAPTURE_SAMPLED);
+}
+
+// Add the packet to the record of its flow; user-space exports and deletes records
+// once they are idle or have been active for too long
+static __always_inline void flow_account(struct pkt_ctx *pkt, __u8 verdict, __u8 reason) {
+    if (!pkt->flow) {
+        return;
+    }
+    __u64 now = bpf_ktime_get_ns();
+    struct flow_record *record = bpf_map_lookup_elem(&flow_export_map, pkt->flow);
+    if (!record) {
+        struct flow_record new_record = {
+            .first_seen_ns = now,
+            .last_seen_ns = now,
+            .packets = 1,
+            .bytes = pkt->bytes,
+            .dropped_packets = verdict == FLOW_DROPPED,
+            .ifindex = pkt->ifindex,
+            .tcp_flags = pkt->tcp_flags,
+            .verdict = verdict,
+            .drop_reason = reason,
+        };
+        if (bpf_map_update_elem(&flow_export_map, pkt->flow, &new_record, BPF_NOEXIST) == 0) {
+            return;
+        }
+        record = bpf_map_lookup_elem(&flow_export_map, pkt->flow); // Created by another CPU meanwhile
+        if (!record) {
+            return;
+        }
+    }
+    record->last_seen_ns = now;
+    __sync_fetch_and_add(&record->packets, 1);
+    __sync_fetch_and_add(&record->bytes, pkt->bytes);
+    if (verdict == FLOW_DROPPED) {
+        __sync_fetch_and_add(&record->dropped_packets, 1);
+        record->drop_reason = reason;
+    }
+    record->tcp_flags |= pkt->tcp_flags;
+    record->verdict = verdict;
+}
+
+// Bump seq with a full barrier. Only this CPU writes its slot, so the exchange is a plain
+// increment; unlike barrier() or a non-fetching add it also orders the seq and value
+// stores for the reader on weakly ordered CPUs (arm64)
+static __always_inline void counters_seq_next(struct cpu_counters *counters) {
+    __atomic_exchange_n(&counters->seq, counters->seq + 1, __ATOMIC_SEQ_CST);
+}
+
+// Slot of this CPU in counters_map, with the update opened (seq odd); NULL if missing
+static __always_inline struct cpu_counters *counters_begin(void) {
+    __u32 cpu = bpf_get_smp_processor_id();
+    struct cpu_counters *counters = bpf_map_lookup_elem(&counters_map, &cpu);
+    if (counters) {
+        counters_seq_next(counters);
+    }
+    return counters;
+}
+
+static __always_inline void counters_end(struct cpu_counters *counters) {
+    counters_seq_next(counters);
+}
+
+// Account a packet dropped for DROP_* `reason` and return XDP_DROP
+static __always_inline int count_drop(struct pkt_ctx *pkt, __u32 reason) {
+    struct cpu_counters *counters = counters_begin();
+    if (counters) {
+        counters->values[COUNTER_DROPPED]++;
+        counters->values[COUNTER_DROPPED_BYTES] += pkt->bytes;
+        if (reason < DROP_REASONS) {
+            counters->values[COUNTER_DROP_REASONS + reason]++;
+        }
+        counters_end(counters);
+    }
+
+    // Update IP-specific statistics
+    if (pkt->ip_stats) {
+        pkt->ip_stats->dropped++;
+    }
+
+    struct iface_stats *iface = bpf_map_lookup_elem(&iface_stats_map, &pkt->ifindex);
+    if (iface) {
+        iface->dropped++;
+    }
+
+    if (pkt->policy) {
+        struct vip_stats *vip = bpf_map_lookup_elem(&vip_stats_map, &pkt->policy);
+        if (vip) {
+            vip->dropped++;
+        }
+    }
+
+    hll_add(HLL_DROPPED, pkt);
+    capture_sample(pkt);
+    flow_account(pkt, FLOW_DROPPED, reason);
+    latency_done(pkt);
+    return XDP_DROP;
+}
+
+// Account a passed packet and return XDP_PASS
+static __always_inline int count_pass(struct pkt_ctx *pkt) {
+    // Update IP-specific passed statistics
+    if (pkt->ip_stats) {
+        pkt->ip_stats->passed++;
+    }
+
+    struct iface_stats *iface = bpf_map_lookup_elem(&iface_stats_map, &pkt->ifindex);
+    if (iface) {
+        iface->passed++;
+    }
+
+    if (pkt->policy) {
+        struct vip_stats *vip = bpf_map_lookup_elem(&vip_stats_map, &pkt->policy);
+        if (vip) {
+            vip->passed++;
+        }
+    }
+
+    // Update global passed counter
+    struct cpu_counters *counters = counters_begin();
+    if (counters) {
+        counters->values[COUNTER_PASSED]++;
+        counters->values[COUNTER_PASSED_BYTES] += pkt->bytes;
+        counters_end(counters);
+    }
+
+    hll_add(HLL_PASSED, pkt);
+    flow_account(pkt, FLOW_PASSED, 0);
+    latency_done(pkt);
+    return XDP_PASS;
+}
+
+// Account a packet handed to user-space inspection and redirect it to the
+// socket of its RX queue; without a socket on that queue it is passed (and
+// counted as passed)
+static __always_inline int count_redirect(struct xdp_md *ctx, struct pkt_ctx *pkt) {
+    int action = bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+    if (action != XDP_REDIRECT) {
+        return count_pass(pkt);
+    }
+
+    struct cpu_counters *counters = counters_begin();
+    if (counters) {
+        counters->values[COUNTER_REDIRECTED]++;
+        counters->values[COUNTER_REDIRECTED_BYTES] += pkt->bytes;
+        counters_end(counters);
+    }
+
+    struct iface_stats *iface = bpf_map_lookup_elem(&iface_stats_map, &pkt->ifindex);
+    if (iface) {
+        iface->redirected++;
+    }
+
+    flow_account(pkt, FLOW_REDIRECTED, 0);
+    latency_done(pkt);
+    return action;
+}
+
+// Take one token of the honeypot rate cap: 1 = redirect, 0 = over the cap, -1 = no honeypot.
+// A lost race with another CPU counts as over the cap.
+static __always_inline int honeypot_admit(void) {
+    __u32 key = 0;
+    struct honeypot_config *config = bpf_map_lookup_elem(&honeypot_config_map, &key);
+    __u64 *full_at = bpf_map_lookup_elem(&honeypot_bucket_map, &key);
+    if (!config || !full_at || !config->interval_ns) {
+        return -1;
+    }
+    __u64 now = bpf_ktime_get_ns();
+    __u64 old = *full_at;
+    __u64 start = old > now ? old : now;
+    if (start - now >= config->burst_ns) {
+        return 0; // Bucket empty
+    }
+    return __sync_val_compare_and_swap(full_at, old, start + config->interval_ns) == old;
+}
+
+static __always_inline void honeypot_count(__u32 counter) {
+    __u64 *value = bpf_map_lookup_elem(&honeypot_stats_map, &counter);
+    if (value) {
+        (*value)++;
+    }
+}
+
+// Send a packet that would be dropped for DROP_* `reason` to the honeypot interface
+// (devmap redirect, stays in the driver); over the rate cap, or when the redirect
+// fails, it is dropped as usual
+static __always_inline int divert_or_drop(struct pkt_ctx *pkt, __u32 reason) {
+    int admit = honeypot_admit();
+    if (admit <= 0) {
+        if (admit == 0) {
+            honeypot_count(HONEYPOT_OVER_CAP);
+        }
+        return count_drop(pkt, reason);
+    }
+    int action = bpf_redirect_map(&honeypot_map, 0, XDP_DROP);
+    if (action != XDP_REDIRECT) {
+        return count_drop(pkt, reason);
+    }
+    honeypot_count(HONEYPOT_REDIRECTED);
+    capture_sample(pkt);
+
+    struct cpu_counters *counters = counters_begin();
+    if (counters) {
+        counters->values[COUNTER_REDIRECTED]++;
+        counters->values[COUNTER_REDIRECTED_BYTES] += pkt->bytes;
+        counters_end(counters);
+    }
+
+    // Never reaches the protected host: a drop for the source statistics
+    if (pkt->ip_stats) {
+        pkt->ip_stats->dropped++;
+    }
+    struct iface_stats *iface = bpf_map_lookup_elem(&iface_stats_map, &pkt->ifindex);
+    if (iface) {
+        iface->redirected++;
+    }
+
+    flow_account(pkt, FLOW_REDIRECTED, reason);
+    latency_done(pkt);
+    return action;
+}
+
+// True when the TCP/UDP destination port of the packet is in inspect_ports_map
+static __always_inline int inspect_port_match(struct iphdr *ip, void *data_end) {
+    if (ip->protocol != IPPROTO_TCP && ip->protocol != IPPROTO_UDP) {
+        return 0;
+    }
+    if (ip->frag_off & bpf_htons(0x1FFF)) {
+        return 0; // Only the first fragment carries the L4 header
+    }
+    __u32 ihl = ip->ihl * 4;
+    if (ihl < sizeof(*ip)) {
+        return 0;
+    }
+
+    // TCP and UDP headers both start with the source and destination ports
+    struct udphdr *l4 = (void *)ip + ihl;
+    if ((void *)(l4 + 1) > data_end) {
+        return 0;
+    }
+    __u16 port = bpf_ntohs(l4->dest);
+    return bpf_map_lookup_elem(&inspect_ports_map, &port) != NULL;
+}
+
+static __always_inline void syncookie_count(__u32 counter) {
+    __u64 *value = bpf_map_lookup_elem(&syncookie_stats_map, &counter);
+    if (value) {
+        (*value)++;
+    }
+}
+
+static __always_inline __u16 csum_fold(__u64 csum) {
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    return (__u16)~csum;
+}
+
+// Turn the SYN in ctx into a SYN-ACK carrying `cookie` and an MSS option.
+// Every field is rewritten from the saved values, so IP / TCP options of the SYN are dropped.
+// Returns -1 on failure: the packet pointers of the caller are then no longer valid.
+static __always_inline int syncookie_reply(struct xdp_md *ctx, struct ethhdr *eth_in, struct iphdr *ip_in,
+                                           struct tcphdr *tcp_in, __u64 cookie) {
+    struct ethhdr eth_orig = *eth_in;
+    __u32 saddr = ip_in->daddr;
+    __u32 daddr = ip_in->saddr;
+    __u16 sport = tcp_in->dest;
+    __u16 dport = tcp_in->source;
+    __u32 ack_seq = bpf_htonl(bpf_ntohl(tcp_in->seq) + 1);
+    __u16 mss = cookie >> 32;
+
+    // Ethernet + 20-byte IP header + 20-byte TCP header + MSS option
+    int new_len = sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct tcphdr) + 4;
+    int delta = new_len - (int)(ctx->data_end - ctx->data);
+    if (delta && bpf_xdp_adjust_tail(ctx, delta)) {
+        return -1;
+    }
+
+    void *data_end = (void *)(long)ctx->data_end;
+    struct ethhdr *eth = (void *)(long)ctx->data;
+    struct iphdr *ip = (void *)(eth + 1);
+    struct tcphdr *tcp = (void *)(ip + 1);
+    __u32 *mss_opt = (void *)(tcp + 1);
+    if ((void *)(mss_opt + 1) > data_end) {
+        return -1;
+    }
+
+    __builtin_memcpy(eth->h_dest, eth_orig.h_source, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, eth_orig.h_dest, ETH_ALEN);
+
+    ip->version = 4;
+    ip->ihl = 5;
+    ip->tos = 0;
+    ip->tot_len = bpf_htons(sizeof(struct iphdr) + sizeof(struct tcphdr) + 4);
+    ip->id = 0;
+    ip->frag_off = bpf_htons(0x4000); // DF
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_TCP;
+    ip->saddr = saddr;
+    ip->daddr = daddr;
+    ip->check = 0;
+    ip->check = csum_fold(bpf_csum_diff(0, 0, (__be32 *)ip, sizeof(*ip), 0));
+
+    __builtin_memset(tcp, 0, sizeof(*tcp));
+    tcp->source = sport;
+    tcp->dest = dport;
+    tcp->seq = bpf_htonl((__u32)cookie);
+    tcp->ack_seq = ack_seq;
+    tcp->doff = (sizeof(struct tcphdr) + 4) / 4;
+    tcp->syn = 1;
+    tcp->ack = 1;
+    tcp->window = bpf_htons(65535);
+    *mss_opt = bpf_htonl((2 << 24) | (4 << 16) | mss); // kind 2 (MSS), length 4
+
+    // Pseudo-header (addresses, protocol, TCP length) summed as raw 16-bit words
+    __u64 pseudo = (saddr & 0xffff) + (saddr >> 16) + (daddr & 0xffff) + (daddr >> 16) +
+                   bpf_htons(IPPROTO_TCP) + bpf_htons(sizeof(struct tcphdr) + 4);
+    tcp->check = csum_fold(bpf_csum_diff(0, 0, (__be32 *)tcp, sizeof(*tcp) + 4, pseudo));
+    return 0;
+}
+
+// SYN cookie stage for TCP to a protected port.
+// Returns an XDP action when the packet has been handled, -1 to continue with the filter
+// (only on paths where the packet has not been resized).
+static __always_inline int syncookie_stage(struct xdp_md *ctx, struct pkt_ctx *pkt, struct ethhdr *eth,
+                                           struct iphdr *ip, void *data_end) {
+    // Helpers from Linux 6.0; on older kernels libbpf turns this check into a constant false
+    if (!bpf_core_enum_value_exists(enum bpf_func_id, BPF_FUNC_tcp_raw_gen_syncookie_ipv4)) {
+        return -1;
+    }
+    if (ip->protocol != IPPROTO_TCP || (ip->frag_off & bpf_htons(0x1FFF))) {
+        return -1;
+    }
+    __u32 ihl = ip->ihl * 4;
+    if (ihl < sizeof(*ip) || ihl > 60) {
+        return -1;
+    }
+    struct tcphdr *tcp = (void *)ip + ihl;
+    if ((void *)(tcp + 1) > data_end) {
+        return -1;
+    }
+    __u16 port = bpf_ntohs(tcp->dest);
+    if (!bpf_map_lookup_elem(&syncookie_ports_map, &port)) {
+        return -1;
+    }
+
+    if (tcp->syn && !tcp->ack && !tcp->rst) {
+        __u32 tcp_len = tcp->doff * 4;
+        if (tcp_len < sizeof(*tcp) || (void *)tcp + tcp_len > data_end) {
+            return -1;
+        }
+        __s64 cookie = bpf_tcp_raw_gen_syncookie_ipv4(ip, tcp, tcp_len);
+        if (cookie < 0) {
+            syncookie_count(SYNCOOKIE_ERROR);
+            return -1;
+        }
+        if (syncookie_reply(ctx, eth, ip, tcp, cookie) != 0) {
+            // The tail adjust invalidated eth / ip / data_end: never go back into the
+            // filter with them, the client retransmits the SYN
+            syncookie_count(SYNCOOKIE_ERROR);
+            return count_drop(pkt, DROP_COOKIE_REPLY);
+        }
+        syncookie_count(SYNCOOKIE_SENT);
+        count_drop(pkt, DROP_COOKIE_REPLY); // The SYN itself never reaches the stack
+        return XDP_TX;
+    }
+
+    if (!tcp->ack || tcp->syn || tcp->rst) {
+        return -1;
+    }
+
+    // Only ACKs that would land on a listening socket can complete a cookie handshake;
+    // established and time-wait sockets handle their own segments
+    struct bpf_sock_tuple tuple = {};
+    tuple.ipv4.saddr = ip->saddr;
+    tuple.ipv4.daddr = ip->daddr;
+    tuple.ipv4.sport = tcp->source;
+    tuple.ipv4.dport = tcp->dest;
+    struct bpf_sock *sk = bpf_skc_lookup_tcp(ctx, &tuple, sizeof(tuple.ipv4), BPF_F_CURRENT_NETNS, 0);
+    if (!sk) {
+        return -1;
+    }
+    __u32 state = sk->state;
+    bpf_sk_release(sk);
+    if (state != BPF_TCP_LISTEN) {
+        return -1;
+    }
+
+    if (bpf_tcp_raw_check_syncookie_ipv4(ip, tcp) != 0) {
+        syncookie_count(SYNCOOKIE_INVALID);
+        return count_drop(pkt, DROP_BAD_COOKIE);
+    }
+    syncookie_count(SYNCOOKIE_VALID);
+    return -1;
+}
+
+// Fill *flow and *tcp_flags from a TCP/UDP packet; returns 0 for anything else
+static __always_inline int flow_parse(struct iphdr *ip, void *data_end, struct flow_key *flow, __u8 *tcp_flags) {
+    if (ip->protocol != IPPROTO_TCP && ip->protocol != IPPROTO_UDP) {
+        return 0;
+    }
+    if (ip->frag_off & bpf_htons(0x3FFF)) {
+        return 0; // Fragments: the ports are not in every piece
+    }
+    __u32 ihl = ip->ihl * 4;
+    if (ihl < sizeof(*ip)) {
+        return 0;
+    }
+    struct tcphdr *l4 = (void *)ip + ihl;
+    if (ip->protocol == IPPROTO_TCP) {
+        if ((void *)(l4 + 1) > data_end) {
+            return 0;
+        }
+        *tcp_flags = ((__u8 *)l4)[13];
+    } else if ((void *)l4 + sizeof(struct udphdr) > data_end) {
+        return 0;
+    }
+
+    flow->saddr = ip->saddr;
+    flow->daddr = ip->daddr;
+    flow->sport = l4->source;
+    flow->dport = l4->dest;
+    flow->protocol = ip->protocol;
+    return 1;
+}
+
+// Limits of src_ip, falling back to the "*" entry
+static __always_inline struct conn_limit *conn_limit_lookup(__u32 src_ip) {
+    struct conn_limit *limit = bpf_map_lookup_elem(&conn_limits_map, &src_ip);
+    if (!limit) {
+        __u32 any = 0;
+        limit = bpf_map_lookup_elem(&conn_limits_map, &any);
+    }
+    return limit;
+}
+
+// Check a new connection attempt (SYN) of src_ip; returns a DROP_* reason or -1 to accept it
+static __always_inline int conn_limit_check(__u32 src_ip) {
+    struct conn_limit *limit = conn_limit_lookup(src_ip);
+    if (!limit) {
+        return -1;
+    }
+
+    __u32 window = bpf_ktime_get_ns() >> 30;
+    struct conn_counter *counter = bpf_map_lookup_elem(&conn_state_map, &src_ip);
+    if (!counter) {
+        struct conn_counter first = {.window = window, .syns = 1};
+        bpf_map_update_elem(&conn_state_map, &src_ip, &first, BPF_NOEXIST);
+        return -1;
+    }
+
+    if (limit->max_conns && counter->active >= limit->max_conns) {
+        return DROP_CONN_LIMIT;
+    }
+    if (counter->window != window) {
+        counter->window = window;
+        counter->syns = 0;
+    }
+    if (limit->syn_per_sec && __sync_fetch_and_add(&counter->syns, 1) >= limit->syn_per_sec) {
+        return DROP_SYN_RATE;
+    }
+    return -1;
+}
+
+// Track the number of conntrack flows of a source (delta = +1 on insert, -1 on removal)
+static __always_inline void conn_active_add(__u32 src_ip, int delta) {
+    struct conn_counter *counter = bpf_map_lookup_elem(&conn_state_map, &src_ip);
+    if (!counter) {
+        if (delta > 0) {
+            struct conn_counter first = {.active = 1};
+            bpf_map_update_elem(&conn_state_map, &src_ip, &first, BPF_NOEXIST);
+        }
+        return;
+    }
+    if (delta > 0) {
+        __sync_fetch_and_add(&counter->active, 1);
+    } else if (counter->active > 0) {
+        __sync_fetch_and_sub(&counter->active, 1);
+    }
+}
+
+// Remove a flow from conntrack_map and from the connection count of its source
+static __always_inline void conntrack_forget(struct flow_key *flow, __u32 flags) {
+    if (bpf_map_delete_elem(&conntrack_map, flow) == 0 && (flags & SETTING_CONN_LIMITS) &&
+        flow->protocol == IPPROTO_TCP) {
+        conn_active_add(flow->saddr, -1);
+    }
+}
+
+// Evaluate the L4 rules in constant time: three lookups, AND of the bitmaps, lowest bit wins.
+// DROP_* reason of the first matching rule, -1 to go on; *divert is set for L4_ACTION_REDIRECT
+static __always_inline int l4_rules_eval(struct bpf_trie_key *src, __u32 protocol, __u32 dport, __u64 bytes,
+                                         __u8 *divert) {
+    __u64 *proto_rules = bpf_map_lookup_elem(&l4_proto_map, &protocol);
+    if (!proto_rules || !*proto_rules) {
+        return -1;
+    }
+    __u64 *port_rules = bpf_map_lookup_elem(&l4_port_map, &dport);
+    if (!port_rules) {
+        return -1;
+    }
+    __u64 match = *proto_rules & *port_rules;
+    if (!match) {
+        return -1;
+    }
+    __u64 *src_rules = bpf_map_lookup_elem(&l4_src_map, src);
+    if (!src_rules) {
+        return -1;
+    }
+    match &= *src_rules;
+    if (!match) {
+        return -1;
+    }
+
+    __u32 idx = log2_u64(match & -match);
+    struct l4_rule_stats *stats = bpf_map_lookup_elem(&l4_rule_stats_map, &idx);
+    if (stats) {
+        stats->packets++;
+        stats->bytes += bytes;
+    }
+    struct l4_rule *rule = bpf_map_lookup_elem(&l4_rules_map, &idx);
+    if (!rule) {
+        return -1;
+    }
+    if (rule->action == L4_ACTION_DROP || rule->action == L4_ACTION_REDIRECT) {
+        *divert = rule->action == L4_ACTION_REDIRECT;
+        return DROP_L4_RULE;
+    }
+    if (rule->action == L4_ACTION_RATE_LIMIT) {
+        __u64 *last = bpf_map_lookup_elem(&l4_rule_last_map, &idx);
+        if (last) {
+            __u64 now = bpf_ktime_get_ns();
+            if (now - *last < rule->interval_ns) {
+                return DROP_L4_RATE;
+            }
+            *last = now;
+        }
+    }
+    return -1;
+}
+
+// Pick the destination policy of the packet (or else the policy of its ingress interface)
+// and check the source against its allowlist
+static __always_inline void vip_select(struct pkt_ctx *pkt, __u32 src_ip, __u32 dst_ip) {
+    struct bpf_trie_key dst_key = {.prefixlen = 32, .ip = dst_ip};
+    __u32 *policy = bpf_map_lookup_elem(&vip_dst_map, &dst_key);
+    if (!policy) {
+        policy = bpf_map_lookup_elem(&iface_policy_map, &pkt->ifindex);
+    }
+    if (!policy || !*policy) {
+        return;
+    }
+    pkt->policy = *policy;
+
+    struct policy_trie_key src_key = {.prefixlen = 64, .policy = *policy, .ip = src_ip};
+    pkt->allowed = bpf_map_lookup_elem(&vip_allowlist_map, &src_key) != NULL;
+}
+
+// Rate limit of the source within its destination policy, 1 when the packet is over the limit
+static __always_inline int vip_rate_limited(struct pkt_ctx *pkt, __u32 src_ip) {
+    struct policy_ip_key key = {.policy = pkt->policy, .ip = src_ip};
+    struct ip_rate_limit *rate_limit = bpf_map_lookup_elem(&vip_rate_limits_map, &key);
+    if (!rate_limit) {
+        return 0;
+    }
+    pkt->policed = 1;
+
+    __u64 now = bpf_ktime_get_ns();
+    struct packet_timestamp *timestamp = bpf_map_lookup_elem(&vip_timestamps_map, &key);
+    if (!timestamp) {
+        struct packet_timestamp new_timestamp = {.last_timestamp = now};
+        bpf_map_update_elem(&vip_timestamps_map, &key, &new_timestamp, BPF_ANY);
+        return 0;
+    }
+    if (now - timestamp->last_timestamp < rate_limit->packet_interval_ns) {
+        return 1;
+    }
+    timestamp->last_timestamp = now;
+    return 0;
+}
+
+// Only UDP and TCP segments of an established handshake (ACK without SYN/FIN/RST) create flows
+static __always_inline int flow_trackable(struct flow_key *flow, __u8 tcp_flags) {
+    if (flow->protocol == IPPROTO_UDP) {
+        return 1;
+    }
+    return (tcp_flags & (TCP_FLAG_ACK | TCP_FLAG_SYN | TCP_FLAG_FIN | TCP_FLAG_RST)) == TCP_FLAG_ACK;
+}
+
+// Whole filter, run by xdp_filter on the receiving CPU or by xdp_filter_cpumap on the
+// CPU picked by cpumap_steer()
+static __always_inline int filter_packet(struct xdp_md *ctx, struct filter_settings *settings) {
     void *data_end = (void *)(long)ctx->data_end;
     void *data = (void *)(long)ctx->data;
 
@@ -93,6 +1448,7 @@ int xdp_filter(struct xdp_md *ctx) {
     if (last_update_ts) {
         bpf_printk("XDP: IP blacklist was updated from user-space.\n");
     }
+    __u64 generation = last_update_ts ? *last_update_ts : 0; // Bumped on every filter change
 
     struct ethhdr *eth = data;
 
@@ -112,28 +1468,103 @@ int xdp_filter(struct xdp_md *ctx) {
 
     __u32 src_ip = ip->saddr; // IP nguồn của gói tin (network byte order)
 
+    __u32 flags = settings ? settings->flags : SETTING_IP_STATS;
+
+    struct pkt_ctx pkt = {0};
+    pkt.ifindex = ctx->ingress_ifindex;
+    pkt.capture = (flags & SETTING_CAPTURE) != 0;
+    pkt.ctx = ctx;
+    pkt.bytes = data_end - data;
+
+    // Time roughly one packet in (latency_sample_mask + 1), the clock reads are not free
+    if ((flags & SETTING_LATENCY) && settings && !(bpf_get_prandom_u32() & settings->latency_sample_mask)) {
+        pkt.lat_start = bpf_ktime_get_ns();
+        pkt.lat_stage_start = pkt.lat_start;
+    }
+
+    if (flags & SETTING_SKETCH) {
+        sketch_update(src_ip, data_end - data);
+    }
+
+    // HyperLogLog: one hash, the top bits pick the register, the rest give the rank
+    if (flags & SETTING_HLL) {
+        __u32 h = cms_hash(src_ip, HLL_HASH_ROW);
+        pkt.hll_idx = h >> (32 - HLL_PRECISION);
+        pkt.hll_rank = hll_rank(h << HLL_PRECISION);
+        if (pkt.hll_rank > 32 - HLL_PRECISION + 1) {
+            pkt.hll_rank = 32 - HLL_PRECISION + 1;
+        }
+        hll_add(HLL_ALL, &pkt);
+    }
+
+    latency_next_stage(&pkt); // LAT_STAGE_STATE
+
     // Tạo key để tra cứu trong LPM Trie
     struct bpf_trie_key key = {
         .prefixlen = 32, // Khi tìm một IP cụ thể trong subnet map, dùng prefixlen 32
         .ip = src_ip
     };
 
-    // Get or initialize packet stats for this IP
+    // 5-tuple for connection tracking, the per-source connection limits and flow export
+    struct flow_key flow = {};
+    __u8 tcp_flags = 0;
+    int has_flow = (flags & (SETTING_CONNTRACK | SETTING_CONN_LIMITS | SETTING_L4_RULES | SETTING_FLOW_EXPORT)) &&
+                   flow_parse(ip, data_end, &flow, &tcp_flags);
+    if (has_flow && (flags & SETTING_FLOW_EXPORT)) {
+        pkt.flow = &flow;
+        pkt.tcp_flags = tcp_flags;
+    }
+
+    // Chính sách theo địa chỉ đích (VIP): blacklist / rate limit / allowlist riêng của VIP
+    if (flags & SETTING_VIP_POLICIES) {
+        vip_select(&pkt, src_ip, ip->daddr);
+    }
+
+    // Get or initialize packet stats for this IP (skipped when per-source tracking is off)
     struct packet_stats new_stats = {0};
-    struct packet_stats *ip_stats = bpf_map_lookup_elem(&ip_stats_map, &src_ip);
-    if (!ip_stats) {
-        // If this IP isn't in the map yet, initialize it with zeros
-        bpf_map_update_elem(&ip_stats_map, &src_ip, &new_stats, BPF_ANY);
+    struct packet_stats *ip_stats = NULL;
+    if (flags & SETTING_IP_STATS) {
         ip_stats = bpf_map_lookup_elem(&ip_stats_map, &src_ip);
         if (!ip_stats) {
-            // This should not happen, but just in case
-            goto process_packet;
+            // If this IP isn't in the map yet, initialize it with zeros. With the map full
+            // the source is still rate limited and filtered, only without per-source stats.
+            if (bpf_map_update_elem(&ip_stats_map, &src_ip, &new_stats, BPF_ANY) != 0) {
+                map_insert_failed(MAP_FAIL_IP_STATS);
+            }
+            ip_stats = bpf_map_lookup_elem(&ip_stats_map, &src_ip);
+        }
+        pkt.ip_stats = ip_stats;
+    }
+
+    // Luồng đã được xác minh: bỏ qua rate limit / blacklist / SYN cookie, chỉ cập nhật bộ đếm.
+    // Flows verified before the last filter change, or idle too long, are checked again.
+    if (has_flow && (flags & SETTING_CONNTRACK)) {
+        struct flow_state *state = bpf_map_lookup_elem(&conntrack_map, &flow);
+        if (state) {
+            __u64 now = bpf_ktime_get_ns();
+            __u64 idle_ns = (__u64)(settings ? settings->conntrack_idle_sec : 0) * 1000000000ULL;
+            if (state->generation == generation && now - state->last_seen_ns < idle_ns) {
+                state->last_seen_ns = now;
+                __sync_fetch_and_add(&state->packets, 1);
+                __sync_fetch_and_add(&state->bytes, data_end - data);
+                if (tcp_flags & (TCP_FLAG_FIN | TCP_FLAG_RST)) {
+                    conntrack_forget(&flow, flags); // Connection is closing
+                }
+                if (!state->policed) {
+                    return count_pass(&pkt);
+                }
+                // Rate-limited source: tracked for visibility, still policed below
+            } else {
+                conntrack_forget(&flow, flags);
+            }
         }
     }
 
     // Rate limiting check - only if this IP has a rate limit configured
-    struct ip_rate_limit *rate_limit = bpf_map_lookup_elem(&ip_rate_limits_map, &src_ip);
+    // (traffic to a VIP uses the rate limits of its policy instead)
+    struct ip_rate_limit *rate_limit = pkt.policy ? NULL : bpf_map_lookup_elem(&ip_rate_limits_map, &src_ip);
     if (rate_limit) {
+        pkt.policed = 1;
         // Get current timestamp
         __u64 current_time = bpf_ktime_get_ns();
         
@@ -142,67 +1573,176 @@ int xdp_filter(struct xdp_md *ctx) {
         struct packet_timestamp *timestamp = bpf_map_lookup_elem(&ip_timestamps_map, &src_ip);
         if (!timestamp) {
             new_timestamp.last_timestamp = current_time;
-            bpf_map_update_elem(&ip_timestamps_map, &src_ip, &new_timestamp, BPF_ANY);
+            if (bpf_map_update_elem(&ip_timestamps_map, &src_ip, &new_timestamp, BPF_ANY) != 0) {
+                map_insert_failed(MAP_FAIL_IP_TIMESTAMPS);
+            }
         } else {
             // Check if packet arrived too soon
             if (current_time - timestamp->last_timestamp < rate_limit->packet_interval_ns) {
                 // Packet arrived too soon - rate limit exceeded
                 bpf_printk("XDP: Rate limit exceeded for IP: %pI4, dropping packet\n", &src_ip);
-                
-                // Update IP-specific statistics
-                if (ip_stats) {
-                    __sync_fetch_and_add(&ip_stats->dropped, 1);
-                }
-                
-                // Update global dropped counter
-                __u32 dropped_key = 0;
-                __u64 *dropped_count = bpf_map_lookup_elem(&global_stats_map, &dropped_key);
-                if (dropped_count) {
-                    __sync_fetch_and_add(dropped_count, 1);
-                }
-                
-                return XDP_DROP;
+                return count_drop(&pkt, DROP_RATE_LIMIT);
             }
             
             // Update the timestamp for the next packet
             timestamp->last_timestamp = current_time;
         }
     }
+    if (pkt.policy && !pkt.allowed && vip_rate_limited(&pkt, src_ip)) {
+        return count_drop(&pkt, DROP_RATE_LIMIT);
+    }
+
+    latency_next_stage(&pkt); // LAT_STAGE_RULES
 
-process_packet:
     // Kiểm tra xem IP nguồn có nằm trong bất kỳ subnet bị blacklist nào không
     // bpf_map_lookup_elem với LPM_TRIE sẽ tìm kiếm tiền tố dài nhất khớp
-    if (bpf_map_lookup_elem(&blacklist_subnets_map, &key)) {
+    // Traffic to a VIP is checked against the blacklist of its policy (allowlisted sources skip it)
+    __u64 *rule_hits = NULL;
+    if (!pkt.policy) {
+        rule_hits = bpf_map_lookup_elem(&blacklist_subnets_map, &key);
+    } else if (!pkt.allowed) {
+        struct policy_trie_key policy_key = {.prefixlen = 64, .policy = pkt.policy, .ip = src_ip};
+        rule_hits = bpf_map_lookup_elem(&vip_blacklist_map, &policy_key);
+    }
+    if (rule_hits) {
+        __sync_fetch_and_add(rule_hits, 1);
         bpf_printk("XDP: Dropping packet from blacklisted IP/subnet: %pI4\n", &src_ip);
-        
-        // Update IP-specific statistics
-        if (ip_stats) {
-            __sync_fetch_and_add(&ip_stats->dropped, 1);
+        if (flags & SETTING_BLACKLIST_REDIRECT) {
+            return divert_or_drop(&pkt, DROP_BLACKLIST);
         }
-        
-        // Update global dropped counter
-        __u32 dropped_key = 0;
-        __u64 *dropped_count = bpf_map_lookup_elem(&global_stats_map, &dropped_key);
-        if (dropped_count) {
-            __sync_fetch_and_add(dropped_count, 1);
+        return count_drop(&pkt, DROP_BLACKLIST); // Chặn gói tin
+    }
+
+    // Luật L4: giao thức + cổng đích + prefix nguồn
+    if (flags & SETTING_L4_RULES) {
+        __u8 divert = 0;
+        int reason = l4_rules_eval(&key, ip->protocol, has_flow ? bpf_ntohs(flow.dport) : 0, data_end - data,
+                                   &divert);
+        if (reason >= 0) {
+            return divert ? divert_or_drop(&pkt, reason) : count_drop(&pkt, reason);
         }
-        
-        return XDP_DROP; // Chặn gói tin
     }
 
-    // Update IP-specific passed statistics
-    if (ip_stats) {
-        __sync_fetch_and_add(&ip_stats->passed, 1);
+    // Giới hạn kết nối mới / đồng thời theo nguồn (chỉ xét gói SYN)
+    if ((flags & SETTING_CONN_LIMITS) && has_flow && flow.protocol == IPPROTO_TCP &&
+        (tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+        int reason = conn_limit_check(src_ip);
+        if (reason >= 0) {
+            return count_drop(&pkt, reason);
+        }
     }
-    
-    // Update global passed counter
-    __u32 passed_key = 1;
-    __u64 *passed_count = bpf_map_lookup_elem(&global_stats_map, &passed_key);
-    if (passed_count) {
-        __sync_fetch_and_add(passed_count, 1);
+
+    // SYN cookie: trả lời SYN ngay tại XDP, stack chỉ thấy các ACK hợp lệ
+    if (flags & SETTING_SYNCOOKIE) {
+        int action = syncookie_stage(ctx, &pkt, eth, ip, data_end);
+        if (action >= 0) {
+            return action;
+        }
+    }
+
+    // Nguồn cần kiểm tra sâu: chuyển lên AF_XDP, user-space sẽ quyết định.
+    // The sockets are bound to the primary interface only: other uplinks skip this stage.
+    __u32 xsk_ifindex = settings ? settings->xsk_ifindex : 0;
+    if ((flags & SETTING_XSK) && (!xsk_ifindex || xsk_ifindex == pkt.ifindex) &&
+        (bpf_map_lookup_elem(&inspect_subnets_map, &key) || inspect_port_match(ip, data_end))) {
+        return count_redirect(ctx, &pkt);
+    }
+
+    // Ghi nhớ luồng đã qua mọi bước kiểm tra
+    if (has_flow && (flags & SETTING_CONNTRACK) && flow_trackable(&flow, tcp_flags)) {
+        __u64 now = bpf_ktime_get_ns();
+        struct flow_state new_state = {
+            .first_seen_ns = now,
+            .last_seen_ns = now,
+            .packets = 1,
+            .bytes = data_end - data,
+            .generation = generation,
+            .policed = pkt.policed,
+        };
+        if (bpf_map_update_elem(&conntrack_map, &flow, &new_state, BPF_NOEXIST) == 0 &&
+            (flags & SETTING_CONN_LIMITS) && flow.protocol == IPPROTO_TCP) {
+            conn_active_add(src_ip, 1);
+        }
+    }
+
+    return count_pass(&pkt); // Cho qua
+}
+
+// Thin first stage of cpumap mode: hash the flow, queue the frame to the CPU of its
+// slot and let xdp_filter_cpumap run the whole filter there. Returns -1 for packets
+// filtered on this CPU: SYNs answered with SYN cookies need XDP_TX, which cpumap
+// programs cannot return, and sources or ports marked for deep inspection need the
+// real RX queue for xsks_map (a cpumap program always sees rx_queue_index 0).
+static __always_inline int cpumap_steer(struct xdp_md *ctx, struct filter_settings *settings) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    struct ethhdr *eth = data;
+    struct iphdr *ip = data + sizeof(*eth);
+
+    if ((void *)(ip + 1) > data_end || eth->h_proto != bpf_htons(ETH_P_IP)) {
+        return -1; // Passed right away by the filter
+    }
+
+    __u32 xsk_ifindex = settings->xsk_ifindex;
+    if ((settings->flags & SETTING_XSK) && (!xsk_ifindex || xsk_ifindex == ctx->ingress_ifindex)) {
+        struct bpf_trie_key key = {
+            .prefixlen = 32,
+            .ip = ip->saddr
+        };
+        if (bpf_map_lookup_elem(&inspect_subnets_map, &key) || inspect_port_match(ip, data_end)) {
+            return -1;
+        }
+    }
+
+    struct flow_key flow = {};
+    __u8 tcp_flags = 0;
+    __u32 hash;
+    if (flow_parse(ip, data_end, &flow, &tcp_flags)) {
+        if ((settings->flags & SETTING_SYNCOOKIE) && (tcp_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) {
+            return -1;
+        }
+        hash = cms_hash(flow.saddr, cms_hash(flow.daddr, ((__u32)flow.sport << 16 | flow.dport) ^ flow.protocol));
+    } else {
+        hash = cms_hash(ip->saddr, ip->daddr); // Fragments and other protocols: per address pair
     }
 
-    return XDP_PASS; // Cho qua
+    __u32 slot = hash % settings->cpumap_cpus;
+    __u32 *cpu = bpf_map_lookup_elem(&cpumap_cpus_map, &slot);
+    if (!cpu) {
+        return -1;
+    }
+    // User-space adds a CPU to cpu_map before any slot points to it
+    return bpf_redirect_map(&cpu_map, *cpu, XDP_PASS);
+}
+
+// Run config read by libxdp when packetfilter.bpf.o is loaded through a libxdp dispatcher
+// (xdp-loader, xdp_multiprog): run before programs with the default priority (50) and
+// continue the chain only for passed packets. The in-tree dispatcher (dispatcher.bpf.c)
+// takes the same values from xdp_priority= / xdp_chain_call_actions= instead.
+#define XDP_RUN_CONFIG(f) _##f SEC(".xdp_run_config")
+struct {
+    __uint(priority, 10);
+    __uint(XDP_PASS, 1);
+} XDP_RUN_CONFIG(xdp_filter);
+
+SEC("xdp")
+int xdp_filter(struct xdp_md *ctx) {
+    __u32 settings_key = 0;
+    struct filter_settings *settings = bpf_map_lookup_elem(&settings_map, &settings_key);
+    if (settings && (settings->flags & SETTING_CPUMAP) && settings->cpumap_cpus) {
+        int ret = cpumap_steer(ctx, settings);
+        if (ret >= 0) {
+            return ret;
+        }
+    }
+    return filter_packet(ctx, settings);
+}
+
+// Second stage of cpumap mode, run from the kthread of each cpu_map entry
+SEC("xdp/cpumap")
+int xdp_filter_cpumap(struct xdp_md *ctx) {
+    __u32 settings_key = 0;
+    return filter_packet(ctx, bpf_map_lookup_elem(&settings_map, &settings_key));
 }
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
\ No newline at end of file
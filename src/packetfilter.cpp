@@ -23,70 +23,268 @@
 
 // Include the packet filter header
 #include "packet_filter.h"
+#include "detector.h"
+#include "heavy_hitters.h"
+#include "cardinality.h"
+#include "runtime_stats.h"
+#include "capture.h"
+#include "flow_export.h"
+#include "map_usage.h"
+#include "counters.h"
+#include "interfaces.h"
+#include "dispatcher.h"
+#include "inspection.h"
+#include "replay.h"
+#include "metrics.h"
 
 // Define event buffer size for inotify
 #define EVENT_SIZE (sizeof(struct inotify_event) + NAME_MAX + 1)
 #define BUF_LEN (1024 * EVENT_SIZE)
 #define MAX_ENTRIES 1024  // Maximum number of tracked IPs
+#define CONN_RECONCILE_SEC 10 // How often idle flows are expired and conn_state_map counts re-counted
 
 #define DEFAULT_CONFIG_FILE_RELATIVE "../src/config.txt"
 
 namespace {
-    // Structure for packet statistics by IP (must match the BPF struct)
-    struct PacketStats {
-        __u64 dropped;  // Number of dropped packets
-        __u64 passed;   // Number of passed packets
-    };
-
     volatile bool exiting = false;
     int map_fd_blacklist_subnets; // File descriptor của blacklist map (giờ là LPM Trie)
     int map_fd_update_signal;     // File descriptor của update signal map
     int map_fd_ip_stats;          // File descriptor for IP statistics map
-    int map_fd_global_stats;      // File descriptor for global statistics map
     int map_fd_rate_limits;       // File descriptor for rate limits map
     int map_fd_ip_timestamps;     // File descriptor for IP timestamps map
+    int map_fd_settings;          // File descriptor for runtime settings map
+    int map_fd_cms;               // File descriptor for count-min sketch map
+    int map_fd_hh_candidates;     // File descriptor for heavy-hitter candidates map
+    int map_fd_hll;               // File descriptor for HyperLogLog registers map
+    int map_fd_inspect_subnets;   // File descriptor for deep-inspection subnets map
+    int map_fd_inspect_ports;     // File descriptor for deep-inspection ports map
+    int map_fd_xsks;              // File descriptor for AF_XDP sockets map
+    int map_fd_latency_hist;      // File descriptor for sampled latency histograms map
+    int map_fd_syncookie_ports;   // File descriptor for SYN cookie ports map
+    int map_fd_syncookie_stats;   // File descriptor for SYN cookie counters map
+    int map_fd_conntrack;         // File descriptor for connection tracking map
+    int map_fd_conn_limits;       // File descriptor for per-source connection limits map
+    int map_fd_conn_state;        // File descriptor for per-source connection state map
+    packet_filter::L4RuleMaps l4_rule_maps; // File descriptors of the L4 rule engine maps
+    packet_filter::VipPolicyMaps vip_policy_maps; // File descriptors of the destination policy maps
+    int map_fd_vip_stats;         // File descriptor for per-policy verdict counters map
+    int map_fd_iface_stats;       // File descriptor for per-interface verdict counters map
+    int map_fd_iface_policy;      // File descriptor for per-interface policy map
+    int map_fd_cpu_map;           // File descriptor for the cpumap of cpumap mode
+    int map_fd_cpumap_cpus;       // File descriptor for the cpumap slot map
+    int map_fd_honeypot;          // File descriptor for the honeypot devmap
+    int map_fd_honeypot_config;   // File descriptor for the honeypot rate cap map
+    int map_fd_honeypot_stats;    // File descriptor for the honeypot counters map
+    int map_fd_capture_ringbuf;   // File descriptor for the packet capture ring buffer
+    int map_fd_capture_stats;     // File descriptor for the packet capture counters map
+    int map_fd_flow_export;       // File descriptor for the flow records map
+    int map_fd_map_fail;          // File descriptor for the failed map inserts counters
+    int map_fd_map_usage;         // File descriptor for the map occupancy published to pf_top
+    packet_filter::CounterReader counters; // Memory-mapped global / drop reason counters
+    std::vector<bpf_map*> pinned_maps;     // Maps pinned under bpf_pin_dir for pf_top
+    std::string pinned_dir;
     std::string config_file_path_abs; // Đường dẫn tuyệt đối tới file config
     std::string filter_interface_name; // Tên interface
     uint32_t current_ifindex; // ifindex của interface
     packet_filter::SubnetNode* current_blacklist_subnets = nullptr; // Linked list of current subnets
     packet_filter::RateLimitNode* current_rate_limits = nullptr;   // Linked list of current rate limits
+    packet_filter::SubnetNode* current_inspect_subnets = nullptr;  // Linked list of deep-inspection subnets
+    packet_filter::Options options; // Daemon options from the config file
+    std::unique_ptr<packet_filter::AutoBanDetector> detector; // Auto-ban thread
+    std::unique_ptr<packet_filter::HeavyHitterMonitor> heavy_hitters; // Sketch reporting thread
+    std::unique_ptr<packet_filter::CardinalityMonitor> cardinality;   // HyperLogLog reporting thread
+    std::unique_ptr<packet_filter::RuntimeStatsMonitor> runtime_stats; // xdp_filter cost reporting thread
+    std::unique_ptr<packet_filter::CaptureWriter> capture;            // pcap writer of sampled drops
+    std::unique_ptr<packet_filter::FlowExporter> flow_exporter;       // IPFIX export thread
+    std::unique_ptr<packet_filter::MapUsageMonitor> map_usage;        // Map occupancy reporting thread
+    std::unique_ptr<packet_filter::InspectionPool> inspection;        // AF_XDP inspection workers
+    std::unique_ptr<packet_filter::L4RuleSet> l4_rules;              // Compiler of the l4_rule lines
+    std::unique_ptr<packet_filter::InterfaceSet> interfaces;         // XDP attachments of the interface= list
+    std::unique_ptr<packet_filter::XdpDispatcher> dispatcher;        // Chain of XDP programs, xdp_dispatcher=1
+    std::shared_ptr<packet_filter::SignatureInspector> signatures;    // Payload matcher used by the workers
 
     void sig_handler(int sig) {
         exiting = true;
     }
 
+    // Pin the maps read by pf_top under `dir`; a stale pin left by a previous instance is replaced
+    void pin_maps(packetfilter_bpf* skel, const std::string& dir) {
+        bpf_map* maps[] = {skel->maps.counters_map, skel->maps.ip_stats_map, skel->maps.blacklist_subnets_map,
+                           skel->maps.l4_rule_stats_map, skel->maps.map_usage_map};
+        for (bpf_map* map : maps) {
+            std::string path = dir + "/" + bpf_map__name(map);
+            unlink(path.c_str());
+            if (bpf_map__pin(map, path.c_str()) != 0) {
+                std::cerr << "Warning: Failed to pin " << bpf_map__name(map) << " at " << path << ": "
+                          << strerror(errno) << std::endl;
+                continue;
+            }
+            pinned_maps.push_back(map);
+        }
+        pinned_dir = dir;
+    }
+
+    void unpin_maps() {
+        for (bpf_map* map : pinned_maps) {
+            bpf_map__unpin(map, nullptr);
+        }
+        if (!pinned_maps.empty()) {
+            rmdir(pinned_dir.c_str());
+        }
+        pinned_maps.clear();
+    }
+
+    // Dropped packets by reason (per-CPU, summed)
+    void print_drop_reasons(const packet_filter::CounterTotals& totals) {
+        bool first = true;
+        for (__u32 reason = 0; reason < packet_filter::DROP_REASONS; reason++) {
+            __u64 sum = totals.drops(reason);
+            if (sum == 0) {
+                continue;
+            }
+            std::cout << (first ? "Drop reasons: " : ", ") << packet_filter::drop_reason_name(reason) << " " << sum;
+            first = false;
+        }
+        if (!first) {
+            std::cout << "\n";
+        }
+    }
+
+    // SYN cookie counters (per-CPU, summed), printed only when the stage has seen traffic
+    void print_syncookie_statistics() {
+        const char* names[] = {"SYN-ACKs sent", "valid cookie ACKs", "invalid cookie ACKs", "SYNs left to the stack"};
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus <= 0) {
+            return;
+        }
+        std::vector<__u64> totals;
+        std::vector<__u64> percpu(ncpus);
+        for (__u32 key = 0; key < 4; key++) {
+            if (bpf_map_lookup_elem(map_fd_syncookie_stats, &key, percpu.data()) != 0) {
+                return;
+            }
+            __u64 sum = 0;
+            for (__u64 v : percpu) {
+                sum += v;
+            }
+            totals.push_back(sum);
+        }
+        if (totals[0] + totals[1] + totals[2] + totals[3] == 0) {
+            return;
+        }
+        std::cout << "SYN cookies:";
+        for (size_t i = 0; i < totals.size(); i++) {
+            std::cout << (i ? ", " : " ") << names[i] << " " << totals[i];
+        }
+        std::cout << "\n";
+    }
+
+    // Packets of the redirect actions (per-CPU, summed), printed only when something was diverted
+    void print_honeypot_statistics() {
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus <= 0) {
+            return;
+        }
+        __u64 totals[packet_filter::HONEYPOT_COUNTERS] = {0, 0};
+        std::vector<__u64> percpu(ncpus);
+        for (__u32 key = 0; key < packet_filter::HONEYPOT_COUNTERS; key++) {
+            if (bpf_map_lookup_elem(map_fd_honeypot_stats, &key, percpu.data()) != 0) {
+                return;
+            }
+            for (__u64 v : percpu) {
+                totals[key] += v;
+            }
+        }
+        if (totals[packet_filter::HONEYPOT_REDIRECTED] + totals[packet_filter::HONEYPOT_OVER_CAP] == 0) {
+            return;
+        }
+        std::cout << "Honeypot: redirected " << totals[packet_filter::HONEYPOT_REDIRECTED]
+                  << ", dropped over the rate cap " << totals[packet_filter::HONEYPOT_OVER_CAP] << "\n";
+    }
+
+    // Verdicts of the traffic to each destination policy
+    void print_vip_statistics() {
+        std::vector<packet_filter::VipStats> stats;
+        if (options.vip_policies.empty() || packet_filter::read_vip_stats(map_fd_vip_stats, stats) != 0) {
+            return;
+        }
+        std::cout << "VIP policies:\n";
+        for (size_t i = 0; i < options.vip_policies.size(); i++) {
+            std::cout << "  " << options.vip_policies[i].name << ": dropped " << stats[i + 1].dropped
+                      << ", passed " << stats[i + 1].passed << "\n";
+        }
+    }
+
+    // Tracked flows and the largest ones by bytes
+    void print_conntrack_statistics() {
+        std::vector<packet_filter::FlowEntry> flows;
+        if (packet_filter::read_conntrack(map_fd_conntrack, flows) != 0 || flows.empty()) {
+            return;
+        }
+        std::sort(flows.begin(), flows.end(),
+            [](const packet_filter::FlowEntry& a, const packet_filter::FlowEntry& b) {
+                return a.state.bytes > b.state.bytes;
+            });
+
+        std::cout << "Tracked flows: " << flows.size() << "\n";
+        for (size_t i = 0; i < flows.size() && i < 10; i++) {
+            const packet_filter::FlowKey& key = flows[i].key;
+            char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &key.saddr, src, sizeof(src));
+            inet_ntop(AF_INET, &key.daddr, dst, sizeof(dst));
+            std::cout << "  " << (key.protocol == IPPROTO_TCP ? "tcp " : "udp ")
+                      << src << ":" << ntohs(key.sport) << " -> " << dst << ":" << ntohs(key.dport)
+                      << "  packets " << flows[i].state.packets << "  bytes " << flows[i].state.bytes << "\n";
+        }
+    }
+
     // Function to print packet statistics when program exits
     void print_statistics() {
         std::cout << "\n-------- Packet Filter Statistics --------\n";
         
         // Print global statistics
-        __u32 key = 0;
-        __u64 dropped = 0;
-        if (bpf_map_lookup_elem(map_fd_global_stats, &key, &dropped) == 0) {
-            key = 1;
-            __u64 passed = 0;
-            if (bpf_map_lookup_elem(map_fd_global_stats, &key, &passed) == 0) {
-                std::cout << "Total packets: " << (dropped + passed)
-                          << " (Dropped: " << dropped << ", Passed: " << passed << ")\n";
+        packet_filter::CounterTotals totals;
+        if (counters.read(totals)) {
+            __u64 dropped = totals.values[packet_filter::COUNTER_DROPPED];
+            __u64 passed = totals.values[packet_filter::COUNTER_PASSED];
+            __u64 redirected = totals.values[packet_filter::COUNTER_REDIRECTED];
+            std::cout << "Total packets: " << (dropped + passed + redirected)
+                      << " (Dropped: " << dropped << ", Passed: " << passed << ")\n";
+            if (redirected > 0) {
+                std::cout << "Redirected to deep inspection / honeypot: " << redirected << "\n";
             }
+            print_drop_reasons(totals);
+        }
+        print_syncookie_statistics();
+        print_honeypot_statistics();
+        print_conntrack_statistics();
+        print_vip_statistics();
+        if (interfaces) {
+            interfaces->print_stats(std::cout);
+        }
+        if (l4_rules) {
+            l4_rules->print_stats(std::cout);
+        }
+        if (runtime_stats) {
+            runtime_stats->print_summary(std::cout);
+        }
+        if (capture) {
+            capture->print_summary(std::cout);
+        }
+        if (flow_exporter) {
+            flow_exporter->print_summary(std::cout);
+        }
+        if (map_usage) {
+            map_usage->print_summary(std::cout);
         }
         
         // Collect per-IP statistics
-        struct IpEntry {
-            __u32 ip;
-            PacketStats stats;
-        };
-        std::vector<IpEntry> entries;
-
-        __u32 ip_key = 0;
-        PacketStats stats;
-
-        while (bpf_map_get_next_key(map_fd_ip_stats, entries.empty() ? nullptr : &ip_key, &ip_key) == 0) {
-            if (bpf_map_lookup_elem(map_fd_ip_stats, &ip_key, &stats) == 0 &&
-                (stats.dropped > 0 || stats.passed > 0)) {
-                entries.push_back({ip_key, stats});
-            }
-        }
+        std::vector<packet_filter::IpStatsEntry> entries;
+        packet_filter::read_ip_stats(map_fd_ip_stats, entries);
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+            [](const packet_filter::IpStatsEntry& e) {
+                return e.stats.dropped == 0 && e.stats.passed == 0;
+            }), entries.end());
 
         if (entries.empty()) {
             std::cout << "\nNo packet statistics recorded.\n";
@@ -95,7 +293,7 @@ namespace {
 
         // Sort by dropped packets (descending)
         std::sort(entries.begin(), entries.end(), 
-            [](const IpEntry& a, const IpEntry& b) {
+            [](const packet_filter::IpStatsEntry& a, const packet_filter::IpStatsEntry& b) {
                 return a.stats.dropped > b.stats.dropped;
             }
         );
@@ -134,13 +332,13 @@ namespace {
 
 int main(int argc, char **argv) {
     std::unique_ptr<packetfilter_bpf> skel = nullptr;
-    std::unique_ptr<bpf_link, void(*)(bpf_link*)> link(nullptr, [](bpf_link* l) {
-        if (l) bpf_link__destroy(l);
-    });
     int err = 0;
     int inotify_fd = -1;
     int watch_descriptor = -1;
     char buffer[BUF_LEN];
+    time_t last_reconcile = 0;
+    std::vector<std::string> replay_files;
+    packet_filter::DispatcherConfig dispatcher_config;
 
     // Lấy đường dẫn của executable
     char executable_path_buf[PATH_MAX];
@@ -161,21 +359,62 @@ int main(int argc, char **argv) {
 
     // Tạo đường dẫn tuyệt đối đến file config
     config_file_path_abs = std::string(dir_path) + "/" + DEFAULT_CONFIG_FILE_RELATIVE;
+
+    // Tham số: [--config FILE] [--replay file.pcap ...]
+    // --replay: chạy các file pcap qua chương trình BPF (không attach vào interface)
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            config_file_path_abs = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_files.assign(argv + i + 1, argv + argc);
+            packet_filter::set_offline(true);
+            break;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--config FILE] [--replay file.pcap ...]" << std::endl;
+            err = 1;
+            goto cleanup_early;
+        }
+    }
     std::cout << "Using config file: " << config_file_path_abs << std::endl;
 
-    if (argc != 1) {
-        std::cerr << "Usage: " << argv[0] << std::endl;
+    // Mở chương trình BPF
+    skel.reset(packetfilter_bpf__open());
+    if (!skel) {
+        std::cerr << "Failed to open BPF skeleton" << std::endl;
         err = 1;
         goto cleanup_early;
     }
 
-    // Mở, tải và xác thực chương trình BPF
-    skel.reset(packetfilter_bpf__open_and_load());
-    if (!skel) {
-        std::cerr << "Failed to open and load BPF skeleton" << std::endl;
+    // cpu_map and counters_map are keyed by CPU id: one entry per possible CPU
+    if (libbpf_num_possible_cpus() > 0) {
+        bpf_map__set_max_entries(skel->maps.cpu_map, libbpf_num_possible_cpus());
+        bpf_map__set_max_entries(skel->maps.counters_map, libbpf_num_possible_cpus());
+    }
+
+    // xdp_dispatcher=1: xdp_filter is loaded as a freplace slot of the dispatcher (not in replay mode,
+    // BPF_PROG_TEST_RUN does not run freplace programs on their own)
+    if (replay_files.empty() && packet_filter::read_dispatcher_config(config_file_path_abs, dispatcher_config) == 0 &&
+        dispatcher_config.enabled) {
+        dispatcher.reset(new packet_filter::XdpDispatcher(dispatcher_config));
+        if (dispatcher->prepare(skel->progs.xdp_filter) != 0) {
+            err = 1;
+            goto cleanup_early;
+        }
+    }
+
+    // Tải và xác thực chương trình BPF
+    if (packetfilter_bpf__load(skel.get()) != 0) {
+        std::cerr << "Failed to load BPF skeleton: " << strerror(errno) << std::endl;
         err = 1;
         goto cleanup_early;
     }
+    if (dispatcher) {
+        if (dispatcher->attach() != 0) {
+            err = 1;
+            goto cleanup_early;
+        }
+        dispatcher->print_chain(std::cout);
+    }
 
     // Lấy file descriptor của map blacklist_subnets_map
     map_fd_blacklist_subnets = bpf_map__fd(skel->maps.blacklist_subnets_map);
@@ -201,9 +440,7 @@ int main(int argc, char **argv) {
         goto cleanup_early;
     }
     
-    map_fd_global_stats = bpf_map__fd(skel->maps.global_stats_map);
-    if (map_fd_global_stats < 0) {
-        std::cerr << "Failed to get global_stats_map FD" << std::endl;
+    if (counters.open(bpf_map__fd(skel->maps.counters_map)) != 0) {
         err = -1;
         goto cleanup_early;
     }
@@ -223,24 +460,153 @@ int main(int argc, char **argv) {
         goto cleanup_early;
     }
     
-    // Initialize global counters to zero
+    map_fd_settings = bpf_map__fd(skel->maps.settings_map);
+    if (map_fd_settings < 0) {
+        std::cerr << "Failed to get settings_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    // Get file descriptors for the heavy-hitter sketch maps
+    map_fd_cms = bpf_map__fd(skel->maps.cms_map);
+    if (map_fd_cms < 0) {
+        std::cerr << "Failed to get cms_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_hh_candidates = bpf_map__fd(skel->maps.hh_candidates_map);
+    if (map_fd_hh_candidates < 0) {
+        std::cerr << "Failed to get hh_candidates_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+
+    map_fd_hll = bpf_map__fd(skel->maps.hll_map);
+    if (map_fd_hll < 0) {
+        std::cerr << "Failed to get hll_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    // Get file descriptors for the deep-inspection maps
+    map_fd_inspect_subnets = bpf_map__fd(skel->maps.inspect_subnets_map);
+    if (map_fd_inspect_subnets < 0) {
+        std::cerr << "Failed to get inspect_subnets_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_inspect_ports = bpf_map__fd(skel->maps.inspect_ports_map);
+    if (map_fd_inspect_ports < 0) {
+        std::cerr << "Failed to get inspect_ports_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_xsks = bpf_map__fd(skel->maps.xsks_map);
+    if (map_fd_xsks < 0) {
+        std::cerr << "Failed to get xsks_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_syncookie_ports = bpf_map__fd(skel->maps.syncookie_ports_map);
+    if (map_fd_syncookie_ports < 0) {
+        std::cerr << "Failed to get syncookie_ports_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_syncookie_stats = bpf_map__fd(skel->maps.syncookie_stats_map);
+    if (map_fd_syncookie_stats < 0) {
+        std::cerr << "Failed to get syncookie_stats_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_conntrack = bpf_map__fd(skel->maps.conntrack_map);
+    if (map_fd_conntrack < 0) {
+        std::cerr << "Failed to get conntrack_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_conn_limits = bpf_map__fd(skel->maps.conn_limits_map);
+    if (map_fd_conn_limits < 0) {
+        std::cerr << "Failed to get conn_limits_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
+    map_fd_conn_state = bpf_map__fd(skel->maps.conn_state_map);
+    if (map_fd_conn_state < 0) {
+        std::cerr << "Failed to get conn_state_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+
     {
-        __u32 key = 0;  // dropped counter
-        __u64 value = 0;
-        if (bpf_map_update_elem(map_fd_global_stats, &key, &value, BPF_ANY) != 0) {
-            std::cerr << "Failed to initialize dropped packets counter: " << strerror(errno) << std::endl;
-        }
-        
-        key = 1;  // passed counter
-        if (bpf_map_update_elem(map_fd_global_stats, &key, &value, BPF_ANY) != 0) {
-            std::cerr << "Failed to initialize passed packets counter: " << strerror(errno) << std::endl;
+        struct {
+            const bpf_map* map;
+            int* fd;
+        } policy_maps[] = {
+            {skel->maps.l4_proto_map, &l4_rule_maps.proto_fd},
+            {skel->maps.l4_port_map, &l4_rule_maps.port_fd},
+            {skel->maps.l4_src_map, &l4_rule_maps.src_fd},
+            {skel->maps.l4_rules_map, &l4_rule_maps.rules_fd},
+            {skel->maps.l4_rule_last_map, &l4_rule_maps.last_fd},
+            {skel->maps.l4_rule_stats_map, &l4_rule_maps.stats_fd},
+            {skel->maps.vip_dst_map, &vip_policy_maps.dst_fd},
+            {skel->maps.vip_blacklist_map, &vip_policy_maps.blacklist_fd},
+            {skel->maps.vip_allowlist_map, &vip_policy_maps.allowlist_fd},
+            {skel->maps.vip_rate_limits_map, &vip_policy_maps.rate_limits_fd},
+            {skel->maps.vip_stats_map, &map_fd_vip_stats},
+            {skel->maps.iface_stats_map, &map_fd_iface_stats},
+            {skel->maps.iface_policy_map, &map_fd_iface_policy},
+            {skel->maps.cpu_map, &map_fd_cpu_map},
+            {skel->maps.cpumap_cpus_map, &map_fd_cpumap_cpus},
+            {skel->maps.honeypot_map, &map_fd_honeypot},
+            {skel->maps.honeypot_config_map, &map_fd_honeypot_config},
+            {skel->maps.honeypot_stats_map, &map_fd_honeypot_stats},
+            {skel->maps.capture_ringbuf, &map_fd_capture_ringbuf},
+            {skel->maps.capture_stats_map, &map_fd_capture_stats},
+            {skel->maps.flow_export_map, &map_fd_flow_export},
+            {skel->maps.map_fail_map, &map_fd_map_fail},
+            {skel->maps.map_usage_map, &map_fd_map_usage},
+        };
+        for (const auto& entry : policy_maps) {
+            *entry.fd = bpf_map__fd(entry.map);
+            if (*entry.fd < 0) {
+                std::cerr << "Failed to get " << bpf_map__name(entry.map) << " FD" << std::endl;
+                err = -1;
+                goto cleanup_early;
+            }
         }
     }
 
+    map_fd_latency_hist = bpf_map__fd(skel->maps.latency_hist_map);
+    if (map_fd_latency_hist < 0) {
+        std::cerr << "Failed to get latency_hist_map FD" << std::endl;
+        err = -1;
+        goto cleanup_early;
+    }
+    
     // Initialize the packet filter module
     packet_filter::init(map_fd_blacklist_subnets, map_fd_update_signal, map_fd_rate_limits,
                        config_file_path_abs, filter_interface_name, 
-                       current_ifindex, &current_blacklist_subnets, &current_rate_limits);
+                       current_ifindex, &current_blacklist_subnets, &current_rate_limits,
+                       map_fd_settings, &options);
+    packet_filter::set_inspect_map(map_fd_inspect_subnets, map_fd_inspect_ports, &current_inspect_subnets);
+    packet_filter::set_syncookie_map(map_fd_syncookie_ports);
+    packet_filter::set_conn_limits_map(map_fd_conn_limits);
+    l4_rules.reset(new packet_filter::L4RuleSet(l4_rule_maps));
+    packet_filter::set_l4_rules(l4_rules.get());
+    packet_filter::set_vip_policy_maps(vip_policy_maps);
+    packet_filter::set_cpumap_maps(map_fd_cpu_map, map_fd_cpumap_cpus,
+                                   bpf_program__fd(skel->progs.xdp_filter_cpumap));
+    packet_filter::set_honeypot_maps(map_fd_honeypot, map_fd_honeypot_config);
 
     // Đọc cấu hình lần đầu và attach XDP
     if (packet_filter::update_from_config() != 0) {
@@ -248,20 +614,104 @@ int main(int argc, char **argv) {
         goto cleanup_early;
     }
 
+    if (!replay_files.empty()) {
+        err = packet_filter::run_replay(bpf_program__fd(skel->progs.xdp_filter),
+                                        map_fd_blacklist_subnets, replay_files) != 0 ? 1 : 0;
+        goto cleanup_early;
+    }
+
     if (filter_interface_name.empty() || current_ifindex == 0) {
         std::cerr << "Failed to determine interface from config on initial load." << std::endl;
         err = -1;
         goto cleanup_early;
     }
 
-    link.reset(bpf_program__attach_xdp(skel->progs.xdp_filter, current_ifindex));
-    if (!link) {
-        std::cerr << "Failed to attach XDP program to ifindex " << current_ifindex << std::endl;
+    // With the dispatcher the interfaces run the whole chain, xdp_filter being one of its slots
+    interfaces.reset(new packet_filter::InterfaceSet(
+        dispatcher ? dispatcher->prog_fd() : bpf_program__fd(skel->progs.xdp_filter), map_fd_iface_stats,
+        map_fd_iface_policy));
+    if (interfaces->sync(options.interfaces, options.vip_policies, options.xdp_mode) <= 0) {
+        std::cerr << "Failed to attach XDP program to any configured interface" << std::endl;
+        err = -1;
         goto cleanup_early;
-    }    
+    }
 
-    std::cout << "Successfully loaded and attached BPF program on interface " 
-              << filter_interface_name << " (index " << current_ifindex << ")." << std::endl;
+    std::cout << "Successfully loaded and attached BPF program (primary interface "
+              << filter_interface_name << ", index " << current_ifindex << ")." << std::endl;
+
+    // Metrics endpoint (chỉ khởi động một lần, đổi địa chỉ cần restart)
+    if (!options.metrics_listen.empty()) {
+        packet_filter::metrics::start(options.metrics_listen);
+    }
+
+    // Maps for pf_top (chỉ pin một lần lúc khởi động, đổi thư mục cần restart)
+    if (!options.pin_dir.empty()) {
+        pin_maps(skel.get(), options.pin_dir);
+    }
+
+    // Auto-ban detector: the thread always runs, autoban_enabled toggles sampling on reload
+    detector.reset(new packet_filter::AutoBanDetector(map_fd_ip_stats, map_fd_blacklist_subnets,
+                                                      map_fd_rate_limits));
+    detector->set_config(options.autoban);
+    detector->start();
+
+    // Heavy-hitter reporting: heavy_hitters=1 turns on the in-kernel sketch
+    heavy_hitters.reset(new packet_filter::HeavyHitterMonitor(map_fd_cms, map_fd_hh_candidates));
+    heavy_hitters->set_config(options.heavy_hitters, options.settings.flags & packet_filter::SETTING_SKETCH);
+    heavy_hitters->start();
+
+    // Distinct-source estimation: distinct_sources=1 turns on the in-kernel registers
+    cardinality.reset(new packet_filter::CardinalityMonitor(map_fd_hll));
+    cardinality->set_config(options.cardinality, options.settings.flags & packet_filter::SETTING_HLL);
+    cardinality->start();
+
+    // Cost of xdp_filter: bpf_stats=1 enables kernel run-time stats, latency_histogram=1 the sampled stages
+    // (freplace programs have no run-time stats of their own: with the dispatcher the cost is the whole chain)
+    runtime_stats.reset(new packet_filter::RuntimeStatsMonitor(
+        dispatcher ? dispatcher->prog_fd() : bpf_program__fd(skel->progs.xdp_filter), map_fd_latency_hist));
+    runtime_stats->set_config(options.runtime_stats, options.settings.flags & packet_filter::SETTING_LATENCY);
+    runtime_stats->start();
+
+    // Sampled capture of dropped packets: capture=1 turns on sampling in xdp_filter,
+    // the writer only drains what the ring buffer receives
+    capture.reset(new packet_filter::CaptureWriter(map_fd_capture_ringbuf, map_fd_capture_stats));
+    capture->set_config(options.capture);
+    if (capture->start() != 0) {
+        std::cerr << "Warning: packet capture writer not started" << std::endl;
+    }
+
+    // Flow telemetry: flow_export=1 turns on the in-kernel flow records
+    flow_exporter.reset(new packet_filter::FlowExporter(map_fd_flow_export));
+    flow_exporter->set_config(options.flow_export, options.settings.flags & packet_filter::SETTING_FLOW_EXPORT);
+    flow_exporter->start();
+
+    // Occupancy of the bounded maps, so a full map is reported before sources go untracked
+    map_usage.reset(new packet_filter::MapUsageMonitor(
+        {{"ip_stats_map", map_fd_ip_stats, packet_filter::MAP_USAGE_IP_STATS, packet_filter::MAP_FAIL_IP_STATS},
+         {"ip_timestamps_map", map_fd_ip_timestamps, packet_filter::MAP_USAGE_IP_TIMESTAMPS,
+          packet_filter::MAP_FAIL_IP_TIMESTAMPS},
+         {"ip_rate_limits_map", map_fd_rate_limits, packet_filter::MAP_USAGE_IP_RATE_LIMITS},
+         {"blacklist_subnets_map", map_fd_blacklist_subnets, packet_filter::MAP_USAGE_BLACKLIST_SUBNETS},
+         {"conntrack_map", map_fd_conntrack, packet_filter::MAP_USAGE_CONNTRACK},
+         {"flow_export_map", map_fd_flow_export, packet_filter::MAP_USAGE_FLOW_EXPORT}},
+        map_fd_map_fail, map_fd_map_usage));
+    map_usage->set_config(options.map_usage);
+    map_usage->start();
+
+    // Deep inspection: sockets are bound once at startup, inspect_subnets can change on reload
+    if (options.settings.flags & packet_filter::SETTING_XSK) {
+        signatures = std::make_shared<packet_filter::SignatureInspector>(
+            [](__u32 src_ip, const std::string& signature) {
+                detector->request_ban(src_ip, "payload signature " + signature);
+            });
+        signatures->set_config(options.inspection);
+        inspection.reset(new packet_filter::InspectionPool(map_fd_xsks, current_ifindex, options.inspection,
+                                                           signatures));
+        if (inspection->start() != 0) {
+            std::cerr << "Failed to start deep inspection, redirected packets will be passed" << std::endl;
+            inspection.reset();
+        }
+    }
 
     // Bắt tín hiệu ngắt (Ctrl+C) để dọn dẹp
     signal(SIGINT, sig_handler);
@@ -292,6 +742,18 @@ int main(int argc, char **argv) {
         struct timeval tv;
         int retval;
 
+        // Idle flows stay in conntrack_map until their next packet or an LRU eviction: delete
+        // them, then re-count the concurrent connections, which drift the same way
+        if ((options.settings.flags & packet_filter::SETTING_CONNTRACK) &&
+            time(nullptr) - last_reconcile >= CONN_RECONCILE_SEC) {
+            __u32 idle_sec = options.settings.conntrack_idle_sec;
+            packet_filter::expire_conntrack(map_fd_conntrack, idle_sec);
+            if (options.settings.flags & packet_filter::SETTING_CONN_LIMITS) {
+                packet_filter::reconcile_conn_counts(map_fd_conntrack, map_fd_conn_state, idle_sec);
+            }
+            last_reconcile = time(nullptr);
+        }
+
         FD_ZERO(&rfds);
         FD_SET(inotify_fd, &rfds);
 
@@ -332,6 +794,26 @@ int main(int argc, char **argv) {
                         std::cout << "Config file '" << config_file_path_abs << "' modified or written. Updating configuration..." << std::endl;
                         if (packet_filter::update_from_config() != 0) {
                             std::cerr << "Failed to update configuration from config. Continuing..." << std::endl;
+                        } else {
+                            // Attach new uplinks / detach removed ones without touching the filter maps
+                            if (interfaces->sync(options.interfaces, options.vip_policies,
+                                                 options.xdp_mode) == 0) {
+                                std::cerr << "Warning: XDP program is not attached to any interface" << std::endl;
+                            }
+                            detector->set_config(options.autoban);
+                            heavy_hitters->set_config(options.heavy_hitters,
+                                                      options.settings.flags & packet_filter::SETTING_SKETCH);
+                            cardinality->set_config(options.cardinality,
+                                                    options.settings.flags & packet_filter::SETTING_HLL);
+                            runtime_stats->set_config(options.runtime_stats,
+                                                      options.settings.flags & packet_filter::SETTING_LATENCY);
+                            capture->set_config(options.capture);
+                            flow_exporter->set_config(options.flow_export,
+                                                      options.settings.flags & packet_filter::SETTING_FLOW_EXPORT);
+                            map_usage->set_config(options.map_usage);
+                            if (signatures) {
+                                signatures->set_config(options.inspection);
+                            }
                         }
                     }
                     p += EVENT_SIZE + event->len;
@@ -340,6 +822,18 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Stop background threads before the final statistics dump
+    detector->stop();
+    heavy_hitters->stop();
+    cardinality->stop();
+    runtime_stats->stop();
+    capture->stop();
+    flow_exporter->stop(); // Sends the flows still in the map
+    map_usage->stop();
+    if (inspection) {
+        inspection->stop();
+    }
+
     // Print statistics when program exits
     print_statistics();
 
@@ -354,9 +848,24 @@ cleanup_inotify:
 cleanup_early:
     std::cout << "Detaching BPF program and cleaning up..." << std::endl;
     
-    // The smart pointers will handle cleanup of skel and link
+    // The smart pointers will handle cleanup of skel and the links
+    interfaces.reset(); // Detach before the program goes away
+    dispatcher.reset();
+    inspection.reset(); // Workers may still report bans to the detector
+    signatures.reset();
+    detector.reset();
+    heavy_hitters.reset();
+    cardinality.reset();
+    capture.reset();
+    flow_exporter.reset();
+    map_usage.reset();
+    runtime_stats.reset(); // Closing the stats fd turns BPF_STATS_RUN_TIME back off
+    packet_filter::metrics::stop();
+    packet_filter::restore_tcp_syncookies(); // After detach: no more cookie ACKs from XDP
+    unpin_maps();
     packet_filter::free_subnet_list(current_blacklist_subnets);
     packet_filter::free_rate_limit_list(current_rate_limits);
+    packet_filter::free_subnet_list(current_inspect_subnets);
     
     return err > 0 ? err : -err;
 }
\ No newline at end of file
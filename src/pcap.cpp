@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pcap.h"
+
+namespace packet_filter {
+    namespace {
+        const size_t GLOBAL_HEADER_SIZE = 24;
+        const size_t RECORD_HEADER_SIZE = 16;
+        const __u32 MAGIC_USEC = 0xa1b2c3d4;
+        const __u32 MAGIC_NSEC = 0xa1b23c4d;
+    }
+
+    PcapFile::PcapFile()
+        : base(nullptr), size(0), offset(0), swapped(false), nanosecond(false), link_type(0) {}
+
+    PcapFile::~PcapFile() {
+        close();
+    }
+
+    __u32 PcapFile::read32(const __u8* p) const {
+        __u32 value;
+        memcpy(&value, p, sizeof(value));
+        return swapped ? __builtin_bswap32(value) : value;
+    }
+
+    int PcapFile::open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < GLOBAL_HEADER_SIZE) {
+            std::cerr << "Invalid capture file " << path << std::endl;
+            ::close(fd);
+            return -1;
+        }
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "Failed to map " << path << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        base = static_cast<const __u8*>(mapped);
+        size = st.st_size;
+        madvise(const_cast<__u8*>(base), size, MADV_SEQUENTIAL);
+
+        __u32 magic;
+        memcpy(&magic, base, sizeof(magic));
+        if (magic == MAGIC_USEC || magic == MAGIC_NSEC) {
+            swapped = false;
+        } else if (__builtin_bswap32(magic) == MAGIC_USEC || __builtin_bswap32(magic) == MAGIC_NSEC) {
+            swapped = true;
+            magic = __builtin_bswap32(magic);
+        } else {
+            std::cerr << path << " is not a pcap file (pcapng is not supported)" << std::endl;
+            close();
+            return -1;
+        }
+        nanosecond = magic == MAGIC_NSEC;
+        link_type = read32(base + 20);
+        offset = GLOBAL_HEADER_SIZE;
+        return 0;
+    }
+
+    void PcapFile::close() {
+        if (base) {
+            munmap(const_cast<__u8*>(base), size);
+            base = nullptr;
+        }
+        size = 0;
+        offset = 0;
+    }
+
+    bool PcapFile::next(PcapPacket& packet) {
+        if (!base || offset + RECORD_HEADER_SIZE > size) {
+            return false;
+        }
+        const __u8* record = base + offset;
+        __u32 caplen = read32(record + 8);
+        if (offset + RECORD_HEADER_SIZE + caplen > size) {
+            return false;
+        }
+        __u64 frac = read32(record + 4);
+        packet.ts_ns = read32(record) * 1000000000ULL + (nanosecond ? frac : frac * 1000);
+        packet.caplen = caplen;
+        packet.len = read32(record + 12);
+        packet.data = record + RECORD_HEADER_SIZE;
+        offset += RECORD_HEADER_SIZE + caplen;
+        return true;
+    }
+
+    void PcapFile::rewind() {
+        offset = base ? GLOBAL_HEADER_SIZE : 0;
+    }
+} // namespace packet_filter
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <string>
+#include <linux/types.h>
+
+namespace packet_filter {
+    // One record of a capture file, pointing into the mapped file
+    struct PcapPacket {
+        const __u8* data;
+        __u32 caplen;    // Bytes present in the file
+        __u32 len;       // Original length on the wire
+        __u64 ts_ns;     // Capture timestamp
+    };
+
+    // Read-only, memory-mapped reader for classic libpcap files (micro- or
+    // nanosecond timestamps, either byte order). Records are not copied.
+    class PcapFile {
+    public:
+        PcapFile();
+        ~PcapFile();
+
+        int open(const std::string& path);
+        void close();
+
+        // Next record, false at the end of the file or on a truncated record
+        bool next(PcapPacket& packet);
+        void rewind();
+
+        __u32 linktype() const { return link_type; }
+
+    private:
+        __u32 read32(const __u8* p) const;
+
+        const __u8* base;
+        size_t size;
+        size_t offset;
+        bool swapped;
+        bool nanosecond;
+        __u32 link_type;
+    };
+} // namespace packet_filter
+
+#endif /* PCAP_H */
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+// Microbenchmark of xdp_filter with BPF_PROG_TEST_RUN.
+// Loads the skeleton once per ruleset size, fills the blacklist with synthetic
+// prefixes and reports ns/packet and Mpps for each traffic scenario as CSV.
+// The vip_* scenarios repeat the lookups through a destination policy to show
+// the cost of per-VIP policy selection against the interface-wide path.
+//
+// Usage: pf_bench [--sizes 10,1000,...] [--repeat N] [--runs N] [--label NAME] [--output FILE]
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <memory>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "packetfilter.skel.h"
+
+#include "packet_filter.h"
+
+namespace {
+    const __u32 RATE_LIMITED_IP = 0xC0A86402; // 192.168.100.2
+    const __u32 ALLOWED_IP = 0xAC100001;      // 172.16.0.1
+    const __u32 DEFAULT_DST_IP = 0xC0A86401;  // 192.168.100.1
+    const __u32 VIP_IP = 0xC6336401;          // 198.51.100.1, destination of policy 1
+    const __u32 MIN_MAP_ENTRIES = 1024;       // Size of blacklist_subnets_map in the BPF object
+
+    struct Options {
+        std::vector<__u32> sizes = {10, 100, 1000, 10000, 100000, 1000000};
+        __u32 repeat = 1000000;
+        __u32 runs = 5;
+        std::string label = "local";
+        std::string output;
+    };
+
+    struct Scenario {
+        const char* name;
+        std::vector<__u8> packet;
+    };
+
+    // i-th synthetic rule (host byte order): mostly /32s spread over 10.0.0.0/8,
+    // every 16th a /24 in 11.0.0.0/8, all distinct up to 1M rules
+    packet_filter::BpfTrieKey synthetic_prefix(__u32 i) {
+        if (i % 16 == 15) {
+            return {24, 0x0B000000 | ((i / 16) << 8)};
+        }
+        return {32, 0x0A000000 | ((i * 2654435761U) & 0x00FFFFFF)};
+    }
+
+    std::vector<__u8> tcp_packet(__u32 src_ip, __u32 dst_ip = DEFAULT_DST_IP) {
+        std::vector<__u8> packet(64, 0);
+        struct ethhdr* eth = reinterpret_cast<struct ethhdr*>(packet.data());
+        memset(eth->h_dest, 0xff, ETH_ALEN);
+        eth->h_proto = htons(ETH_P_IP);
+
+        struct iphdr* ip = reinterpret_cast<struct iphdr*>(eth + 1);
+        ip->version = 4;
+        ip->ihl = 5;
+        ip->ttl = 64;
+        ip->protocol = IPPROTO_TCP;
+        ip->tot_len = htons(packet.size() - sizeof(*eth));
+        ip->saddr = htonl(src_ip);
+        ip->daddr = htonl(dst_ip);
+
+        struct tcphdr* tcp = reinterpret_cast<struct tcphdr*>(ip + 1);
+        tcp->source = htons(40000);
+        tcp->dest = htons(80);
+        tcp->doff = 5;
+        tcp->syn = 1;
+        return packet;
+    }
+
+    std::vector<__u8> arp_packet() {
+        std::vector<__u8> packet(64, 0);
+        struct ethhdr* eth = reinterpret_cast<struct ethhdr*>(packet.data());
+        memset(eth->h_dest, 0xff, ETH_ALEN);
+        eth->h_proto = htons(ETH_P_ARP);
+        return packet;
+    }
+
+    const char* xdp_action_name(__u32 action) {
+        switch (action) {
+            case 0: return "XDP_ABORTED";
+            case 1: return "XDP_DROP";
+            case 2: return "XDP_PASS";
+            case 3: return "XDP_TX";
+            case 4: return "XDP_REDIRECT";
+            default: return "UNKNOWN";
+        }
+    }
+
+    bool parse_args(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+            try {
+                if (arg == "--sizes") {
+                    options.sizes.clear();
+                    std::stringstream ss(value);
+                    std::string item;
+                    while (std::getline(ss, item, ',')) {
+                        options.sizes.push_back(static_cast<__u32>(std::stoul(item)));
+                    }
+                } else if (arg == "--repeat") {
+                    options.repeat = static_cast<__u32>(std::stoul(value));
+                } else if (arg == "--runs") {
+                    options.runs = std::max(1U, static_cast<__u32>(std::stoul(value)));
+                } else if (arg == "--label") {
+                    options.label = value;
+                } else if (arg == "--output") {
+                    options.output = value;
+                } else {
+                    return false;
+                }
+            } catch (const std::exception& e) {
+                return false;
+            }
+        }
+        return !options.sizes.empty();
+    }
+
+    int fill_blacklist(int map_fd, size_t value_size, __u32 count) {
+        std::vector<__u8> value(value_size, 0);
+        for (__u32 i = 0; i < count; i++) {
+            packet_filter::BpfTrieKey key = synthetic_prefix(i);
+            key.ip = htonl(key.ip);
+            if (bpf_map_update_elem(map_fd, &key, value.data(), BPF_ANY) != 0) {
+                std::cerr << "Failed to insert rule " << i << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Same synthetic prefixes, scoped to policy 1
+    int fill_vip_blacklist(int map_fd, __u32 count) {
+        __u64 value = 0;
+        for (__u32 i = 0; i < count; i++) {
+            packet_filter::BpfTrieKey prefix = synthetic_prefix(i);
+            packet_filter::PolicyTrieKey key = {32 + prefix.prefixlen, 1, htonl(prefix.ip)};
+            if (bpf_map_update_elem(map_fd, &key, &value, BPF_ANY) != 0) {
+                std::cerr << "Failed to insert policy rule " << i << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    // Median ns/packet over several runs of one scenario
+    int measure(int prog_fd, const Scenario& scenario, const Options& options, double& ns_per_packet,
+                __u32& retval) {
+        std::vector<double> samples;
+        for (__u32 run = 0; run < options.runs; run++) {
+            struct bpf_test_run_opts opts;
+            memset(&opts, 0, sizeof(opts));
+            opts.sz = sizeof(opts);
+            opts.data_in = scenario.packet.data();
+            opts.data_size_in = static_cast<__u32>(scenario.packet.size());
+            opts.repeat = static_cast<int>(options.repeat);
+            if (bpf_prog_test_run_opts(prog_fd, &opts) != 0) {
+                std::cerr << "BPF_PROG_TEST_RUN failed for " << scenario.name << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+            samples.push_back(static_cast<double>(opts.duration)); // Average ns per repetition
+            retval = opts.retval;
+        }
+        std::sort(samples.begin(), samples.end());
+        ns_per_packet = samples[samples.size() / 2];
+        return 0;
+    }
+
+    int run_scenarios(int prog_fd, const std::vector<Scenario>& scenarios, __u32 size, const Options& options,
+                      std::ostream& csv) {
+        for (const auto& scenario : scenarios) {
+            double ns_per_packet = 0;
+            __u32 retval = 0;
+            if (measure(prog_fd, scenario, options, ns_per_packet, retval) != 0) {
+                return -1;
+            }
+            csv << options.label << "," << size << "," << scenario.name << "," << options.repeat << ","
+                << std::fixed << std::setprecision(1) << ns_per_packet << ","
+                << std::setprecision(3) << (ns_per_packet > 0 ? 1000.0 / ns_per_packet : 0.0) << ","
+                << xdp_action_name(retval) << std::endl;
+        }
+        return 0;
+    }
+
+    int bench_size(__u32 size, const Options& options, std::ostream& csv) {
+        std::unique_ptr<packetfilter_bpf, void(*)(packetfilter_bpf*)> skel(
+            packetfilter_bpf__open(), packetfilter_bpf__destroy);
+        if (!skel) {
+            std::cerr << "Failed to open BPF skeleton" << std::endl;
+            return -1;
+        }
+        if (bpf_map__set_max_entries(skel->maps.blacklist_subnets_map, std::max(size, MIN_MAP_ENTRIES)) != 0) {
+            std::cerr << "Failed to resize blacklist_subnets_map" << std::endl;
+            return -1;
+        }
+        if (bpf_map__set_max_entries(skel->maps.vip_blacklist_map, std::max(size, MIN_MAP_ENTRIES)) != 0) {
+            std::cerr << "Failed to resize vip_blacklist_map" << std::endl;
+            return -1;
+        }
+        // cpu_map and counters_map are keyed by CPU id: one entry per possible CPU, as in the daemon
+        int ncpus = libbpf_num_possible_cpus();
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return -1;
+        }
+        if (bpf_map__set_max_entries(skel->maps.cpu_map, ncpus) != 0 ||
+            bpf_map__set_max_entries(skel->maps.counters_map, ncpus) != 0) {
+            std::cerr << "Failed to resize the per-CPU maps" << std::endl;
+            return -1;
+        }
+        if (packetfilter_bpf__load(skel.get()) != 0) {
+            std::cerr << "Failed to load BPF skeleton (root privileges required)" << std::endl;
+            return -1;
+        }
+
+        int blacklist_fd = bpf_map__fd(skel->maps.blacklist_subnets_map);
+        std::cerr << "Loading " << size << " prefixes..." << std::endl;
+        if (fill_blacklist(blacklist_fd, bpf_map__value_size(skel->maps.blacklist_subnets_map), size) != 0) {
+            return -1;
+        }
+
+        // Default runtime settings, as written by update_from_config()
+        __u32 key = 0;
+        packet_filter::FilterSettings settings;
+        bpf_map_update_elem(bpf_map__fd(skel->maps.settings_map), &key, &settings, BPF_ANY);
+
+        // 1 pps: every repetition after the first one is over the limit
+        packet_filter::BpfRateLimit rate_limit = {1, 1000000000ULL};
+        __u32 rate_limited_ip = htonl(RATE_LIMITED_IP);
+        bpf_map_update_elem(bpf_map__fd(skel->maps.ip_rate_limits_map), &rate_limited_ip, &rate_limit, BPF_ANY);
+
+        std::vector<Scenario> scenarios = {
+            {"blacklisted", tcp_packet(synthetic_prefix(0).ip)},
+            {"allowed", tcp_packet(ALLOWED_IP)},
+            {"rate_limited", tcp_packet(RATE_LIMITED_IP)},
+            {"non_ip", arp_packet()},
+        };
+
+        int prog_fd = bpf_program__fd(skel->progs.xdp_filter);
+        if (run_scenarios(prog_fd, scenarios, size, options, csv) != 0) {
+            return -1;
+        }
+
+        // Destination policy 1 on VIP_IP with the same blacklist and rate limit
+        std::cerr << "Loading " << size << " prefixes into policy 1..." << std::endl;
+        if (fill_vip_blacklist(bpf_map__fd(skel->maps.vip_blacklist_map), size) != 0) {
+            return -1;
+        }
+        packet_filter::BpfTrieKey vip_key = {32, htonl(VIP_IP)};
+        __u32 policy = 1;
+        bpf_map_update_elem(bpf_map__fd(skel->maps.vip_dst_map), &vip_key, &policy, BPF_ANY);
+        packet_filter::PolicyIpKey limited_key = {policy, rate_limited_ip};
+        bpf_map_update_elem(bpf_map__fd(skel->maps.vip_rate_limits_map), &limited_key, &rate_limit, BPF_ANY);
+        settings.flags |= packet_filter::SETTING_VIP_POLICIES;
+        bpf_map_update_elem(bpf_map__fd(skel->maps.settings_map), &key, &settings, BPF_ANY);
+
+        std::vector<Scenario> vip_scenarios = {
+            {"vip_other_dst", tcp_packet(ALLOWED_IP)}, // Policy selection miss, interface-wide lists
+            {"vip_blacklisted", tcp_packet(synthetic_prefix(0).ip, VIP_IP)},
+            {"vip_allowed", tcp_packet(ALLOWED_IP, VIP_IP)},
+            {"vip_rate_limited", tcp_packet(RATE_LIMITED_IP, VIP_IP)},
+        };
+        return run_scenarios(prog_fd, vip_scenarios, size, options, csv);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--sizes 10,1000,...] [--repeat N] [--runs N] [--label NAME] [--output FILE]" << std::endl;
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file.is_open()) {
+            std::cerr << "Error opening " << options.output << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& csv = options.output.empty() ? std::cout : file;
+
+    csv << "label,prefixes,scenario,repeat,ns_per_packet,mpps,verdict" << std::endl;
+    for (__u32 size : options.sizes) {
+        if (bench_size(size, options, csv) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,475 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+// Live dashboard of a running packetfilter. Attaches to the maps the daemon pins
+// under bpf_pin_dir (no BPF object of its own) and shows, every interval, the
+// global pps / bps by verdict, the drop reasons, the top sources by drop and pass
+// rate, the top blacklist prefixes and l4 rules by hits and the map occupancy.
+// Rates are deltas of two snapshots: the global counters come from the
+// memory-mapped counters_map, the hash maps are read with batched lookups into
+// buffers reused from one refresh to the next. Map occupancy is not counted here:
+// it is the last count of the daemon's map usage monitor, read from map_usage_map.
+//
+// Usage: pf_top [--pin-dir DIR] [--config FILE] [--interval MS] [--top N] [--count N]
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "packet_filter.h"
+#include "counters.h"
+
+namespace {
+    const __u32 BATCH_SIZE = 4096;
+    const __u32 L4_RULES_MAX = 64; // Must match the BPF definition
+    const auto PREFIX_KEYS_REFRESH = std::chrono::seconds(10); // Re-walk of the blacklist keys at the latest
+
+    // Names of the map_usage_map slots, in MAP_USAGE_* order
+    const char* const MAP_USAGE_NAMES[packet_filter::MAP_USAGE_SLOTS] = {
+        "ip_stats_map", "ip_timestamps_map", "ip_rate_limits_map",
+        "blacklist_subnets_map", "conntrack_map", "flow_export_map",
+    };
+
+    volatile sig_atomic_t exiting = 0;
+
+    struct Options {
+        std::string pin_dir = "/sys/fs/bpf/packetfilter";
+        std::string config;   // For the l4_rule names, optional
+        __u32 interval_ms = 1000;
+        __u32 top = 10;
+        __u32 count = 0;      // Refreshes before exiting, 0 = until interrupted
+    };
+
+    // Must match struct l4_rule_stats
+    struct L4RuleStats {
+        __u64 packets;
+        __u64 bytes;
+    };
+
+    struct PinnedMap {
+        const char* name;
+        int fd = -1;
+        __u32 key_size = 0;
+        __u32 value_size = 0;
+        __u32 max_entries = 0;
+    };
+
+    // Everything that rates are computed from
+    struct Snapshot {
+        std::chrono::steady_clock::time_point time;
+        packet_filter::CounterTotals totals;
+        std::unordered_map<__u32, packet_filter::PacketStats> sources;
+        std::unordered_map<__u64, __u64> prefix_hits; // prefixlen << 32 | ip
+        std::vector<L4RuleStats> rules;
+    };
+
+    struct RateEntry {
+        __u64 key;
+        double rate;
+    };
+
+    void sig_handler(int sig) {
+        exiting = 1;
+    }
+
+    bool parse_args(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+            try {
+                if (arg == "--pin-dir") {
+                    options.pin_dir = value;
+                } else if (arg == "--config") {
+                    options.config = value;
+                } else if (arg == "--interval") {
+                    options.interval_ms = std::max(100U, static_cast<__u32>(std::stoul(value)));
+                } else if (arg == "--top") {
+                    options.top = static_cast<__u32>(std::stoul(value));
+                } else if (arg == "--count") {
+                    options.count = static_cast<__u32>(std::stoul(value));
+                } else {
+                    return false;
+                }
+            } catch (const std::exception& e) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int open_pinned(const std::string& dir, PinnedMap& map) {
+        std::string path = dir + "/" + map.name;
+        map.fd = bpf_obj_get(path.c_str());
+        if (map.fd < 0) {
+            std::cerr << "Failed to open " << path << ": " << strerror(errno)
+                      << " (is packetfilter running with bpf_pin_dir=" << dir << "?)" << std::endl;
+            return -1;
+        }
+        struct bpf_map_info info;
+        __u32 info_len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (bpf_map_get_info_by_fd(map.fd, &info, &info_len) != 0) {
+            std::cerr << "Failed to get " << map.name << " info: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        map.key_size = info.key_size;
+        map.value_size = info.value_size;
+        map.max_entries = info.max_entries;
+        return 0;
+    }
+
+    // Walk a hash map with batched lookups; `visit(keys, values, count)` sees each batch
+    template <typename Visit>
+    int scan_batched(const PinnedMap& map, size_t value_stride, std::vector<__u8>& keys, std::vector<__u8>& values,
+                     Visit visit) {
+        keys.resize(static_cast<size_t>(BATCH_SIZE) * map.key_size);
+        values.resize(BATCH_SIZE * value_stride);
+        __u32 in_batch = 0, out_batch = 0;
+        bool first = true;
+        while (true) {
+            __u32 count = BATCH_SIZE;
+            int ret = bpf_map_lookup_batch(map.fd, first ? nullptr : &in_batch, &out_batch, keys.data(),
+                                           values.data(), &count, nullptr);
+            if (ret != 0 && errno != ENOENT) {
+                std::cerr << "Failed to batch read " << map.name << ": " << strerror(errno) << std::endl;
+                return -1;
+            }
+            visit(keys.data(), values.data(), count);
+            if (ret != 0) {
+                return 0; // ENOENT: the whole map has been read
+            }
+            in_batch = out_batch;
+            first = false;
+        }
+    }
+
+    class Dashboard {
+    public:
+        explicit Dashboard(const Options& options) : options(options), ncpus(libbpf_num_possible_cpus()) {
+            maps[0].name = "counters_map";
+            maps[1].name = "ip_stats_map";
+            maps[2].name = "blacklist_subnets_map";
+            maps[3].name = "l4_rule_stats_map";
+            maps[4].name = "map_usage_map";
+            memset(usage, 0, sizeof(usage));
+        }
+
+        ~Dashboard() {
+            for (auto& map : maps) {
+                if (map.fd >= 0) {
+                    close(map.fd);
+                }
+            }
+        }
+
+        int open() {
+            if (ncpus <= 0) {
+                std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+                return -1;
+            }
+            for (auto& map : maps) {
+                if (open_pinned(options.pin_dir, map) != 0) {
+                    return -1;
+                }
+            }
+            if (counters.open(maps[0].fd) != 0) {
+                return -1;
+            }
+            read_rule_names();
+            return 0;
+        }
+
+        int take(Snapshot& snap) {
+            snap.time = std::chrono::steady_clock::now();
+            counters.read(snap.totals);
+
+            // Per-CPU values: the kernel rounds each CPU's value up to 8 bytes
+            size_t stride = ((sizeof(packet_filter::PacketStats) + 7) & ~7UL) * ncpus;
+            snap.sources.clear();
+            if (scan_batched(maps[1], stride, keys, values, [&](const __u8* k, const __u8* v, __u32 count) {
+                    for (__u32 i = 0; i < count; i++) {
+                        __u32 ip;
+                        memcpy(&ip, k + i * sizeof(__u32), sizeof(ip));
+                        const auto* percpu = reinterpret_cast<const packet_filter::PacketStats*>(v + i * stride);
+                        packet_filter::PacketStats sum = {0, 0};
+                        for (int cpu = 0; cpu < ncpus; cpu++) {
+                            sum.dropped += percpu[cpu].dropped;
+                            sum.passed += percpu[cpu].passed;
+                        }
+                        snap.sources[ip] = sum;
+                    }
+                }) != 0) {
+                return -1;
+            }
+
+            // Entry counts of the bounded maps, as last counted by the daemon
+            if (scan_batched(maps[4], sizeof(packet_filter::MapUsage), keys, values,
+                             [&](const __u8* k, const __u8* v, __u32 count) {
+                    for (__u32 i = 0; i < count; i++) {
+                        __u32 slot;
+                        memcpy(&slot, k + i * sizeof(__u32), sizeof(slot));
+                        if (slot < packet_filter::MAP_USAGE_SLOTS) {
+                            memcpy(&usage[slot], v + i * sizeof(packet_filter::MapUsage), sizeof(usage[slot]));
+                        }
+                    }
+                }) != 0) {
+                return -1;
+            }
+
+            // LPM tries have no batch ops: the prefixes are walked again only when the
+            // published count changes or the list is old, each refresh reads just the hits
+            if (usage[packet_filter::MAP_USAGE_BLACKLIST_SUBNETS].entries != prefix_keys.size() ||
+                snap.time - prefix_keys_time >= PREFIX_KEYS_REFRESH) {
+                read_prefix_keys();
+                prefix_keys_time = snap.time;
+            }
+            snap.prefix_hits.clear();
+            for (const auto& key : prefix_keys) {
+                __u64 hits = 0;
+                if (bpf_map_lookup_elem(maps[2].fd, &key, &hits) == 0) {
+                    snap.prefix_hits[static_cast<__u64>(key.prefixlen) << 32 | key.ip] = hits;
+                }
+            }
+
+            snap.rules.assign(L4_RULES_MAX, L4RuleStats{0, 0});
+            std::vector<L4RuleStats> percpu(ncpus);
+            for (__u32 i = 0; i < L4_RULES_MAX && i < maps[3].max_entries; i++) {
+                if (bpf_map_lookup_elem(maps[3].fd, &i, percpu.data()) != 0) {
+                    continue;
+                }
+                for (const auto& stats : percpu) {
+                    snap.rules[i].packets += stats.packets;
+                    snap.rules[i].bytes += stats.bytes;
+                }
+            }
+            return 0;
+        }
+
+        void render(const Snapshot& prev, const Snapshot& cur, double scan_ms, std::ostream& out) const {
+            double secs = std::chrono::duration<double>(cur.time - prev.time).count();
+            if (secs <= 0) {
+                return;
+            }
+            auto rate = [&](__u32 counter) {
+                return (cur.totals.values[counter] - prev.totals.values[counter]) / secs;
+            };
+
+            time_t now = time(nullptr);
+            char stamp[32];
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+            out << "packetfilter top - " << stamp << "  (interval " << std::fixed << std::setprecision(2) << secs
+                << " s, scan " << std::setprecision(1) << scan_ms << " ms)\n\n";
+
+            out << std::left << std::setw(12) << "" << std::right << std::setw(12) << "pps" << std::setw(12) << "bps"
+                << "\n";
+            const struct {
+                const char* name;
+                __u32 packets;
+                __u32 bytes;
+            } verdicts[] = {
+                {"passed", packet_filter::COUNTER_PASSED, packet_filter::COUNTER_PASSED_BYTES},
+                {"dropped", packet_filter::COUNTER_DROPPED, packet_filter::COUNTER_DROPPED_BYTES},
+                {"redirected", packet_filter::COUNTER_REDIRECTED, packet_filter::COUNTER_REDIRECTED_BYTES},
+            };
+            for (const auto& verdict : verdicts) {
+                out << std::left << std::setw(12) << verdict.name << std::right << std::setw(12)
+                    << human(rate(verdict.packets)) << std::setw(12) << human(rate(verdict.bytes) * 8) << "\n";
+            }
+
+            out << "\nDrop reasons (pps):";
+            bool any = false;
+            for (__u32 reason = 0; reason < packet_filter::DROP_REASONS; reason++) {
+                double pps = rate(packet_filter::COUNTER_DROP_REASONS + reason);
+                if (pps > 0) {
+                    out << "  " << packet_filter::drop_reason_name(reason) << " " << human(pps);
+                    any = true;
+                }
+            }
+            out << (any ? "\n" : "  none\n");
+
+            // Sources: a source missing from the previous snapshot was seen for the first time
+            std::vector<RateEntry> drops, passes;
+            for (const auto& entry : cur.sources) {
+                auto old = prev.sources.find(entry.first);
+                packet_filter::PacketStats base = old != prev.sources.end() ? old->second
+                                                                            : packet_filter::PacketStats{0, 0};
+                if (entry.second.dropped > base.dropped) {
+                    drops.push_back({entry.first, (entry.second.dropped - base.dropped) / secs});
+                }
+                if (entry.second.passed > base.passed) {
+                    passes.push_back({entry.first, (entry.second.passed - base.passed) / secs});
+                }
+            }
+            print_top(out, "Top sources by drop rate (pps)", drops, [](__u64 key) { return ip_string(key); });
+            print_top(out, "Top sources by pass rate (pps)", passes, [](__u64 key) { return ip_string(key); });
+
+            std::vector<RateEntry> prefixes;
+            for (const auto& entry : cur.prefix_hits) {
+                auto old = prev.prefix_hits.find(entry.first);
+                __u64 base = old != prev.prefix_hits.end() ? old->second : 0;
+                if (entry.second > base) {
+                    prefixes.push_back({entry.first, (entry.second - base) / secs});
+                }
+            }
+            print_top(out, "Top blacklist prefixes by hits (pps)", prefixes, [](__u64 key) {
+                return ip_string(key & 0xFFFFFFFF) + "/" + std::to_string(key >> 32);
+            });
+
+            std::vector<RateEntry> rules;
+            for (__u32 i = 0; i < cur.rules.size() && i < prev.rules.size(); i++) {
+                if (cur.rules[i].packets > prev.rules[i].packets) {
+                    rules.push_back({i, (cur.rules[i].packets - prev.rules[i].packets) / secs});
+                }
+            }
+            print_top(out, "Top l4 rules by hits (pps)", rules, [this](__u64 key) { return rule_name(key); });
+
+            out << "\nMaps (last map usage count):\n";
+            for (__u32 slot = 0; slot < packet_filter::MAP_USAGE_SLOTS; slot++) {
+                const packet_filter::MapUsage& map = usage[slot];
+                if (map.capacity == 0) {
+                    continue; // Not counted by the daemon (yet)
+                }
+                out << "  " << std::left << std::setw(24) << MAP_USAGE_NAMES[slot] << std::right << std::setw(9)
+                    << map.entries << " / " << std::setw(9) << map.capacity << std::setw(6) << std::setprecision(0)
+                    << 100.0 * map.entries / map.capacity << "%  peak " << map.high_water << "\n";
+            }
+            out << std::flush;
+        }
+
+    private:
+        static std::string human(double v) {
+            const char* units[] = {"", "K", "M", "G", "T"};
+            int unit = 0;
+            while (v >= 1000 && unit < 4) {
+                v /= 1000;
+                unit++;
+            }
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(unit ? 1 : 0) << v << units[unit];
+            return ss.str();
+        }
+
+        static std::string ip_string(__u64 ip) {
+            struct in_addr addr;
+            addr.s_addr = static_cast<__u32>(ip);
+            char buf[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+            return buf;
+        }
+
+        template <typename Label>
+        void print_top(std::ostream& out, const char* title, std::vector<RateEntry>& entries, Label label) const {
+            size_t n = std::min<size_t>(options.top, entries.size());
+            std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                              [](const RateEntry& a, const RateEntry& b) { return a.rate > b.rate; });
+            out << "\n" << title << ":" << (n ? "\n" : "  none\n");
+            for (size_t i = 0; i < n; i++) {
+                out << "  " << std::left << std::setw(24) << label(entries[i].key) << std::right << std::setw(10)
+                    << human(entries[i].rate) << "\n";
+            }
+        }
+
+        // Names of the l4_rule lines in config order (the daemon numbers the valid lines
+        // only, so a rejected line shifts the names after it)
+        void read_rule_names() {
+            if (options.config.empty()) {
+                return;
+            }
+            std::ifstream file(options.config);
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line.find("l4_rule=") != 0) {
+                    continue;
+                }
+                std::string name = "rule" + std::to_string(rule_names.size());
+                std::stringstream ss(line.substr(strlen("l4_rule=")));
+                std::string token;
+                while (ss >> token) {
+                    if (token.find("name=") == 0) {
+                        name = token.substr(strlen("name="));
+                    }
+                }
+                rule_names.push_back(name);
+            }
+        }
+
+        void read_prefix_keys() {
+            prefix_keys.clear();
+            packet_filter::BpfTrieKey key;
+            bool have_key = false;
+            while (bpf_map_get_next_key(maps[2].fd, have_key ? &key : nullptr, &key) == 0) {
+                have_key = true;
+                prefix_keys.push_back(key);
+            }
+        }
+
+        std::string rule_name(__u64 index) const {
+            return index < rule_names.size() ? rule_names[index] : "rule" + std::to_string(index);
+        }
+
+        Options options;
+        int ncpus;
+        PinnedMap maps[5];
+        packet_filter::MapUsage usage[packet_filter::MAP_USAGE_SLOTS]; // Last map_usage_map read
+        std::vector<packet_filter::BpfTrieKey> prefix_keys;           // Blacklist prefixes, see take()
+        std::chrono::steady_clock::time_point prefix_keys_time;
+        packet_filter::CounterReader counters;
+        std::vector<std::string> rule_names;
+        std::vector<__u8> keys;   // Batch buffers, kept between refreshes
+        std::vector<__u8> values;
+    };
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--pin-dir DIR] [--config FILE] [--interval MS] [--top N] [--count N]" << std::endl;
+        return 1;
+    }
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    Dashboard dashboard(options);
+    if (dashboard.open() != 0) {
+        return 1;
+    }
+
+    bool tty = isatty(STDOUT_FILENO);
+    Snapshot snapshots[2];
+    int cur = 0;
+    if (dashboard.take(snapshots[cur]) != 0) {
+        return 1;
+    }
+    for (__u32 refresh = 0; !exiting && (options.count == 0 || refresh < options.count); refresh++) {
+        usleep(options.interval_ms * 1000);
+        if (exiting) {
+            break;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (dashboard.take(snapshots[1 - cur]) != 0) {
+            return 1;
+        }
+        double scan_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (tty) {
+            std::cout << "\033[H\033[2J"; // Clear the screen
+        }
+        dashboard.render(snapshots[cur], snapshots[1 - cur], scan_ms, std::cout);
+        cur = 1 - cur;
+    }
+    return 0;
+}
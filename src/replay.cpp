@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <arpa/inet.h>
+#include <bpf/bpf.h>
+
+#include "replay.h"
+#include "packet_filter.h"
+#include "pcap.h"
+
+namespace packet_filter {
+    namespace {
+        const __u32 XDP_VERDICTS = 5; // XDP_ABORTED .. XDP_REDIRECT
+        const char* VERDICT_NAMES[XDP_VERDICTS] = {"aborted", "dropped", "passed", "tx", "redirected"};
+        const __u32 LINKTYPE_ETHERNET = 1;
+        const size_t TOP_RULES = 20;
+
+        struct ReplayResult {
+            std::string file;
+            bool ok = false;
+            __u64 packets = 0;
+            __u64 bytes = 0;
+            __u64 errors = 0;          // Frames rejected by BPF_PROG_TEST_RUN (e.g. shorter than Ethernet)
+            __u64 verdicts[XDP_VERDICTS] = {};
+            double seconds = 0;
+        };
+
+        struct RuleHits {
+            BpfTrieKey key;
+            __u64 hits;
+        };
+
+        void replay_file(int prog_fd, ReplayResult& result) {
+            PcapFile capture;
+            if (capture.open(result.file) != 0) {
+                return;
+            }
+            if (capture.linktype() != LINKTYPE_ETHERNET) {
+                std::cerr << result.file << ": link type " << capture.linktype()
+                          << " is not Ethernet, skipping." << std::endl;
+                return;
+            }
+
+            // Frames are passed straight from the mapped file; the kernel copies each one
+            struct bpf_test_run_opts opts;
+            PcapPacket packet;
+            auto start = std::chrono::steady_clock::now();
+            while (capture.next(packet)) {
+                memset(&opts, 0, sizeof(opts));
+                opts.sz = sizeof(opts);
+                opts.data_in = packet.data;
+                opts.data_size_in = packet.caplen;
+                opts.repeat = 1;
+
+                result.packets++;
+                result.bytes += packet.caplen;
+                if (bpf_prog_test_run_opts(prog_fd, &opts) != 0 || opts.retval >= XDP_VERDICTS) {
+                    result.errors++;
+                    continue;
+                }
+                result.verdicts[opts.retval]++;
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.ok = true;
+        }
+
+        void print_result(const ReplayResult& result) {
+            std::cout << std::left << std::setw(32) << result.file << std::right
+                      << std::setw(10) << result.packets << " pkts";
+            for (__u32 v = 0; v < XDP_VERDICTS; v++) {
+                if (result.verdicts[v] > 0) {
+                    std::cout << "  " << VERDICT_NAMES[v] << " " << result.verdicts[v];
+                }
+            }
+            if (result.errors > 0) {
+                std::cout << "  errors " << result.errors;
+            }
+            double pps = result.seconds > 0 ? result.packets / result.seconds : 0;
+            std::cout << "  (" << std::fixed << std::setprecision(3) << result.seconds << " s, "
+                      << std::setprecision(0) << pps << " pps)" << std::endl;
+        }
+
+        void print_rule_hits(int blacklist_map_fd) {
+            std::vector<RuleHits> rules;
+            BpfTrieKey key, next_key;
+            void* prev = nullptr;
+            while (bpf_map_get_next_key(blacklist_map_fd, prev, &next_key) == 0) {
+                __u64 hits = 0;
+                if (bpf_map_lookup_elem(blacklist_map_fd, &next_key, &hits) == 0 && hits > 0) {
+                    rules.push_back({next_key, hits});
+                }
+                key = next_key;
+                prev = &key;
+            }
+
+            std::cout << "\nBlacklist rules hit: " << rules.size() << std::endl;
+            std::sort(rules.begin(), rules.end(), [](const RuleHits& a, const RuleHits& b) {
+                return a.hits > b.hits;
+            });
+            for (size_t i = 0; i < rules.size() && i < TOP_RULES; i++) {
+                char ip_str[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &rules[i].key.ip, ip_str, sizeof(ip_str));
+                std::string prefix = std::string(ip_str) + "/" + std::to_string(rules[i].key.prefixlen);
+                std::cout << "  " << std::left << std::setw(20) << prefix << std::right
+                          << std::setw(12) << rules[i].hits << std::endl;
+            }
+        }
+    }
+
+    int run_replay(int prog_fd, int blacklist_map_fd, const std::vector<std::string>& files) {
+        std::vector<ReplayResult> results(files.size());
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < files.size(); i++) {
+            results[i].file = files[i];
+            threads.emplace_back(replay_file, prog_fd, std::ref(results[i]));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "\n-------- Replay results --------\n";
+        ReplayResult total;
+        total.file = "total";
+        total.ok = true;
+        for (const auto& result : results) {
+            if (!result.ok) {
+                std::cout << std::left << std::setw(32) << result.file << " failed" << std::endl;
+                total.ok = false;
+                continue;
+            }
+            print_result(result);
+            total.packets += result.packets;
+            total.bytes += result.bytes;
+            total.errors += result.errors;
+            for (__u32 v = 0; v < XDP_VERDICTS; v++) {
+                total.verdicts[v] += result.verdicts[v];
+            }
+        }
+        if (results.size() > 1) {
+            total.seconds = seconds; // Wall clock across the parallel threads
+            print_result(total);
+        }
+
+        print_rule_hits(blacklist_map_fd);
+        return total.ok ? 0 : -1;
+    }
+} // namespace packet_filter
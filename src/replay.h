@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <vector>
+
+namespace packet_filter {
+    // Offline replay (packetfilter --replay a.pcap b.pcap ...): every frame of the
+    // capture files goes through the loaded xdp_filter with BPF_PROG_TEST_RUN,
+    // one thread per file. Prints verdict counts and rate per file, then the
+    // blacklist rules ranked by hits. Returns 0 when every file was replayed.
+    int run_replay(int prog_fd, int blacklist_map_fd, const std::vector<std::string>& files);
+} // namespace packet_filter
+
+#endif /* REPLAY_H */
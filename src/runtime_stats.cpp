@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <prometheus/histogram.h>
+
+#include "runtime_stats.h"
+#include "metrics.h"
+
+namespace packet_filter {
+    namespace {
+        const char* const STAGE_NAMES[LAT_STAGES] = {"accounting", "state", "rules", "total"};
+
+        prometheus::Family<prometheus::Counter>& runs_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_xdp_runs_total")
+                .Help("xdp_filter invocations counted while BPF_STATS_RUN_TIME is enabled")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Counter>& run_time_family() {
+            static auto& family = prometheus::BuildCounter()
+                .Name("packetfilter_xdp_run_time_seconds_total")
+                .Help("Time spent in xdp_filter while BPF_STATS_RUN_TIME is enabled")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Gauge>& ns_per_packet_family() {
+            static auto& family = prometheus::BuildGauge()
+                .Name("packetfilter_xdp_ns_per_packet")
+                .Help("Average xdp_filter run time per packet over the last interval")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        prometheus::Family<prometheus::Histogram>& stage_family() {
+            static auto& family = prometheus::BuildHistogram()
+                .Name("packetfilter_xdp_stage_duration_seconds")
+                .Help("Sampled xdp_filter latency per stage (log2 buckets)")
+                .Register(metrics::registry());
+            return family;
+        }
+
+        // Upper bounds of the log2 buckets in seconds (the last bucket is +Inf)
+        prometheus::Histogram::BucketBoundaries stage_boundaries() {
+            prometheus::Histogram::BucketBoundaries bounds;
+            for (__u32 i = 0; i + 1 < LAT_BUCKETS; i++) {
+                bounds.push_back(static_cast<double>(1ULL << (i + 1)) / 1e9);
+            }
+            return bounds;
+        }
+
+        // Upper bound in ns of the bucket holding the p-th percentile
+        __u64 percentile_ns(const LatencyHist& hist, double p) {
+            __u64 total = 0;
+            for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+                total += hist.buckets[i];
+            }
+            __u64 rank = static_cast<__u64>(p * total);
+            __u64 seen = 0;
+            for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+                seen += hist.buckets[i];
+                if (seen > rank) {
+                    return 1ULL << (i + 1);
+                }
+            }
+            return 0;
+        }
+    }
+
+    RuntimeStatsMonitor::RuntimeStatsMonitor(int prog_fd, int latency_map_fd)
+        : prog_fd(prog_fd), map_fd_latency(latency_map_fd), ncpus(libbpf_num_possible_cpus()), stats_fd(-1),
+          latency(false), running(false), prev_run_cnt(0), prev_run_time_ns(0) {
+        memset(prev_hist, 0, sizeof(prev_hist));
+    }
+
+    RuntimeStatsMonitor::~RuntimeStatsMonitor() {
+        stop();
+        if (stats_fd >= 0) {
+            close(stats_fd);
+        }
+    }
+
+    void RuntimeStatsMonitor::set_config(const RuntimeStatsConfig& config, bool latency_enabled) {
+        std::lock_guard<std::mutex> lock(config_mutex);
+        current_config = config;
+        latency = latency_enabled;
+
+        // The kernel keeps run-time stats on while any fd from bpf_enable_stats() is open
+        if (config.bpf_stats && stats_fd < 0) {
+            stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+            if (stats_fd < 0) {
+                std::cerr << "Failed to enable BPF_STATS_RUN_TIME: " << strerror(errno) << std::endl;
+            } else {
+                std::cout << "BPF run-time statistics enabled" << std::endl;
+            }
+        } else if (!config.bpf_stats && stats_fd >= 0) {
+            close(stats_fd);
+            stats_fd = -1;
+            std::cout << "BPF run-time statistics disabled" << std::endl;
+        }
+    }
+
+    void RuntimeStatsMonitor::start() {
+        if (running) {
+            return;
+        }
+        if (ncpus <= 0) {
+            std::cerr << "Failed to get number of possible CPUs: " << strerror(-ncpus) << std::endl;
+            return;
+        }
+        running = true;
+        worker = std::thread(&RuntimeStatsMonitor::run, this);
+    }
+
+    void RuntimeStatsMonitor::stop() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void RuntimeStatsMonitor::run() {
+        while (running) {
+            RuntimeStatsConfig config;
+            bool latency_enabled;
+            {
+                std::lock_guard<std::mutex> lock(config_mutex);
+                config = current_config;
+                latency_enabled = latency;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(config.interval_ms),
+                              [this] { return !running; });
+            }
+            if (!running) {
+                continue;
+            }
+
+            __u64 run_cnt = 0, run_time_ns = 0;
+            if (config.bpf_stats && read_prog_stats(run_cnt, run_time_ns) == 0) {
+                // run_cnt only grows while stats are enabled, a reset shows up as a decrease
+                if (run_cnt >= prev_run_cnt && run_time_ns >= prev_run_time_ns) {
+                    __u64 runs = run_cnt - prev_run_cnt;
+                    __u64 time_ns = run_time_ns - prev_run_time_ns;
+                    runs_family().Add({}).Increment(static_cast<double>(runs));
+                    run_time_family().Add({}).Increment(static_cast<double>(time_ns) / 1e9);
+                    ns_per_packet_family().Add({}).Set(runs ? static_cast<double>(time_ns) / runs : 0.0);
+                }
+                prev_run_cnt = run_cnt;
+                prev_run_time_ns = run_time_ns;
+            }
+
+            if (latency_enabled) {
+                LatencyHist merged[LAT_STAGES];
+                if (read_histograms(merged) == 0) {
+                    export_histograms(merged);
+                }
+            }
+        }
+    }
+
+    int RuntimeStatsMonitor::read_prog_stats(__u64& run_cnt, __u64& run_time_ns) {
+        struct bpf_prog_info info;
+        __u32 info_len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (bpf_prog_get_info_by_fd(prog_fd, &info, &info_len) != 0) {
+            std::cerr << "Failed to read xdp_filter info: " << strerror(errno) << std::endl;
+            return -1;
+        }
+        run_cnt = info.run_cnt;
+        run_time_ns = info.run_time_ns;
+        return 0;
+    }
+
+    // Sum the per-CPU histograms of every stage
+    int RuntimeStatsMonitor::read_histograms(LatencyHist merged[LAT_STAGES]) {
+        std::vector<LatencyHist> percpu(ncpus);
+
+        for (__u32 stage = 0; stage < LAT_STAGES; stage++) {
+            if (bpf_map_lookup_elem(map_fd_latency, &stage, percpu.data()) != 0) {
+                std::cerr << "Failed to read latency_hist_map: " << strerror(errno) << std::endl;
+                return -1;
+            }
+            memset(&merged[stage], 0, sizeof(LatencyHist));
+            for (int cpu = 0; cpu < ncpus; cpu++) {
+                for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+                    merged[stage].buckets[i] += percpu[cpu].buckets[i];
+                }
+                merged[stage].sum_ns += percpu[cpu].sum_ns;
+            }
+        }
+        return 0;
+    }
+
+    // Feed the samples added since the previous interval into the Prometheus histograms
+    void RuntimeStatsMonitor::export_histograms(const LatencyHist merged[LAT_STAGES]) {
+        static const prometheus::Histogram::BucketBoundaries bounds = stage_boundaries();
+
+        for (__u32 stage = 0; stage < LAT_STAGES; stage++) {
+            std::vector<double> increments(LAT_BUCKETS);
+            for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+                increments[i] = static_cast<double>(merged[stage].buckets[i] - prev_hist[stage].buckets[i]);
+            }
+            double sum_s = static_cast<double>(merged[stage].sum_ns - prev_hist[stage].sum_ns) / 1e9;
+            stage_family().Add({{"stage", STAGE_NAMES[stage]}}, bounds).ObserveMultiple(increments, sum_s);
+            prev_hist[stage] = merged[stage];
+        }
+    }
+
+    void RuntimeStatsMonitor::print_summary(std::ostream& out) {
+        bool bpf_stats, latency_enabled;
+        {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            bpf_stats = current_config.bpf_stats;
+            latency_enabled = latency;
+        }
+
+        __u64 run_cnt = 0, run_time_ns = 0;
+        if (bpf_stats && read_prog_stats(run_cnt, run_time_ns) == 0 && run_cnt > 0) {
+            out << "XDP program: " << run_cnt << " runs, " << std::fixed << std::setprecision(1)
+                << static_cast<double>(run_time_ns) / run_cnt << " ns/packet on average\n";
+        }
+
+        LatencyHist merged[LAT_STAGES];
+        if (!latency_enabled || read_histograms(merged) != 0) {
+            return;
+        }
+        out << "Sampled latency per stage (ns, p50/p99 are bucket upper bounds):\n";
+        for (__u32 stage = 0; stage < LAT_STAGES; stage++) {
+            __u64 samples = 0;
+            for (__u32 i = 0; i < LAT_BUCKETS; i++) {
+                samples += merged[stage].buckets[i];
+            }
+            if (samples == 0) {
+                continue;
+            }
+            out << "  " << std::left << std::setw(11) << STAGE_NAMES[stage] << std::right
+                << " samples " << std::setw(10) << samples
+                << "  mean " << std::setw(7) << merged[stage].sum_ns / samples
+                << "  p50 <" << std::setw(7) << percentile_ns(merged[stage], 0.5)
+                << "  p99 <" << std::setw(7) << percentile_ns(merged[stage], 0.99) << "\n";
+        }
+    }
+} // namespace packet_filter
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef RUNTIME_STATS_H
+#define RUNTIME_STATS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#include "packet_filter.h"
+
+namespace packet_filter {
+    // Latency histogram layout (must match the BPF definitions)
+    constexpr __u32 LAT_BUCKETS = 32;
+    constexpr __u32 LAT_STAGES = 4; // accounting, state, rules, total
+
+    // Histogram of one stage (must match struct latency_hist)
+    struct LatencyHist {
+        __u64 buckets[LAT_BUCKETS]; // buckets[i]: durations in [2^i, 2^(i+1)) ns
+        __u64 sum_ns;
+    };
+
+    // Background thread that exports the cost of xdp_filter: run_cnt / run_time_ns
+    // from bpf_prog_info (needs BPF_STATS_RUN_TIME) and the sampled per-stage
+    // latency histograms of latency_hist_map.
+    class RuntimeStatsMonitor {
+    public:
+        RuntimeStatsMonitor(int prog_fd, int latency_map_fd);
+        ~RuntimeStatsMonitor();
+
+        // Apply a new configuration (safe to call while the thread is running);
+        // enables or disables BPF_STATS_RUN_TIME as requested
+        void set_config(const RuntimeStatsConfig& config, bool latency_enabled);
+
+        void start();
+        void stop();
+
+        // Average ns/packet since startup and per-stage latency percentiles
+        void print_summary(std::ostream& out);
+
+    private:
+        void run();
+        int read_prog_stats(__u64& run_cnt, __u64& run_time_ns);
+        int read_histograms(LatencyHist merged[LAT_STAGES]);
+        void export_histograms(const LatencyHist merged[LAT_STAGES]);
+
+        int prog_fd;
+        int map_fd_latency;
+        int ncpus;
+        int stats_fd; // Holds BPF_STATS_RUN_TIME enabled, -1 when off
+
+        std::mutex config_mutex;
+        RuntimeStatsConfig current_config;
+        bool latency;
+
+        std::thread worker;
+        std::atomic<bool> running;
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+
+        // Totals of the previous interval
+        __u64 prev_run_cnt;
+        __u64 prev_run_time_ns;
+        LatencyHist prev_hist[LAT_STAGES];
+    };
+} // namespace packet_filter
+
+#endif /* RUNTIME_STATS_H */
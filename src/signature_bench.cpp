@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+// Throughput benchmark of the payload signature matcher over a capture file.
+// Usage: signature_bench <capture.pcap> [config.txt] [iterations]
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+#include "pcap.h"
+#include "signatures.h"
+
+namespace {
+    struct Payload {
+        const __u8* data;
+        __u32 len;
+    };
+
+    // Signatures used when the config file has no payload_signature lines
+    const char* DEFAULT_SIGNATURES[] = {
+        "http-get:GET /",
+        "http-post:POST /",
+        "http-put:PUT /",
+        "http-delete:DELETE /",
+        "python-client:User-Agent: Python",
+        "tls-handshake:\\x16\\x03\\x01",
+    };
+
+    std::vector<packet_filter::PayloadSignature> load_signatures(const char* config_path) {
+        std::vector<packet_filter::PayloadSignature> signatures;
+        packet_filter::PayloadSignature signature;
+        if (config_path) {
+            std::ifstream file(config_path);
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line.find("payload_signature=") == 0 &&
+                    packet_filter::parse_signature(line.substr(strlen("payload_signature=")), signature)) {
+                    signatures.push_back(signature);
+                }
+            }
+        }
+        if (signatures.empty()) {
+            for (const char* value : DEFAULT_SIGNATURES) {
+                packet_filter::parse_signature(value, signature);
+                signatures.push_back(signature);
+            }
+        }
+        return signatures;
+    }
+
+    // Reference matcher: one memmem() per signature
+    int naive_find(const std::vector<packet_filter::PayloadSignature>& signatures, const Payload& payload) {
+        const void* first = nullptr;
+        int found = -1;
+        for (size_t id = 0; id < signatures.size(); id++) {
+            const std::string& pattern = signatures[id].pattern;
+            const void* hit = memmem(payload.data, payload.len, pattern.data(), pattern.size());
+            if (!hit) {
+                continue;
+            }
+            const __u8* end = static_cast<const __u8*>(hit) + pattern.size();
+            if (!first || end < first) {
+                first = end;
+                found = static_cast<int>(id);
+            }
+        }
+        return found;
+    }
+
+    template <typename Match>
+    double run(const char* label, const std::vector<Payload>& payloads, __u64 bytes, int iterations,
+               Match match, std::vector<int>& results) {
+        results.assign(payloads.size(), -1);
+        auto start = std::chrono::steady_clock::now();
+        for (int it = 0; it < iterations; it++) {
+            for (size_t i = 0; i < payloads.size(); i++) {
+                results[i] = match(payloads[i]);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        __u64 matched = 0;
+        for (int id : results) {
+            matched += id >= 0;
+        }
+        double packets = static_cast<double>(payloads.size()) * iterations;
+        std::cout << std::left << std::setw(16) << label << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << bytes * iterations / seconds / 1e6 << " MB/s"
+                  << std::setw(10) << packets / seconds / 1e6 << " Mpps"
+                  << std::setw(10) << seconds * 1e9 / packets << " ns/pkt"
+                  << "   matched " << matched << "/" << payloads.size() << std::endl;
+        return seconds;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " <capture.pcap> [config.txt] [iterations]" << std::endl;
+        return 1;
+    }
+    int iterations = argc > 3 ? atoi(argv[3]) : 20000;
+    if (iterations <= 0) {
+        iterations = 1;
+    }
+
+    packet_filter::PcapFile capture;
+    if (capture.open(argv[1]) != 0) {
+        return 1;
+    }
+    std::vector<Payload> payloads;
+    __u64 bytes = 0;
+    packet_filter::PcapPacket packet;
+    while (capture.next(packet)) {
+        __u32 offset = packet_filter::payload_offset(packet.data, packet.caplen);
+        payloads.push_back({packet.data + offset, packet.caplen - offset});
+        bytes += packet.caplen - offset;
+    }
+    if (payloads.empty()) {
+        std::cerr << "No packets in " << argv[1] << std::endl;
+        return 1;
+    }
+
+    auto signatures = load_signatures(argc > 2 ? argv[2] : nullptr);
+    packet_filter::SignatureMatcher matcher(signatures);
+    std::cout << signatures.size() << " signatures, " << matcher.state_count() << " DFA states; "
+              << payloads.size() << " packets, " << bytes << " payload bytes, "
+              << iterations << " iterations" << std::endl;
+
+    std::vector<int> dfa_results, naive_results;
+    double dfa_seconds = run("aho-corasick", payloads, bytes, iterations,
+        [&matcher](const Payload& p) { return matcher.find(p.data, p.len); }, dfa_results);
+    double naive_seconds = run("memmem", payloads, bytes, iterations,
+        [&signatures](const Payload& p) { return naive_find(signatures, p); }, naive_results);
+    std::cout << "speedup " << std::setprecision(2) << naive_seconds / dfa_seconds << "x" << std::endl;
+
+    if (dfa_results != naive_results) {
+        std::cerr << "Mismatch between the DFA and the reference matcher" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <cstring>
+#include <deque>
+#include <netinet/in.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "signatures.h"
+
+namespace packet_filter {
+    namespace {
+        const size_t MAX_SIMD_START_BYTES = 8;
+
+        int hex_value(char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+    }
+
+    bool parse_signature(const std::string& value, PayloadSignature& signature) {
+        size_t colon = value.find(':');
+        if (colon == std::string::npos || colon == 0) {
+            return false;
+        }
+        signature.name = value.substr(0, colon);
+        signature.pattern.clear();
+
+        for (size_t i = colon + 1; i < value.size(); i++) {
+            if (value[i] != '\\' || i + 1 == value.size()) {
+                signature.pattern += value[i];
+                continue;
+            }
+            char escape = value[++i];
+            switch (escape) {
+                case 'r': signature.pattern += '\r'; break;
+                case 'n': signature.pattern += '\n'; break;
+                case 't': signature.pattern += '\t'; break;
+                case 'x': {
+                    int hi = i + 1 < value.size() ? hex_value(value[i + 1]) : -1;
+                    int lo = i + 2 < value.size() ? hex_value(value[i + 2]) : -1;
+                    if (hi < 0 || lo < 0) {
+                        return false;
+                    }
+                    signature.pattern += static_cast<char>(hi << 4 | lo);
+                    i += 2;
+                    break;
+                }
+                default: signature.pattern += escape; break; // "\\", "\:" ...
+            }
+        }
+        return !signature.pattern.empty();
+    }
+
+    __u32 payload_offset(const __u8* frame, __u32 len) {
+        const __u32 eth_len = 14;
+        if (len < eth_len + 20 || frame[12] != 0x08 || frame[13] != 0x00) {
+            return len;
+        }
+        const __u8* ip = frame + eth_len;
+        __u32 ihl = (ip[0] & 0x0F) * 4;
+        __u32 offset = eth_len + ihl;
+        if (ihl < 20 || offset > len) {
+            return len;
+        }
+        bool first_fragment = ((ip[6] & 0x1F) | ip[7]) == 0;
+        if (!first_fragment) {
+            return offset;
+        }
+        if (ip[9] == IPPROTO_TCP && offset + 20 <= len) {
+            offset += (frame[offset + 12] >> 4) * 4;
+        } else if (ip[9] == IPPROTO_UDP) {
+            offset += 8;
+        }
+        return offset < len ? offset : len;
+    }
+
+    SignatureMatcher::SignatureMatcher(const std::vector<PayloadSignature>& signatures) : class_count(1) {
+        memset(classes, 0, sizeof(classes));
+        memset(start_byte, 0, sizeof(start_byte));
+
+        // Every byte used by a pattern gets its own column, all other bytes share column 0
+        bool used[256] = {};
+        for (const auto& signature : signatures) {
+            for (unsigned char c : signature.pattern) {
+                used[c] = true;
+            }
+        }
+        for (int b = 0; b < 256; b++) {
+            if (used[b]) {
+                classes[b] = static_cast<__u8>(class_count++);
+            }
+        }
+
+        // Trie of all patterns; output = lowest signature id ending in the state
+        std::vector<std::vector<int>> next(1, std::vector<int>(class_count, -1));
+        std::vector<int> output(1, -1);
+        for (size_t id = 0; id < signatures.size(); id++) {
+            const std::string& pattern = signatures[id].pattern;
+            names.push_back(signatures[id].name);
+            if (pattern.empty()) {
+                continue;
+            }
+            int state = 0;
+            for (unsigned char c : pattern) {
+                int& child = next[state][classes[c]];
+                if (child < 0) {
+                    child = static_cast<int>(next.size());
+                    next.emplace_back(class_count, -1);
+                    output.push_back(-1);
+                }
+                state = next[state][classes[c]];
+            }
+            if (output[state] < 0) {
+                output[state] = static_cast<int>(id);
+            }
+            start_byte[static_cast<unsigned char>(pattern[0])] = true;
+        }
+
+        // Breadth-first: failure links, then fill every missing transition (full DFA)
+        std::vector<int> fail(next.size(), 0);
+        std::deque<int> queue;
+        for (__u32 cls = 0; cls < class_count; cls++) {
+            if (next[0][cls] < 0) {
+                next[0][cls] = 0;
+            } else {
+                queue.push_back(next[0][cls]);
+            }
+        }
+        while (!queue.empty()) {
+            int state = queue.front();
+            queue.pop_front();
+            int inherited = output[fail[state]];
+            if (inherited >= 0 && (output[state] < 0 || inherited < output[state])) {
+                output[state] = inherited;
+            }
+            for (__u32 cls = 0; cls < class_count; cls++) {
+                int child = next[state][cls];
+                if (child < 0) {
+                    next[state][cls] = next[fail[state]][cls];
+                } else {
+                    fail[child] = next[fail[state]][cls];
+                    queue.push_back(child);
+                }
+            }
+        }
+
+        // Flatten into one premultiplied table so a step is a single load
+        table.resize(next.size() * class_count);
+        for (size_t state = 0; state < next.size(); state++) {
+            for (__u32 cls = 0; cls < class_count; cls++) {
+                int target = next[state][cls];
+                table[state * class_count + cls] = target * class_count | (output[target] >= 0 ? MATCH_FLAG : 0);
+            }
+        }
+        match_id = output;
+
+        for (int b = 0; b < 256; b++) {
+            if (start_byte[b]) {
+                start_bytes.push_back(static_cast<__u8>(b));
+            }
+        }
+    }
+
+    // First position at or after pos holding a byte that can start a pattern
+    size_t SignatureMatcher::skip_root(const __u8* data, size_t pos, size_t len) const {
+#ifdef __SSE2__
+        size_t count = start_bytes.size();
+        if (count > 0 && count <= MAX_SIMD_START_BYTES) {
+            __m128i needles[MAX_SIMD_START_BYTES];
+            for (size_t i = 0; i < MAX_SIMD_START_BYTES; i++) {
+                needles[i] = _mm_set1_epi8(static_cast<char>(start_bytes[i < count ? i : 0]));
+            }
+            while (pos + 16 <= len) {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+                for (size_t i = 1; i < count; i++) {
+                    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[i]));
+                }
+                int mask = _mm_movemask_epi8(hits);
+                if (mask != 0) {
+                    return pos + __builtin_ctz(mask);
+                }
+                pos += 16;
+            }
+        }
+#endif
+        while (pos < len && !start_byte[data[pos]]) {
+            pos++;
+        }
+        return pos;
+    }
+
+    int SignatureMatcher::find(const __u8* data, size_t len) const {
+        const __u32* delta = table.data();
+        __u32 state = 0;
+        size_t pos = 0;
+        while (pos < len) {
+            if (state == 0) {
+                pos = skip_root(data, pos, len);
+                if (pos >= len) {
+                    break;
+                }
+            }
+            state = delta[state + classes[data[pos++]]];
+            if (state & MATCH_FLAG) {
+                return match_id[(state & ~MATCH_FLAG) / class_count];
+            }
+        }
+        return -1;
+    }
+} // namespace packet_filter
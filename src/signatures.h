@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef SIGNATURES_H
+#define SIGNATURES_H
+
+#include <string>
+#include <vector>
+#include <linux/types.h>
+
+namespace packet_filter {
+    // Payload signature from a "payload_signature=name:pattern" config line
+    struct PayloadSignature {
+        std::string name;
+        std::string pattern; // Raw bytes, escapes already decoded
+    };
+
+    // Parse "name:pattern"; the pattern accepts \xHH, \r, \n, \t and \\ escapes
+    bool parse_signature(const std::string& value, PayloadSignature& signature);
+
+    // Offset of the TCP/UDP payload (IP payload for other protocols) in an
+    // Ethernet frame; len when the frame carries no IPv4 payload
+    __u32 payload_offset(const __u8* frame, __u32 len);
+
+    // Multi-pattern matcher: Aho-Corasick automaton compiled to a full DFA.
+    // Bytes that never occur in a pattern share one column (byte classes), so the
+    // transition table stays small enough for L1/L2; while the automaton sits in
+    // the root state, SSE2 skips 16 bytes at a time to the next possible pattern start.
+    class SignatureMatcher {
+    public:
+        explicit SignatureMatcher(const std::vector<PayloadSignature>& signatures);
+
+        // Index of the signature that ends first in data, -1 if none matches
+        int find(const __u8* data, size_t len) const;
+
+        const std::string& name(int id) const { return names[id]; }
+        size_t size() const { return names.size(); }
+        size_t state_count() const { return class_count ? table.size() / class_count : 0; }
+
+    private:
+        size_t skip_root(const __u8* data, size_t pos, size_t len) const;
+
+        static constexpr __u32 MATCH_FLAG = 1U << 31;
+
+        __u8 classes[256];         // Byte -> column in the transition table
+        __u32 class_count;
+        std::vector<__u32> table;  // Next state premultiplied by class_count, MATCH_FLAG on accepting states
+        std::vector<int> match_id; // Signature reported by each state, -1 if none
+        bool start_byte[256];      // Bytes that leave the root state
+        std::vector<__u8> start_bytes;
+        std::vector<std::string> names;
+    };
+} // namespace packet_filter
+
+#endif /* SIGNATURES_H */
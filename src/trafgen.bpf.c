@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+// Traffic generator program for pf_trafgen.
+// Run with BPF_PROG_TEST_RUN + BPF_F_TEST_XDP_LIVE_FRAMES: every repetition
+// rewrites the source address of the template frame and redirects it out of
+// target_ifindex, so frames never cross the user/kernel boundary.
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#define ETH_P_IP 0x0800
+#define MAX_BLACKLIST_SOURCES 4096
+
+// Set by user-space before load
+const volatile __u32 target_ifindex = 0;
+const volatile __u32 src_base = 0;        // First generated source (host byte order)
+const volatile __u32 src_count = 0;       // Distinct generated sources, 0 = keep the template source
+const volatile __u32 blacklist_ratio = 0; // Percentage of frames sent from blacklisted sources
+const volatile __u32 blacklist_count = 0; // Entries used in blacklist_sources
+
+// Blacklisted sources (network byte order) picked for blacklist_ratio % of the frames
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, MAX_BLACKLIST_SOURCES);
+    __type(key, __u32);
+    __type(value, __u32);
+} blacklist_sources SEC(".maps");
+
+static __always_inline __u16 csum_fold(__u32 csum) {
+    csum = (csum & 0xffff) + (csum >> 16);
+    csum = (csum & 0xffff) + (csum >> 16);
+    return (__u16)~csum;
+}
+
+// Incremental checksum update for a 32-bit field change (RFC 1624)
+static __always_inline void csum_replace4(__u16 *sum, __u32 from, __u32 to) {
+    __u32 csum = (__u16)~*sum;
+    csum += (~from & 0xffff) + (~from >> 16);
+    csum += (to & 0xffff) + (to >> 16);
+    *sum = csum_fold(csum);
+}
+
+static __always_inline __u32 pick_source(void) {
+    if (blacklist_count && bpf_get_prandom_u32() % 100 < blacklist_ratio) {
+        __u32 idx = bpf_get_prandom_u32() % blacklist_count;
+        __u32 *src = bpf_map_lookup_elem(&blacklist_sources, &idx);
+        return src ? *src : 0;
+    }
+    if (src_count) {
+        return bpf_htonl(src_base + bpf_get_prandom_u32() % src_count);
+    }
+    return 0;
+}
+
+SEC("xdp")
+int xdp_trafgen(struct xdp_md *ctx) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+
+    struct ethhdr *eth = data;
+    if ((void *)(eth + 1) > data_end) {
+        return XDP_DROP;
+    }
+    if (eth->h_proto != bpf_htons(ETH_P_IP)) {
+        return bpf_redirect(target_ifindex, 0);
+    }
+
+    // Templates are built with a 20-byte IP header
+    struct iphdr *ip = (void *)(eth + 1);
+    if ((void *)(ip + 1) > data_end) {
+        return XDP_DROP;
+    }
+
+    __u32 src = pick_source();
+    if (src && src != ip->saddr) {
+        __u32 old = ip->saddr;
+        ip->saddr = src;
+        csum_replace4(&ip->check, old, src);
+
+        // The TCP/UDP checksum covers the source address through the pseudo-header
+        if (ip->protocol == IPPROTO_TCP) {
+            struct tcphdr *tcp = (void *)(ip + 1);
+            if ((void *)(tcp + 1) <= data_end) {
+                csum_replace4(&tcp->check, old, src);
+            }
+        } else if (ip->protocol == IPPROTO_UDP) {
+            struct udphdr *udp = (void *)(ip + 1);
+            if ((void *)(udp + 1) <= data_end && udp->check) {
+                csum_replace4(&udp->check, old, src);
+            }
+        }
+    }
+
+    return bpf_redirect(target_ifindex, 0);
+}
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
@@ -0,0 +1,394 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+// pf_trafgen: high-rate packet generator for load testing the filter on a veth pair.
+// Templates (protocol x size) are built once; the kernel replays them with
+// BPF_F_TEST_XDP_LIVE_FRAMES and xdp_trafgen rewrites the source per frame.
+//
+// Usage: pf_trafgen --dev veth-cli [--duration 10] [--threads 1] [--proto tcp:70,udp:20,icmp:10]
+//                   [--sizes 64:60,512:30,1500:10] [--sources 65536] [--src-base 10.0.0.0]
+//                   [--blacklist-ratio 20] [--config ../src/config.txt] [--dst-ip 192.168.100.1]
+//                   [--dst-mac ff:ff:ff:ff:ff:ff] [--batch 65536]
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/icmp.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "trafgen.skel.h"
+
+namespace {
+    const __u32 MAX_BLACKLIST_SOURCES = 4096; // Must match trafgen.bpf.c
+    const __u32 SCHEDULE_SLOTS = 100;         // Template slots per round, weighted by the mix
+
+    volatile bool exiting = false;
+
+    struct Weighted {
+        std::string name;
+        __u32 weight;
+    };
+
+    struct Options {
+        std::string dev;
+        __u32 duration = 10;
+        __u32 threads = 1;
+        std::vector<Weighted> protocols = {{"tcp", 70}, {"udp", 20}, {"icmp", 10}};
+        std::vector<Weighted> sizes = {{"64", 60}, {"512", 30}, {"1500", 10}};
+        __u32 sources = 65536;
+        std::string src_base = "10.0.0.0";
+        __u32 blacklist_ratio = 0;
+        std::string config;
+        std::string dst_ip = "192.168.100.1";
+        std::string dst_mac = "ff:ff:ff:ff:ff:ff";
+        __u32 batch = 65536;
+    };
+
+    struct Template {
+        std::vector<__u8> frame;
+        __u32 weight;
+    };
+
+    void sig_handler(int sig) {
+        exiting = true;
+    }
+
+    bool parse_weights(const std::string& value, std::vector<Weighted>& out) {
+        out.clear();
+        std::stringstream ss(value);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            size_t colon = item.find(':');
+            try {
+                out.push_back({item.substr(0, colon),
+                               colon == std::string::npos ? 1U : static_cast<__u32>(std::stoul(item.substr(colon + 1)))});
+            } catch (const std::exception& e) {
+                return false;
+            }
+        }
+        return !out.empty();
+    }
+
+    bool parse_args(int argc, char** argv, Options& options) {
+        for (int i = 1; i + 1 < argc; i += 2) {
+            std::string arg = argv[i];
+            std::string value = argv[i + 1];
+            try {
+                if (arg == "--dev") options.dev = value;
+                else if (arg == "--duration") options.duration = std::stoul(value);
+                else if (arg == "--threads") options.threads = std::max(1UL, std::stoul(value));
+                else if (arg == "--proto") { if (!parse_weights(value, options.protocols)) return false; }
+                else if (arg == "--sizes") { if (!parse_weights(value, options.sizes)) return false; }
+                else if (arg == "--sources") options.sources = std::stoul(value);
+                else if (arg == "--src-base") options.src_base = value;
+                else if (arg == "--blacklist-ratio") options.blacklist_ratio = std::min(100UL, std::stoul(value));
+                else if (arg == "--config") options.config = value;
+                else if (arg == "--dst-ip") options.dst_ip = value;
+                else if (arg == "--dst-mac") options.dst_mac = value;
+                else if (arg == "--batch") options.batch = std::max(1UL, std::stoul(value));
+                else return false;
+            } catch (const std::exception& e) {
+                return false;
+            }
+        }
+        return argc % 2 == 1 && !options.dev.empty();
+    }
+
+    __u32 csum_add(const __u8* data, size_t len, __u32 sum) {
+        for (size_t i = 0; i + 1 < len; i += 2) {
+            sum += (data[i] << 8) | data[i + 1];
+        }
+        if (len & 1) {
+            sum += data[len - 1] << 8;
+        }
+        return sum;
+    }
+
+    __u16 csum_finish(__u32 sum) {
+        while (sum >> 16) {
+            sum = (sum & 0xffff) + (sum >> 16);
+        }
+        return htons(static_cast<__u16>(~sum));
+    }
+
+    bool read_mac(const std::string& dev, __u8 mac[ETH_ALEN]) {
+        std::ifstream file("/sys/class/net/" + dev + "/address");
+        std::string text;
+        return file >> text && sscanf(text.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                                      &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6;
+    }
+
+    __u64 read_counter(const std::string& dev, const char* name) {
+        std::ifstream file("/sys/class/net/" + dev + "/statistics/" + name);
+        __u64 value = 0;
+        file >> value;
+        return value;
+    }
+
+    // Ethernet + IPv4 + TCP SYN / UDP / ICMP echo, padded to size bytes
+    std::vector<__u8> build_frame(const std::string& protocol, __u32 size, const __u8 src_mac[ETH_ALEN],
+                                  const __u8 dst_mac[ETH_ALEN], __u32 src_ip, __u32 dst_ip) {
+        __u32 l4_len = protocol == "tcp" ? sizeof(struct tcphdr)
+                     : protocol == "udp" ? sizeof(struct udphdr) : sizeof(struct icmphdr);
+        __u32 min_size = sizeof(struct ethhdr) + sizeof(struct iphdr) + l4_len;
+        std::vector<__u8> frame(std::max(std::max(size, min_size), 60U), 0);
+
+        struct ethhdr* eth = reinterpret_cast<struct ethhdr*>(frame.data());
+        memcpy(eth->h_dest, dst_mac, ETH_ALEN);
+        memcpy(eth->h_source, src_mac, ETH_ALEN);
+        eth->h_proto = htons(ETH_P_IP);
+
+        struct iphdr* ip = reinterpret_cast<struct iphdr*>(eth + 1);
+        __u16 ip_len = static_cast<__u16>(frame.size() - sizeof(*eth));
+        ip->version = 4;
+        ip->ihl = 5;
+        ip->ttl = 64;
+        ip->tot_len = htons(ip_len);
+        ip->saddr = src_ip;
+        ip->daddr = dst_ip;
+
+        __u8* l4 = reinterpret_cast<__u8*>(ip + 1);
+        __u16 l4_total = ip_len - sizeof(*ip);
+        // Pseudo-header for the TCP/UDP checksum
+        __u32 pseudo = csum_add(reinterpret_cast<const __u8*>(&ip->saddr), 8, 0);
+        if (protocol == "tcp") {
+            ip->protocol = IPPROTO_TCP;
+            struct tcphdr* tcp = reinterpret_cast<struct tcphdr*>(l4);
+            tcp->source = htons(40000);
+            tcp->dest = htons(80);
+            tcp->seq = htonl(1);
+            tcp->doff = 5;
+            tcp->syn = 1;
+            tcp->window = htons(65535);
+            tcp->check = csum_finish(csum_add(l4, l4_total, pseudo + IPPROTO_TCP + l4_total));
+        } else if (protocol == "udp") {
+            ip->protocol = IPPROTO_UDP;
+            struct udphdr* udp = reinterpret_cast<struct udphdr*>(l4);
+            udp->source = htons(40000);
+            udp->dest = htons(53);
+            udp->len = htons(l4_total);
+            udp->check = csum_finish(csum_add(l4, l4_total, pseudo + IPPROTO_UDP + l4_total));
+        } else {
+            ip->protocol = IPPROTO_ICMP;
+            struct icmphdr* icmp = reinterpret_cast<struct icmphdr*>(l4);
+            icmp->type = ICMP_ECHO;
+            icmp->un.echo.id = htons(1);
+            icmp->checksum = csum_finish(csum_add(l4, l4_total, 0));
+        }
+        ip->check = csum_finish(csum_add(reinterpret_cast<const __u8*>(ip), sizeof(*ip), 0));
+        return frame;
+    }
+
+    // Sources of the ip_blacklist= line of the filter config (network address for subnets)
+    std::vector<__u32> read_blacklist(const std::string& path) {
+        std::vector<__u32> sources;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.find("ip_blacklist=") != 0) {
+                continue;
+            }
+            std::stringstream ss(line.substr(strlen("ip_blacklist=")));
+            std::string item;
+            while (std::getline(ss, item, ',') && sources.size() < MAX_BLACKLIST_SOURCES) {
+                struct in_addr addr;
+                if (inet_pton(AF_INET, item.substr(0, item.find('/')).c_str(), &addr) == 1) {
+                    sources.push_back(addr.s_addr);
+                }
+            }
+        }
+        return sources;
+    }
+
+    void generate(int prog_fd, __u32 ifindex, __u32 cpu, const std::vector<Template>& templates,
+                  const std::vector<__u32>& schedule, __u32 batch, std::atomic<__u64>& sent) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+        struct xdp_md ctx_in;
+        struct bpf_test_run_opts opts;
+        while (!exiting) {
+            for (__u32 slot : schedule) {
+                const std::vector<__u8>& frame = templates[slot].frame;
+                memset(&ctx_in, 0, sizeof(ctx_in));
+                ctx_in.data_end = frame.size();
+                ctx_in.ingress_ifindex = ifindex;
+
+                memset(&opts, 0, sizeof(opts));
+                opts.sz = sizeof(opts);
+                opts.data_in = frame.data();
+                opts.data_size_in = frame.size();
+                opts.ctx_in = &ctx_in;
+                opts.ctx_size_in = sizeof(ctx_in);
+                opts.repeat = batch;
+                opts.flags = BPF_F_TEST_XDP_LIVE_FRAMES;
+                if (bpf_prog_test_run_opts(prog_fd, &opts) != 0) {
+                    std::cerr << "BPF_PROG_TEST_RUN failed on CPU " << cpu << ": " << strerror(errno) << std::endl;
+                    exiting = true;
+                    return;
+                }
+                sent += batch;
+                if (exiting) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " --dev IFACE [--duration S] [--threads N] [--proto tcp:70,udp:20,icmp:10]"
+                  << " [--sizes 64:60,512:30,1500:10] [--sources N] [--src-base IP] [--blacklist-ratio PCT]"
+                  << " [--config FILE] [--dst-ip IP] [--dst-mac MAC] [--batch N]" << std::endl;
+        return 1;
+    }
+
+    __u32 ifindex = if_nametoindex(options.dev.c_str());
+    __u8 src_mac[ETH_ALEN], dst_mac[ETH_ALEN];
+    struct in_addr src_base, dst_ip;
+    if (!ifindex || !read_mac(options.dev, src_mac)) {
+        std::cerr << "Unknown interface " << options.dev << std::endl;
+        return 1;
+    }
+    if (sscanf(options.dst_mac.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &dst_mac[0], &dst_mac[1],
+               &dst_mac[2], &dst_mac[3], &dst_mac[4], &dst_mac[5]) != 6 ||
+        inet_pton(AF_INET, options.src_base.c_str(), &src_base) != 1 ||
+        inet_pton(AF_INET, options.dst_ip.c_str(), &dst_ip) != 1) {
+        std::cerr << "Invalid --dst-mac, --src-base or --dst-ip" << std::endl;
+        return 1;
+    }
+
+    std::vector<__u32> blacklist;
+    if (options.blacklist_ratio > 0) {
+        blacklist = read_blacklist(options.config.empty() ? "../src/config.txt" : options.config);
+        if (blacklist.empty()) {
+            std::cerr << "--blacklist-ratio needs an ip_blacklist= line in the config file" << std::endl;
+            return 1;
+        }
+    }
+
+    // One template per protocol x size, weighted by the product of both weights
+    std::vector<Template> templates;
+    for (const auto& protocol : options.protocols) {
+        if (protocol.name != "tcp" && protocol.name != "udp" && protocol.name != "icmp") {
+            std::cerr << "Unknown protocol " << protocol.name << " (tcp, udp, icmp)" << std::endl;
+            return 1;
+        }
+        for (const auto& size : options.sizes) {
+            __u32 bytes = static_cast<__u32>(std::stoul(size.name));
+            templates.push_back({build_frame(protocol.name, std::min(bytes, 1514U), src_mac, dst_mac,
+                                             src_base.s_addr, dst_ip.s_addr),
+                                 protocol.weight * size.weight});
+        }
+    }
+    __u64 total_weight = 0;
+    for (const auto& t : templates) {
+        total_weight += t.weight;
+    }
+    std::vector<__u32> schedule;
+    for (__u32 i = 0; i < templates.size(); i++) {
+        __u64 slots = total_weight ? (templates[i].weight * SCHEDULE_SLOTS + total_weight / 2) / total_weight : 0;
+        schedule.insert(schedule.end(), slots ? slots : 1, i);
+    }
+    double avg_frame = 0;
+    for (__u32 slot : schedule) {
+        avg_frame += templates[slot].frame.size();
+    }
+    avg_frame /= schedule.size();
+
+    std::unique_ptr<trafgen_bpf, void(*)(trafgen_bpf*)> skel(trafgen_bpf__open(), trafgen_bpf__destroy);
+    if (!skel) {
+        std::cerr << "Failed to open BPF skeleton" << std::endl;
+        return 1;
+    }
+    skel->rodata->target_ifindex = ifindex;
+    skel->rodata->src_base = ntohl(src_base.s_addr);
+    skel->rodata->src_count = options.sources;
+    skel->rodata->blacklist_ratio = options.blacklist_ratio;
+    skel->rodata->blacklist_count = blacklist.size();
+    if (trafgen_bpf__load(skel.get()) != 0) {
+        std::cerr << "Failed to load BPF skeleton (root privileges required)" << std::endl;
+        return 1;
+    }
+    int blacklist_fd = bpf_map__fd(skel->maps.blacklist_sources);
+    for (__u32 i = 0; i < blacklist.size(); i++) {
+        bpf_map_update_elem(blacklist_fd, &i, &blacklist[i], BPF_ANY);
+    }
+
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    std::cout << "Generating on " << options.dev << " with " << options.threads << " thread(s), "
+              << templates.size() << " templates, avg " << std::fixed << std::setprecision(0) << avg_frame
+              << " bytes/frame, " << options.sources << " sources, " << options.blacklist_ratio
+              << "% blacklisted" << std::endl;
+
+    int prog_fd = bpf_program__fd(skel->progs.xdp_trafgen);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    std::vector<std::atomic<__u64>> sent(options.threads);
+    std::vector<std::thread> threads;
+    for (__u32 i = 0; i < options.threads; i++) {
+        sent[i] = 0;
+        threads.emplace_back(generate, prog_fd, ifindex, static_cast<__u32>(i % cpus), std::cref(templates),
+                             std::cref(schedule), options.batch, std::ref(sent[i]));
+    }
+
+    // Per-second report: frames generated by the test runs vs. what the device counted
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    __u64 last_sent = 0;
+    __u64 tx_start = read_counter(options.dev, "tx_packets");
+    __u64 last_tx = tx_start;
+    __u64 drop_start = read_counter(options.dev, "tx_dropped");
+    for (__u32 second = 0; second < options.duration && !exiting; second++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        __u64 total = 0;
+        for (const auto& s : sent) {
+            total += s;
+        }
+        __u64 tx = read_counter(options.dev, "tx_packets");
+        double pps = (total - last_sent) / elapsed;
+        std::cout << std::setw(4) << second + 1 << "s  generated " << std::setprecision(2) << std::setw(7)
+                  << pps / 1e6 << " Mpps " << std::setw(7) << pps * avg_frame * 8 / 1e9 << " Gbps   "
+                  << options.dev << " tx " << std::setw(7) << (tx - last_tx) / elapsed / 1e6 << " Mpps" << std::endl;
+        last = now;
+        last_sent = total;
+        last_tx = tx;
+    }
+    exiting = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    __u64 total = 0;
+    for (const auto& s : sent) {
+        total += s;
+    }
+    std::cout << "Total: " << total << " frames in " << std::setprecision(2) << seconds << " s ("
+              << total / seconds / 1e6 << " Mpps), " << options.dev << " tx_packets +"
+              << read_counter(options.dev, "tx_packets") - tx_start << ", tx_dropped +"
+              << read_counter(options.dev, "tx_dropped") - drop_start << std::endl;
+    return 0;
+}
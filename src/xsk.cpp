@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "xsk.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+namespace packet_filter {
+    namespace {
+        // Entries the producer may still write
+        __u32 ring_free(const XskRing& ring) {
+            __u32 cons = __atomic_load_n(ring.consumer, __ATOMIC_ACQUIRE);
+            return ring.size - (*ring.producer - cons);
+        }
+
+        // Entries the consumer may still read
+        __u32 ring_avail(const XskRing& ring) {
+            __u32 prod = __atomic_load_n(ring.producer, __ATOMIC_ACQUIRE);
+            return prod - *ring.consumer;
+        }
+
+        bool needs_wakeup(const XskRing& ring) {
+            return __atomic_load_n(ring.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP;
+        }
+    }
+
+    XskSocket::XskSocket() : sock_fd(-1), umem_area(nullptr), umem_len(0) {
+        memset(&rx, 0, sizeof(rx));
+        memset(&tx, 0, sizeof(tx));
+        memset(&fill, 0, sizeof(fill));
+        memset(&comp, 0, sizeof(comp));
+    }
+
+    XskSocket::~XskSocket() {
+        close();
+    }
+
+    int XskSocket::map_ring(XskRing& ring, __u32 size, size_t desc_size,
+                            const struct xdp_ring_offset& off, off_t pgoff) {
+        ring.map_len = off.desc + size * desc_size;
+        ring.map = mmap(nullptr, ring.map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, sock_fd, pgoff);
+        if (ring.map == MAP_FAILED) {
+            ring.map = nullptr;
+            return -1;
+        }
+        __u8* base = static_cast<__u8*>(ring.map);
+        ring.producer = reinterpret_cast<__u32*>(base + off.producer);
+        ring.consumer = reinterpret_cast<__u32*>(base + off.consumer);
+        ring.flags = reinterpret_cast<__u32*>(base + off.flags);
+        ring.descs = base + off.desc;
+        ring.size = size;
+        ring.mask = size - 1;
+        return 0;
+    }
+
+    int XskSocket::open(__u32 ifindex, __u32 queue_id, const XskSocketConfig& config) {
+        sock_fd = socket(AF_XDP, SOCK_RAW, 0);
+        if (sock_fd < 0) {
+            std::cerr << "Failed to create AF_XDP socket: " << strerror(errno) << std::endl;
+            return -1;
+        }
+
+        // UMEM: one contiguous area split into frame_count frames
+        umem_len = static_cast<size_t>(config.frame_count) * config.frame_size;
+        void* area = mmap(nullptr, umem_len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (area == MAP_FAILED) {
+            std::cerr << "Failed to allocate UMEM: " << strerror(errno) << std::endl;
+            close();
+            return -1;
+        }
+        umem_area = static_cast<__u8*>(area);
+
+        struct xdp_umem_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = reinterpret_cast<__u64>(umem_area);
+        reg.len = umem_len;
+        reg.chunk_size = config.frame_size;
+        reg.headroom = 0;
+        __u32 ring_size = config.ring_size;
+        __u32 fill_size = config.frame_count; // Room for every frame
+
+        if (setsockopt(sock_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0 ||
+            setsockopt(sock_fd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) != 0 ||
+            setsockopt(sock_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &fill_size, sizeof(fill_size)) != 0 ||
+            setsockopt(sock_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) != 0 ||
+            setsockopt(sock_fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) != 0) {
+            std::cerr << "Failed to configure AF_XDP rings: " << strerror(errno) << std::endl;
+            close();
+            return -1;
+        }
+
+        struct xdp_mmap_offsets off;
+        socklen_t optlen = sizeof(off);
+        if (getsockopt(sock_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0) {
+            std::cerr << "Failed to get AF_XDP ring offsets: " << strerror(errno) << std::endl;
+            close();
+            return -1;
+        }
+
+        if (map_ring(rx, ring_size, sizeof(struct xdp_desc), off.rx, XDP_PGOFF_RX_RING) != 0 ||
+            map_ring(tx, ring_size, sizeof(struct xdp_desc), off.tx, XDP_PGOFF_TX_RING) != 0 ||
+            map_ring(fill, fill_size, sizeof(__u64), off.fr, XDP_UMEM_PGOFF_FILL_RING) != 0 ||
+            map_ring(comp, fill_size, sizeof(__u64), off.cr, XDP_UMEM_PGOFF_COMPLETION_RING) != 0) {
+            std::cerr << "Failed to map AF_XDP rings: " << strerror(errno) << std::endl;
+            close();
+            return -1;
+        }
+
+        // Hand every frame to the kernel before binding
+        std::vector<__u64> addrs(config.frame_count);
+        for (__u32 i = 0; i < config.frame_count; i++) {
+            addrs[i] = static_cast<__u64>(i) * config.frame_size;
+        }
+        refill(addrs.data(), config.frame_count);
+
+        struct sockaddr_xdp sxdp;
+        memset(&sxdp, 0, sizeof(sxdp));
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = ifindex;
+        sxdp.sxdp_queue_id = queue_id;
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | (config.zerocopy ? XDP_ZEROCOPY : XDP_COPY);
+        if (bind(sock_fd, reinterpret_cast<struct sockaddr*>(&sxdp), sizeof(sxdp)) != 0) {
+            std::cerr << "Failed to bind AF_XDP socket to queue " << queue_id << ": " << strerror(errno) << std::endl;
+            close();
+            return -1;
+        }
+
+        if (config.busy_poll_budget > 0) {
+            int one = 1;
+            int usecs = 20;
+            int budget = static_cast<int>(config.busy_poll_budget);
+            if (setsockopt(sock_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) != 0 ||
+                setsockopt(sock_fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0 ||
+                setsockopt(sock_fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) != 0) {
+                std::cerr << "Warning: busy polling not available on queue " << queue_id << ": "
+                          << strerror(errno) << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    void XskSocket::close() {
+        for (XskRing* ring : {&rx, &tx, &fill, &comp}) {
+            if (ring->map) {
+                munmap(ring->map, ring->map_len);
+            }
+            memset(ring, 0, sizeof(*ring));
+        }
+        if (sock_fd >= 0) {
+            ::close(sock_fd);
+            sock_fd = -1;
+        }
+        if (umem_area) {
+            munmap(umem_area, umem_len);
+            umem_area = nullptr;
+        }
+    }
+
+    __u32 XskSocket::receive(struct xdp_desc* descs, __u32 max) {
+        __u32 n = std::min(ring_avail(rx), max);
+        const struct xdp_desc* ring = static_cast<const struct xdp_desc*>(rx.descs);
+        __u32 cons = *rx.consumer;
+        for (__u32 i = 0; i < n; i++) {
+            descs[i] = ring[(cons + i) & rx.mask];
+        }
+        __atomic_store_n(rx.consumer, cons + n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    __u32 XskSocket::refill(const __u64* addrs, __u32 n) {
+        n = std::min(ring_free(fill), n);
+        __u64* ring = static_cast<__u64*>(fill.descs);
+        __u32 prod = *fill.producer;
+        for (__u32 i = 0; i < n; i++) {
+            ring[(prod + i) & fill.mask] = addrs[i];
+        }
+        __atomic_store_n(fill.producer, prod + n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    __u32 XskSocket::transmit(const struct xdp_desc* descs, __u32 n) {
+        n = std::min(ring_free(tx), n);
+        struct xdp_desc* ring = static_cast<struct xdp_desc*>(tx.descs);
+        __u32 prod = *tx.producer;
+        for (__u32 i = 0; i < n; i++) {
+            ring[(prod + i) & tx.mask] = descs[i];
+        }
+        __atomic_store_n(tx.producer, prod + n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    __u32 XskSocket::complete(__u64* addrs, __u32 max) {
+        __u32 n = std::min(ring_avail(comp), max);
+        const __u64* ring = static_cast<const __u64*>(comp.descs);
+        __u32 cons = *comp.consumer;
+        for (__u32 i = 0; i < n; i++) {
+            addrs[i] = ring[(cons + i) & comp.mask];
+        }
+        __atomic_store_n(comp.consumer, cons + n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    void XskSocket::kick_tx() {
+        if (needs_wakeup(tx)) {
+            sendto(sock_fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+        }
+    }
+
+    void XskSocket::kick_rx() {
+        if (needs_wakeup(fill)) {
+            recvfrom(sock_fd, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+        }
+    }
+} // namespace packet_filter
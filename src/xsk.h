@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0 OR BSD-3-Clause
+#ifndef XSK_H
+#define XSK_H
+
+#include <cstddef>
+#include <linux/types.h>
+#include <linux/if_xdp.h>
+
+namespace packet_filter {
+    // One AF_XDP ring shared with the kernel (single producer, single consumer)
+    struct XskRing {
+        __u32* producer;
+        __u32* consumer;
+        __u32* flags;
+        void* descs;    // xdp_desc[] for RX/TX, __u64[] for fill/completion
+        __u32 size;
+        __u32 mask;
+        void* map;
+        size_t map_len;
+    };
+
+    // Socket parameters; frame_count and ring_size must be powers of two
+    struct XskSocketConfig {
+        __u32 frame_count;
+        __u32 frame_size;
+        __u32 ring_size;
+        __u32 busy_poll_budget; // Frames per busy-poll round, 0 = no busy polling
+        bool zerocopy;
+    };
+
+    // AF_XDP socket with its own UMEM, bound to one RX queue.
+    // Only the thread that owns the socket may use the ring operations.
+    class XskSocket {
+    public:
+        XskSocket();
+        ~XskSocket();
+        XskSocket(const XskSocket&) = delete;
+        XskSocket& operator=(const XskSocket&) = delete;
+
+        // Create the UMEM and rings and bind to ifindex/queue_id; every frame starts in the fill ring
+        int open(__u32 ifindex, __u32 queue_id, const XskSocketConfig& config);
+        void close();
+
+        int fd() const { return sock_fd; }
+        __u8* frame(__u64 addr) const { return umem_area + addr; }
+
+        // Take up to max received descriptors from the RX ring
+        __u32 receive(struct xdp_desc* descs, __u32 max);
+        // Hand frames back to the kernel for reception, returns how many fit
+        __u32 refill(const __u64* addrs, __u32 n);
+        // Queue frames on the TX ring, returns how many fit
+        __u32 transmit(const struct xdp_desc* descs, __u32 n);
+        // Take up to max transmitted frame addresses from the completion ring
+        __u32 complete(__u64* addrs, __u32 max);
+
+        // Wake the kernel when the rings ask for it (XDP_USE_NEED_WAKEUP)
+        void kick_tx();
+        void kick_rx();
+
+    private:
+        int map_ring(XskRing& ring, __u32 size, size_t desc_size, const struct xdp_ring_offset& off, off_t pgoff);
+
+        int sock_fd;
+        __u8* umem_area;
+        size_t umem_len;
+        XskRing rx;
+        XskRing tx;
+        XskRing fill;
+        XskRing comp;
+    };
+} // namespace packet_filter
+
+#endif /* XSK_H */
@@ -0,0 +1,295 @@
+#!/usr/bin/env bash
+# e2e_bench.sh - end-to-end throughput / latency benchmark of packetfilter on a veth pair.
+#
+# Builds the same topology as script.sh (attacker-ns/veth-att <-> veth-srv), attaches
+# packetfilter with a generated config and runs fixed load profiles with pf_trafgen.
+# Clean traffic (iperf3 + ping) comes from 192.168.100.3 inside attacker-ns and is
+# measured while the attack runs. One JSON object per profile is appended to --output.
+#
+# Usage (root): ./test/e2e_bench.sh --build-dir src/build [--duration 10] [--output bench_results.jsonl]
+#               [--profiles clean,blacklist_flood,ratelimit_flood,syn_flood,mixed]
+#               [--baseline old_results.jsonl] [--tolerance 10] [--label $(git rev-parse --short HEAD)]
+#               [--xdp-mode auto|native|generic]   (the mode actually used is recorded as "xdp_mode")
+#
+# With --baseline the script exits non-zero when goodput drops, or RTT p99 of clean traffic
+# rises, by more than --tolerance percent compared to the same profile, or when the loss of
+# clean traffic rises by more than one percentage point (absolute: the baseline is often 0).
+# Exits 77 (skipped, for ctest) when not run as root or when a required tool is missing.
+set -euo pipefail
+
+BUILD_DIR=""
+DURATION=10
+OUTPUT="bench_results.jsonl"
+PROFILES="clean,blacklist_flood,ratelimit_flood,syn_flood,mixed"
+BASELINE=""
+TOLERANCE=10
+LABEL="local"
+XDP_MODE="auto"
+
+NS="attacker-ns"
+SRV_DEV="veth-srv"
+ATT_DEV="veth-att"
+SRV_IP="192.168.100.1"
+RATE_LIMITED_IP="192.168.100.2"
+CLIENT_IP="192.168.100.3"
+BLACKLIST_NET="10.66.0.0"
+IPERF_PORT=5201
+
+print_help() {
+  sed -n '2,15p' "$0" | sed 's/^# \{0,1\}//'
+}
+
+while [[ $# -gt 0 ]]; do
+  case "$1" in
+    --build-dir) BUILD_DIR="$2"; shift 2 ;;
+    --duration) DURATION="$2"; shift 2 ;;
+    --output) OUTPUT="$2"; shift 2 ;;
+    --profiles) PROFILES="$2"; shift 2 ;;
+    --baseline) BASELINE="$2"; shift 2 ;;
+    --tolerance) TOLERANCE="$2"; shift 2 ;;
+    --label) LABEL="$2"; shift 2 ;;
+    --xdp-mode) XDP_MODE="$2"; shift 2 ;;
+    -h|--help) print_help; exit 0 ;;
+    *) echo "Unknown arg $1"; print_help; exit 1 ;;
+  esac
+done
+
+if [[ -z "${BUILD_DIR}" ]]; then
+  echo "Error: --build-dir is required"; exit 1
+fi
+BUILD_DIR="$(cd "${BUILD_DIR}" && pwd)"
+OUTPUT="$(realpath -m "${OUTPUT}")"
+if [[ "$(id -u)" -ne 0 ]]; then
+  echo "Skipped: must run as root (netns, XDP attach, BPF test runs)"; exit 77
+fi
+for tool in ip iperf3 ping python3; do
+  if ! command -v "${tool}" >/dev/null 2>&1; then
+    echo "Skipped: ${tool} not found in PATH"; exit 77
+  fi
+done
+for bin in packetfilter pf_trafgen; do
+  if [[ ! -x "${BUILD_DIR}/${bin}" ]]; then
+    echo "Error: ${BUILD_DIR}/${bin} not found, build it first"; exit 1
+  fi
+done
+
+WORK_DIR="$(mktemp -d /tmp/pf_e2e.XXXXXX)"
+FILTER_PID=""
+IPERF_SERVER_PID=""
+
+cleanup() {
+  [[ -n "${FILTER_PID}" ]] && kill -INT "${FILTER_PID}" 2>/dev/null || true
+  [[ -n "${IPERF_SERVER_PID}" ]] && kill "${IPERF_SERVER_PID}" 2>/dev/null || true
+  wait 2>/dev/null || true
+  ip netns delete "${NS}" 2>/dev/null || true
+  ip link delete "${SRV_DEV}" 2>/dev/null || true
+  rm -rf "${WORK_DIR}"
+}
+trap cleanup EXIT INT TERM
+
+setup_topology() {
+  ip netns delete "${NS}" 2>/dev/null || true
+  ip link delete "${SRV_DEV}" 2>/dev/null || true
+  ip netns add "${NS}"
+  ip link add "${SRV_DEV}" type veth peer name "${ATT_DEV}"
+  ip link set "${ATT_DEV}" netns "${NS}"
+  ip addr add "${SRV_IP}/24" dev "${SRV_DEV}"
+  ip link set "${SRV_DEV}" up
+  ip netns exec "${NS}" ip addr add "${RATE_LIMITED_IP}/24" dev "${ATT_DEV}"
+  ip netns exec "${NS}" ip addr add "${CLIENT_IP}/24" dev "${ATT_DEV}"
+  ip netns exec "${NS}" ip link set "${ATT_DEV}" up
+  ip netns exec "${NS}" ip link set lo up
+  # Spoofed sources answer to nobody; keep the server from queueing ARP for them
+  sysctl -qw net.ipv4.conf."${SRV_DEV}".rp_filter=0
+}
+
+write_config() {
+  cat > "${WORK_DIR}/config.txt" <<EOF
+interface=${SRV_DEV}
+xdp_mode=${XDP_MODE}
+ip_blacklist=${BLACKLIST_NET}/16
+ip_rate_limits=${RATE_LIMITED_IP}:100
+ip_stats=1
+EOF
+}
+
+# Busy jiffies and total jiffies per core from /proc/stat
+cpu_snapshot() {
+  awk '/^cpu[0-9]+ / { busy = $2 + $3 + $4 + $7 + $8; total = busy + $5 + $6; print $1, busy, total }' /proc/stat
+}
+
+# Per-core busy percentage between two snapshots, as a JSON array
+cpu_busy_json() {
+  python3 - "$1" "$2" <<'EOF'
+import sys, json
+def load(path):
+    return {l.split()[0]: tuple(map(int, l.split()[1:])) for l in open(path)}
+a, b = load(sys.argv[1]), load(sys.argv[2])
+out = []
+for cpu in sorted(b, key=lambda c: int(c[3:])):
+    busy = b[cpu][0] - a[cpu][0]
+    total = b[cpu][1] - a[cpu][1]
+    out.append(round(100.0 * busy / total, 1) if total else 0.0)
+print(json.dumps(out))
+EOF
+}
+
+# trafgen arguments of each attack profile (empty = clean traffic only)
+attack_args() {
+  case "$1" in
+    clean) echo "" ;;
+    blacklist_flood) echo "--proto udp:100 --sizes 64:100 --src-base ${BLACKLIST_NET} --sources 65536" ;;
+    ratelimit_flood) echo "--proto udp:100 --sizes 64:100 --src-base ${RATE_LIMITED_IP} --sources 1" ;;
+    syn_flood) echo "--proto tcp:100 --sizes 64:100 --src-base 172.20.0.0 --sources 1000000" ;;
+    mixed) echo "--proto tcp:50,udp:40,icmp:10 --sizes 64:60,512:30,1500:10 --src-base 172.20.0.0 --sources 65536 --blacklist-ratio 50 --config ${WORK_DIR}/config.txt" ;;
+    *) return 1 ;;
+  esac
+}
+
+run_profile() {
+  local profile="$1" args
+  if ! args="$(attack_args "${profile}")"; then
+    echo "Unknown profile ${profile}"; return 1
+  fi
+  echo "=== ${profile} ==="
+  local dir="${WORK_DIR}/${profile}"
+  mkdir -p "${dir}"
+
+  # Fresh filter per profile so the counters only cover this run
+  (cd "${dir}" && exec "${BUILD_DIR}/packetfilter" --config "${WORK_DIR}/config.txt") > "${dir}/filter.log" 2>&1 &
+  FILTER_PID=$!
+  sleep 2
+
+  iperf3 -s -B "${SRV_IP}" -p "${IPERF_PORT}" -1 > /dev/null 2>&1 &
+  IPERF_SERVER_PID=$!
+  sleep 0.5
+
+  local trafgen_pid=""
+  if [[ -n "${args}" ]]; then
+    # shellcheck disable=SC2086
+    ip netns exec "${NS}" "${BUILD_DIR}/pf_trafgen" --dev "${ATT_DEV}" --duration "$((DURATION + 2))" \
+      --dst-ip "${SRV_IP}" ${args} > "${dir}/trafgen.log" 2>&1 &
+    trafgen_pid=$!
+    sleep 1
+  fi
+
+  cpu_snapshot > "${dir}/cpu_before"
+  ip netns exec "${NS}" ping -I "${CLIENT_IP}" -i 0.01 -w "${DURATION}" "${SRV_IP}" > "${dir}/ping.log" 2>&1 &
+  local ping_pid=$!
+  ip netns exec "${NS}" iperf3 -c "${SRV_IP}" -B "${CLIENT_IP}" -p "${IPERF_PORT}" -t "${DURATION}" -J \
+    > "${dir}/iperf.json" 2>/dev/null || true
+  wait "${ping_pid}" || true
+  cpu_snapshot > "${dir}/cpu_after"
+
+  [[ -n "${trafgen_pid}" ]] && { kill -INT "${trafgen_pid}" 2>/dev/null || true; wait "${trafgen_pid}" || true; }
+  kill "${IPERF_SERVER_PID}" 2>/dev/null || true
+  wait "${IPERF_SERVER_PID}" 2>/dev/null || true
+  IPERF_SERVER_PID=""
+  kill -INT "${FILTER_PID}" 2>/dev/null || true
+  wait "${FILTER_PID}" || true
+  FILTER_PID=""
+
+  local cpu_json
+  cpu_json="$(cpu_busy_json "${dir}/cpu_before" "${dir}/cpu_after")"
+  python3 - "${profile}" "${dir}" "${cpu_json}" "${LABEL}" "${DURATION}" >> "${OUTPUT}" <<'EOF'
+import sys, json, re
+profile, d, cpu, label, duration = sys.argv[1], sys.argv[2], json.loads(sys.argv[3]), sys.argv[4], int(sys.argv[5])
+
+goodput = 0.0
+try:
+    goodput = json.load(open(d + "/iperf.json"))["end"]["sum_received"]["bits_per_second"] / 1e6
+except Exception:
+    pass
+
+rtts = sorted(float(m) for m in re.findall(r"time=([\d.]+) ms", open(d + "/ping.log").read()))
+sent = re.search(r"(\d+) packets transmitted", open(d + "/ping.log").read())
+def pct(p):
+    return round(rtts[min(len(rtts) - 1, int(p / 100.0 * len(rtts)))], 3) if rtts else None
+
+dropped = passed = 0
+totals = re.findall(r"Dropped: (\d+), Passed: (\d+)", open(d + "/filter.log").read())
+if totals:
+    dropped, passed = map(int, totals[-1])  # Last report = totals at exit
+
+filter_log = open(d + "/filter.log").read()
+mode = re.search(r"XDP mode: (\w+)", filter_log)
+
+generated = 0
+try:
+    m = re.search(r"Total: (\d+) frames", open(d + "/trafgen.log").read())
+    generated = int(m.group(1)) if m else 0
+except FileNotFoundError:
+    pass
+
+print(json.dumps({
+    "label": label,
+    "profile": profile,
+    "duration_s": duration,
+    "goodput_mbps": round(goodput, 1),
+    "attack_frames": generated,
+    "filter_dropped": dropped,
+    "filter_passed": passed,
+    "xdp_mode": mode.group(1) if mode else None,
+    "drop_rate": round(dropped / float(dropped + passed), 4) if dropped + passed else 0.0,
+    "clean_loss": round(1 - len(rtts) / float(sent.group(1)), 4) if sent and int(sent.group(1)) else None,
+    "rtt_ms": {"p50": pct(50), "p90": pct(90), "p99": pct(99), "max": rtts[-1] if rtts else None},
+    "cpu_busy_pct": cpu,
+}))
+EOF
+  tail -n 1 "${OUTPUT}"
+}
+
+compare_baseline() {
+  python3 - "${BASELINE}" "${OUTPUT}" "${LABEL}" "${TOLERANCE}" <<'EOF'
+import sys, json
+baseline_path, output_path, label, tolerance = sys.argv[1], sys.argv[2], sys.argv[3], float(sys.argv[4]) / 100
+CLEAN_LOSS_POINTS = 0.01  # Absolute rise of clean_loss that fails the comparison
+def load(path, label=None):
+    rows = {}
+    for line in open(path):
+        row = json.loads(line)
+        if label is None or row["label"] == label:
+            rows[row["profile"]] = row  # Last run of each profile wins
+    return rows
+base, cur = load(baseline_path), load(output_path, label)
+failed = False
+for profile, row in cur.items():
+    if profile not in base:
+        continue
+    old = base[profile]
+    if old.get("xdp_mode") != row.get("xdp_mode"):
+        print(f"WARNING {profile}: XDP mode differs from the baseline ({old.get('xdp_mode')} -> {row.get('xdp_mode')})")
+    # name, baseline, current, direction, absolute tolerance (None = relative --tolerance)
+    checks = [
+        ("goodput_mbps", old["goodput_mbps"], row["goodput_mbps"], -1, None),
+        ("rtt p99", (old["rtt_ms"] or {}).get("p99"), (row["rtt_ms"] or {}).get("p99"), 1, None),
+        ("clean_loss", old.get("clean_loss"), row.get("clean_loss"), 1, CLEAN_LOSS_POINTS),
+    ]
+    for name, a, b, direction, absolute in checks:
+        if absolute is not None:
+            if a is not None and b is not None and (b - a) * direction > absolute:
+                print(f"REGRESSION {profile}: {name} {a} -> {b} ({(b - a) * 100:+.1f} points)")
+                failed = True
+            continue
+        if not a or b is None:
+            continue
+        change = (b - a) / a
+        if change * direction > tolerance:
+            print(f"REGRESSION {profile}: {name} {a} -> {b} ({change:+.1%})")
+            failed = True
+print("Baseline comparison: " + ("FAILED" if failed else "ok"))
+sys.exit(1 if failed else 0)
+EOF
+}
+
+setup_topology
+write_config
+IFS=',' read -r -a profile_list <<< "${PROFILES}"
+for profile in "${profile_list[@]}"; do
+  run_profile "${profile}"
+done
+echo "Results appended to ${OUTPUT}"
+
+if [[ -n "${BASELINE}" ]]; then
+  compare_baseline
+fi